@@ -3,28 +3,101 @@
 #include <string.h>
 
 #include "sqlparser.h"
+#include "sqlserver.h"
+#include "sqlclient.h"
+#include "sqlshard.h"
+#include "sqlreplica.h"
+#include "sqlvacuum.h"
 
-int main()
+int main(int argc, char **argv)
 {
-    char input[500];
+    char       *input;
+    size_t      size;
+    ssize_t     length;
+    const char *server;
+    const char *host;
+    const char *port;
+    const char *shards;
+    const char *primary;
+    int         i;
+
+    server  = NULL;
+    host    = NULL;
+    port    = NULL;
+    shards  = NULL;
+    primary = NULL;
+    for (i = 1 ; i < argc ; ++i)
+    {
+        if ((strcmp(argv[i], "--server") == 0) && (i + 1 < argc))
+            server = argv[++i];
+        else if ((strcmp(argv[i], "--client") == 0) && (i + 2 < argc))
+        {
+            host = argv[++i];
+            port = argv[++i];
+        }
+        else if ((strcmp(argv[i], "--shards") == 0) && (i + 1 < argc))
+            shards = argv[++i];
+        else if ((strcmp(argv[i], "--cache") == 0) && (i + 1 < argc))
+            SQLresultCache_SetCapacity(strtoul(argv[++i], NULL, 10));
+        else if (strcmp(argv[i], "--primary") == 0)
+        {
+            if (SQLwal_Open() == 0)
+                return 1;
+        }
+        else if ((strcmp(argv[i], "--replica") == 0) && (i + 1 < argc))
+            primary = argv[++i];
+        else if ((strcmp(argv[i], "--vacuum") == 0) && (i + 1 < argc))
+            SQLVacuum_Budget = strtol(argv[++i], NULL, 10);
+        else if ((strcmp(argv[i], "--limits") == 0) && (i + 1 < argc) && (SQLServer_SetLimits(argv[i + 1]) != 0))
+            ++i;
+        else if ((strcmp(argv[i], "--memory") == 0) && (i + 1 < argc))
+            SQLServer_Scheduler.memory = strtoul(argv[++i], NULL, 10);
+        else if ((strcmp(argv[i], "--timeout") == 0) && (i + 1 < argc))
+            SQLcancel_Timeout = strtoul(argv[++i], NULL, 10);
+        else
+        {
+            printf("usage: %s [--cache BYTES] [--vacuum BYTES] [--primary | --replica DIRECTORY] "
+                   "[--limits LOOKUP,WRITE,SCAN] [--memory BYTES] [--timeout MS] "
+                   "[--server PORT | --client HOST PORT | --shards COUNT]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    /* Client mode, send the queries to a server */
+    if (host != NULL)
+        return SQLClient_Run(host, port);
+    /* Coordinator mode, the tables are sharded over local worker processes */
+    if (shards != NULL)
+        return SQLShard_Run(strtoul(shards, NULL, 10));
+
+    /* Deleted rows are reclaimed in the background, throttled to the vacuum budget */
+    if (SQLVacuum_Start(SQLVacuum_Budget) == 0)
+        return 1;
+    /* Replica mode, the primary writes are replayed in the background */
+    if ((primary != NULL) && (SQLReplica_Start(primary) == 0))
+        return 1;
+    /* Server mode, answer binary protocol requests instead of reading stdin */
+    if (server != NULL)
+        return SQLServer_Run(strtol(server, NULL, 10));
 
     printf("--------------------- Database Manager ---------------------\n" );
+    input = NULL;
+    size  = 0;
     for (;;)
     {
-        size_t length;
-
         printf("dbc > ");
-        if (fgets(input, sizeof(input), stdin) == NULL)
+        if ((length = getline(&input, &size, stdin)) <= 0)
             return -1;
 
-        length = strlen(input);
         if (input[length - 1] == '\n')
             input[length - 1] = '\0';
 
         if ((strcmp(input, "exit") == 0) || (strcmp(input, "\\q") == 0))
             return 0;
 
+        pthread_mutex_lock(&SQLServer_EngineLock);
         SQLExecuteQuery(input);
+        pthread_mutex_unlock(&SQLServer_EngineLock);
     }
     return 0;
 }
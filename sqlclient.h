@@ -0,0 +1,522 @@
+#ifndef SQLCLIENT_H
+#define SQLCLIENT_H
+
+#include <stdint.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#include "sqlparser.h"
+#include "sqlprotocol.h"
+
+/* Number of requests sent ahead of their replies when reading queries from a pipe */
+#define SQL_CLIENT_PIPELINE_DEPTH 64
+
+/* Size of the error messages kept by the clients, longer ones are truncated */
+#define SQL_CLIENT_MESSAGE_SIZE 1024
+
+/*
+ * Client connection state:
+ *      descriptor : the connected socket
+ *      input      : received bytes not yet decoded
+ *      columnCount: number of columns announced by the last HeaderFrame
+ *      columnTypes: data types announced by the last HeaderFrame
+ *      message    : the message of the last ErrorFrame received
+ */
+struct SQLClient
+{
+    int                descriptor;
+    struct FrameBuffer input;
+    size_t             columnCount;
+    enum FieldType    *columnTypes;
+    char               message[SQL_CLIENT_MESSAGE_SIZE];
+};
+
+/* Connect to the server at `host`:`port`, returns 0 on failure */
+int SQLClient_Connect(struct SQLClient *client, const char *const host, const char *const port)
+{
+    struct addrinfo  hints;
+    struct addrinfo *addresses;
+    struct addrinfo *current;
+
+    memset(client, 0, sizeof(*client));
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &addresses) != 0)
+        return 0;
+    client->descriptor = -1;
+    for (current = addresses ; current != NULL ; current = current->ai_next)
+    {
+        client->descriptor = socket(current->ai_family, current->ai_socktype, current->ai_protocol);
+        if (client->descriptor < 0)
+            continue;
+        if (connect(client->descriptor, current->ai_addr, current->ai_addrlen) == 0)
+            break;
+        close(client->descriptor);
+        client->descriptor = -1;
+    }
+    freeaddrinfo(addresses);
+
+    return (client->descriptor >= 0);
+}
+
+/* Close the connection */
+void SQLClient_Close(struct SQLClient *client)
+{
+    if (client->descriptor >= 0)
+        close(client->descriptor);
+    client->descriptor = -1;
+    SQLFrame_Free(&(client->input));
+    free(client->columnTypes);
+    client->columnTypes = NULL;
+    client->columnCount = 0;
+}
+
+/* Send one query, tagged with `request` */
+int SQLClient_Send(struct SQLClient *client, uint32_t request, const char *const query)
+{
+    struct FrameBuffer frame;
+    int                success;
+
+    memset(&frame, 0, sizeof(frame));
+    SQLFrame_PutFrame(&frame, QueryFrame, request, query, strlen(query));
+    success = (frame.error == 0) && (SQLFrame_WriteAll(client->descriptor, frame.data, frame.length) != 0);
+    SQLFrame_Free(&frame);
+
+    return success;
+}
+
+/*
+ * Decode one reply frame of `request`, sending the rows to `sink`
+ *
+ *      Returns -2 when more frames of the request follow, 0 when the request
+ *      completed, 1 if the server reported an error, whose message is then
+ *      in client->message, and -1 on a malformed frame.
+ */
+static int SQLClient_Decode(struct SQLClient *client, const unsigned char *frame, long size,
+                            const struct ResultSink *const sink, uint32_t *request)
+{
+    struct FrameReader reader;
+    struct Row        *rows;
+    enum FieldType    *types;
+    uint32_t           count;
+    uint32_t           i;
+    int                result;
+
+    result = -2; /* keep reading frames */
+    switch (SQLFrame_Open(&reader, frame, size, request))
+    {
+    case HeaderFrame:
+        client->columnCount = SQLFrame_GetU16(&reader);
+        types               = realloc(client->columnTypes, (client->columnCount + 1) * sizeof(enum FieldType));
+        if (types == NULL)
+            return -1;
+        client->columnTypes = types;
+        for (i = 0 ; i < client->columnCount ; ++i)
+        {
+            client->columnTypes[i] = SQLFrame_GetU8(&reader);
+            SQLFrame_GetBytes(&reader, SQLFrame_GetU16(&reader)); /* column name */
+        }
+        break;
+    case BatchFrame:
+        rows = SQLFrame_DecodeBatch(&reader, client->columnTypes, client->columnCount, &count);
+        if (rows == NULL)
+            return -1;
+        for (i = 0 ; i < count ; ++i)
+        {
+            if (sink != NULL)
+                sink->row(sink->context, &(rows[i]));
+            SQLfreeRow(&(rows[i]));
+        }
+        free(rows);
+        break;
+    case CompleteFrame:
+        result = 0;
+        break;
+    case ErrorFrame:
+        snprintf(client->message, sizeof(client->message), "%.*s", (int) reader.length, (const char *) reader.data);
+        result = 1;
+        break;
+    default:
+        return -1;
+    }
+    return (reader.error != 0) ? -1 : result;
+}
+
+/*
+ * Receive the reply frames for one request, sending the rows to `sink`
+ *
+ *      Returns 0 when the request completed, 1 if the server reported an
+ *      error, whose message is then in client->message, and -1 if the
+ *      connection failed.
+ */
+int SQLClient_Receive(struct SQLClient *client, const struct ResultSink *const sink)
+{
+    for (;;)
+    {
+        uint32_t request;
+        long     size;
+        int      result;
+
+        while ((size = SQLFrame_Available(&(client->input), 0)) == 0)
+        {
+            if (SQLFrame_Fill(client->descriptor, &(client->input)) == 0)
+                return -1;
+        }
+        if (size < 0)
+            return -1;
+        result = SQLClient_Decode(client, client->input.data, size, sink, &request);
+        SQLFrame_Consume(&(client->input), size);
+        if (result != -2)
+            return result;
+    }
+}
+
+/* Status of a future whose reply has not been received yet */
+#define SQL_FUTURE_PENDING -2
+
+/*
+ * A query submitted to an asynchronous client, the future of its result:
+ *      request: protocol request id of the query
+ *      sink   : receives the result rows as their batches arrive, may be NULL
+ *      status : SQL_FUTURE_PENDING until the reply is complete, then 0 on
+ *               success, 1 if the server reported an error, and -1 if the
+ *               connection failed
+ *      message: why the query failed, once its status is 1 or -1
+ *      next   : the next pending future of the client
+ *
+ *  The future belongs to the caller and must stay valid until it completes.
+ */
+struct SQLFuture
+{
+    uint32_t                 request;
+    const struct ResultSink *sink;
+    int                      status;
+    char                     message[SQL_CLIENT_MESSAGE_SIZE];
+    struct SQLFuture        *next;
+};
+
+/*
+ * Asynchronous client, keeps many queries in flight from one thread:
+ *      client : the connection
+ *      output : the query frames not yet accepted by the socket
+ *      request: id of the next submitted query
+ *      pending: the futures waiting for their reply, in request order, the
+ *               order the server replies in
+ *      last   : the last pending future
+ *
+ *  Nothing ever blocks but SQLAsync_Wait(): queries are written as far as
+ *  the socket accepts them, and the replies are decoded as they arrive. The
+ *  descriptor can be watched by the event loop of the application, which
+ *  then calls SQLAsync_Poll() with no timeout.
+ */
+struct SQLAsyncClient
+{
+    struct SQLClient   client;
+    struct FrameBuffer output;
+    uint32_t           request;
+    struct SQLFuture  *pending;
+    struct SQLFuture  *last;
+};
+
+/* Connect the asynchronous client to the server at `host`:`port`, returns 0 on failure */
+int SQLAsync_Connect(struct SQLAsyncClient *async, const char *const host, const char *const port)
+{
+    memset(async, 0, sizeof(*async));
+    return SQLClient_Connect(&(async->client), host, port);
+}
+
+/* Complete every pending future with `status` */
+static void SQLAsync_CompleteAll(struct SQLAsyncClient *async, int status)
+{
+    for ( ; async->pending != NULL ; async->pending = async->pending->next)
+    {
+        async->pending->status = status;
+        snprintf(async->pending->message, sizeof(async->pending->message), "connection lost");
+    }
+    async->last = NULL;
+}
+
+/* Close the connection, the futures still pending fail */
+void SQLAsync_Close(struct SQLAsyncClient *async)
+{
+    SQLAsync_CompleteAll(async, -1);
+    SQLClient_Close(&(async->client));
+    SQLFrame_Free(&(async->output));
+}
+
+/* Write the queued queries as far as the socket accepts them without blocking, returns 0 on failure */
+static int SQLAsync_Flush(struct SQLAsyncClient *async)
+{
+    size_t sent;
+
+    sent = 0;
+    while (sent < async->output.length)
+    {
+        ssize_t written;
+
+        written = send(async->client.descriptor, async->output.data + sent, async->output.length - sent,
+                       MSG_DONTWAIT | MSG_NOSIGNAL);
+        if ((written < 0) && (errno == EINTR))
+            continue;
+        if ((written < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+            break;
+        if (written <= 0)
+            return 0;
+        sent += written;
+    }
+    SQLFrame_Consume(&(async->output), sent);
+
+    return 1;
+}
+
+/* Decode the complete reply frames received, completing their futures, returns 0 on failure */
+static int SQLAsync_Dispatch(struct SQLAsyncClient *async)
+{
+    long size;
+
+    while ((size = SQLFrame_Available(&(async->client.input), 0)) > 0)
+    {
+        struct SQLFuture *future;
+        uint32_t          request;
+        int               result;
+
+        future = async->pending;
+        if (future == NULL)
+            return 0;
+        result = SQLClient_Decode(&(async->client), async->client.input.data, size, future->sink, &request);
+        SQLFrame_Consume(&(async->client.input), size);
+        if ((result == -1) || (request != future->request))
+            return 0;
+        if (result == -2)
+            continue;
+        if (result == 1)
+            memcpy(future->message, async->client.message, sizeof(future->message));
+        future->status = result;
+        async->pending = future->next;
+        if (async->pending == NULL)
+            async->last = NULL;
+    }
+    return (size == 0);
+}
+
+/*
+ * Submit a query, its rows will be sent to `sink` as they arrive, returns 0 on failure
+ *
+ *      The query is queued and written as far as the socket accepts it, the
+ *      caller goes on at once and finds the result in `future` once
+ *      SQLAsync_Poll() or SQLAsync_Wait() completed it.
+ */
+int SQLAsync_Submit(struct SQLAsyncClient *async, const char *const query, const struct ResultSink *const sink,
+                                                                          struct SQLFuture *future)
+{
+    future->request = async->request++;
+    future->sink    = sink;
+    future->status  = SQL_FUTURE_PENDING;
+    future->next    = NULL;
+    future->message[0] = '\0';
+    SQLFrame_PutFrame(&(async->output), QueryFrame, future->request, query, strlen(query));
+    if (async->output.error != 0)
+    {
+        future->status = -1;
+        snprintf(future->message, sizeof(future->message), "out of memory");
+        return 0;
+    }
+    if (async->last != NULL)
+        async->last->next = future;
+    else
+        async->pending = future;
+    async->last = future;
+    if (SQLAsync_Flush(async) == 0)
+    {
+        SQLAsync_CompleteAll(async, -1);
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Make progress on the queries in flight, waiting at most `timeout` milliseconds (-1 forever) for the socket
+ *
+ *      Writes the queued queries and reads the replies, completing their
+ *      futures. Returns 0 if the connection failed, the pending futures then
+ *      complete with -1.
+ */
+int SQLAsync_Poll(struct SQLAsyncClient *async, int timeout)
+{
+    struct pollfd descriptor;
+    int           ready;
+
+    if ((async->pending == NULL) && (async->output.length == 0))
+        return 1;
+    descriptor.fd      = async->client.descriptor;
+    descriptor.events  = POLLIN | ((async->output.length != 0) ? POLLOUT : 0);
+    descriptor.revents = 0;
+    do
+        ready = poll(&descriptor, 1, timeout);
+    while ((ready < 0) && (errno == EINTR));
+    if (ready < 0)
+        goto abort;
+    if ((descriptor.revents & POLLOUT) && (SQLAsync_Flush(async) == 0))
+        goto abort;
+    if (descriptor.revents & (POLLIN | POLLHUP | POLLERR))
+    {
+        if ((SQLFrame_Fill(async->client.descriptor, &(async->client.input)) == 0) || (SQLAsync_Dispatch(async) == 0))
+            goto abort;
+    }
+    return 1;
+
+abort:
+    SQLAsync_CompleteAll(async, -1);
+    return 0;
+}
+
+/* Wait until `future` completes, returns its status */
+int SQLAsync_Wait(struct SQLAsyncClient *async, struct SQLFuture *future)
+{
+    while (future->status == SQL_FUTURE_PENDING)
+        SQLAsync_Poll(async, -1);
+    return future->status;
+}
+
+/* Why the query of a completed `future` failed, NULL if it succeeded or is still pending */
+const char *SQLAsync_Error(const struct SQLFuture *const future)
+{
+    if ((future->status == 0) || (future->status == SQL_FUTURE_PENDING))
+        return NULL;
+    return future->message;
+}
+
+/*
+ * Ask the server to stop the query of `future`, returns 0 on failure
+ *
+ *      The query then completes with an error, or normally when it ended
+ *      first. `cancel` completes once the server received the request.
+ */
+int SQLAsync_Cancel(struct SQLAsyncClient *async, const struct SQLFuture *const future, struct SQLFuture *cancel)
+{
+    char query[32];
+
+    snprintf(query, sizeof(query), "CANCEL:%lu", (unsigned long) future->request);
+    return SQLAsync_Submit(async, query, NULL, cancel);
+}
+
+/*
+ * Replies printed by the interactive client:
+ *      futures : the futures of the queries, used as a ring of `depth`
+ *      depth   : number of queries in flight at most
+ *      sent    : number of queries submitted
+ *      reported: number of completed queries whose error was printed
+ *
+ *  Several replies can complete in one poll, so the errors are printed in
+ *  request order before the rows of a later query. They are printed as the
+ *  REPL prints the messages of the engine.
+ */
+struct ClientReport
+{
+    struct SQLFuture *futures;
+    uint32_t          depth;
+    uint32_t          sent;
+    uint32_t          reported;
+};
+
+/* Print the errors of the queries completed since the last report */
+static void SQLClient_Report(struct ClientReport *report)
+{
+    while (report->reported < report->sent)
+    {
+        const struct SQLFuture *future;
+
+        future = &(report->futures[report->reported % report->depth]);
+        if (future->status == SQL_FUTURE_PENDING)
+            break;
+        if (future->status == 1)
+            printf("%s\n", SQLAsync_Error(future));
+        report->reported += 1;
+    }
+}
+
+/* Print a result row, after the errors of the queries before it */
+static void SQLClient_ReportRow(void *context, const struct Row *const row)
+{
+    SQLClient_Report(context);
+    SQLstdoutSinkRow(NULL, row);
+}
+
+/*
+ * Interactive client, reads queries from stdin and prints the results
+ *
+ *      When stdin is not a terminal up to SQL_CLIENT_PIPELINE_DEPTH queries
+ *      are in flight before waiting for the oldest reply.
+ */
+int SQLClient_Run(const char *const host, const char *const port)
+{
+    struct SQLAsyncClient async;
+    struct SQLFuture      futures[SQL_CLIENT_PIPELINE_DEPTH];
+    struct ClientReport   report;
+    struct ResultSink     sink;
+    char                 *input;
+    size_t                size;
+    ssize_t               length;
+    uint32_t              received;
+    uint32_t              depth;
+
+    if (SQLAsync_Connect(&async, host, port) == 0)
+    {
+        printf("error: cannot connect to %s:%s.\n", host, port);
+        return 1;
+    }
+    depth    = isatty(STDIN_FILENO) ? 1 : SQL_CLIENT_PIPELINE_DEPTH;
+    received = 0;
+    memset(&report, 0, sizeof(report));
+    report.futures = futures;
+    report.depth   = depth;
+    sink           = SQLstdoutSink;
+    sink.row       = SQLClient_ReportRow;
+    sink.context   = &report;
+    input    = NULL;
+    size     = 0;
+    for (;;)
+    {
+        if (depth == 1)
+            printf("dbc > ");
+        fflush(stdout);
+        if ((length = getline(&input, &size, stdin)) <= 0)
+            break;
+
+        if (input[length - 1] == '\n')
+            input[length - 1] = '\0';
+
+        if ((strcmp(input, "exit") == 0) || (strcmp(input, "\\q") == 0))
+            break;
+        if (SQLAsync_Submit(&async, input, &sink, &(futures[report.sent++ % depth])) == 0)
+            goto abort;
+        while (report.sent - received >= depth)
+        {
+            if (SQLAsync_Wait(&async, &(futures[received++ % depth])) < 0)
+                goto abort;
+            SQLClient_Report(&report);
+        }
+    }
+    /* Drain the replies still in flight */
+    while (received < report.sent)
+    {
+        if (SQLAsync_Wait(&async, &(futures[received++ % depth])) < 0)
+            goto abort;
+        SQLClient_Report(&report);
+    }
+    free(input);
+    SQLAsync_Close(&async);
+
+    return 0;
+
+abort:
+    printf("error: connection lost.\n");
+    free(input);
+    SQLAsync_Close(&async);
+
+    return 1;
+}
+
+#endif /* SQLCLIENT_H */
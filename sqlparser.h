@@ -1,8 +1,17 @@
+#ifndef SQLPARSER_H
+#define SQLPARSER_H
+
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <errno.h>
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+#include <stdarg.h>
 #include <unistd.h>
+#include <sys/time.h>
 #include <io.h>
 
 /* SQL parser lexer state */
@@ -20,6 +29,10 @@ enum QueryType
     Delete,
     Insert,
     Update,
+    CreateView,
+    Status,
+    Alter,
+    Cancel,
     Invalid
 };
 
@@ -29,30 +42,113 @@ enum FieldType
     Integer,
     Number,
     String,
-    Boolean
+    Boolean,
+    Int64,
+    Double,
+    Decimal,
+    Timestamp,
+    Date
+};
+
+/* Enumeration for the ways to split a table in partitions */
+enum PartitionType
+{
+    NoPartition,
+    HashPartition,
+    RangePartition
+};
+
+/* Enumeration for the SELECT clauses, given with the `:` operator */
+enum ClauseType
+{
+    InvalidClause = Invalid, /* SQLParser_FindInMap() result for unknown names */
+    FieldsClause,
+    GroupClause,
+    FromClause,
+    CountAggregate,
+    SumAggregate,
+    MinAggregate,
+    MaxAggregate,
+    AvgAggregate,
+    PartitionClause,
+    HashClause,
+    RangeClause,
+    AddClause,
+    DropClause,
+    TypeClause,
+    DefaultClause,
+    IsNullClause,
+    IsNotNullClause,
+    CountDistinctAggregate,
+    DistinctClause,
+    ApproxCountDistinctAggregate,
+    ApproxPercentileAggregate,
+    PartialClause,
+    SampleClause,
+    BlockSampleClause,
+    FullTextClause,
+    MatchClause,
+    LikeClause,
+    InClause,
+    BetweenClause,
+    IntoClause,
+    TimeoutClause
+};
+
+/*
+ * A bound of a range, in the encoding of its column: `exact` for INTEGER,
+ * INT64, DECIMAL (in units), DATE and TIMESTAMP columns, `real` for NUMBER
+ * and DOUBLE ones, so 64-bit bounds are not rounded to doubles
+ */
+union RangeBound
+{
+    long long exact;
+    double    real;
 };
 
 /*
- * Table structure container (maximum 128 columns)
+ * Table structure container
  *
- *   count      : number of columns in the table
- *   columns    : names of table columns
- *   columnTypes: data type of each column
- *   name       : the name of the table
+ *   count          : number of columns in the table
+ *   columns        : names of table columns
+ *   columnTypes    : data type of each column
+ *   name           : the name of the table
+ *   partitionType  : how the rows are split among the partition files
+ *   partitionColumn: the column deciding the partition of a row
+ *   partitionCount : number of partition files (maximum 64)
+ *   partitionBounds: for RANGE partitions, partition `i` holds the values
+ *                    below partitionBounds[i], the last one all the rest,
+ *                    see union RangeBound for their encoding
+ *   columnDefaults : value of each column for the rows stored before it was
+ *                    added and for the inserts not giving it, empty for NULL
+ *   columnDropped  : set for dropped columns, they are hidden but their
+ *                    values stay in the stored rows
+ *   columnIndexed  : set for STRING columns with a full-text index, see
+ *                    ALTER FULLTEXT and MATCH
+ *
+ *  The column arrays are sized to the table and grown by SQLstructure_AddColumn(),
+ *  a structure owns them and is released with SQLstructure_Free().
  */
 struct TableStructureInfo
 {
     size_t count;
-    char   columns[128][128];
-    enum   FieldType columnTypes[128];
+    char   **columns;
+    enum   FieldType *columnTypes;
     char   name[128];
+    enum   PartitionType partitionType;
+    int    partitionColumn;
+    size_t partitionCount;
+    union  RangeBound partitionBounds[63];
+    char   **columnDefaults;
+    char   *columnDropped;
+    char   *columnIndexed;
 };
 
-/* A generic map container for binary search usage */
+/* A generic map container for binary search usage, the value is one of the enum the map is for */
 struct StringIntMap
 {
     const char *string;
-    enum QueryType type;
+    int value;
 };
 
 /* Operators for SQL statments */
@@ -74,6 +170,9 @@ struct TokenList
     char *keyword;
     char *value;
     enum Operator operator;
+    int quoted; /* set when the value was written between quotes */
+    struct ValueSet *set; /* compiled values of an IN or BETWEEN condition, NULL otherwise */
+    struct LikeCondition *like; /* compiled pattern of a LIKE condition, NULL otherwise */
 
     struct TokenList *next;
 };
@@ -92,8 +191,39 @@ union Value
     float number;
     char *string;
     Bool boolean;
+    long long int64;
+    double real;
+    long long decimal;   /* fixed-point, in units of 1 / SQL_DECIMAL_SCALE */
+    long long timestamp; /* microseconds since 1970-01-01T00:00:00Z */
+    long long date;      /* days since 1970-01-01 */
+};
+
+/*
+ * The values of an `IN:FIELD,VALUE,...` or `BETWEEN:FIELD,LOW,HIGH` condition,
+ * compiled once per query by SQLvalueSet_CompileList():
+ *      column  : position of the column in the queried table
+ *      type    : type of the column, the values are converted to it
+ *      count   : number of values, NULL ones are left out
+ *      values  : the values, sorted when there are few of them, in their
+ *                order for BETWEEN
+ *      slots   : open addressing hash table of value positions plus one, 0
+ *                for empty slots, NULL when the values are sorted
+ *      capacity: number of slots, a power of two
+ */
+struct ValueSet
+{
+    int            column;
+    enum FieldType type;
+    size_t         count;
+    union Value   *values;
+    size_t        *slots;
+    size_t         capacity;
 };
 
+/* DECIMAL values are stored as 64-bit integers with this many fractional digits */
+#define SQL_DECIMAL_DIGITS 4
+#define SQL_DECIMAL_SCALE  10000
+
 /*
  * One column of a table:
  *      value   : the column data value
@@ -111,12 +241,17 @@ struct Column
  * One row of a table:
  *      index       : the row index
  *      columns     : columns the row columns content
+ *      nulls       : validity bitmap, bit `i` is set when column `i` is NULL
  *      columnsCount: the number of columns in the row
+ *
+ *  The columns and the bitmap are one allocation made by SQLallocRow(), sized
+ *  to the row, released by SQLfreeRow().
  */
 struct Row
 {
     int index;
-    struct Column columns[128];
+    struct Column *columns;
+    unsigned char *nulls;
     size_t columnCount;
 };
 
@@ -131,21 +266,81 @@ struct Table
     size_t rowCount;
 };
 
+/*
+ * Consumer of query results, so the same executor can print to stdout or
+ * encode the rows for a client connection:
+ *      begin  : called once with the result structure, before any row
+ *      row    : called for every result row
+ *      end    : called once after the last row
+ *      context: user data passed back to every callback
+ */
+struct ResultSink
+{
+    void (*begin)(void *context, const struct TableStructureInfo *const tableStructure);
+    void (*row)(void *context, const struct Row *const row);
+    void (*end)(void *context);
+    void  *context;
+};
+
 /* A map of the SQL commands, allows fast search using binary search */
 static const struct StringIntMap QueryTypes[] = {
+    {"ALTER", Alter},
+    {"CANCEL", Cancel},
     {"DATASET", Create},
     {"DELETE", Delete},
     {"INSERT_INTO", Insert},
+    {"MATERIALIZED_VIEW", CreateView},
     {"SELECT", Select},
+    {"STATUS", Status},
     {"UPDATE", Update}
 };
 
 /* A map of the valid data types, allows fast search using binary search */
 static const struct StringIntMap DataTypes[] = {
     {"BOOLEAN", Boolean},
+    {"DATE", Date},
+    {"DECIMAL", Decimal},
+    {"DOUBLE", Double},
+    {"INT64", Int64},
     {"INTEGER", Integer},
     {"NUMBER", Number},
-    {"STRING", String}
+    {"STRING", String},
+    {"TIMESTAMP", Timestamp}
+};
+
+/* A map of the SELECT clauses, allows fast search using binary search */
+static const struct StringIntMap ClauseTypes[] = {
+    {"ADD", AddClause},
+    {"APPROX_COUNT_DISTINCT", ApproxCountDistinctAggregate},
+    {"APPROX_PERCENTILE", ApproxPercentileAggregate},
+    {"AVG", AvgAggregate},
+    {"BETWEEN", BetweenClause},
+    {"BLOCK_SAMPLE", BlockSampleClause},
+    {"COUNT", CountAggregate},
+    {"COUNT_DISTINCT", CountDistinctAggregate},
+    {"DEFAULT", DefaultClause},
+    {"DISTINCT", DistinctClause},
+    {"DROP", DropClause},
+    {"FIELDS", FieldsClause},
+    {"FROM", FromClause},
+    {"FULLTEXT", FullTextClause},
+    {"GROUP", GroupClause},
+    {"HASH", HashClause},
+    {"IN", InClause},
+    {"INTO", IntoClause},
+    {"IS_NOT_NULL", IsNotNullClause},
+    {"IS_NULL", IsNullClause},
+    {"LIKE", LikeClause},
+    {"MATCH", MatchClause},
+    {"MAX", MaxAggregate},
+    {"MIN", MinAggregate},
+    {"PARTIAL", PartialClause},
+    {"PARTITION", PartitionClause},
+    {"RANGE", RangeClause},
+    {"SAMPLE", SampleClause},
+    {"SUM", SumAggregate},
+    {"TIMEOUT", TimeoutClause},
+    {"TYPE", TypeClause}
 };
 
 /* String map comparison function, for binary search */
@@ -156,10 +351,285 @@ static int compare(const void *const lhs, const void *const rhs)
     return strcmp(((struct StringIntMap *)lhs)->string, ((struct StringIntMap *)rhs)->string);
 }
 
+/* Parse a decimal literal exactly, rounding the digits beyond SQL_DECIMAL_DIGITS */
+long long SQLdecimalFromString(const char *string, char **end)
+{
+    long long value;
+    int       negative;
+    int       digits;
+
+    while (isspace(*string) != 0)
+        string++;
+    negative = (*string == '-');
+    if ((*string == '-') || (*string == '+'))
+        string++;
+    value = 0;
+    while (isdigit(*string) != 0)
+        value = 10 * value + (*(string++) - '0');
+    digits = 0;
+    if (*string == '.')
+    {
+        for (string++ ; isdigit(*string) != 0 ; string++)
+        {
+            if (digits < SQL_DECIMAL_DIGITS)
+                value = 10 * value + (*string - '0');
+            else if ((digits == SQL_DECIMAL_DIGITS) && (*string >= '5'))
+                value += 1;
+            digits++;
+        }
+    }
+    for ( ; digits < SQL_DECIMAL_DIGITS ; digits++)
+        value *= 10;
+    if (end != NULL)
+        *end = (char *) string;
+
+    return negative ? -value : value;
+}
+
+/* Format a decimal value with all its fractional digits */
+void SQLdecimalToString(long long value, char *buffer, size_t size)
+{
+    unsigned long long magnitude;
+
+    magnitude = (value < 0) ? -(unsigned long long) value : (unsigned long long) value;
+    snprintf(buffer, size, "%s%llu.%0*llu", (value < 0) ? "-" : "", magnitude / SQL_DECIMAL_SCALE,
+                                         SQL_DECIMAL_DIGITS, magnitude % SQL_DECIMAL_SCALE);
+}
+
+/* Days since 1970-01-01 of a date of the proleptic Gregorian calendar */
+long long SQLdaysFromCivil(long long year, unsigned month, unsigned day)
+{
+    long long era;
+    unsigned  yearOfEra;
+    unsigned  dayOfYear;
+    unsigned  dayOfEra;
+
+    year      -= (month <= 2);
+    era        = ((year >= 0) ? year : year - 399) / 400;
+    yearOfEra  = (unsigned) (year - era * 400);
+    dayOfYear  = (153 * (month + ((month > 2) ? -3 : 9)) + 2) / 5 + day - 1;
+    dayOfEra   = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+
+    return era * 146097 + (long long) dayOfEra - 719468;
+}
+
+/* Date of the proleptic Gregorian calendar of a number of days since 1970-01-01 */
+void SQLcivilFromDays(long long days, long long *year, unsigned *month, unsigned *day)
+{
+    long long era;
+    unsigned  dayOfEra;
+    unsigned  yearOfEra;
+    unsigned  dayOfYear;
+    unsigned  shifted;
+
+    days     += 719468;
+    era       = ((days >= 0) ? days : days - 146096) / 146097;
+    dayOfEra  = (unsigned) (days - era * 146097);
+    yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    shifted   = (5 * dayOfYear + 2) / 153;
+    *day      = dayOfYear - (153 * shifted + 2) / 5 + 1;
+    *month    = shifted + ((shifted < 10) ? 3 : -9);
+    *year     = (long long) yearOfEra + era * 400 + (*month <= 2);
+}
+
+/* Number of days in the month of the proleptic Gregorian calendar */
+unsigned SQLdaysInMonth(long long year, unsigned month)
+{
+    static const unsigned days[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+
+    if ((month == 2) && (year % 4 == 0) && ((year % 100 != 0) || (year % 400 == 0)))
+        return 29;
+    return days[month - 1];
+}
+
+/* Parse exactly `count` digits, returns -1 if there are not */
+static long SQLparseDigits(const char **string, int count)
+{
+    long value;
+
+    for (value = 0 ; count > 0 ; --count, ++(*string))
+    {
+        if (isdigit(**string) == 0)
+            return -1;
+        value = 10 * value + (**string - '0');
+    }
+    return value;
+}
+
+/*
+ * Parse an ISO-8601 date or timestamp into microseconds since 1970-01-01T00:00:00Z
+ *
+ *      YYYY-MM-DD[(T| )HH:MM[:SS[.ffffff]]][Z|(+|-)HH:MM]
+ *
+ *  `*end` is set to `string` when it is not a valid literal.
+ */
+long long SQLtimestampFromString(const char *string, char **end)
+{
+    const char *start;
+    long long   value;
+    long        year;
+    long        month;
+    long        day;
+    long        hour;
+    long        minute;
+    long        second;
+    long        micro;
+    int         digits;
+
+    start  = string;
+    hour   = 0;
+    minute = 0;
+    second = 0;
+    micro  = 0;
+    year   = SQLparseDigits(&string, 4);
+    if ((year < 0) || (*(string++) != '-') || ((month = SQLparseDigits(&string, 2)) < 1) || (month > 12) ||
+        (*(string++) != '-') || ((day = SQLparseDigits(&string, 2)) < 1) || (day > (long) SQLdaysInMonth(year, month)))
+        goto abort;
+    if ((*string == 'T') || (*string == ' '))
+    {
+        string++;
+        if (((hour = SQLparseDigits(&string, 2)) < 0) || (hour > 23) || (*(string++) != ':') ||
+            ((minute = SQLparseDigits(&string, 2)) < 0) || (minute > 59))
+            goto abort;
+        if (*string == ':')
+        {
+            string++;
+            if (((second = SQLparseDigits(&string, 2)) < 0) || (second > 60))
+                goto abort;
+            if (*string == '.')
+            {
+                for (string++, digits = 0 ; isdigit(*string) != 0 ; string++, digits++)
+                {
+                    if (digits < 6)
+                        micro = 10 * micro + (*string - '0');
+                }
+                for ( ; digits < 6 ; digits++)
+                    micro *= 10;
+            }
+        }
+    }
+    value = ((SQLdaysFromCivil(year, month, day) * 24 + hour) * 60 + minute) * 60 + second;
+    if (*string == 'Z')
+        string++;
+    else if ((*string == '+') || (*string == '-'))
+    {
+        long sign;
+        long offsetHours;
+        long offsetMinutes;
+
+        sign = (*(string++) == '-') ? -1 : 1;
+        if (((offsetHours = SQLparseDigits(&string, 2)) < 0) || (*(string++) != ':') ||
+            ((offsetMinutes = SQLparseDigits(&string, 2)) < 0))
+            goto abort;
+        /* The literal is in local time, UTC is behind a positive offset */
+        value -= sign * (offsetHours * 3600 + offsetMinutes * 60);
+    }
+    if (end != NULL)
+        *end = (char *) string;
+
+    return value * 1000000 + micro;
+
+abort:
+    if (end != NULL)
+        *end = (char *) start;
+    return 0;
+}
+
+/* Parse an ISO-8601 date into days since 1970-01-01, a time of day is truncated */
+long long SQLdateFromString(const char *string, char **end)
+{
+    long long value;
+
+    value = SQLtimestampFromString(string, end);
+    return ((value >= 0) ? value : value - 86399999999LL) / 86400000000LL;
+}
+
+/* Format a timestamp as ISO-8601 in UTC, the fraction of second only when not 0 */
+void SQLtimestampToString(long long value, char *buffer, size_t size)
+{
+    long long days;
+    long long seconds;
+    long long year;
+    unsigned  month;
+    unsigned  day;
+    long      micro;
+
+    micro   = value % 1000000;
+    seconds = value / 1000000;
+    if (micro < 0)
+    {
+        micro   += 1000000;
+        seconds -= 1;
+    }
+    days     = ((seconds >= 0) ? seconds : seconds - 86399) / 86400;
+    seconds -= days * 86400;
+    SQLcivilFromDays(days, &year, &month, &day);
+    if (micro == 0)
+        snprintf(buffer, size, "%04lld-%02u-%02uT%02lld:%02lld:%02lld", year, month, day,
+                                    seconds / 3600, seconds / 60 % 60, seconds % 60);
+    else
+        snprintf(buffer, size, "%04lld-%02u-%02uT%02lld:%02lld:%02lld.%06ld", year, month, day,
+                                    seconds / 3600, seconds / 60 % 60, seconds % 60, micro);
+}
+
+/* Format a date as ISO-8601 */
+void SQLdateToString(long long value, char *buffer, size_t size)
+{
+    long long year;
+    unsigned  month;
+    unsigned  day;
+
+    SQLcivilFromDays(value, &year, &month, &day);
+    snprintf(buffer, size, "%04lld-%02u-%02u", year, month, day);
+}
+
+/* Check if the values of the type are ordered instants */
+int SQLisTemporalType(enum FieldType type)
+{
+    return (type == Timestamp) || (type == Date);
+}
+
+/* Check if the values of the type are numbers */
+int SQLisNumericType(enum FieldType type)
+{
+    return (type == Integer) || (type == Number) || (type == Int64) || (type == Double) || (type == Decimal);
+}
+
+/* Parse a DATE or TIMESTAMP literal, quoted or not, `*valid` is set to 0 when the whole string is not one */
+static long long SQLtemporalFromString(const char *string, enum FieldType type, int *valid)
+{
+    long long value;
+    char     *end;
+    int       quoted;
+
+    quoted  = (*string == '\'');
+    string += quoted;
+    value   = (type == Timestamp) ? SQLtimestampFromString(string, &end) : SQLdateFromString(string, &end);
+    if ((quoted != 0) && (*end == '\''))
+        end++;
+    *valid = (end != string) && (*end == '\0');
+
+    return value;
+}
+
+/* Check if the string is a valid literal of the type, only DATE and TIMESTAMP literals can be wrong */
+int SQLisValidLiteral(const char *string, enum FieldType type)
+{
+    int valid;
+
+    if (SQLisTemporalType(type) == 0)
+        return 1;
+    SQLtemporalFromString(string, type, &valid);
+
+    return valid;
+}
+
 /* Convert the parsed string to a column value, giving the string and the field type */
 union Value SQLvalueFromStringAndType(const char *string, enum FieldType type)
 {
     union Value value;
+    int         valid;
 
     switch (type)
     {
@@ -172,6 +642,19 @@ union Value SQLvalueFromStringAndType(const char *string, enum FieldType type)
     case Number:
         value.number = strtod(string, NULL);
         break;
+    case Int64:
+        value.int64 = strtoll(string, NULL, 10);
+        break;
+    case Double:
+        value.real = strtod(string, NULL);
+        break;
+    case Decimal:
+        value.decimal = SQLdecimalFromString(string, NULL);
+        break;
+    case Timestamp:
+    case Date: /* invalid literals are rejected by SQLcheckLiterals() before */
+        value.int64 = SQLtemporalFromString(string, type, &valid);
+        break;
     case String:
         if (string == NULL)
             value.string = NULL;
@@ -193,6 +676,18 @@ union Value SQLvalueFromStringAndType(const char *string, enum FieldType type)
     return value;
 }
 
+/* Convert a value read from a storage file, instants are stored as their integer encoding */
+union Value SQLvalueFromStoredString(const char *string, enum FieldType type)
+{
+    union Value value;
+
+    if (SQLisTemporalType(type) == 0)
+        return SQLvalueFromStringAndType(string, type);
+    value.int64 = strtoll(string, NULL, 10);
+
+    return value;
+}
+
 /* Generic StringIntMap search */
 int SQLParser_FindInMap(const char *const query, const struct StringIntMap *const map, int count)
 {
@@ -207,7 +702,7 @@ int SQLParser_FindInMap(const char *const query, const struct StringIntMap *cons
     if (found == NULL)
         return Invalid;
 
-    return found->type;
+    return found->value;
 }
 
 /* Retrieve Query Type */
@@ -222,6 +717,37 @@ enum FieldType SQLParser_GetFieldType(const char *const query)
     return SQLParser_FindInMap(query, DataTypes, sizeof(DataTypes) / sizeof(DataTypes[0]));
 }
 
+/* Retrieve Clause Type */
+enum ClauseType SQLParser_GetClauseType(const char *const query)
+{
+    return SQLParser_FindInMap(query, ClauseTypes, sizeof(ClauseTypes) / sizeof(ClauseTypes[0]));
+}
+
+/* Find the value of the first `CLAUSE:VALUE` token of the query, returns NULL without one */
+const char *SQLParser_FindClause(const struct TokenList *list, enum ClauseType clause)
+{
+    for (list = list->next ; list != NULL ; list = list->next)
+    {
+        if ((list->operator == AssignOperator) && (SQLParser_GetClauseType(list->keyword) == clause))
+            return list->value;
+    }
+    return NULL;
+}
+
+/* Release a compiled IN list */
+static void SQLvalueSet_Free(struct ValueSet *set)
+{
+    size_t i;
+
+    if (set == NULL)
+        return;
+    for (i = 0 ; (set->type == String) && (i < set->count) ; ++i)
+        free(set->values[i].string);
+    free(set->values);
+    free(set->slots);
+    free(set);
+}
+
 /* cleanup Token List */
 static void freeTokens(struct TokenList *head)
 {
@@ -240,6 +766,8 @@ static void freeTokens(struct TokenList *head)
                 free(last->value);
             if (last->keyword != NULL)
                 free(last->keyword);
+            SQLvalueSet_Free(last->set);
+            free(last->like);
             free(last);
         }
     }
@@ -254,10 +782,10 @@ static void freeTokens(struct TokenList *head)
  *
  *      head = NULL;
  *      for (count = 0 ; count < totalCount ; ++count)
- *          head = appendToken(head, keyword, operator, value);
+ *          head = appendToken(head, keyword, operator, value, quoted);
  */
 static struct TokenList *appendToken(struct TokenList *head,
-        const char *const keyword, enum Operator operator, const char *const value)
+        const char *const keyword, enum Operator operator, const char *const value, int quoted)
 {
     struct TokenList *new;
 
@@ -270,6 +798,9 @@ static struct TokenList *appendToken(struct TokenList *head,
     new->keyword  = strdup(keyword);
     new->value    = strdup(value);
     new->operator = operator;
+    new->quoted   = quoted;
+    new->set      = NULL;
+    new->like     = NULL;
 
     /* If head was not yet specified, then the new node is head */
     if (head == NULL)
@@ -337,7 +868,63 @@ enum Operator SQLfindOperator_helper(const char **source)
     return operator;
 }
 
-struct TokenList *SQLParser_Parse(const char *query)
+/*
+ * Error messages of the executing statement:
+ *      capture : set while the messages are kept in `text` for the caller
+ *                instead of being printed, the server sends them to the
+ *                client
+ *      text    : the kept messages, one per line
+ *      length  : length of `text`
+ *      capacity: allocated size of `text`
+ *      count   : number of messages reported, printed or kept
+ */
+struct MessageLog
+{
+    int    capture;
+    char  *text;
+    size_t length;
+    size_t capacity;
+    size_t count;
+};
+
+static struct MessageLog SQLmessages;
+
+/* Report an error of the statement, printed or kept in SQLmessages */
+static void SQLreport(const char *const format, ...)
+{
+    va_list arguments;
+    int     written;
+
+    SQLmessages.count += 1;
+    va_start(arguments, format);
+    if (SQLmessages.capture == 0)
+    {
+        vprintf(format, arguments);
+        va_end(arguments);
+        return;
+    }
+    written = vsnprintf(NULL, 0, format, arguments);
+    va_end(arguments);
+    if (written < 0)
+        return;
+    if (SQLmessages.length + written >= SQLmessages.capacity)
+    {
+        char *auxiliar;
+
+        auxiliar = realloc(SQLmessages.text, 2 * (SQLmessages.length + written) + 64);
+        if (auxiliar == NULL)
+            return;
+        SQLmessages.text     = auxiliar;
+        SQLmessages.capacity = 2 * (SQLmessages.length + written) + 64;
+    }
+    va_start(arguments, format);
+    vsnprintf(SQLmessages.text + SQLmessages.length, SQLmessages.capacity - SQLmessages.length, format, arguments);
+    va_end(arguments);
+    SQLmessages.length += written;
+}
+
+/* Split the query into its tokens, reporting a malformed query unless `quiet` is set, returns NULL if it is */
+static struct TokenList *SQLParser_Tokenize(const char *query, int quiet)
 {
     struct TokenList  *head;
     enum ScannerState  state;
@@ -346,6 +933,7 @@ struct TokenList *SQLParser_Parse(const char *query)
     size_t             index;
     size_t             length;
     enum Operator      operator;
+    int                quoted;
 
     index  = 0;
     length = strlen(query);
@@ -358,6 +946,7 @@ struct TokenList *SQLParser_Parse(const char *query)
     head     = NULL;
     operator = AssignOperator;
     state    = ScanToken;
+    quoted   = 0;
     while (*query != '\0')
     {
         switch (*query)
@@ -401,6 +990,7 @@ struct TokenList *SQLParser_Parse(const char *query)
             while ((*(query++) != '\0') && (*query != '\''))
                 buffer[index++] = *query;
             buffer[index] = '\0';
+            quoted        = 1;
             break;
         case ' ':
         case '\t':
@@ -411,8 +1001,9 @@ struct TokenList *SQLParser_Parse(const char *query)
                 /* Copy the value, and start searching for the next token */
                 buffer[index] = '\0';
                 index         = 0;
-                head          = appendToken(head, keyword, operator, buffer);
+                head          = appendToken(head, keyword, operator, buffer, quoted);
                 state         = ScanToken;
+                quoted        = 0;
             }
             break;
         default:
@@ -428,7 +1019,7 @@ struct TokenList *SQLParser_Parse(const char *query)
     {
         buffer[index] = '\0';
         index         = 0;
-        head          = appendToken(head, keyword, operator, buffer);
+        head          = appendToken(head, keyword, operator, buffer, quoted);
     }
     /* release memory to OS */
     free(keyword);
@@ -438,7 +1029,8 @@ struct TokenList *SQLParser_Parse(const char *query)
 
     /* This label is to prevent repeating the same code over and over DRY principle */
 abort:
-    printf("error: cannot parse query.\n");
+    if (quiet == 0)
+        SQLreport("error: cannot parse query.\n");
     if (head != NULL)
         freeTokens(head);
     if (buffer != NULL)
@@ -448,6 +1040,12 @@ abort:
     return NULL;
 }
 
+/* Split the query into its tokens, returns NULL if it is malformed */
+struct TokenList *SQLParser_Parse(const char *query)
+{
+    return SQLParser_Tokenize(query, 0);
+}
+
 /* Simple brute force search for a column position */
 int SQLParser_FindColumn(const struct TableStructureInfo *const table,
                                                const char *const column)
@@ -457,12 +1055,156 @@ int SQLParser_FindColumn(const struct TableStructureInfo *const table,
         return -1;
     for (i = 0 ; i < table->count ; i++)
     {
-        if (strcmp(column, table->columns[i]) == 0)
+        if ((table->columnDropped[i] == 0) && (strcmp(column, table->columns[i]) == 0))
             return i;
     }
     return -1;
 }
 
+/*
+ * Append a column to the structure, keeping copies of `name` and `initial`
+ * (its DEFAULT, NULL for none), returns 0 on failure
+ */
+int SQLstructure_AddColumn(struct TableStructureInfo *info, const char *const name, enum FieldType type,
+                                                                              const char *const initial)
+{
+    char          **columns;
+    enum FieldType *types;
+    char          **defaults;
+    char           *dropped;
+    char           *indexed;
+    size_t          count;
+
+    count = info->count + 1;
+    if ((columns = realloc(info->columns, count * sizeof(char *))) != NULL)
+        info->columns = columns;
+    if ((types = realloc(info->columnTypes, count * sizeof(enum FieldType))) != NULL)
+        info->columnTypes = types;
+    if ((defaults = realloc(info->columnDefaults, count * sizeof(char *))) != NULL)
+        info->columnDefaults = defaults;
+    if ((dropped = realloc(info->columnDropped, count)) != NULL)
+        info->columnDropped = dropped;
+    if ((indexed = realloc(info->columnIndexed, count)) != NULL)
+        info->columnIndexed = indexed;
+    if ((columns == NULL) || (types == NULL) || (defaults == NULL) || (dropped == NULL) || (indexed == NULL))
+        return 0;
+    columns[info->count]  = strdup(name);
+    defaults[info->count] = strdup((initial == NULL) ? "" : initial);
+    if ((columns[info->count] == NULL) || (defaults[info->count] == NULL))
+    {
+        free(columns[info->count]);
+        free(defaults[info->count]);
+        return 0;
+    }
+    types[info->count]   = type;
+    dropped[info->count] = 0;
+    indexed[info->count] = 0;
+    info->count          = count;
+
+    return 1;
+}
+
+/* Release the columns of the structure, leaving it empty */
+void SQLstructure_Free(struct TableStructureInfo *info)
+{
+    size_t i;
+
+    for (i = 0 ; i < info->count ; ++i)
+    {
+        free(info->columns[i]);
+        free(info->columnDefaults[i]);
+    }
+    free(info->columns);
+    free(info->columnTypes);
+    free(info->columnDefaults);
+    free(info->columnDropped);
+    free(info->columnIndexed);
+    memset(info, 0, sizeof(*info));
+}
+
+/* Copy the structure with its own columns, returns 0 on failure */
+int SQLstructure_Copy(struct TableStructureInfo *destination, const struct TableStructureInfo *const source)
+{
+    size_t i;
+
+    *destination                = *source;
+    destination->count          = 0;
+    destination->columns        = NULL;
+    destination->columnTypes    = NULL;
+    destination->columnDefaults = NULL;
+    destination->columnDropped  = NULL;
+    destination->columnIndexed  = NULL;
+    for (i = 0 ; i < source->count ; ++i)
+    {
+        if (SQLstructure_AddColumn(destination, source->columns[i], source->columnTypes[i],
+                                                source->columnDefaults[i]) == 0)
+        {
+            SQLstructure_Free(destination);
+            return 0;
+        }
+        destination->columnDropped[i] = source->columnDropped[i];
+        destination->columnIndexed[i] = source->columnIndexed[i];
+    }
+    return 1;
+}
+
+/* Text of a NULL value, in queries and in storage files (where strings are quoted) */
+#define SQL_NULL "NULL"
+
+/* Check whether the text of a value means NULL */
+int SQLisNullText(const char *const text)
+{
+    return (text != NULL) && (strcmp(text, SQL_NULL) == 0);
+}
+
+/* Check whether the value of a token is the NULL literal, a quoted 'NULL' is a string */
+int SQLisNullToken(const struct TokenList *const token)
+{
+    return (token->quoted == 0) && (SQLisNullText(token->value) != 0);
+}
+
+/* Check the validity bitmap of the row, returns 1 when the column is NULL */
+int SQLisNull(const struct Row *const row, size_t column)
+{
+    return (row->nulls[column / 8] >> (column % 8)) & 1;
+}
+
+/* Mark a column of the row as NULL, or as holding a value */
+void SQLsetNull(struct Row *const row, size_t column, int null)
+{
+    if (null != 0)
+        row->nulls[column / 8] |= 1 << (column % 8);
+    else
+        row->nulls[column / 8] &= ~(1 << (column % 8));
+}
+
+/* Value kept in NULL columns, an empty string for strings so they can always be released and compared */
+union Value SQLnullValue(enum FieldType type)
+{
+    union Value value;
+
+    memset(&value, 0, sizeof(value));
+    if (type == String)
+        value.string = strdup("");
+
+    return value;
+}
+
+/* Value of a column missing from a query or from a stored row: its DEFAULT, or NULL without one */
+void SQLsetColumnDefault(const struct TableStructureInfo *const table, struct Row *const row, size_t column)
+{
+    const char *initial;
+    int         null;
+
+    initial = table->columnDefaults[column];
+    null    = (initial[0] == '\0') || (SQLisNullText(initial) != 0);
+    row->columns[column].type     = table->columnTypes[column];
+    row->columns[column].position = column;
+    row->columns[column].value    = null ? SQLnullValue(table->columnTypes[column])
+                                         : SQLvalueFromStringAndType(initial, table->columnTypes[column]);
+    SQLsetNull(row, column, null);
+}
+
 /* Send the row to stdout, for printing select results */
 void SQLwriteRowToStdout(const struct Row *const row)
 {
@@ -473,6 +1215,11 @@ void SQLwriteRowToStdout(const struct Row *const row)
         struct Column column;
 
         column = row->columns[i];
+        if (SQLisNull(row, i) != 0)
+        {
+            printf("%-10s|\t", SQL_NULL);
+            continue;
+        }
         switch (column.type) /* Select format specifier and union member depending on type */
         {
         case Integer:
@@ -484,6 +1231,32 @@ void SQLwriteRowToStdout(const struct Row *const row)
         case Number:
             printf("%10g|\t", column.value.number);
             break;
+        case Int64:
+            printf("%10lld|\t", column.value.int64);
+            break;
+        case Double:
+            printf("%10.15g|\t", column.value.real);
+            break;
+        case Decimal:
+            {
+                char text[32];
+
+                SQLdecimalToString(column.value.decimal, text, sizeof(text));
+                printf("%10s|\t", text);
+            }
+            break;
+        case Timestamp:
+        case Date:
+            {
+                char text[48];
+
+                if (column.type == Timestamp)
+                    SQLtimestampToString(column.value.timestamp, text, sizeof(text));
+                else
+                    SQLdateToString(column.value.date, text, sizeof(text));
+                printf("%-10s|\t", text);
+            }
+            break;
         case String:
             printf("%-10s|\t", column.value.string);
             break;
@@ -492,48 +1265,158 @@ void SQLwriteRowToStdout(const struct Row *const row)
     printf("\n");
 }
 
-/* Send row to a FILE * */
-void SQLwriteRowToFile(FILE *file, const struct Row *const row)
+/* Append formatted text to the growing `*buffer`, returns 0 on failure */
+static int SQLformatAppend(char **buffer, size_t *capacity, size_t *length, const char *const format, ...)
+{
+    va_list arguments;
+    int     written;
+
+    for (;;)
+    {
+        va_start(arguments, format);
+        written = vsnprintf(*buffer + *length, *capacity - *length, format, arguments);
+        va_end(arguments);
+        if (written < 0)
+            return 0;
+        if (*length + written < *capacity)
+            break;
+        {
+            char *auxiliar;
+
+            auxiliar = realloc(*buffer, 2 * (*length + written) + 64);
+            if (auxiliar == NULL)
+                return 0;
+            *buffer   = auxiliar;
+            *capacity = 2 * (*length + written) + 64;
+        }
+    }
+    *length += written;
+
+    return 1;
+}
+
+/* Format the row as a storage line into `*buffer`, returns its length or 0 on failure */
+size_t SQLformatRow(char **buffer, size_t *capacity, const struct Row *const row)
 {
+    size_t length;
     size_t i;
+    int    status;
 
-    fprintf(file, "%d;", row->index);
-    for (i = 0 ; i < row->columnCount ; ++i)
+    if (*buffer == NULL)
+        *capacity = 0;
+    length = 0;
+    status = SQLformatAppend(buffer, capacity, &length, "%d;", row->index);
+    for (i = 0 ; (status != 0) && (i < row->columnCount) ; ++i)
     {
         struct Column column;
 
         column = row->columns[i];
+        if (SQLisNull(row, i) != 0) /* unquoted, unlike a 'NULL' string */
+        {
+            status = SQLformatAppend(buffer, capacity, &length, "%s;", SQL_NULL);
+            continue;
+        }
         switch (column.type) /* Select format specifier and union member depending on type */
         {
         case Integer:
-            fprintf(file, "%d;", column.value.integer);
+            status = SQLformatAppend(buffer, capacity, &length, "%d;", column.value.integer);
             break;
         case Boolean:
-            fprintf(file, "%s;", column.value.boolean ? "True" : "False");
+            status = SQLformatAppend(buffer, capacity, &length, "%s;", column.value.boolean ? "True" : "False");
             break;
-        case Number:
-            fprintf(file, "%g;", column.value.number);
+        case Number: /* enough digits to read back the exact same float */
+            status = SQLformatAppend(buffer, capacity, &length, "%.9g;", column.value.number);
             break;
-        case String:
-            fprintf(file, "'%s';", column.value.string);
+        case Int64:
+            status = SQLformatAppend(buffer, capacity, &length, "%lld;", column.value.int64);
+            break;
+        case Double: /* enough digits to read back the exact same double */
+            status = SQLformatAppend(buffer, capacity, &length, "%.17g;", column.value.real);
+            break;
+        case Decimal:
+            {
+                char text[32];
+
+                SQLdecimalToString(column.value.decimal, text, sizeof(text));
+                status = SQLformatAppend(buffer, capacity, &length, "%s;", text);
+            }
+            break;
+        case Timestamp: /* stored as their integer encoding, to be read back without parsing */
+            status = SQLformatAppend(buffer, capacity, &length, "%lld;", column.value.timestamp);
+            break;
+        case Date:
+            status = SQLformatAppend(buffer, capacity, &length, "%lld;", column.value.date);
+            break;
+        case String:
+            status = SQLformatAppend(buffer, capacity, &length, "'%s';", column.value.string);
             break;
         }
     }
-    fprintf(file, "\n");
+    if ((status == 0) || (SQLformatAppend(buffer, capacity, &length, "\n") == 0))
+        return 0;
+
+    return length;
 }
 
-/* Modify the row, and send it to the file */
-void SQLupdateRowAndWriteToFile(FILE *file, const struct TableStructureInfo *const tableStructure, struct TokenList *list, struct Row *const row)
+/* Send row to a FILE *, formatted by SQLformatRow() into a buffer kept between the calls */
+void SQLwriteRowToFile(FILE *file, const struct Row *const row)
 {
-    if ((file == NULL) || (row == NULL))
+    static char  *buffer   = NULL;
+    static size_t capacity = 0;
+    size_t        length;
+
+    length = SQLformatRow(&buffer, &capacity, row);
+    if (length != 0)
+        fwrite(buffer, 1, length, file);
+}
+
+/* Create and open for writing a temporary file, its `filename` template ends with XXXXXX, NULL on failure */
+FILE *SQLtemporaryFile(char *filename)
+{
+    FILE *file;
+    int   descriptor;
+
+    descriptor = mkstemp(filename);
+    if (descriptor == -1)
+        return NULL;
+    file = fdopen(descriptor, "w");
+    if (file == NULL)
+    {
+        close(descriptor);
+        remove(filename);
+    }
+
+    return file;
+}
+
+/* Modify the row, applying the assignments in list */
+void SQLupdateRow(const struct TableStructureInfo *const tableStructure, struct TokenList *list, struct Row *const row)
+{
+    if (row == NULL)
         return;
     while (list != NULL)
     {
         int index;
         if ((list->operator == AssignOperator) && ((index = SQLParser_FindColumn(tableStructure, list->keyword)) != -1))
-            row->columns[index].value = SQLvalueFromStringAndType(list->value, tableStructure->columnTypes[index]);
+        {
+            if (row->columns[index].type == String)
+                free(row->columns[index].value.string);
+            if (SQLisNullToken(list) != 0)
+                row->columns[index].value = SQLnullValue(tableStructure->columnTypes[index]);
+            else
+                row->columns[index].value = SQLvalueFromStringAndType(list->value, tableStructure->columnTypes[index]);
+            SQLsetNull(row, index, SQLisNullToken(list));
+        }
         list = list->next;
     }
+}
+
+/* Modify the row, and send it to the file */
+void SQLupdateRowAndWriteToFile(FILE *file, const struct TableStructureInfo *const tableStructure, struct TokenList *list, struct Row *const row)
+{
+    if ((file == NULL) || (row == NULL))
+        return;
+    SQLupdateRow(tableStructure, list, row);
     SQLwriteRowToFile(file, row);
 }
 
@@ -557,110 +1440,518 @@ void SQLprintTable(struct Table *table)
         SQLwriteRowToStdout(&(table->rows[i]));
 }
 
+/* ResultSink callback that prints the rows to stdout */
+static void SQLstdoutSinkRow(void *context, const struct Row *const row)
+{
+    (void) context;
+    SQLwriteRowToStdout(row);
+}
+
+/* The default result sink, the interactive prompt prints results to stdout */
+static const struct ResultSink SQLstdoutSink = {NULL, SQLstdoutSinkRow, NULL, NULL};
+
+/* Allocate the `count` columns of an empty row, all zero and not NULL, returns 0 on failure */
+int SQLallocRow(struct Row *row, size_t count)
+{
+    memset(row, 0, sizeof(*row));
+    row->columns = calloc(1, count * sizeof(struct Column) + (count + 7) / 8 + 1);
+    if (row->columns == NULL)
+        return 0;
+    row->nulls       = (unsigned char *) (row->columns + count);
+    row->columnCount = count;
+
+    return 1;
+}
+
+/* Release the memory owned by the row and its columns */
+void SQLfreeRow(struct Row *row)
+{
+    size_t i;
+
+    if ((row == NULL) || (row->columns == NULL))
+        return;
+    for (i = 0 ; i < row->columnCount ; ++i)
+    {
+        if ((row->columns[i].type == String) && (row->columns[i].value.string != NULL))
+            free(row->columns[i].value.string);
+    }
+    free(row->columns);
+    row->columns     = NULL;
+    row->nulls       = NULL;
+    row->columnCount = 0;
+}
+
+/* Release the rows of the table, and the memory they own */
+void SQLfreeTable(struct Table *table)
+{
+    size_t i;
+
+    for (i = 0 ; i < table->rowCount ; ++i)
+        SQLfreeRow(&(table->rows[i]));
+    free(table->rows);
+    table->rows     = NULL;
+    table->rowCount = 0;
+}
+
+/* Copy the row, duplicating the memory owned by the columns, returns 0 on failure */
+int SQLcopyRow(struct Row *destination, const struct Row *const source)
+{
+    size_t i;
+
+    if (SQLallocRow(destination, source->columnCount) == 0)
+        return 0;
+    destination->index = source->index;
+    memcpy(destination->columns, source->columns, source->columnCount * sizeof(struct Column));
+    memcpy(destination->nulls, source->nulls, (source->columnCount + 7) / 8);
+    for (i = 0 ; i < source->columnCount ; ++i)
+    {
+        if ((source->columns[i].type != String) || (source->columns[i].value.string == NULL))
+            continue;
+        destination->columns[i].value.string = strdup(source->columns[i].value.string);
+        if (destination->columns[i].value.string == NULL)
+        {
+            destination->columnCount = i;
+            SQLfreeRow(destination);
+            return 0;
+        }
+    }
+    return 1;
+}
+
 /* This function will compare the values, according to their type and corresponding operator */
 int SQLcompareValues(const struct TokenList *list, union Value value, enum FieldType type)
 {
+    int compared;
+
     if ((list == NULL) || (list->operator == -1))
         return -1;
+    /* The condition reads `column operator value`, compare them three-way */
     switch (type) /* check what type are the operands */
     {
     case Integer:
         {
-            int lhs;
-            int rhs;
+            long rhs;
 
-            lhs = strtol(list->value, NULL, 10);
-            rhs = value.integer;
-
-            switch (list->operator)
-            {
-            case EqualOperator:
-                return (lhs == rhs);
-            case NotEqualOperator:
-                return (lhs != rhs);
-            case GreaterThanOperator:
-                return (lhs > rhs);
-            case GreaterOrEqualOperator:
-                return (lhs >= rhs);
-            case LessThanOperator:
-                return (lhs < rhs);
-            case LessOrEqualOperator:
-                return (lhs >= rhs);
-            default:
-                return -1;
-            }
+            rhs      = strtol(list->value, NULL, 10);
+            compared = (value.integer > rhs) - (value.integer < rhs);
         }
         break;
     case Number:
         {
-            int lhs;
-            int rhs;
+            float rhs;
 
-            lhs = strtod(list->value, NULL);
-            rhs = value.number;
-            switch (list->operator)
-            {
-            case EqualOperator:
-                return (lhs == rhs);
-            case NotEqualOperator:
-                return (lhs != rhs);
-            case GreaterThanOperator:
-                return (lhs > rhs);
-            case GreaterOrEqualOperator:
-                return (lhs >= rhs);
-            case LessThanOperator:
-                return (lhs < rhs);
-            case LessOrEqualOperator:
-                return (lhs >= rhs);
-            default:
-                return -1;
-            }
+            /* Rounded like the stored value, or 1.1 would never equal itself */
+            rhs      = strtof(list->value, NULL);
+            compared = (value.number > rhs) - (value.number < rhs);
         }
         break;
-    case String:
+    case Int64:
         {
-            switch (list->operator)
-            {
-            case EqualOperator:
-                return (strcmp(list->value, value.string) == 0);
-            case NotEqualOperator:
-                return (strcmp(list->value, value.string) != 0);
-            case GreaterThanOperator:
-                return (strcmp(list->value, value.string) > 0);
-            case GreaterOrEqualOperator:
-                return (strcmp(list->value, value.string) >= 0);
-            case LessThanOperator:
-                return (strcmp(list->value, value.string) < 0);
-            case LessOrEqualOperator:
-                return (strcmp(list->value, value.string) <= 0);
-            default:
-                return -1;
-            }
+            long long rhs;
+
+            rhs      = strtoll(list->value, NULL, 10);
+            compared = (value.int64 > rhs) - (value.int64 < rhs);
         }
         break;
-    case Boolean:
+    case Double:
         {
-            switch (list->operator)
-            {
-            case EqualOperator:
-            case NotEqualOperator:
-            case GreaterThanOperator:
-            case GreaterOrEqualOperator:
-            case LessThanOperator:
-            case LessOrEqualOperator:
-                return ((strcmp("True", list->value) == 0) == value.boolean);
-            default:
-                return -1;
-            }
+            double rhs;
+
+            rhs      = strtod(list->value, NULL);
+            compared = (value.real > rhs) - (value.real < rhs);
         }
         break;
-    default:
+    case Decimal:
+        {
+            long long rhs;
+
+            rhs      = SQLdecimalFromString(list->value, NULL);
+            compared = (value.decimal > rhs) - (value.decimal < rhs);
+        }
+        break;
+    case Timestamp:
+    case Date:
+        {
+            long long lhs;
+            long long rhs;
+
+            lhs      = (type == Timestamp) ? value.timestamp : value.date;
+            rhs      = (type == Timestamp) ? SQLtimestampFromString(list->value, NULL)
+                                           : SQLdateFromString(list->value, NULL);
+            compared = (lhs > rhs) - (lhs < rhs);
+        }
+        break;
+    case String:
+        compared = strcmp(value.string, list->value);
         break;
+    case Boolean:
+        /* Booleans are only checked for equality, whatever the operator */
+        if (list->operator == AssignOperator)
+            return -1;
+        return ((strcmp("True", list->value) == 0) == value.boolean);
+    default:
+        return 1;
+    }
+    switch (list->operator)
+    {
+    case EqualOperator:
+        return (compared == 0);
+    case NotEqualOperator:
+        return (compared != 0);
+    case GreaterThanOperator:
+        return (compared > 0);
+    case GreaterOrEqualOperator:
+        return (compared >= 0);
+    case LessThanOperator:
+        return (compared < 0);
+    case LessOrEqualOperator:
+        return (compared <= 0);
+    default:
+        return -1;
+    }
+}
+
+/* Longest full-text term, longer words are cut to this length */
+#define SQL_FULLTEXT_TERM 64
+
+/*
+ * Read the next term of `*text` into `term`, advancing `*text` past it
+ *
+ *      Terms are the runs of ASCII letters and digits, lowercased, so MATCH
+ *      is case insensitive. Returns 0 at the end of the text.
+ */
+static int SQLfulltext_NextTerm(const char **text, char term[SQL_FULLTEXT_TERM + 1])
+{
+    size_t length;
+
+    while ((**text != '\0') && (isalnum((unsigned char) **text) == 0))
+        (*text)++;
+    for (length = 0 ; isalnum((unsigned char) **text) != 0 ; (*text)++)
+    {
+        if (length < SQL_FULLTEXT_TERM)
+            term[length++] = tolower((unsigned char) **text);
+    }
+    term[length] = '\0';
+
+    return length != 0;
+}
+
+/* Check if `text` holds every term of `terms` */
+static int SQLfulltext_Matches(const char *const text, const char *terms)
+{
+    char wanted[SQL_FULLTEXT_TERM + 1];
+    char term[SQL_FULLTEXT_TERM + 1];
+
+    while (SQLfulltext_NextTerm(&terms, wanted) != 0)
+    {
+        const char *current;
+
+        current = text;
+        while ((SQLfulltext_NextTerm(&current, term) != 0) && (strcmp(term, wanted) != 0));
+        if (strcmp(term, wanted) != 0)
+            return 0;
     }
     return 1;
 }
 
-/* This function will filter the row according to the conditions in list */
+/*
+ * Split the value of `MATCH:FIELD,TERMS` or `LIKE:FIELD,PATTERN`, copying the
+ * column into `name` (sized like `value`), returns the terms or the pattern
+ */
+static const char *SQLsplitCondition(const char *const value, char *name)
+{
+    const char *separator;
+    size_t      length;
+
+    separator = strchr(value, ',');
+    length    = (separator == NULL) ? strlen(value) : (size_t) (separator - value);
+    memcpy(name, value, length);
+    name[length] = '\0';
+
+    return (separator == NULL) ? "" : separator + 1;
+}
+
+/*
+ * Find `needle` (of `size` bytes) in the `length` bytes of `haystack`, returns NULL if missing
+ *
+ *      The first and last bytes of the needle are compared with a whole word
+ *      of haystack positions at once, each byte of the word holding one
+ *      position, and only the positions matching both are compared fully.
+ */
+static const char *SQLsubstring_Find(const char *const haystack, size_t length, const char *const needle, size_t size)
+{
+    unsigned long ones;
+    unsigned long highs;
+    unsigned long first;
+    unsigned long last;
+    size_t        i;
+    size_t        j;
+
+    if (size == 0)
+        return haystack;
+    if (size > length)
+        return NULL;
+    ones  = ~0UL / 255;
+    highs = ones * 0x80;
+    first = ones * (unsigned char) needle[0];
+    last  = ones * (unsigned char) needle[size - 1];
+    for (i = 0 ; i + sizeof(unsigned long) + size - 1 <= length ; i += sizeof(unsigned long))
+    {
+        unsigned long head;
+        unsigned long tail;
+        unsigned long equal;
+
+        memcpy(&head, haystack + i, sizeof(head));
+        memcpy(&tail, haystack + i + size - 1, sizeof(tail));
+        /* A zero byte where both the first and the last byte match */
+        equal = (head ^ first) | (tail ^ last);
+        if ((((equal - ones) & ~equal) & highs) == 0)
+            continue;
+        for (j = i ; j < i + sizeof(unsigned long) ; ++j)
+        {
+            if ((haystack[j] == needle[0]) && (haystack[j + size - 1] == needle[size - 1]) &&
+                (memcmp(haystack + j, needle, size) == 0))
+                return haystack + j;
+        }
+    }
+    for ( ; i + size <= length ; ++i)
+    {
+        if ((haystack[i] == needle[0]) && (memcmp(haystack + i, needle, size) == 0))
+            return haystack + i;
+    }
+    return NULL;
+}
+
+/* How a LIKE pattern is matched, the ones with a single literal do not need the general matcher */
+enum LikeKind
+{
+    LikeExact,
+    LikePrefix,
+    LikeSuffix,
+    LikeContains,
+    LikeGeneral
+};
+
+/*
+ * A compiled LIKE pattern, `%` matches any run of characters and `_` any single one:
+ *      kind        : the matcher to use
+ *      pattern     : the whole pattern without its quotes, for the general
+ *                    matcher
+ *      end         : end of the pattern
+ *      literal     : the pattern without its leading and trailing `%`
+ *      length      : length of the literal
+ *      needle      : the longest run of the pattern without wildcards, every
+ *                    matching value holds it
+ *      needleLength: length of the needle
+ */
+struct LikePattern
+{
+    enum LikeKind kind;
+    const char   *pattern;
+    const char   *end;
+    const char   *literal;
+    size_t        length;
+    const char   *needle;
+    size_t        needleLength;
+};
+
+/*
+ * A `LIKE:FIELD,PATTERN` condition, compiled once per query by SQLlike_CompileList():
+ *      column : position of the column in the queried table
+ *      pattern: the compiled pattern, it points into the value of the token
+ */
+struct LikeCondition
+{
+    int                column;
+    struct LikePattern pattern;
+};
+
+/* Compile `pattern` for SQLlike_Match(), the pattern may be quoted and must outlive the compiled one */
+static void SQLlike_Compile(struct LikePattern *compiled, const char *pattern)
+{
+    const char *run;
+    size_t      length;
+    size_t      start;
+    size_t      end;
+    size_t      i;
+
+    length = strlen(pattern);
+    if ((length >= 2) && (pattern[0] == '\'') && (pattern[length - 1] == '\''))
+    {
+        pattern += 1;
+        length  -= 2;
+    }
+    start  = (length > 0) && (pattern[0] == '%');
+    end    = ((length > start) && (pattern[length - 1] == '%')) ? length - 1 : length;
+    compiled->pattern      = pattern;
+    compiled->end          = pattern + length;
+    compiled->literal      = pattern + start;
+    compiled->length       = end - start;
+    compiled->needle       = pattern;
+    compiled->needleLength = 0;
+    compiled->kind         = LikeExact;
+    for (run = pattern, i = 0 ; i <= length ; ++i)
+    {
+        if ((i < length) && (pattern[i] != '%') && (pattern[i] != '_'))
+            continue;
+        if ((i >= start) && (i < end))
+            compiled->kind = LikeGeneral;
+        if ((size_t) (pattern + i - run) > compiled->needleLength)
+        {
+            compiled->needle       = run;
+            compiled->needleLength = pattern + i - run;
+        }
+        run = pattern + i + 1;
+    }
+    if (compiled->kind == LikeGeneral)
+        return;
+    if (start == 0)
+        compiled->kind = (end == length) ? LikeExact : LikePrefix;
+    else
+        compiled->kind = (end == length) ? LikeSuffix : LikeContains;
+}
+
+/* Match `text` against a pattern (ending at `end`) with `%` and `_` wildcards, backtracking to the last `%` on a mismatch */
+static int SQLlike_Wildcard(const char *text, const char *pattern, const char *const end)
+{
+    const char *star;
+    const char *resume;
+
+    star   = NULL;
+    resume = NULL;
+    while (*text != '\0')
+    {
+        if ((pattern < end) && (*pattern != '%') && ((*pattern == '_') || (*pattern == *text)))
+        {
+            text++;
+            pattern++;
+        }
+        else if ((pattern < end) && (*pattern == '%'))
+        {
+            star   = ++pattern;
+            resume = text;
+        }
+        else if (star != NULL)
+        {
+            pattern = star;
+            text    = ++resume;
+        }
+        else
+            return 0;
+    }
+    while ((pattern < end) && (*pattern == '%'))
+        pattern++;
+
+    return pattern == end;
+}
+
+/* Check if `text` matches the compiled LIKE pattern */
+static int SQLlike_Match(const struct LikePattern *const compiled, const char *const text)
+{
+    size_t length;
+
+    switch (compiled->kind)
+    {
+    case LikeExact:
+        return (strlen(text) == compiled->length) && (memcmp(text, compiled->literal, compiled->length) == 0);
+    case LikePrefix:
+        return strncmp(text, compiled->literal, compiled->length) == 0;
+    case LikeSuffix:
+        length = strlen(text);
+        return (length >= compiled->length) &&
+               (memcmp(text + length - compiled->length, compiled->literal, compiled->length) == 0);
+    case LikeContains:
+        return SQLsubstring_Find(text, strlen(text), compiled->literal, compiled->length) != NULL;
+    default:
+        return SQLlike_Wildcard(text, compiled->pattern, compiled->end);
+    }
+}
+
+/* Compile the LIKE conditions of `list` for the columns of the queried table, once per query */
+void SQLlike_CompileList(struct TokenList *list, const struct TableStructureInfo *const tableStructure)
+{
+    for ( ; list != NULL ; list = list->next)
+    {
+        char        name[strlen(list->value) + 1];
+        const char *pattern;
+        int         column;
+
+        if ((list->operator != AssignOperator) || (SQLParser_GetClauseType(list->keyword) != LikeClause))
+            continue;
+        pattern = SQLsplitCondition(list->value, name);
+        column  = SQLParser_FindColumn(tableStructure, name);
+        free(list->like);
+        list->like = NULL;
+        if ((column == -1) || ((list->like = malloc(sizeof(struct LikeCondition))) == NULL))
+            continue;
+        list->like->column = column;
+        SQLlike_Compile(&(list->like->pattern), pattern);
+    }
+}
+
+int SQLcompareColumnValues(union Value lhs, union Value rhs, enum FieldType type);
+static struct ValueSet *SQLvalueSet_New(const char *const values, enum FieldType type, int lookup);
+static int SQLvalueSet_Contains(const struct ValueSet *const set, union Value value);
+
+/*
+ * Check the `IN:FIELD,VALUE,...` or `BETWEEN:FIELD,LOW,HIGH` condition `token`
+ * against the row, with the set compiled for the query if any
+ *
+ *      BETWEEN includes both bounds, and matches nothing when LOW is greater
+ *      than HIGH.
+ */
+static int SQLvalueSet_Filter(const struct TokenList *token, enum ClauseType clause,
+                              const struct TableStructureInfo *const tableStructure, const struct Row *row)
+{
+    struct ValueSet *set;
+    int              position;
+    int              found;
+
+    if ((set = token->set) != NULL)
+        position = set->column;
+    else
+    {
+        char        name[strlen(token->value) + 1];
+        const char *values;
+
+        values   = SQLsplitCondition(token->value, name);
+        position = SQLParser_FindColumn(tableStructure, name);
+        if (position == -1)
+            return 1;
+        set = SQLvalueSet_New(values, row->columns[position].type, clause == InClause);
+    }
+    found = (set != NULL) && (SQLisNull(row, position) == 0);
+    if ((found != 0) && (clause == InClause))
+        found = SQLvalueSet_Contains(set, row->columns[position].value);
+    else if (found != 0)
+        found = (set->count == 2) &&
+                (SQLcompareColumnValues(row->columns[position].value, set->values[0], set->type) >= 0) &&
+                (SQLcompareColumnValues(row->columns[position].value, set->values[1], set->type) <= 0);
+    if (set != token->set)
+        SQLvalueSet_Free(set);
+
+    return found;
+}
+
+/* Check if the clause of a condition names its column in its value, like `IS_NULL:FIELD` or `IN:FIELD,VALUE,...` */
+static int SQLisColumnCondition(enum ClauseType clause)
+{
+    return (clause == IsNullClause) || (clause == IsNotNullClause) || (clause == MatchClause) ||
+           (clause == LikeClause) || (clause == InClause) || (clause == BetweenClause);
+}
+
+/*
+ * This function will filter the row according to the conditions in list
+ *
+ *      A comparison with a NULL column never matches, `IS_NULL:FIELD` and
+ *      `IS_NOT_NULL:FIELD` test the validity bitmap of the row instead.
+ *      `MATCH:FIELD,TERMS` keeps the rows whose STRING column holds all the
+ *      terms, whether or not the column has a full-text index, and
+ *      `LIKE:FIELD,PATTERN` the ones whose STRING column matches the pattern.
+ *      `IN:FIELD,VALUE,...` and `BETWEEN:FIELD,LOW,HIGH` use the values
+ *      compiled for the query, or ones built for the row when the list was
+ *      not compiled.
+ */
 int SQLfilterRow(const struct TokenList *list, const struct TableStructureInfo *const tableStructure, const struct Row *row)
 {
     if (list == NULL)
@@ -669,8 +1960,49 @@ int SQLfilterRow(const struct TokenList *list, const struct TableStructureInfo *
         return 1;
     while (list != NULL)
     {
-        int position;
+        enum ClauseType clause;
+        int             position;
+
+        if ((list->operator == AssignOperator) &&
+            (((clause = SQLParser_GetClauseType(list->keyword)) == IsNullClause) || (clause == IsNotNullClause)))
+        {
+            position = SQLParser_FindColumn(tableStructure, list->value);
+            if ((position != -1) && (SQLisNull(row, position) != (clause == IsNullClause)))
+                return 0;
+            list = list->next;
+            continue;
+        }
+        if ((list->operator == AssignOperator) && ((clause == InClause) || (clause == BetweenClause)))
+        {
+            if (SQLvalueSet_Filter(list, clause, tableStructure, row) == 0)
+                return 0;
+            list = list->next;
+            continue;
+        }
+        if ((list->operator == AssignOperator) && (clause == LikeClause))
+        {
+            const struct LikeCondition *like;
+
+            like = list->like;
+            if ((like != NULL) && ((row->columns[like->column].type != String) || (SQLisNull(row, like->column) != 0) ||
+                                   (SQLlike_Match(&(like->pattern), row->columns[like->column].value.string) == 0)))
+                return 0;
+            list = list->next;
+            continue;
+        }
+        if ((list->operator == AssignOperator) && (clause == MatchClause))
+        {
+            char        name[strlen(list->value) + 1];
+            const char *terms;
 
+            terms    = SQLsplitCondition(list->value, name);
+            position = SQLParser_FindColumn(tableStructure, name);
+            if ((position != -1) && ((row->columns[position].type != String) || (SQLisNull(row, position) != 0) ||
+                                     (SQLfulltext_Matches(row->columns[position].value.string, terms) == 0)))
+                return 0;
+            list = list->next;
+            continue;
+        }
         /* find column position */
         position = SQLParser_FindColumn(tableStructure, list->keyword);
         if (position != -1) /* if found (-1 == not-found) */ 
@@ -680,11 +2012,14 @@ int SQLfilterRow(const struct TokenList *list, const struct TableStructureInfo *
 
             /* get the column, and search the conditions for a match */
 
-            column   = &(row->columns[position]);
+            column = &(row->columns[position]);
+            /* Nothing compares with NULL, the literal is not compared with its placeholder value */
+            if ((list->operator != AssignOperator) && (SQLisNullToken(list) != 0))
+                return 0;
             compared = SQLcompareValues(list, column->value, column->type);
             if (compared != -1) /* if the values match (-1 don't-match) */
             {
-                if ((position == column->position) && (compared == 0))
+                if ((position == column->position) && ((compared == 0) || (SQLisNull(row, position) != 0)))
                     return 0;
             }
         }
@@ -693,36 +2028,36 @@ int SQLfilterRow(const struct TokenList *list, const struct TableStructureInfo *
     return 1;
 }
 
-/* This will read a row from the file */
-int
-SQLreadRow(FILE *file, const struct TableStructureInfo *const tableStructure, struct Row *row)
+/* First character of the lines of deleted rows, they are skipped until the vacuum removes them */
+#define SQL_TOMBSTONE '#'
+
+/* Parse a stored row line into `row`, the line is tokenized in place, returns 0 on failure */
+static int SQLparseRow(char *line, const struct TableStructureInfo *const tableStructure, struct Row *row)
 {
-    if ((tableStructure == NULL) || (row == NULL))
-        return 0;
-    /* Read one line from the file
-     *   128 -> maximum fields with.
-     * so the maximum possible length of a line, is 128 * tableStructure->count
-     */
-    char       line[2 + 128 * tableStructure->count];
     char      *pointer;
     char      *token;
+    size_t     filled;
     int        columnIndex;
     struct Row current;
 
-    /* Get the line */
-    if (fgets(line, sizeof(line), file) == NULL)
-        return 0;
     /* Initialize the row all to 0 */
-    memset(&current, 0, sizeof(current));
+    if (SQLallocRow(&current, tableStructure->count) == 0)
+        return 0;
 
     pointer     = line;
+    filled      = 0;
     columnIndex = -1;
-    while ((token = strtok(pointer, ";")) != NULL) /* start tokenizing the string with ';' */
+    while ((token = strtok(pointer, ";\n")) != NULL) /* start tokenizing the string with ';' */
     {
         struct Column column;
 
         /* next call and all subsequent calls to strtok need pointer == NULL */
         pointer = NULL;
+        /* Rows updated in place may be padded with spaces */
+        if (token[strspn(token, " ")] == '\0')
+            continue;
+        if (columnIndex >= (int) tableStructure->count)
+            break;
         if (columnIndex > -1) /* if this is the first column, ignor it's just the index */
         {
             enum FieldType type;
@@ -731,47 +2066,97 @@ SQLreadRow(FILE *file, const struct TableStructureInfo *const tableStructure, st
             type            = tableStructure->columnTypes[columnIndex];
             column.position = columnIndex;
             column.type     = type;
-            column.value    = SQLvalueFromStringAndType(token, type);
+            if (SQLisNullText(token) != 0)
+                column.value = SQLnullValue(type);
+            else
+                column.value = SQLvalueFromStoredString(token, type);
+            SQLsetNull(&current, columnIndex, SQLisNullText(token));
             /* Set the columnIndex-th column in the row */
             current.columns[columnIndex] = column;
-            /* Increase columnCount in this row */
-            current.columnCount++;
+            /* Increase the number of columns read */
+            filled++;
         }
         else
             current.index = strtol(token, NULL, 10); /* Get the row index */
         columnIndex++;
     }
-    /* Column count was updated 1 too far, fix that */
-    current.columnCount -= 1;
+    /* Rows stored before a column was added do not have it */
+    while (filled < tableStructure->count)
+    {
+        SQLsetColumnDefault(tableStructure, &current, filled);
+        filled++;
+    }
     /* Set the row data */
     *row = current;
 
     return 1;
 }
 
-struct Table SQLloadTable(const struct TokenList *list, const struct TableStructureInfo *const tableStructure)
+/* This will read a row from the file, storing the offset of its line in `offset` if not NULL */
+int
+SQLreadRowAt(FILE *file, const struct TableStructureInfo *const tableStructure, struct Row *row, long *offset)
+{
+    char  *line;
+    size_t size;
+    int    status;
+
+    if ((tableStructure == NULL) || (row == NULL))
+        return 0;
+    /* Get the line, whatever its length, skipping deleted rows */
+    line = NULL;
+    size = 0;
+    do
+    {
+        if (offset != NULL)
+            *offset = ftell(file);
+        if (getline(&line, &size, file) <= 0)
+        {
+            free(line);
+            return 0;
+        }
+    } while (line[0] == SQL_TOMBSTONE);
+    status = SQLparseRow(line, tableStructure, row);
+    free(line);
+
+    return status;
+}
+
+/* This will read a row from the file */
+int
+SQLreadRow(FILE *file, const struct TableStructureInfo *const tableStructure, struct Row *row)
+{
+    return SQLreadRowAt(file, tableStructure, row, NULL);
+}
+
+/* Load the rows satisfying the conditions in `list` from one storage file */
+struct Table SQLloadFile(const struct TokenList *list, const struct TableStructureInfo *const tableStructure,
+                                                                            const char *const filename)
 {
     int          index;
     struct Row   row;
     struct Table table;
     FILE        *file;
 
+    table.rows     = NULL;
+    table.rowCount = 0;
     if (tableStructure == NULL)
         return table;
 
     /* Open the table file storage */
-    file = fopen(tableStructure->name, "r");
+    file = fopen(filename, "r");
     if (file == NULL)
         return table;
 
-    index      = 0;
-    table.rows = NULL;
+    index = 0;
     /* Start reading rows */
     while (SQLreadRow(file, tableStructure, &row) != 0)
     {
         struct Row *auxiliar;
         if ((list != NULL) && (SQLfilterRow(list, tableStructure, &row) == 0))
+        {
+            SQLfreeRow(&row);
             continue;
+        }
         /* Increase the table rows array size */
         auxiliar = realloc(table.rows, (1 + index) * sizeof(struct Row));
         if (auxiliar == NULL)
@@ -788,9 +2173,8 @@ struct Table SQLloadTable(const struct TokenList *list, const struct TableStruct
     return table;
 
 abort: /* This label is to avoid violating the DRY principle */
-    table.rowCount = 0;
-    if (table.rows != NULL)
-        free(table.rows);
+    SQLfreeRow(&row);
+    SQLfreeTable(&table);
     fclose(file);
 
     return table;
@@ -799,6 +2183,8 @@ abort: /* This label is to avoid violating the DRY principle */
 /* Check if this row is valid */
 int SQLisValidRow(struct TokenList *list, const struct TableStructureInfo *const tableStructure, struct Row *row)
 {
+    const char *name;
+
     if (list == NULL)
         return 1;
     if ((row == NULL) || (tableStructure == NULL))
@@ -806,293 +2192,6736 @@ int SQLisValidRow(struct TokenList *list, const struct TableStructureInfo *const
     /* If the row contains more columns than the table, invalid */
     if (row->columnCount > tableStructure->count)
     {
-        printf("you specified more columns than avaiable\n");
+        SQLreport("you specified more columns than avaiable\n");
         return 0;
     }
-    /* If there is no column with this name in the table, invalid */
-    if (SQLParser_FindColumn(tableStructure, list->keyword) == -1)
+    /* Conditions like `IS_NULL:FIELD` or `MATCH:FIELD,TERMS` name the column in their value */
+    name = list->keyword;
+    if ((list->operator == AssignOperator) && (SQLisColumnCondition(SQLParser_GetClauseType(list->keyword)) != 0))
+        name = list->value;
     {
-        printf("no column `%s` in table `%s`\n", list->keyword, tableStructure->name);
-        return 0;
+        char column[strlen(name) + 1];
+
+        SQLsplitCondition(name, column);
+        /* If there is no column with this name in the table, invalid */
+        if (SQLParser_FindColumn(tableStructure, column) == -1)
+        {
+            SQLreport("no column `%s` in table `%s`\n", column, tableStructure->name);
+            return 0;
+        }
     }
     /* Otherwise, valid */
     return 1;
 }
 
-/* The sql select function */
-void SQLselect(const struct TokenList *list, const struct TableStructureInfo *const tableStructure)
+/* Check one literal compared with or assigned to the column, NULL when `null` is set, printing why it is invalid, returns 0 if it is */
+static int SQLcheckLiteral(const struct TableStructureInfo *const tableStructure, int column, const char *const value,
+                                                                                                      int null)
 {
-    struct Table table;
-    if (tableStructure == NULL)
-        return;
-    table = SQLloadTable(list, tableStructure);
+    enum FieldType type;
 
-    SQLprintTable(&table);
+    type = tableStructure->columnTypes[column];
+    if ((null != 0) || (SQLisValidLiteral(value, type) != 0))
+        return 1;
+    SQLreport("invalid %s `%s` for column `%s`\n", (type == Date) ? "DATE" : "TIMESTAMP", value,
+                                                tableStructure->columns[column]);
+    return 0;
 }
 
-/* The sql delete function */
-void SQLdelete(struct TokenList *list, const struct TableStructureInfo *const tableStructure)
+/*
+ * Check the literals of the conditions and assignments of the query, returns 0 if one is invalid
+ *
+ *      Values of the DATE and TIMESTAMP columns are parsed once per row, a
+ *      wrong one would silently be read as another instant. A comparison
+ *      with NULL is rejected, IS_NULL and IS_NOT_NULL test for it.
+ */
+int SQLcheckLiterals(const struct TokenList *list, const struct TableStructureInfo *const tableStructure)
 {
-    struct Table table;
-    size_t       i;
-    char         filename[] = "__database_Temporary_XXXXXX"; /* temporary filename */
-    FILE        *file;
-
-    if (tableStructure == NULL)
-        return;
-    if (_mktemp(filename) == NULL)
-        return;
-    if (filename == NULL)
-        return;
-    /* Open the temporary file */
-    file = fopen(filename, "w");
-    if (file == NULL)
-        return;
-    /* Load all the rows in the table */
-    table = SQLloadTable(NULL, tableStructure);
-    for (i = 0 ; i < table.rowCount ; i++)
+    for (list = list->next ; list != NULL ; list = list->next)
     {
-        struct Row *row;
-        row = &(table.rows[i]);
-        /* If row is invalid, abort the operation */
-        if (SQLisValidRow(list->next, tableStructure, row) == 0)
-            goto abort;
-        /*
-         * If the row, does not satisfy the condition, write it back to the storage,
-         * otherwise skip it.
-         */
-        if (SQLfilterRow(list, tableStructure, row) == 0)
-            SQLwriteRowToFile(file, row);
-    }
-    /* close the temporary file */
-    fclose(file);
+        enum ClauseType clause;
+        int             column;
 
-    /* delete the table storage file */
-    remove(tableStructure->name);
-    /* make the temporary file, the new storage file */
-    rename(filename, tableStructure->name);
+        if ((list->operator == AssignOperator) &&
+            (((clause = SQLParser_GetClauseType(list->keyword)) == InClause) || (clause == BetweenClause)))
+        {
+            char        name[strlen(list->value) + 1];
+            const char *start;
+            const char *end;
 
-    return;
+            start = SQLsplitCondition(list->value, name);
+            if (((column = SQLParser_FindColumn(tableStructure, name)) == -1) ||
+                (SQLisTemporalType(tableStructure->columnTypes[column]) == 0))
+                continue;
+            /* The values are split like SQLvalueSet_New() does, quoted ones may hold commas */
+            for ( ; *start != '\0' ; start = (*end == ',') ? end + 1 : end)
+            {
+                int quoted;
 
-abort:
-    fclose(file);
-    remove(filename);
+                for (quoted = 0, end = start ; (*end != '\0') && ((*end != ',') || (quoted != 0)) ; ++end)
+                    quoted ^= (*end == '\'');
+                {
+                    char item[end - start + 1];
+
+                    memcpy(item, start, end - start);
+                    item[end - start] = '\0';
+                    if ((item[0] != '\0') && (SQLcheckLiteral(tableStructure, column, item, SQLisNullText(item)) == 0))
+                        return 0;
+                }
+            }
+            continue;
+        }
+        if ((column = SQLParser_FindColumn(tableStructure, list->keyword)) == -1)
+            continue;
+        if ((list->operator != AssignOperator) && (SQLisNullToken(list) != 0))
+        {
+            SQLreport("cannot compare `%s` with NULL, use IS_NULL:%s or IS_NOT_NULL:%s\n", list->keyword,
+                                                                              list->keyword, list->keyword);
+            return 0;
+        }
+        if (SQLcheckLiteral(tableStructure, column, list->value, SQLisNullToken(list)) == 0)
+            return 0;
+    }
+    return 1;
 }
 
-/* The sql delete function */
-void SQLupdate(struct TokenList *list, const struct TableStructureInfo *const tableStructure)
+/*
+ * Compare two column values of the same type
+ *
+ *      Returns a negative number, zero, or a positive number when `lhs` is
+ *      less than, equal to, or greater than `rhs`, like strcmp().
+ */
+int SQLcompareColumnValues(union Value lhs, union Value rhs, enum FieldType type)
 {
-    struct Table table;
-    size_t       i;
-    char         filename[] = "__database_Temporary_XXXXXX"; /* temporary filename */
-    FILE        *file;
-
-    if (tableStructure == NULL)
-        return;
-    if (_mktemp(filename) == NULL)
-        return;
-    if (filename == NULL)
-        return;
-    /* Open the temporary file */
-    file = fopen(filename, "w");
-    if (file == NULL)
-        return;
-    /* Load all the rows in the table */
-    table = SQLloadTable(NULL, tableStructure);
-    for (i = 0 ; i < table.rowCount ; i++)
+    switch (type)
     {
-        struct Row *row;
-
-        row = &(table.rows[i]);
-        /* If row is invalid, abort the operation */
-        if (SQLisValidRow(list->next, tableStructure, row) == 0)
-            goto abort;
-        /* If the row, does not satisfy the condition, write it back to the storage */
-        if (SQLfilterRow(list, tableStructure, row) == 0)
-            SQLwriteRowToFile(file, row);
-        else /* If the row, does satisfy the condition, write the modified row to the storage */
-            SQLupdateRowAndWriteToFile(file, tableStructure, list->next, row);
+    case Integer:
+        return (lhs.integer > rhs.integer) - (lhs.integer < rhs.integer);
+    case Number:
+        return (lhs.number > rhs.number) - (lhs.number < rhs.number);
+    case Int64:
+        return (lhs.int64 > rhs.int64) - (lhs.int64 < rhs.int64);
+    case Double:
+        return (lhs.real > rhs.real) - (lhs.real < rhs.real);
+    case Decimal:
+        return (lhs.decimal > rhs.decimal) - (lhs.decimal < rhs.decimal);
+    case Timestamp:
+        return (lhs.timestamp > rhs.timestamp) - (lhs.timestamp < rhs.timestamp);
+    case Date:
+        return (lhs.date > rhs.date) - (lhs.date < rhs.date);
+    case Boolean:
+        return (lhs.boolean > rhs.boolean) - (lhs.boolean < rhs.boolean);
+    case String:
+        if ((lhs.string == NULL) || (rhs.string == NULL))
+            return (lhs.string != NULL) - (rhs.string != NULL);
+        return strcmp(lhs.string, rhs.string);
     }
-    /* close the temporary file */
-    fclose(file);
+    return 0;
+}
 
-    /* delete the table storage file */
-    remove(tableStructure->name);
-    /* make the temporary file, the new storage file */
-    rename(filename, tableStructure->name);
+/* Bytes of a column value, equal values have equal bytes (`value` is normalized in place) */
+static const unsigned char *SQLvalueBytes(union Value *value, enum FieldType type, size_t *size)
+{
+    const unsigned char *bytes;
+
+    switch (type)
+    {
+    case Integer:
+        bytes = (const unsigned char *) &(value->integer);
+        *size = sizeof(value->integer);
+        break;
+    case Number:
+        if (value->number == 0) /* 0.0 and -0.0 are equal, but have different bits */
+            value->number = 0;
+        bytes = (const unsigned char *) &(value->number);
+        *size = sizeof(value->number);
+        break;
+    case Int64:
+        bytes = (const unsigned char *) &(value->int64);
+        *size = sizeof(value->int64);
+        break;
+    case Double:
+        if (value->real == 0)
+            value->real = 0;
+        bytes = (const unsigned char *) &(value->real);
+        *size = sizeof(value->real);
+        break;
+    case Decimal:
+        bytes = (const unsigned char *) &(value->decimal);
+        *size = sizeof(value->decimal);
+        break;
+    case Timestamp:
+        bytes = (const unsigned char *) &(value->timestamp);
+        *size = sizeof(value->timestamp);
+        break;
+    case Date:
+        bytes = (const unsigned char *) &(value->date);
+        *size = sizeof(value->date);
+        break;
+    case Boolean:
+        bytes = (const unsigned char *) &(value->boolean);
+        *size = sizeof(value->boolean);
+        break;
+    case String:
+        bytes = (const unsigned char *) ((value->string == NULL) ? "" : value->string);
+        *size = strlen((const char *) bytes);
+        break;
+    default:
+        bytes = NULL;
+        *size = 0;
+        break;
+    }
+    return bytes;
+}
 
-    return;
+/* Hash a column value, equal values have equal hashes */
+static unsigned long SQLhashColumnValue(unsigned long hash, union Value value, enum FieldType type)
+{
+    const unsigned char *bytes;
+    size_t               size;
+    size_t               i;
 
-abort:
-    fclose(file);
-    remove(filename);
+    bytes = SQLvalueBytes(&value, type, &size);
+    for (i = 0 ; i < size ; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 16777619UL;
+    }
+    return hash;
 }
 
-/* Simple check operators are equal function */
-int SQLcheckOperator(enum Operator lhs, enum Operator rhs)
+/* Mix the bits of an FNV hash, so every bit depends on every byte */
+static unsigned long SQLmixHash(unsigned long hash)
 {
-    if (lhs != rhs)
-        printf("invalid operator for expression.\n");
-    return (lhs == rhs);
+    hash ^= hash >> 29;
+    hash *= 0xBF58476D1CE4E5B9UL;
+    hash ^= hash >> 32;
+
+    return hash;
 }
 
-/* The sql insert function */
-void SQLinsert(struct TokenList *list, const struct TableStructureInfo *const tableStructure)
+/* IN lists with at most this many values are kept sorted and binary searched, longer ones are hashed */
+#define SQL_VALUESET_SORTED 16
+
+/*
+ * Compile the comma separated `values` of a condition to a set of `type` values, returns NULL on failure
+ *
+ *      Quoted values may hold commas, NULL values are left out since they
+ *      never match. With `lookup` set, the values are sorted or hashed for
+ *      SQLvalueSet_Contains(), otherwise they are kept in their order.
+ */
+static struct ValueSet *SQLvalueSet_New(const char *const values, enum FieldType type, int lookup)
 {
-    struct Row  row;
-    const char *tableName;
+    struct ValueSet *set;
+    const char      *start;
+    const char      *end;
+    size_t           capacity;
+    size_t           i;
 
-    if ((list == NULL) || (tableStructure == NULL))
-        return;
+    if ((set = calloc(1, sizeof(struct ValueSet))) == NULL)
+        return NULL;
+    set->type = type;
+    for (capacity = 1, end = values ; *end != '\0' ; ++end)
+        capacity += (*end == ',');
+    if ((set->values = malloc(capacity * sizeof(union Value))) == NULL)
+    {
+        free(set);
+        return NULL;
+    }
+    for (start = values ; *start != '\0' ; start = (*end == ',') ? end + 1 : end)
+    {
+        int quoted;
 
-    tableName       = tableStructure->name;
-    row.columnCount = 0;
-    list            = list->next;
-    row.index       = 0;
-    /* Parse the AST to get the row values */
-    while (list != NULL)
+        for (quoted = 0, end = start ; (*end != '\0') && ((*end != ',') || (quoted != 0)) ; ++end)
+            quoted ^= (*end == '\'');
+        {
+            char item[end - start + 1];
+
+            memcpy(item, start, end - start);
+            item[end - start] = '\0';
+            if ((item[0] != '\0') && (SQLisNullText(item) == 0))
+                set->values[set->count++] = SQLvalueFromStringAndType(item, type);
+        }
+    }
+    if (lookup == 0)
+        return set;
+    if (set->count <= SQL_VALUESET_SORTED)
     {
-        struct Column column;
+        /* Insertion sort, there are few values */
+        for (i = 1 ; i < set->count ; ++i)
+        {
+            union Value value;
+            size_t      j;
 
-        /* Only assignment operator is valid here */
-        if (SQLcheckOperator(list->operator, AssignOperator) == 0)
-            return;
-        /* Check that this column is valid */
-        if (SQLisValidRow(list, tableStructure, &row) == 0)
-            return;
+            value = set->values[i];
+            for (j = i ; (j > 0) && (SQLcompareColumnValues(set->values[j - 1], value, type) > 0) ; --j)
+                set->values[j] = set->values[j - 1];
+            set->values[j] = value;
+        }
+        return set;
+    }
+    for (set->capacity = 1 ; set->capacity < 2 * set->count ; set->capacity *= 2);
+    if ((set->slots = calloc(set->capacity, sizeof(size_t))) == NULL)
+    {
+        SQLvalueSet_Free(set);
+        return NULL;
+    }
+    for (i = 0 ; i < set->count ; ++i)
+    {
+        size_t slot;
 
-        column.type                  = tableStructure->columnTypes[row.columnCount];
-        column.value                 = SQLvalueFromStringAndType(list->value, column.type);
-        column.position              = SQLParser_FindColumn(tableStructure, list->keyword);
-        row.columns[row.columnCount] = column;
-        row.columnCount             += 1;
-        list                         = list->next;
+        slot = SQLmixHash(SQLhashColumnValue(2166136261UL, set->values[i], type)) & (set->capacity - 1);
+        while (set->slots[slot] != 0)
+            slot = (slot + 1) & (set->capacity - 1);
+        set->slots[slot] = i + 1;
     }
-    /* Append the row to the file */
-    SQLwriteRow(tableName, &row);
+    return set;
 }
 
-/* This function will create a table in the database */
-int SQLParser_CreateTable(struct TokenList *list)
+/* Check if `value` is in the set */
+static int SQLvalueSet_Contains(const struct ValueSet *const set, union Value value)
 {
-    FILE                     *file;
-    struct TableStructureInfo info;
-    struct TokenList         *current;
-    size_t                    length;
-    int                       success;
+    size_t slot;
 
-    if (list == NULL)
-        return 1;
+    if (set->slots == NULL)
+    {
+        size_t lower;
+        size_t upper;
 
-    /* Open the database internal table structure storage file */
-    file = fopen("__tables_data.dat", "a");
-    if (file == NULL)
-        return 1;
-    /* Initialize TableStructureInfo to 0 */
-    memset(&info, 0, sizeof(info));
+        for (lower = 0, upper = set->count ; lower < upper ; )
+        {
+            size_t middle;
+            int    compared;
 
-    /* Get the length of the table name, and ensure it can be stored */
-    length = strlen(list->keyword);
-    if (length > sizeof(info.name) - 1)
-        goto abort;
-    current = list->next;
-    /* Copy the table name */
-    memcpy(info.name, list->value, length);
-    /* Parse the AST to get all field's names, and types */
-    while (current != NULL)
+            middle   = lower + (upper - lower) / 2;
+            compared = SQLcompareColumnValues(set->values[middle], value, set->type);
+            if (compared == 0)
+                return 1;
+            if (compared < 0)
+                lower = middle + 1;
+            else
+                upper = middle;
+        }
+        return 0;
+    }
+    slot = SQLmixHash(SQLhashColumnValue(2166136261UL, value, set->type)) & (set->capacity - 1);
+    for ( ; set->slots[slot] != 0 ; slot = (slot + 1) & (set->capacity - 1))
     {
-        /* Check that the field name is not too large */
-        length = strlen(current->keyword);
-        if (length > sizeof(info.columns) - 1)
-            goto abort;
-        /* Copy field name */
-        memcpy(info.columns[info.count], current->keyword, length);
+        if (SQLcompareColumnValues(set->values[set->slots[slot] - 1], value, set->type) == 0)
+            return 1;
+    }
+    return 0;
+}
 
-        /* Find the field type enum value, and set that value for current column */
-        info.columnTypes[info.count] = SQLParser_GetFieldType(current->value);
-        info.count                  += 1;
+/* Compile the IN and BETWEEN conditions of `list` for the columns of the queried table, once per query */
+void SQLvalueSet_CompileList(struct TokenList *list, const struct TableStructureInfo *const tableStructure)
+{
+    for ( ; list != NULL ; list = list->next)
+    {
+        char            name[strlen(list->value) + 1];
+        const char     *values;
+        enum ClauseType clause;
+        int             column;
 
-        /* If there is no more room to store columns, abort */
-        if (info.count > sizeof(info.columnTypes))
-            goto abort;
-        current = current->next;
+        if ((list->operator != AssignOperator) ||
+            (((clause = SQLParser_GetClauseType(list->keyword)) != InClause) && (clause != BetweenClause)))
+            continue;
+        values = SQLsplitCondition(list->value, name);
+        column = SQLParser_FindColumn(tableStructure, name);
+        SQLvalueSet_Free(list->set);
+        list->set = NULL;
+        if (column == -1)
+            continue;
+        list->set = SQLvalueSet_New(values, tableStructure->columnTypes[column], clause == InClause);
+        if (list->set != NULL)
+            list->set->column = column;
+        if ((clause == BetweenClause) && ((list->set == NULL) || (list->set->count != 2)))
+            SQLreport("usage: BETWEEN:FIELD,LOW,HIGH with two values that are not NULL\n");
     }
-    /* Write the data to the file */
-    success = fwrite(&info, sizeof(info), 1, file);
-    /* close the file */
-    fclose(file);
+}
 
-    return (success != 1);
+/* Memory a set of distinct keys may use before its new keys are spilled to temporary files */
+#define SQL_DISTINCT_MEMORY (64 * 1024 * 1024)
 
-abort:
-    if (file != NULL)
-        fclose(file);
-    return 1;
-}
+/* Number of spill files of a full set, the keys are spread over them by hash */
+#define SQL_DISTINCT_SPILLS 16
 
-/* This function searches for a table in the TableStructureInfo */
-struct TableStructureInfo SQLParser_FindTable(const char *const name)
+/* Number of spill levels, each one uses 4 more bits of the hash to choose the file */
+#define SQL_DISTINCT_LEVELS (2 * sizeof(unsigned long))
+
+/*
+ * Encoded key of a distinct set, built column by column:
+ *      data    : every column as a NULL flag byte followed by its value bytes
+ *      length  : bytes used in `data`
+ *      capacity: bytes allocated for `data`
+ */
+struct DistinctKey
 {
-    FILE                     *file;
-    struct TableStructureInfo table;
+    unsigned char *data;
+    size_t         length;
+    size_t         capacity;
+};
 
-    memset(&table, 0, sizeof(table));
+/*
+ * Set of distinct keys
+ *
+ *      The keys are stored once, each one after its length, and found through
+ *      an open addressing table holding their hash and offset. Once the set
+ *      would use more than `budget` bytes it stops growing, the keys it does
+ *      not hold are written to spill files and deduplicated afterwards by
+ *      SQLdistinct_Drain().
+ *
+ *      keys     : the stored keys
+ *      size     : bytes used in `keys`
+ *      capacity : bytes allocated for `keys`
+ *      hashes   : hash of the key in every slot, 0 for an empty slot
+ *      offsets  : offset in `keys` of the key in every slot
+ *      slotCount: number of slots, a power of 2
+ *      count    : number of keys held
+ *      budget   : bytes the set may use
+ *      level    : spill level of the set, drained sets are one level deeper
+ *      spills   : the spill files, NULL until a key goes to them
+ */
+struct DistinctSet
+{
+    unsigned char *keys;
+    size_t         size;
+    size_t         capacity;
+    unsigned long *hashes;
+    size_t        *offsets;
+    size_t         slotCount;
+    size_t         count;
+    size_t         budget;
+    size_t         level;
+    FILE          *spills[SQL_DISTINCT_SPILLS];
+};
 
-    /* Open the storage file for reading */
-    file = fopen("__tables_data.dat", "r");
-    if (file == NULL)
-        return table;
-    /* read records until the record is found, or the end of file is reached */
-    while (fread(&table, sizeof(struct TableStructureInfo), 1, file) == 1)
+/* Append bytes to the key, returns 0 on failure */
+static int SQLdistinct_AppendBytes(struct DistinctKey *key, const void *bytes, size_t size)
+{
+    unsigned char *auxiliar;
+    size_t         capacity;
+
+    if (key->length + size > key->capacity)
     {
-        if (strcmp(name, table.name) == 0)
-        {
-            fclose(file);
-            return table;
-        }
+        capacity = (key->capacity == 0) ? 64 : key->capacity;
+        while (capacity < key->length + size)
+            capacity *= 2;
+        auxiliar = realloc(key->data, capacity);
+        if (auxiliar == NULL)
+            return 0;
+        key->data     = auxiliar;
+        key->capacity = capacity;
     }
-    /* Reset the table structure to return an invalid value */
-    memset(&table, 0, sizeof(table));
+    memcpy(key->data + key->length, bytes, size);
+    key->length += size;
 
-    return table;
+    return 1;
 }
 
-/* Execute query function */
-int SQLExecuteQuery(const char *const query)
+/* Append a column of the row to the key, strings keep their nul so the keys stay unambiguous */
+static int SQLdistinct_AppendColumn(struct DistinctKey *key, const struct Row *const row, size_t column)
 {
-    struct TokenList         *list;
-    struct TableStructureInfo table;
+    const unsigned char *bytes;
+    union Value          value;
+    unsigned char        null;
+    size_t               size;
 
-    list = SQLParser_Parse(query);
-    if (list == NULL)
+    null = SQLisNull(row, column);
+    if (SQLdistinct_AppendBytes(key, &null, 1) == 0)
+        return 0;
+    if (null != 0)
         return 1;
+    value = row->columns[column].value;
+    bytes = SQLvalueBytes(&value, row->columns[column].type, &size);
+    if (row->columns[column].type == String)
+        size += 1;
 
-    /* Find the queried table */
-    table = SQLParser_FindTable(list->value);
-    switch (SQLParser_GetQueryType(list->keyword)) /* Check the command and call the right function */
+    return SQLdistinct_AppendBytes(key, bytes, size);
+}
+
+/*
+ * Rebuild `count` columns of `row`, from position `first`, out of a key
+ *
+ *      The strings point into the key, the row must only have its columns
+ *      released. Returns the position of the next column in the key.
+ */
+static const unsigned char *SQLdistinct_DecodeColumns(const unsigned char *key, struct Row *row, size_t first,
+                                                           const enum FieldType *types, size_t count)
+{
+    size_t i;
+
+    for (i = 0 ; i < count ; ++i)
     {
-        case Create:
-            if (table.name[0] == '\0')
-                SQLParser_CreateTable(list);
-            else
-                printf("there is a table with the same name, cannot create table `%s`\n", list->value);
+        struct Column *column;
+        size_t         size;
+
+        column           = &(row->columns[first + i]);
+        column->type     = types[i];
+        column->position = first + i;
+        memset(&(column->value), 0, sizeof(column->value));
+        SQLsetNull(row, first + i, *key);
+        if (*(key++) != 0)
+        {
+            if (types[i] == String)
+                column->value.string = "";
+            continue;
+        }
+        if (types[i] == String)
+        {
+            column->value.string = (char *) key;
+            key                 += strlen((const char *) key) + 1;
+            continue;
+        }
+        /* Every member of the value union starts at its address */
+        SQLvalueBytes(&(column->value), types[i], &size);
+        memcpy(&(column->value), key, size);
+        key += size;
+    }
+    return key;
+}
+
+/* Initialize an empty set using at most `budget` bytes, returns 0 on failure */
+int SQLdistinct_Init(struct DistinctSet *set, size_t budget, size_t level)
+{
+    memset(set, 0, sizeof(*set));
+    set->budget    = budget;
+    set->level     = level;
+    set->slotCount = 64;
+    set->hashes    = calloc(set->slotCount, sizeof(unsigned long));
+    set->offsets   = malloc(set->slotCount * sizeof(size_t));
+
+    return (set->hashes != NULL) && (set->offsets != NULL);
+}
+
+/* Release the keys and the spill files of the set */
+void SQLdistinct_Free(struct DistinctSet *set)
+{
+    size_t i;
+
+    for (i = 0 ; i < SQL_DISTINCT_SPILLS ; ++i)
+    {
+        if (set->spills[i] != NULL)
+            fclose(set->spills[i]);
+    }
+    free(set->keys);
+    free(set->hashes);
+    free(set->offsets);
+    memset(set, 0, sizeof(*set));
+}
+
+/* FNV-1a hash of a key, mixed so every bit depends on every byte, never 0 */
+static unsigned long SQLdistinct_Hash(const unsigned char *key, size_t length)
+{
+    unsigned long hash;
+    size_t        i;
+
+    hash = 2166136261UL;
+    for (i = 0 ; i < length ; ++i)
+    {
+        hash ^= key[i];
+        hash *= 16777619UL;
+    }
+    hash = SQLmixHash(hash);
+
+    return (hash == 0) ? 1 : hash;
+}
+
+/* Find the slot of a key, or the empty slot where it belongs */
+static size_t SQLdistinct_Slot(const struct DistinctSet *set, unsigned long hash, const unsigned char *key,
+                                                                                    size_t length)
+{
+    size_t slot;
+
+    for (slot = hash & (set->slotCount - 1) ; set->hashes[slot] != 0 ; slot = (slot + 1) & (set->slotCount - 1))
+    {
+        const unsigned char *stored;
+        size_t               size;
+
+        if (set->hashes[slot] != hash)
+            continue;
+        stored = set->keys + set->offsets[slot];
+        memcpy(&size, stored, sizeof(size));
+        if ((size == length) && (memcmp(stored + sizeof(size), key, length) == 0))
+            break;
+    }
+    return slot;
+}
+
+/* Double the number of slots, returns 0 on failure */
+static int SQLdistinct_Grow(struct DistinctSet *set)
+{
+    struct DistinctSet grown;
+    size_t             i;
+
+    grown           = *set;
+    grown.slotCount = 2 * set->slotCount;
+    grown.hashes    = calloc(grown.slotCount, sizeof(unsigned long));
+    grown.offsets   = malloc(grown.slotCount * sizeof(size_t));
+    if ((grown.hashes == NULL) || (grown.offsets == NULL))
+    {
+        free(grown.hashes);
+        free(grown.offsets);
+        return 0;
+    }
+    for (i = 0 ; i < set->slotCount ; ++i)
+    {
+        size_t slot;
+
+        if (set->hashes[i] == 0)
+            continue;
+        for (slot = set->hashes[i] & (grown.slotCount - 1) ; grown.hashes[slot] != 0 ;
+             slot = (slot + 1) & (grown.slotCount - 1));
+        grown.hashes[slot]  = set->hashes[i];
+        grown.offsets[slot] = set->offsets[i];
+    }
+    free(set->hashes);
+    free(set->offsets);
+    *set = grown;
+
+    return 1;
+}
+
+/* Write a key to the spill file chosen by the high bits of its hash, returns 0 on failure */
+static int SQLdistinct_Spill(struct DistinctSet *set, unsigned long hash, const unsigned char *key, size_t length)
+{
+    FILE  **spill;
+    size_t  shift;
+
+    /* The low bits choose the slots, the files of each level use the next 4 high bits */
+    shift = 8 * sizeof(unsigned long) - 4 * (set->level + 1);
+    spill = &(set->spills[(hash >> shift) % SQL_DISTINCT_SPILLS]);
+    if ((*spill == NULL) && ((*spill = tmpfile()) == NULL))
+        return 0;
+
+    return (fwrite(&length, sizeof(length), 1, *spill) == 1) && (fwrite(key, 1, length, *spill) == length);
+}
+
+/*
+ * Add a key to the set
+ *
+ *      Returns 1 if the key is new, 0 if the set already holds it, -1 if it
+ *      was spilled (SQLdistinct_Drain() reports it if it is new) and -2 on
+ *      failure.
+ */
+int SQLdistinct_Insert(struct DistinctSet *set, const unsigned char *key, size_t length)
+{
+    unsigned long hash;
+    size_t        slot;
+    size_t        slots;
+    size_t        capacity;
+
+    hash = SQLdistinct_Hash(key, length);
+    slot = SQLdistinct_Slot(set, hash, key, length);
+    if (set->hashes[slot] != 0)
+        return 0;
+    /* The memory needed to hold one more key, with the table at most half full */
+    slots    = (2 * (set->count + 1) > set->slotCount) ? 2 * set->slotCount : set->slotCount;
+    capacity = (set->capacity == 0) ? 4096 : set->capacity;
+    while (capacity < set->size + sizeof(length) + length)
+        capacity *= 2;
+    if ((slots * (sizeof(unsigned long) + sizeof(size_t)) + capacity > set->budget) &&
+        (set->level + 1 < SQL_DISTINCT_LEVELS))
+        return (SQLdistinct_Spill(set, hash, key, length) != 0) ? -1 : -2;
+
+    if (capacity != set->capacity)
+    {
+        unsigned char *auxiliar;
+
+        auxiliar = realloc(set->keys, capacity);
+        if (auxiliar == NULL)
+            return -2;
+        set->keys     = auxiliar;
+        set->capacity = capacity;
+    }
+    if (slots != set->slotCount)
+    {
+        if (SQLdistinct_Grow(set) == 0)
+            return -2;
+        slot = SQLdistinct_Slot(set, hash, key, length);
+    }
+    memcpy(set->keys + set->size, &length, sizeof(length));
+    memcpy(set->keys + set->size + sizeof(length), key, length);
+    set->hashes[slot]  = hash;
+    set->offsets[slot] = set->size;
+    set->size         += sizeof(length) + length;
+    set->count        += 1;
+
+    return 1;
+}
+
+/*
+ * Pass every spilled key that is new to `callback`
+ *
+ *      A key is only spilled when the set does not hold it, and equal keys go
+ *      to the same file, so the files are deduplicated one at a time, each in
+ *      a set of the next level that may spill again. The keys held in memory
+ *      are released first, the set can only be freed afterwards. Returns 0
+ *      on failure.
+ */
+int SQLdistinct_Drain(struct DistinctSet *set, void (*callback)(void *context, const unsigned char *key, size_t length),
+                                                                                       void *context)
+{
+    unsigned char *key;
+    size_t         i;
+    int            success;
+
+    free(set->keys);
+    free(set->hashes);
+    free(set->offsets);
+    set->keys    = NULL;
+    set->hashes  = NULL;
+    set->offsets = NULL;
+    key          = NULL;
+    success      = 1;
+    for (i = 0 ; (success != 0) && (i < SQL_DISTINCT_SPILLS) ; ++i)
+    {
+        struct DistinctSet drained;
+        size_t             length;
+
+        if (set->spills[i] == NULL)
+            continue;
+        rewind(set->spills[i]);
+        if (SQLdistinct_Init(&drained, set->budget, set->level + 1) == 0)
+            success = 0;
+        while ((success != 0) && (fread(&length, sizeof(length), 1, set->spills[i]) == 1))
+        {
+            unsigned char *auxiliar;
+
+            auxiliar = realloc(key, length + 1);
+            if ((auxiliar == NULL) || (fread(auxiliar, 1, length, set->spills[i]) != length))
+            {
+                key     = (auxiliar != NULL) ? auxiliar : key;
+                success = 0;
+                break;
+            }
+            key = auxiliar;
+            switch (SQLdistinct_Insert(&drained, key, length))
+            {
+            case 1:
+                callback(context, key, length);
+                break;
+            case -2:
+                success = 0;
+                break;
+            default:
+                break;
+            }
+        }
+        if (success != 0)
+            success = SQLdistinct_Drain(&drained, callback, context);
+        SQLdistinct_Free(&drained);
+        fclose(set->spills[i]);
+        set->spills[i] = NULL;
+    }
+    free(key);
+
+    return success;
+}
+
+/*
+ * ResultSink wrapping another sink, dropping the rows equal to a row already sent:
+ *      sink     : the sink receiving the distinct rows
+ *      structure: structure of the rows, to rebuild the spilled ones
+ *      set      : the rows already sent
+ *      key      : the encoded current row
+ *      spilled  : a spilled row, rebuilt from its key
+ */
+struct DistinctSink
+{
+    const struct ResultSink         *sink;
+    const struct TableStructureInfo *structure;
+    struct DistinctSet               set;
+    struct DistinctKey               key;
+    struct Row                       spilled;
+};
+
+/* ResultSink callbacks of the DistinctSink */
+static void SQLdistinctSinkBegin(void *context, const struct TableStructureInfo *const tableStructure)
+{
+    struct DistinctSink *distinct;
+
+    distinct = context;
+    if (distinct->sink->begin != NULL)
+        distinct->sink->begin(distinct->sink->context, tableStructure);
+}
+
+static void SQLdistinctSinkRow(void *context, const struct Row *const row)
+{
+    struct DistinctSink *distinct;
+    size_t               i;
+
+    distinct             = context;
+    distinct->key.length = 0;
+    for (i = 0 ; i < row->columnCount ; ++i)
+    {
+        /* Without its key the row cannot be checked, sending a duplicate is better than losing it */
+        if (SQLdistinct_AppendColumn(&(distinct->key), row, i) == 0)
+        {
+            distinct->sink->row(distinct->sink->context, row);
+            return;
+        }
+    }
+    switch (SQLdistinct_Insert(&(distinct->set), distinct->key.data, distinct->key.length))
+    {
+    case 1:
+    case -2:
+        distinct->sink->row(distinct->sink->context, row);
+        break;
+    default:
+        break;
+    }
+}
+
+static void SQLdistinctSinkSpilled(void *context, const unsigned char *key, size_t length)
+{
+    struct DistinctSink *distinct;
+
+    (void) length;
+    distinct = context;
+    SQLdistinct_DecodeColumns(key, &(distinct->spilled), 0, distinct->structure->columnTypes,
+                                                            distinct->structure->count);
+    distinct->sink->row(distinct->sink->context, &(distinct->spilled));
+}
+
+static void SQLdistinctSinkEnd(void *context)
+{
+    struct DistinctSink *distinct;
+
+    distinct = context;
+    SQLdistinct_Drain(&(distinct->set), SQLdistinctSinkSpilled, distinct);
+    if (distinct->sink->end != NULL)
+        distinct->sink->end(distinct->sink->context);
+}
+
+/*
+ * Wrap `sink` in `wrapper`, so it only receives distinct rows of `structure`
+ *
+ *      Rows are sent as soon as they are seen the first time, the ones that
+ *      overflowed the memory of the set at the end. Returns 0 on failure,
+ *      the state is released with SQLdistinctSink_Free() in both cases.
+ */
+int SQLdistinctSink_Init(struct DistinctSink *distinct, struct ResultSink *wrapper, const struct ResultSink *const sink,
+                                                            const struct TableStructureInfo *const structure)
+{
+    memset(distinct, 0, sizeof(*distinct));
+    distinct->sink      = sink;
+    distinct->structure = structure;
+    wrapper->begin      = SQLdistinctSinkBegin;
+    wrapper->row        = SQLdistinctSinkRow;
+    wrapper->end        = SQLdistinctSinkEnd;
+    wrapper->context    = distinct;
+
+    return (SQLdistinct_Init(&(distinct->set), SQL_DISTINCT_MEMORY, 0) != 0) &&
+           (SQLallocRow(&(distinct->spilled), structure->count) != 0);
+}
+
+/* Release the DistinctSink state, the spilled row values belong to the set keys */
+void SQLdistinctSink_Free(struct DistinctSink *distinct)
+{
+    SQLdistinct_Free(&(distinct->set));
+    free(distinct->key.data);
+    free(distinct->spilled.columns);
+    memset(distinct, 0, sizeof(*distinct));
+}
+
+static double SQLnumericValue(const struct Column *const column);
+
+/* Precision of the HyperLogLog sketches, 2^11 registers give a standard error around 2.3% */
+#define SQL_HLL_PRECISION 11
+#define SQL_HLL_REGISTERS (1 << SQL_HLL_PRECISION)
+
+/* Compression of the t-digest sketches, they keep a few hundred centroids at most */
+#define SQL_TDIGEST_COMPRESSION 100
+
+/* Number of centroids a t-digest buffers before they are compressed */
+#define SQL_TDIGEST_BUFFER (5 * SQL_TDIGEST_COMPRESSION)
+
+/* Digits of the encoded HyperLogLog registers, one per register, never `;` so sketches can be stored */
+static const char SQLsketchDigits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/* HyperLogLog sketch of APPROX_COUNT_DISTINCT: the longest run of zero hash bits seen by each register */
+struct HyperLogLog
+{
+    unsigned char registers[SQL_HLL_REGISTERS];
+};
+
+/* One centroid of a t-digest, `weight` values around `mean` */
+struct Centroid
+{
+    double mean;
+    double weight;
+};
+
+/*
+ * t-digest sketch of APPROX_PERCENTILE:
+ *      centroids: the centroids, sorted after SQLtdigest_Compress()
+ *      count    : number of centroids
+ *      capacity : number of allocated centroids
+ *      weight   : number of values in the sketch
+ *      minimum  : the smallest value
+ *      maximum  : the largest value
+ *
+ *  Centroids near the median may hold many values, the ones near the ends
+ *  few, so extreme percentiles stay accurate.
+ */
+struct TDigest
+{
+    struct Centroid *centroids;
+    size_t           count;
+    size_t           capacity;
+    double           weight;
+    double           minimum;
+    double           maximum;
+};
+
+/* Natural logarithm, without requiring the math library */
+static double SQLlog(double x)
+{
+    double y;
+    double square;
+    double term;
+    double sum;
+    int    exponent;
+    int    k;
+
+    exponent = 0;
+    for ( ; x >= 2 ; x /= 2)
+        exponent++;
+    for ( ; x < 1 ; x *= 2)
+        exponent--;
+    /* ln(x) = 2 atanh((x - 1) / (x + 1)), quick to converge for x in [1, 2) */
+    y      = (x - 1) / (x + 1);
+    square = y * y;
+    term   = y;
+    sum    = 0;
+    for (k = 1 ; k < 40 ; k += 2)
+    {
+        sum  += term / k;
+        term *= square;
+    }
+    return exponent * 0.69314718055994530942 + 2 * sum;
+}
+
+/* Add a value to the sketch, the top hash bits choose the register, the trailing zeros of the others are counted */
+static void SQLhll_Add(struct HyperLogLog *hll, const struct Column *const column)
+{
+    unsigned long hash;
+    size_t        bits;
+    size_t        index;
+    unsigned char rank;
+
+    bits  = 8 * sizeof(unsigned long) - SQL_HLL_PRECISION;
+    hash  = SQLmixHash(SQLhashColumnValue(2166136261UL, column->value, column->type));
+    index = hash >> bits;
+    for (rank = 1 ; (rank <= bits) && ((hash & 1) == 0) ; ++rank)
+        hash >>= 1;
+    if (rank > hll->registers[index])
+        hll->registers[index] = rank;
+}
+
+/* Estimated number of distinct values, by linear counting while many registers are empty */
+static long long SQLhll_Estimate(const struct HyperLogLog *const hll)
+{
+    double estimate;
+    double sum;
+    size_t zeros;
+    size_t i;
+
+    sum   = 0;
+    zeros = 0;
+    for (i = 0 ; i < SQL_HLL_REGISTERS ; ++i)
+    {
+        sum   += 1.0 / (double) (1UL << hll->registers[i]);
+        zeros += (hll->registers[i] == 0);
+    }
+    estimate = 0.7213 / (1 + 1.079 / SQL_HLL_REGISTERS) * SQL_HLL_REGISTERS * SQL_HLL_REGISTERS / sum;
+    if ((estimate <= 2.5 * SQL_HLL_REGISTERS) && (zeros != 0))
+        estimate = SQL_HLL_REGISTERS * SQLlog((double) SQL_HLL_REGISTERS / zeros);
+
+    return estimate + 0.5;
+}
+
+/* Encode the registers, one digit each, returns NULL on failure */
+static char *SQLhll_Encode(const struct HyperLogLog *const hll)
+{
+    char  *text;
+    size_t i;
+
+    text = malloc(SQL_HLL_REGISTERS + 1);
+    if (text == NULL)
+        return NULL;
+    for (i = 0 ; i < SQL_HLL_REGISTERS ; ++i)
+        text[i] = SQLsketchDigits[hll->registers[i]];
+    text[SQL_HLL_REGISTERS] = '\0';
+
+    return text;
+}
+
+/* Merge encoded registers into the sketch, the union keeps the longest run of each register */
+static int SQLhll_Merge(struct HyperLogLog *hll, const char *const text)
+{
+    const char *digit;
+    size_t      i;
+
+    for (i = 0 ; (i < SQL_HLL_REGISTERS) && (text[i] != '\0') ; ++i)
+    {
+        if ((digit = strchr(SQLsketchDigits, text[i])) == NULL)
+            return 0;
+        if (digit - SQLsketchDigits > hll->registers[i])
+            hll->registers[i] = digit - SQLsketchDigits;
+    }
+    return 1;
+}
+
+/* Order centroids by mean, for qsort */
+static int SQLtdigest_CompareCentroids(const void *const lhs, const void *const rhs)
+{
+    double left;
+    double right;
+
+    left  = ((const struct Centroid *) lhs)->mean;
+    right = ((const struct Centroid *) rhs)->mean;
+
+    return (left > right) - (left < right);
+}
+
+/*
+ * Sort the centroids and merge the neighbours whose weight stays in the bound of their quantile
+ *
+ *      A centroid at quantile q may hold 4 * n * q * (1 - q) / compression values,
+ *      so the sketch size does not depend on the number of values.
+ */
+static void SQLtdigest_Compress(struct TDigest *digest)
+{
+    struct Centroid *centroids;
+    double           cumulative;
+    size_t           last;
+    size_t           i;
+
+    if (digest->count < 2)
+        return;
+    centroids = digest->centroids;
+    qsort(centroids, digest->count, sizeof(struct Centroid), SQLtdigest_CompareCentroids);
+    cumulative = 0;
+    last       = 0;
+    for (i = 1 ; i < digest->count ; ++i)
+    {
+        double weight;
+        double quantile;
+
+        weight   = centroids[last].weight + centroids[i].weight;
+        quantile = (cumulative + weight / 2) / digest->weight;
+        if (weight <= 4 * digest->weight * quantile * (1 - quantile) / SQL_TDIGEST_COMPRESSION)
+        {
+            centroids[last].mean  += (centroids[i].mean - centroids[last].mean) * centroids[i].weight / weight;
+            centroids[last].weight = weight;
+        }
+        else
+        {
+            cumulative        += centroids[last].weight;
+            centroids[++last]  = centroids[i];
+        }
+    }
+    digest->count = last + 1;
+}
+
+/* Add `weight` values around `mean` to the sketch, returns 0 on failure */
+static int SQLtdigest_Add(struct TDigest *digest, double mean, double weight)
+{
+    if (digest->count >= SQL_TDIGEST_BUFFER)
+        SQLtdigest_Compress(digest);
+    if (digest->count == digest->capacity)
+    {
+        struct Centroid *centroids;
+        size_t           capacity;
+
+        capacity  = (digest->capacity == 0) ? 16 : 2 * digest->capacity;
+        centroids = realloc(digest->centroids, capacity * sizeof(struct Centroid));
+        if (centroids == NULL)
+            return 0;
+        digest->centroids = centroids;
+        digest->capacity  = capacity;
+    }
+    if ((digest->weight == 0) || (mean < digest->minimum))
+        digest->minimum = mean;
+    if ((digest->weight == 0) || (mean > digest->maximum))
+        digest->maximum = mean;
+    digest->centroids[digest->count].mean   = mean;
+    digest->centroids[digest->count].weight = weight;
+    digest->count                          += 1;
+    digest->weight                         += weight;
+
+    return 1;
+}
+
+/* Estimated value at `fraction` of the sorted values, interpolated between the centroid means */
+static double SQLtdigest_Quantile(struct TDigest *digest, double fraction)
+{
+    const struct Centroid *centroids;
+    double                 target;
+    double                 center;
+    double                 previous;
+    double                 mean;
+    double                 cumulative;
+    size_t                 i;
+
+    SQLtdigest_Compress(digest);
+    if (digest->count == 0)
+        return 0;
+    centroids  = digest->centroids;
+    target     = fraction * digest->weight;
+    previous   = 0; /* the minimum is the left end of the first centroid */
+    mean       = digest->minimum;
+    cumulative = 0;
+    for (i = 0 ; i < digest->count ; ++i)
+    {
+        center = cumulative + centroids[i].weight / 2;
+        if (target < center)
+            return mean + (centroids[i].mean - mean) * (target - previous) / (center - previous);
+        previous    = center;
+        mean        = centroids[i].mean;
+        cumulative += centroids[i].weight;
+    }
+    return mean + (digest->maximum - mean) * (target - previous) / (cumulative - previous);
+}
+
+/* Encode the sketch as `MIN,MAX,MEAN:WEIGHT,...`, empty without values, returns NULL on failure */
+static char *SQLtdigest_Encode(struct TDigest *digest)
+{
+    char  *text;
+    size_t size;
+    size_t length;
+    size_t i;
+
+    SQLtdigest_Compress(digest);
+    size = 2 * (digest->count + 1) * 32 + 1;
+    text = malloc(size);
+    if (text == NULL)
+        return NULL;
+    text[0] = '\0';
+    if (digest->count == 0)
+        return text;
+    length = snprintf(text, size, "%.17g,%.17g", digest->minimum, digest->maximum);
+    for (i = 0 ; i < digest->count ; ++i)
+        length += snprintf(text + length, size - length, ",%.17g:%.17g", digest->centroids[i].mean,
+                                                                          digest->centroids[i].weight);
+    return text;
+}
+
+/* Merge an encoded sketch into the sketch, returns 0 if it is invalid or on failure */
+static int SQLtdigest_Merge(struct TDigest *digest, const char *const text)
+{
+    char  *end;
+    double minimum;
+    double maximum;
+
+    if (text[0] == '\0')
+        return 1;
+    minimum = strtod(text, &end);
+    if (*end != ',')
+        return 0;
+    maximum = strtod(end + 1, &end);
+    while (*end == ',')
+    {
+        double mean;
+        double weight;
+
+        mean = strtod(end + 1, &end);
+        if (*end != ':')
+            return 0;
+        weight = strtod(end + 1, &end);
+        if ((weight <= 0) || (SQLtdigest_Add(digest, mean, weight) == 0))
+            return 0;
+    }
+    if (minimum < digest->minimum)
+        digest->minimum = minimum;
+    if (maximum > digest->maximum)
+        digest->maximum = maximum;
+
+    return *end == '\0';
+}
+
+/* Check if the aggregate is approximated by a sketch, whose state merges over any split of the rows */
+static int SQLisSketchAggregate(enum ClauseType type)
+{
+    return (type == ApproxCountDistinctAggregate) || (type == ApproxPercentileAggregate);
+}
+
+/* Allocate an empty sketch for the aggregate, returns NULL on failure */
+static void *SQLsketch_New(enum ClauseType type)
+{
+    if (type == ApproxCountDistinctAggregate)
+        return calloc(1, sizeof(struct HyperLogLog));
+    return calloc(1, sizeof(struct TDigest));
+}
+
+/* Release a sketch of the aggregate */
+static void SQLsketch_Free(enum ClauseType type, void *sketch)
+{
+    if ((type == ApproxPercentileAggregate) && (sketch != NULL))
+        free(((struct TDigest *) sketch)->centroids);
+    free(sketch);
+}
+
+/* Add a non NULL argument to the sketch of the aggregate */
+static void SQLsketch_Add(enum ClauseType type, void *sketch, const struct Column *const column)
+{
+    if (type == ApproxCountDistinctAggregate)
+        SQLhll_Add(sketch, column);
+    else
+        SQLtdigest_Add(sketch, SQLnumericValue(column), 1);
+}
+
+/* Merge an encoded sketch of the aggregate, returns 0 if it is invalid or on failure */
+static int SQLsketch_Merge(enum ClauseType type, void *sketch, const char *const text)
+{
+    if (type == ApproxCountDistinctAggregate)
+        return SQLhll_Merge(sketch, text);
+    return SQLtdigest_Merge(sketch, text);
+}
+
+/* Encode the sketch of the aggregate as a string, which SQLsketch_Merge() reads back, returns NULL on failure */
+static char *SQLsketch_Encode(enum ClauseType type, void *sketch)
+{
+    if (type == ApproxCountDistinctAggregate)
+        return SQLhll_Encode(sketch);
+    return SQLtdigest_Encode(sketch);
+}
+
+/* Bytes of the storage file blocks read or skipped together by BLOCK_SAMPLE */
+#define SQL_SAMPLE_BLOCK (64 * 1024)
+
+/*
+ * Sample of the rows read by a scan:
+ *      percent: percentage of the rows, or of the blocks, that are read
+ *      blocks : sample whole blocks of the storage files instead of rows,
+ *               the skipped blocks are not read at all
+ *      seed   : chooses the sample, a given seed picks the same rows as long
+ *               as the storage files are not changed
+ */
+struct TableSample
+{
+    double        percent;
+    int           blocks;
+    unsigned long seed;
+};
+
+/* Check if the line or block at `position` of the partition file belongs to the sample, a hash makes it repeatable */
+static int SQLsample_Pick(const struct TableSample *const sample, size_t partition, long position)
+{
+    unsigned long hash;
+
+    hash = SQLmixHash((((unsigned long) position * 16777619UL) ^ sample->seed) + partition * 2166136261UL);
+
+    return (hash % 1000000) < sample->percent * 10000;
+}
+
+/*
+ * Execution plan of a SELECT:
+ *      fieldCount      : number of projected columns, 0 to return every column
+ *      fields          : table position of every projected column
+ *      distinct        : only return the first of equal projected rows
+ *      groupCount      : number of GROUP columns
+ *      groups          : table position of every GROUP column
+ *      aggregateCount  : number of aggregates
+ *      aggregateTypes  : the aggregate function of each aggregate
+ *      aggregateColumns: table position of each aggregate argument, -1 for `COUNT:*`
+ *      fractions       : the fraction of each APPROX_PERCENTILE, 0 for the
+ *                        other aggregates
+ *      countRows       : append the `__rows` column holding the group row count,
+ *                        a `__values` column for each aggregate but the counts
+ *                        holding its number of non NULL arguments, and a
+ *                        `__sketch` column for each approximate aggregate
+ *                        holding its encoded sketch (`PARTIAL:*` asks for them)
+ *      valueColumns    : result position of the `__values` column of each
+ *                        aggregate, -1 without one
+ *      sketchColumns   : result position of the `__sketch` column of each
+ *                        aggregate, -1 without one
+ *      sample          : the rows read, 100 percent without SAMPLE clause
+ *      result          : structure of the result rows
+ *
+ *  Aggregated result rows hold the GROUP columns, followed by the aggregates,
+ *  followed by the `__values` and `__sketch` columns and `__rows` if
+ *  requested. The arrays grow with the query, a plan is released with
+ *  SQLplanFree().
+ */
+struct SelectPlan
+{
+    size_t                    fieldCount;
+    int                      *fields;
+    int                       distinct;
+    size_t                    groupCount;
+    int                      *groups;
+    size_t                    aggregateCount;
+    enum ClauseType          *aggregateTypes;
+    int                      *aggregateColumns;
+    double                   *fractions;
+    int                       countRows;
+    int                      *valueColumns;
+    int                      *sketchColumns;
+    struct TableSample        sample;
+    struct TableStructureInfo result;
+};
+
+/* Append a table position to a plan array holding `count` of them, returns 0 on failure */
+static int SQLplanAppend(int **positions, size_t count, int position)
+{
+    int *auxiliar;
+
+    auxiliar = realloc(*positions, (count + 1) * sizeof(int));
+    if (auxiliar == NULL)
+        return 0;
+    auxiliar[count] = position;
+    *positions      = auxiliar;
+
+    return 1;
+}
+
+/* Append an aggregate to the plan, returns 0 on failure */
+static int SQLplanAddAggregate(struct SelectPlan *plan, enum ClauseType type, int column, double fraction)
+{
+    enum ClauseType *types;
+    double          *fractions;
+
+    types = realloc(plan->aggregateTypes, (plan->aggregateCount + 1) * sizeof(enum ClauseType));
+    if (types == NULL)
+        return 0;
+    plan->aggregateTypes = types;
+    fractions = realloc(plan->fractions, (plan->aggregateCount + 1) * sizeof(double));
+    if (fractions == NULL)
+        return 0;
+    plan->fractions = fractions;
+    if ((SQLplanAppend(&(plan->aggregateColumns), plan->aggregateCount, column) == 0) ||
+        (SQLplanAppend(&(plan->valueColumns), plan->aggregateCount, -1) == 0) ||
+        (SQLplanAppend(&(plan->sketchColumns), plan->aggregateCount, -1) == 0))
+        return 0;
+    types[plan->aggregateCount]     = type;
+    fractions[plan->aggregateCount] = fraction;
+    plan->aggregateCount       += 1;
+
+    return 1;
+}
+
+/* Release the arrays and the result structure of the plan */
+void SQLplanFree(struct SelectPlan *plan)
+{
+    free(plan->fields);
+    free(plan->groups);
+    free(plan->aggregateTypes);
+    free(plan->aggregateColumns);
+    free(plan->fractions);
+    free(plan->valueColumns);
+    free(plan->sketchColumns);
+    SQLstructure_Free(&(plan->result));
+    memset(plan, 0, sizeof(*plan));
+}
+
+/* Parse a comma separated list of column names into table positions, returns the count or -1 */
+static int SQLplanColumnList(const char *const value, const struct TableStructureInfo *const tableStructure,
+                                                                    int **positions, size_t count)
+{
+    char *names;
+    char *name;
+    char *state;
+
+    names = strdup(value);
+    if (names == NULL)
+        return -1;
+    for (name = strtok_r(names, ",", &state) ; name != NULL ; name = strtok_r(NULL, ",", &state))
+    {
+        int position;
+
+        if ((position = SQLParser_FindColumn(tableStructure, name)) == -1)
+        {
+            SQLreport("no column `%s` in table `%s`\n", name, tableStructure->name);
+            goto abort;
+        }
+        if (SQLplanAppend(positions, count, position) == 0)
+            goto abort;
+        count += 1;
+    }
+    free(names);
+
+    return count;
+
+abort:
+    free(names);
+    return -1;
+}
+
+/* Parse `PERCENT%[,SEED]` into the sample of the plan, returns 0 if it is invalid */
+static int SQLplanSample(struct SelectPlan *plan, const char *const value, int blocks)
+{
+    char *end;
+
+    plan->sample.blocks  = blocks;
+    plan->sample.percent = strtod(value, &end);
+    if (*end == '%')
+        end++;
+    if (*end == ',')
+        plan->sample.seed = strtoul(end + 1, &end, 10);
+    if ((end == value) || (*end != '\0') || (plan->sample.percent < 0) || (plan->sample.percent > 100))
+    {
+        SQLreport("usage: %s:PERCENT%%[,SEED] with a percentage between 0 and 100\n", blocks ? "BLOCK_SAMPLE" : "SAMPLE");
+        return 0;
+    }
+    return 1;
+}
+
+/* Add a column to the result structure of the plan */
+static int SQLplanAddResultColumn(struct SelectPlan *plan, const char *const name, enum FieldType type)
+{
+    return SQLstructure_AddColumn(&(plan->result), name, type, NULL);
+}
+
+/* Check if the aggregate is a count, counts are never NULL and need no `__values` column */
+static int SQLisCountAggregate(enum ClauseType type)
+{
+    return (type == CountAggregate) || (type == CountDistinctAggregate) || (type == ApproxCountDistinctAggregate);
+}
+
+/*
+ * Build the execution plan of a SELECT from its `:` clauses
+ *
+ *      SELECT:TABLENAME FIELDS:A,B
+ *      SELECT:TABLENAME DISTINCT:A,B        (DISTINCT:* for every column)
+ *      SELECT:TABLENAME GROUP:A,B COUNT:* COUNT_DISTINCT:C SUM:C MIN:C MAX:C AVG:C
+ *      SELECT:TABLENAME APPROX_COUNT_DISTINCT:C APPROX_PERCENTILE:C,0.95
+ *      SELECT:TABLENAME SAMPLE:10% ...      (BLOCK_SAMPLE:10% for whole blocks)
+ *
+ *  Returns 0 if the clauses are invalid, the plan is released with
+ *  SQLplanFree() in both cases.
+ */
+int SQLplanSelect(const struct TokenList *list, const struct TableStructureInfo *const tableStructure,
+                                                           struct SelectPlan *plan, int countRows)
+{
+    int    count;
+    size_t i;
+
+    memset(plan, 0, sizeof(*plan));
+    plan->countRows      = countRows;
+    plan->sample.percent = 100;
+    for (list = list->next ; list != NULL ; list = list->next)
+    {
+        enum ClauseType clause;
+        int             column;
+        double          fraction;
+
+        if (list->operator != AssignOperator)
+            continue;
+        switch ((clause = SQLParser_GetClauseType(list->keyword)))
+        {
+        case DistinctClause: /* the distinct columns are projected like FIELDS */
+            plan->distinct = 1;
+            if (strcmp(list->value, "*") == 0)
+                break;
+            /* fall through */
+        case FieldsClause:
+            if ((count = SQLplanColumnList(list->value, tableStructure, &(plan->fields), plan->fieldCount)) == -1)
+                return 0;
+            plan->fieldCount = count;
+            break;
+        case GroupClause:
+            if ((count = SQLplanColumnList(list->value, tableStructure, &(plan->groups), plan->groupCount)) == -1)
+                return 0;
+            plan->groupCount = count;
+            break;
+        case PartialClause: /* the partial aggregates of a shard, merged by the coordinator */
+            plan->countRows = 1;
+            break;
+        case SampleClause:
+        case BlockSampleClause:
+            if (SQLplanSample(plan, list->value, clause == BlockSampleClause) == 0)
+                return 0;
+            break;
+        case CountAggregate:
+        case CountDistinctAggregate:
+        case SumAggregate:
+        case MinAggregate:
+        case MaxAggregate:
+        case AvgAggregate:
+        case ApproxCountDistinctAggregate:
+        case ApproxPercentileAggregate:
+            column   = -1;
+            fraction = 0;
+            {
+                char  argument[strlen(list->value) + 1];
+                char *separator;
+                char *end;
+
+                strcpy(argument, list->value);
+                /* APPROX_PERCENTILE:FIELD,FRACTION */
+                if (clause == ApproxPercentileAggregate)
+                {
+                    if ((separator = strrchr(argument, ',')) != NULL)
+                    {
+                        *separator = '\0';
+                        fraction   = strtod(separator + 1, &end);
+                    }
+                    if ((separator == NULL) || (end == separator + 1) || (*end != '\0') ||
+                        (fraction < 0) || (fraction > 1))
+                    {
+                        SQLreport("usage: APPROX_PERCENTILE:FIELD,FRACTION with a fraction between 0 and 1\n");
+                        return 0;
+                    }
+                }
+                if ((clause != CountAggregate) || (strcmp(argument, "*") != 0))
+                {
+                    if ((column = SQLParser_FindColumn(tableStructure, argument)) == -1)
+                    {
+                        SQLreport("no column `%s` in table `%s`\n", argument, tableStructure->name);
+                        return 0;
+                    }
+                }
+                if ((clause == SumAggregate) || (clause == AvgAggregate) || (clause == ApproxPercentileAggregate))
+                {
+                    enum FieldType type;
+
+                    type = tableStructure->columnTypes[column];
+                    if (SQLisNumericType(type) == 0)
+                    {
+                        SQLreport("cannot compute `%s` of non numeric column `%s`\n", list->keyword, argument);
+                        return 0;
+                    }
+                }
+            }
+            if (SQLplanAddAggregate(plan, clause, column, fraction) == 0)
+                return 0;
+            break;
+        default: /* Other `:` tokens are not SELECT clauses */
+            break;
+        }
+    }
+    if (((plan->fieldCount != 0) || (plan->distinct != 0)) && ((plan->groupCount != 0) || (plan->aggregateCount != 0)))
+    {
+        SQLreport("FIELDS and DISTINCT cannot be combined with GROUP or aggregates.\n");
+        return 0;
+    }
+
+    /* Build the structure of the result rows */
+    strcpy(plan->result.name, tableStructure->name);
+    if ((plan->groupCount == 0) && (plan->aggregateCount == 0))
+    {
+        if (plan->fieldCount == 0)
+        {
+            /* Dropped columns are still stored, a projection of the others hides them */
+            for (i = 0 ; (i < tableStructure->count) && (tableStructure->columnDropped[i] == 0) ; ++i);
+            if ((i == tableStructure->count) && (plan->distinct == 0))
+                return SQLstructure_Copy(&(plan->result), tableStructure);
+            for (i = 0 ; i < tableStructure->count ; ++i)
+            {
+                if ((tableStructure->columnDropped[i] == 0) &&
+                    (SQLplanAppend(&(plan->fields), plan->fieldCount++, i) == 0))
+                    return 0;
+            }
+        }
+        for (i = 0 ; i < plan->fieldCount ; ++i)
+        {
+            if (SQLplanAddResultColumn(plan, tableStructure->columns[plan->fields[i]],
+                                             tableStructure->columnTypes[plan->fields[i]]) == 0)
+                return 0;
+        }
+        return 1;
+    }
+    for (i = 0 ; i < plan->groupCount ; ++i)
+    {
+        if (SQLplanAddResultColumn(plan, tableStructure->columns[plan->groups[i]],
+                                         tableStructure->columnTypes[plan->groups[i]]) == 0)
+            return 0;
+    }
+    for (i = 0 ; i < plan->aggregateCount ; ++i)
+    {
+        const char    *argument;
+        const char    *format;
+        enum FieldType type;
+        int            column;
+
+        column   = plan->aggregateColumns[i];
+        argument = (column == -1) ? "*" : tableStructure->columns[column];
+        type     = (column == -1) ? Integer : tableStructure->columnTypes[column];
+        switch (plan->aggregateTypes[i])
+        {
+        case CountAggregate:
+            format = "COUNT(%s)";
+            type   = Integer;
+            break;
+        case CountDistinctAggregate:
+            format = "COUNT(DISTINCT %s)";
+            type   = Integer;
+            break;
+        case ApproxCountDistinctAggregate:
+            format = "APPROX_COUNT_DISTINCT(%s)";
+            type   = Int64;
+            break;
+        case ApproxPercentileAggregate:
+            format = "APPROX_PERCENTILE(%s,%g)";
+            type   = Double;
+            break;
+        case SumAggregate:
+            format = "SUM(%s)";
+            break;
+        case MinAggregate:
+            format = "MIN(%s)";
+            break;
+        case MaxAggregate:
+            format = "MAX(%s)";
+            break;
+        default:
+            format = "AVG(%s)";
+            type   = Double;
+            break;
+        }
+        {
+            char name[strlen(format) + strlen(argument) + 32];
+
+            snprintf(name, sizeof(name), format, argument, plan->fractions[i]);
+            if (SQLplanAddResultColumn(plan, name, type) == 0)
+                return 0;
+        }
+    }
+    for (i = 0 ; i < plan->aggregateCount ; ++i)
+    {
+        if ((plan->countRows == 0) || (SQLisCountAggregate(plan->aggregateTypes[i]) != 0))
+            continue;
+        plan->valueColumns[i] = plan->result.count;
+        if (SQLplanAddResultColumn(plan, "__values", Integer) == 0)
+            return 0;
+    }
+    for (i = 0 ; i < plan->aggregateCount ; ++i)
+    {
+        if ((plan->countRows == 0) || (SQLisSketchAggregate(plan->aggregateTypes[i]) == 0))
+            continue;
+        plan->sketchColumns[i] = plan->result.count;
+        if (SQLplanAddResultColumn(plan, "__sketch", String) == 0)
+            return 0;
+    }
+    if (plan->countRows != 0)
+        return SQLplanAddResultColumn(plan, "__rows", Integer);
+
+    return 1;
+}
+
+/*
+ * Copy the projected columns of `source` into `destination`, the values are not duplicated
+ *
+ *      `destination` must have been allocated with SQLallocRow() for the
+ *      projected columns, it can be reused for every row.
+ */
+void SQLprojectRow(const struct SelectPlan *const plan, const struct Row *const source, struct Row *destination)
+{
+    size_t i;
+
+    destination->index       = source->index;
+    destination->columnCount = plan->fieldCount;
+    memset(destination->nulls, 0, (plan->fieldCount + 7) / 8);
+    for (i = 0 ; i < plan->fieldCount ; ++i)
+    {
+        destination->columns[i]          = source->columns[plan->fields[i]];
+        destination->columns[i].position = i;
+        SQLsetNull(destination, i, SQLisNull(source, plan->fields[i]));
+    }
+}
+
+/*
+ * ResultSink wrapping another sink, to apply a plan to the rows:
+ *      plan       : the SELECT plan
+ *      sink       : the sink receiving the result rows
+ *      aggregation: the group state, for aggregated plans
+ *      projected  : the projected row, reused for every row
+ */
+struct PlanSink
+{
+    const struct SelectPlan *plan;
+    const struct ResultSink *sink;
+    struct Aggregation      *aggregation;
+    struct Row               projected;
+};
+
+/* ResultSink callbacks to project the rows */
+static void SQLprojectSinkBegin(void *context, const struct TableStructureInfo *const tableStructure)
+{
+    struct PlanSink *planSink;
+
+    (void) tableStructure;
+    planSink = context;
+    if (planSink->sink->begin != NULL)
+        planSink->sink->begin(planSink->sink->context, &(planSink->plan->result));
+}
+
+static void SQLprojectSinkRow(void *context, const struct Row *const row)
+{
+    struct PlanSink *planSink;
+
+    planSink = context;
+    SQLprojectRow(planSink->plan, row, &(planSink->projected));
+    planSink->sink->row(planSink->sink->context, &(planSink->projected));
+}
+
+static void SQLprojectSinkEnd(void *context)
+{
+    struct PlanSink *planSink;
+
+    planSink = context;
+    if (planSink->sink->end != NULL)
+        planSink->sink->end(planSink->sink->context);
+}
+
+/*
+ * One group of an aggregation:
+ *      hash    : hash of the GROUP values
+ *      row     : the result row, GROUP values followed by the aggregates
+ *      count   : number of rows in the group
+ *      next    : next group in the same hash bucket
+ *      after   : next group in creation order
+ *      sketches: sketch of each approximate aggregate, NULL for the others or
+ *                without approximate aggregates
+ *      values  : number of non NULL arguments of each aggregate, without any
+ *                the aggregate is NULL (COUNT is 0)
+ */
+struct AggregateGroup
+{
+    unsigned long          hash;
+    struct Row             row;
+    long                   count;
+    struct AggregateGroup *next;
+    struct AggregateGroup *after;
+    void                 **sketches;
+    long                   values[];
+};
+
+/*
+ * Hash table of the groups of an aggregation:
+ *      plan        : the SELECT plan
+ *      buckets     : the hash buckets
+ *      bucketCount : number of hash buckets
+ *      groupCount  : number of groups
+ *      first, last : the groups in creation order
+ *      distinct    : the (aggregate, GROUP values, argument) keys already
+ *                    counted by the COUNT_DISTINCT aggregates
+ *      key         : the key being built for `distinct`
+ */
+struct Aggregation
+{
+    const struct SelectPlan *plan;
+    struct AggregateGroup  **buckets;
+    size_t                   bucketCount;
+    size_t                   groupCount;
+    struct AggregateGroup   *first;
+    struct AggregateGroup   *last;
+    struct DistinctSet       distinct;
+    struct DistinctKey       key;
+};
+
+/* Check if the plan computes an aggregate of this type */
+int SQLplanHasAggregate(const struct SelectPlan *const plan, enum ClauseType type)
+{
+    size_t i;
+
+    for (i = 0 ; i < plan->aggregateCount ; ++i)
+    {
+        if (plan->aggregateTypes[i] == type)
+            return 1;
+    }
+    return 0;
+}
+
+/* Initialize the aggregation, returns 0 on failure */
+int SQLaggregation_Init(struct Aggregation *aggregation, const struct SelectPlan *const plan)
+{
+    memset(aggregation, 0, sizeof(*aggregation));
+    aggregation->plan        = plan;
+    aggregation->bucketCount = 256;
+    aggregation->buckets     = calloc(aggregation->bucketCount, sizeof(struct AggregateGroup *));
+    if ((SQLplanHasAggregate(plan, CountDistinctAggregate) != 0) &&
+        (SQLdistinct_Init(&(aggregation->distinct), SQL_DISTINCT_MEMORY, 0) == 0))
+    {
+        SQLdistinct_Free(&(aggregation->distinct));
+        free(aggregation->buckets);
+        return 0;
+    }
+    return (aggregation->buckets != NULL);
+}
+
+/* Release a group, its row and its sketches */
+static void SQLaggregation_FreeGroup(const struct SelectPlan *const plan, struct AggregateGroup *group)
+{
+    size_t i;
+
+    for (i = 0 ; (group->sketches != NULL) && (i < plan->aggregateCount) ; ++i)
+        SQLsketch_Free(plan->aggregateTypes[i], group->sketches[i]);
+    free(group->sketches);
+    SQLfreeRow(&(group->row));
+    free(group);
+}
+
+/* Allocate the empty sketches of a new group, when the plan has approximate aggregates, returns 0 on failure */
+static int SQLaggregation_NewSketches(const struct SelectPlan *const plan, struct AggregateGroup *group)
+{
+    size_t i;
+
+    for (i = 0 ; i < plan->aggregateCount ; ++i)
+    {
+        if (SQLisSketchAggregate(plan->aggregateTypes[i]) == 0)
+            continue;
+        if ((group->sketches == NULL) && ((group->sketches = calloc(plan->aggregateCount, sizeof(void *))) == NULL))
+            return 0;
+        if ((group->sketches[i] = SQLsketch_New(plan->aggregateTypes[i])) == NULL)
+            return 0;
+    }
+    return 1;
+}
+
+/* Release all the groups */
+void SQLaggregation_Free(struct Aggregation *aggregation)
+{
+    struct AggregateGroup *group;
+    struct AggregateGroup *after;
+
+    for (group = aggregation->first ; group != NULL ; group = after)
+    {
+        after = group->after;
+        SQLaggregation_FreeGroup(aggregation->plan, group);
+    }
+    free(aggregation->buckets);
+    SQLdistinct_Free(&(aggregation->distinct));
+    free(aggregation->key.data);
+    memset(aggregation, 0, sizeof(*aggregation));
+}
+
+/* Hash the GROUP values of `row`, found at `positions` */
+static unsigned long SQLaggregation_Hash(const struct SelectPlan *const plan, const struct Row *const row,
+                                                                                 const int *positions)
+{
+    unsigned long hash;
+    size_t        i;
+
+    hash = 2166136261UL;
+    for (i = 0 ; i < plan->groupCount ; ++i)
+    {
+        if (SQLisNull(row, positions[i]) != 0) /* NULL values make one group */
+            hash = (hash ^ 0xFF) * 16777619UL;
+        else
+            hash = SQLhashColumnValue(hash, row->columns[positions[i]].value, row->columns[positions[i]].type);
+    }
+    return hash;
+}
+
+/* Double the number of buckets, keeping lookups O(1) as the groups grow */
+static void SQLaggregation_Grow(struct Aggregation *aggregation)
+{
+    struct AggregateGroup **buckets;
+    struct AggregateGroup  *group;
+    size_t                  count;
+
+    count   = 2 * aggregation->bucketCount;
+    buckets = calloc(count, sizeof(struct AggregateGroup *));
+    if (buckets == NULL)
+        return; /* Keep working with longer chains */
+    for (group = aggregation->first ; group != NULL ; group = group->after)
+    {
+        group->next                   = buckets[group->hash % count];
+        buckets[group->hash % count]  = group;
+    }
+    free(aggregation->buckets);
+    aggregation->buckets     = buckets;
+    aggregation->bucketCount = count;
+}
+
+/* Mark the aggregates of the group without any non NULL argument as NULL (COUNTs excepted), and store their counts */
+static void SQLaggregation_SetNulls(const struct SelectPlan *const plan, struct AggregateGroup *group)
+{
+    size_t i;
+
+    for (i = 0 ; i < plan->aggregateCount ; ++i)
+    {
+        SQLsetNull(&(group->row), plan->groupCount + i,
+                   (SQLisCountAggregate(plan->aggregateTypes[i]) == 0) && (group->values[i] == 0));
+        if (plan->valueColumns[i] != -1)
+            group->row.columns[plan->valueColumns[i]].value.integer = group->values[i];
+    }
+}
+
+/*
+ * Find the group of `row`, whose GROUP values are at `positions`
+ *
+ *      When `create` is not 0 a missing group is created, with zeroed
+ *      aggregates. Returns NULL if the group does not exist or on failure.
+ */
+struct AggregateGroup *SQLaggregation_Lookup(struct Aggregation *aggregation, const struct Row *const row,
+                                                                        const int *positions, int create)
+{
+    const struct SelectPlan *plan;
+    struct AggregateGroup   *group;
+    unsigned long            hash;
+    size_t                   i;
+
+    plan = aggregation->plan;
+    hash = SQLaggregation_Hash(plan, row, positions);
+    for (group = aggregation->buckets[hash % aggregation->bucketCount] ; group != NULL ; group = group->next)
+    {
+        if (group->hash != hash)
+            continue;
+        for (i = 0 ; i < plan->groupCount ; ++i)
+        {
+            const struct Column *column;
+
+            column = &(row->columns[positions[i]]);
+            if (SQLisNull(&(group->row), i) != SQLisNull(row, positions[i]))
+                break;
+            if (SQLcompareColumnValues(group->row.columns[i].value, column->value, column->type) != 0)
+                break;
+        }
+        if (i == plan->groupCount)
+            return group;
+    }
+    if (create == 0)
+        return NULL;
+
+    group = calloc(1, sizeof(struct AggregateGroup) + plan->aggregateCount * sizeof(long));
+    if (group == NULL)
+        return NULL;
+    if ((SQLallocRow(&(group->row), plan->result.count) == 0) || (SQLaggregation_NewSketches(plan, group) == 0))
+    {
+        SQLaggregation_FreeGroup(plan, group);
+        return NULL;
+    }
+    group->hash = hash;
+    for (i = 0 ; i < plan->result.count ; ++i)
+    {
+        group->row.columns[i].type     = plan->result.columnTypes[i];
+        group->row.columns[i].position = i;
+    }
+    for (i = 0 ; i < plan->groupCount ; ++i)
+    {
+        group->row.columns[i].value = row->columns[positions[i]].value;
+        if ((group->row.columns[i].type == String) && (group->row.columns[i].value.string != NULL))
+            group->row.columns[i].value.string = strdup(group->row.columns[i].value.string);
+        SQLsetNull(&(group->row), i, SQLisNull(row, positions[i]));
+    }
+    SQLaggregation_SetNulls(plan, group);
+    if (aggregation->groupCount >= 2 * aggregation->bucketCount)
+        SQLaggregation_Grow(aggregation);
+    group->next = aggregation->buckets[hash % aggregation->bucketCount];
+    aggregation->buckets[hash % aggregation->bucketCount] = group;
+    if (aggregation->last != NULL)
+        aggregation->last->after = group;
+    else
+        aggregation->first = group;
+    aggregation->last        = group;
+    aggregation->groupCount += 1;
+
+    return group;
+}
+
+/* Get a numeric column value as a double */
+static double SQLnumericValue(const struct Column *const column)
+{
+    switch (column->type)
+    {
+    case Integer:
+        return column->value.integer;
+    case Int64:
+        return column->value.int64;
+    case Double:
+        return column->value.real;
+    case Decimal:
+        return (double) column->value.decimal / SQL_DECIMAL_SCALE;
+    case Timestamp: /* instants are ordered like their encoding */
+        return column->value.timestamp;
+    case Date:
+        return column->value.date;
+    default:
+        return column->value.number;
+    }
+}
+
+/* Store a double into a numeric column */
+static void SQLsetNumericValue(struct Column *column, double value)
+{
+    switch (column->type)
+    {
+    case Integer:
+        column->value.integer = value;
+        break;
+    case Int64:
+        column->value.int64 = value;
+        break;
+    case Double:
+        column->value.real = value;
+        break;
+    case Decimal: /* rounded to the nearest unit */
+        column->value.decimal = value * SQL_DECIMAL_SCALE + ((value < 0) ? -0.5 : 0.5);
+        break;
+    default:
+        column->value.number = value;
+        break;
+    }
+}
+
+/* Add `sign` times the value of `column` to `result`, exactly when both are 64-bit integers or decimals */
+static void SQLaddNumericValue(struct Column *result, const struct Column *const column, int sign)
+{
+    if ((result->type == Int64) && (column->type == Int64))
+        result->value.int64 += sign * column->value.int64;
+    else if ((result->type == Decimal) && (column->type == Decimal))
+        result->value.decimal += sign * column->value.decimal;
+    else
+        SQLsetNumericValue(result, SQLnumericValue(result) + sign * SQLnumericValue(column));
+}
+
+/*
+ * Check the argument of the COUNT_DISTINCT aggregate `index` for the group
+ *
+ *      Returns 1 if the group did not have this value yet, 0 if it had, and
+ *      -1 if the value was spilled, it is then counted by
+ *      SQLaggregation_Finish().
+ */
+static int SQLaggregation_CountDistinct(struct Aggregation *aggregation, const struct AggregateGroup *const group,
+                                                              size_t index, const struct Row *const row)
+{
+    const struct SelectPlan *plan;
+    size_t                   i;
+
+    plan                    = aggregation->plan;
+    aggregation->key.length = 0;
+    if (SQLdistinct_AppendBytes(&(aggregation->key), &index, sizeof(index)) == 0)
+        return 0;
+    for (i = 0 ; i < plan->groupCount ; ++i)
+    {
+        if (SQLdistinct_AppendColumn(&(aggregation->key), &(group->row), i) == 0)
+            return 0;
+    }
+    if (SQLdistinct_AppendColumn(&(aggregation->key), row, plan->aggregateColumns[index]) == 0)
+        return 0;
+
+    return SQLdistinct_Insert(&(aggregation->distinct), aggregation->key.data, aggregation->key.length);
+}
+
+/* SQLdistinct_Drain() callback, counts a spilled COUNT_DISTINCT value in its group */
+static void SQLaggregation_CountSpilled(void *context, const unsigned char *key, size_t length)
+{
+    struct Aggregation    *aggregation;
+    struct AggregateGroup *group;
+    struct Row             row;
+    size_t                 index;
+    size_t                 i;
+
+    (void) length;
+    aggregation = context;
+    if (SQLallocRow(&row, aggregation->plan->groupCount) == 0)
+        return;
+    {
+        int identity[aggregation->plan->groupCount + 1];
+
+        for (i = 0 ; i < aggregation->plan->groupCount ; ++i)
+            identity[i] = i;
+        memcpy(&index, key, sizeof(index));
+        SQLdistinct_DecodeColumns(key + sizeof(index), &row, 0, aggregation->plan->result.columnTypes,
+                                                                aggregation->plan->groupCount);
+        group = SQLaggregation_Lookup(aggregation, &row, identity, 0);
+    }
+    if (group != NULL)
+        group->row.columns[aggregation->plan->groupCount + index].value.integer += 1;
+    free(row.columns);
+}
+
+/* Count the COUNT_DISTINCT values that were spilled, once every row was added */
+void SQLaggregation_Finish(struct Aggregation *aggregation)
+{
+    if (aggregation->distinct.hashes != NULL)
+        SQLdistinct_Drain(&(aggregation->distinct), SQLaggregation_CountSpilled, aggregation);
+}
+
+/* Fold `row` into the aggregates of `group`, updating the group row count */
+void SQLaggregation_Add(struct Aggregation *aggregation, struct AggregateGroup *group, const struct Row *const row)
+{
+    const struct SelectPlan *plan;
+    size_t                   i;
+
+    plan          = aggregation->plan;
+    group->count += 1;
+    for (i = 0 ; i < plan->aggregateCount ; ++i)
+    {
+        struct Column       *result;
+        const struct Column *column;
+
+        result = &(group->row.columns[plan->groupCount + i]);
+        column = (plan->aggregateColumns[i] == -1) ? NULL : &(row->columns[plan->aggregateColumns[i]]);
+        /* NULL arguments are skipped, `COUNT:*` counts every row */
+        if ((column != NULL) && (SQLisNull(row, plan->aggregateColumns[i]) != 0))
+            continue;
+        group->values[i] += 1;
+        switch (plan->aggregateTypes[i])
+        {
+        case CountAggregate:
+            result->value.integer += 1;
+            break;
+        case CountDistinctAggregate:
+            if (SQLaggregation_CountDistinct(aggregation, group, i, row) == 1)
+                result->value.integer += 1;
+            break;
+        case SumAggregate:
+            SQLaddNumericValue(result, column, 1);
+            break;
+        case AvgAggregate: /* running mean, so the value is always the current average */
+            SQLsetNumericValue(result, SQLnumericValue(result) +
+                               (SQLnumericValue(column) - SQLnumericValue(result)) / group->values[i]);
+            break;
+        case MinAggregate:
+        case MaxAggregate:
+            if (group->values[i] > 1)
+            {
+                int compared;
+
+                compared = SQLcompareColumnValues(column->value, result->value, column->type);
+                if ((plan->aggregateTypes[i] == MinAggregate) ? (compared >= 0) : (compared <= 0))
+                    break;
+                if (result->type == String)
+                    free(result->value.string);
+            }
+            result->value = column->value;
+            if ((result->type == String) && (result->value.string != NULL))
+                result->value.string = strdup(result->value.string);
+            break;
+        case ApproxCountDistinctAggregate:
+        case ApproxPercentileAggregate: /* the estimate is computed by SQLaggregation_Emit() */
+            SQLsketch_Add(plan->aggregateTypes[i], group->sketches[i], column);
+            break;
+        default:
+            break;
+        }
+    }
+    SQLaggregation_SetNulls(plan, group);
+    if (plan->countRows != 0)
+        group->row.columns[plan->result.count - 1].value.integer = group->count;
+}
+
+/*
+ * Remove `row` from the aggregates of `group`, updating the group row count
+ *
+ *      Returns 0 when a MIN or MAX aggregate cannot be maintained, because
+ *      the removed value was the extreme, or with a distinct count or a
+ *      sketch, which cannot forget a value, so the group must be recomputed.
+ */
+int SQLaggregation_Remove(struct Aggregation *aggregation, struct AggregateGroup *group, const struct Row *const row)
+{
+    const struct SelectPlan *plan;
+    size_t                   i;
+    int                      exact;
+
+    plan          = aggregation->plan;
+    exact         = 1;
+    group->count -= 1;
+    for (i = 0 ; i < plan->aggregateCount ; ++i)
+    {
+        struct Column       *result;
+        const struct Column *column;
+
+        result = &(group->row.columns[plan->groupCount + i]);
+        column = (plan->aggregateColumns[i] == -1) ? NULL : &(row->columns[plan->aggregateColumns[i]]);
+        if ((column != NULL) && (SQLisNull(row, plan->aggregateColumns[i]) != 0))
+            continue;
+        group->values[i] -= 1;
+        switch (plan->aggregateTypes[i])
+        {
+        case CountAggregate:
+            result->value.integer -= 1;
+            break;
+        case CountDistinctAggregate: /* other rows may hold the same value */
+        case ApproxCountDistinctAggregate:
+        case ApproxPercentileAggregate:
+            exact = 0;
+            break;
+        case SumAggregate:
+            SQLaddNumericValue(result, column, -1);
+            break;
+        case AvgAggregate:
+            if (group->values[i] == 0)
+                SQLsetNumericValue(result, 0);
+            else
+                SQLsetNumericValue(result, SQLnumericValue(result) +
+                                   (SQLnumericValue(result) - SQLnumericValue(column)) / group->values[i]);
+            break;
+        case MinAggregate:
+        case MaxAggregate:
+            if (group->values[i] == 0) /* Back to the value of an empty group */
+            {
+                if (result->type == String)
+                    free(result->value.string);
+                memset(&(result->value), 0, sizeof(result->value));
+            }
+            else if (SQLcompareColumnValues(column->value, result->value, column->type) == 0)
+                exact = 0;
+            break;
+        default:
+            break;
+        }
+    }
+    SQLaggregation_SetNulls(plan, group);
+    if (plan->countRows != 0)
+        group->row.columns[plan->result.count - 1].value.integer = group->count;
+
+    return exact;
+}
+
+/*
+ * Merge a partial aggregate into `group`
+ *
+ *      `partial` is a result row of the same plan computed over another part
+ *      of the data, this combines the results of several shards or partitions
+ *      into the final one. The plan must count its rows (`PARTIAL:*`), so the
+ *      row carries its `__rows`, `__values` and `__sketch` columns.
+ */
+void SQLaggregation_Merge(struct Aggregation *aggregation, struct AggregateGroup *group,
+                                                             const struct Row *const partial)
+{
+    const struct SelectPlan *plan;
+    size_t                   i;
+    long                     count;
+
+    plan  = aggregation->plan;
+    count = partial->columns[plan->result.count - 1].value.integer;
+    if (count == 0)
+        return;
+    for (i = 0 ; i < plan->aggregateCount ; ++i)
+    {
+        struct Column       *result;
+        const struct Column *column;
+        const struct Column *sketch;
+        int                  compared;
+        long                 values;
+
+        result = &(group->row.columns[plan->groupCount + i]);
+        column = &(partial->columns[plan->groupCount + i]);
+        values = (plan->valueColumns[i] == -1) ? count : partial->columns[plan->valueColumns[i]].value.integer;
+        /* A NULL partial aggregate had no argument to aggregate */
+        if (SQLisNull(partial, plan->groupCount + i) != 0)
+            continue;
+        switch (plan->aggregateTypes[i])
+        {
+        case CountAggregate:
+        case CountDistinctAggregate: /* the parts must not share values, see SQLShard_Select() */
+        case SumAggregate:
+            SQLaddNumericValue(result, column, 1);
+            break;
+        case AvgAggregate: /* weighted by the number of values of each part */
+            SQLsetNumericValue(result, (SQLnumericValue(result) * group->values[i] + SQLnumericValue(column) * values) /
+                                       (group->values[i] + values));
+            break;
+        case ApproxCountDistinctAggregate:
+        case ApproxPercentileAggregate:
+            sketch = &(partial->columns[plan->sketchColumns[i]]);
+            if ((SQLisNull(partial, plan->sketchColumns[i]) == 0) && (sketch->value.string != NULL))
+                SQLsketch_Merge(plan->aggregateTypes[i], group->sketches[i], sketch->value.string);
+            break;
+        case MinAggregate:
+        case MaxAggregate:
+            if (group->values[i] != 0)
+            {
+                compared = SQLcompareColumnValues(column->value, result->value, result->type);
+                if ((plan->aggregateTypes[i] == MinAggregate) ? (compared >= 0) : (compared <= 0))
+                    break;
+            }
+            if (result->type == String)
+                free(result->value.string);
+            result->value = column->value;
+            if ((result->type == String) && (result->value.string != NULL))
+                result->value.string = strdup(result->value.string);
+            break;
+        default:
+            break;
+        }
+        group->values[i] += values;
+    }
+    SQLaggregation_SetNulls(plan, group);
+    group->count += count;
+    if (plan->countRows != 0)
+        group->row.columns[plan->result.count - 1].value.integer = group->count;
+}
+
+/* Store the estimates of the sketches of the group, and the encoded sketches when the plan counts its rows */
+static void SQLaggregation_Estimate(const struct SelectPlan *const plan, struct AggregateGroup *group)
+{
+    size_t i;
+
+    for (i = 0 ; (group->sketches != NULL) && (i < plan->aggregateCount) ; ++i)
+    {
+        struct Column *result;
+
+        result = &(group->row.columns[plan->groupCount + i]);
+        if (plan->aggregateTypes[i] == ApproxCountDistinctAggregate)
+            result->value.int64 = SQLhll_Estimate(group->sketches[i]);
+        else if (plan->aggregateTypes[i] == ApproxPercentileAggregate)
+            result->value.real = SQLtdigest_Quantile(group->sketches[i], plan->fractions[i]);
+        else
+            continue;
+        if (plan->sketchColumns[i] == -1)
+            continue;
+        result = &(group->row.columns[plan->sketchColumns[i]]);
+        free(result->value.string);
+        result->value.string = SQLsketch_Encode(plan->aggregateTypes[i], group->sketches[i]);
+        SQLsetNull(&(group->row), plan->sketchColumns[i], result->value.string == NULL);
+    }
+}
+
+/* Current time in seconds, defined with the replication log */
+double SQLwal_Now(void);
+
+/* The clock is only read by one cancellation checkpoint out of this many */
+#define SQL_CANCEL_CLOCK_CHECKS 1024
+
+/*
+ * Cancellation of the executing statement, checked between the rows it reads:
+ *      requested: set by another thread to stop the statement, see CANCEL
+ *      deadline : time the statement stops at, 0 without a timeout
+ *      checks   : checkpoints passed since the clock was read
+ *      enabled  : set while a statement that may stop early executes, the
+ *                 writes always run to completion
+ *      stopped  : why the statement stopped, NULL while it runs
+ *
+ *  A stopped statement still ends its result, the rows it sent are only
+ *  a part of the result.
+ */
+struct CancelState
+{
+    int         requested;
+    double      deadline;
+    unsigned    checks;
+    int         enabled;
+    const char *stopped;
+};
+
+static struct CancelState SQLcancel;
+
+/* Timeout of the SELECT statements without a TIMEOUT clause in milliseconds, 0 for none */
+static unsigned long SQLcancel_Timeout;
+
+/*
+ * Start the cancellation checks of a statement, returns 0 if its TIMEOUT clause is invalid
+ *
+ *      `TIMEOUT:MS` stops the statement after that many milliseconds,
+ *      `TIMEOUT:0` runs it without timeout. `requested` is left alone, it
+ *      belongs to the thread cancelling the statement.
+ */
+int SQLcancel_Begin(const struct TokenList *list, int enabled)
+{
+    const char   *value;
+    char         *end;
+    unsigned long timeout;
+
+    SQLcancel.deadline = 0;
+    SQLcancel.checks   = 0;
+    SQLcancel.enabled  = 0;
+    SQLcancel.stopped  = NULL;
+    if (enabled == 0)
+        return 1;
+    timeout = SQLcancel_Timeout;
+    if ((value = SQLParser_FindClause(list, TimeoutClause)) != NULL)
+    {
+        timeout = strtoul(value, &end, 10);
+        if ((end == value) || (*end != '\0'))
+        {
+            SQLreport("usage: TIMEOUT:MILLISECONDS\n");
+            return 0;
+        }
+    }
+    if (timeout != 0)
+        SQLcancel.deadline = SQLwal_Now() + timeout / 1e3;
+    SQLcancel.enabled = 1;
+
+    return 1;
+}
+
+/* Cancellation checkpoint, returns 1 once the executing statement must stop */
+static int SQLcancel_Check(void)
+{
+    if (SQLcancel.stopped != NULL)
+        return 1;
+    if (SQLcancel.enabled == 0)
+        return 0;
+    if (__atomic_load_n(&(SQLcancel.requested), __ATOMIC_RELAXED) != 0)
+        SQLcancel.stopped = "statement cancelled";
+    else if ((SQLcancel.deadline != 0) && (++SQLcancel.checks >= SQL_CANCEL_CLOCK_CHECKS))
+    {
+        SQLcancel.checks = 0;
+        if (SQLwal_Now() >= SQLcancel.deadline)
+            SQLcancel.stopped = "statement timed out";
+    }
+    return SQLcancel.stopped != NULL;
+}
+
+/* Send every non empty group to the sink, a plan without GROUP always produces its single row */
+void SQLaggregation_Emit(struct Aggregation *aggregation, const struct ResultSink *const sink)
+{
+    struct AggregateGroup *group;
+
+    for (group = aggregation->first ; (group != NULL) && (SQLcancel_Check() == 0) ; group = group->after)
+    {
+        if ((group->count == 0) && (aggregation->plan->groupCount != 0))
+            continue;
+        SQLaggregation_Estimate(aggregation->plan, group);
+        sink->row(sink->context, &(group->row));
+    }
+}
+
+/* ResultSink callbacks to aggregate the rows */
+static void SQLaggregateSinkRow(void *context, const struct Row *const row)
+{
+    struct PlanSink       *planSink;
+    struct AggregateGroup *group;
+
+    planSink = context;
+    group    = SQLaggregation_Lookup(planSink->aggregation, row, planSink->plan->groups, 1);
+    if (group != NULL)
+        SQLaggregation_Add(planSink->aggregation, group, row);
+}
+
+static void SQLaggregateSinkEnd(void *context)
+{
+    struct PlanSink *planSink;
+
+    planSink = context;
+    SQLaggregation_Finish(planSink->aggregation);
+    SQLaggregation_Emit(planSink->aggregation, planSink->sink);
+    if (planSink->sink->end != NULL)
+        planSink->sink->end(planSink->sink->context);
+}
+
+/* Number of storage files of the table */
+size_t SQLpartitionCount(const struct TableStructureInfo *const tableStructure)
+{
+    return (tableStructure->partitionType == NoPartition) ? 1 : tableStructure->partitionCount;
+}
+
+/* Storage file name of the partition, unpartitioned tables are stored in a file named after the table */
+void SQLpartitionFile(const struct TableStructureInfo *const tableStructure, size_t partition,
+                                                              char *filename, size_t size)
+{
+    if (tableStructure->partitionType == NoPartition)
+        snprintf(filename, size, "%s", tableStructure->name);
+    else
+        snprintf(filename, size, "%s.p%u", tableStructure->name, (unsigned) partition);
+}
+
+/* Check if the values of `type` are range bounds as integers */
+static int SQLrange_IsExact(enum FieldType type)
+{
+    return (type != Number) && (type != Double);
+}
+
+/* Get the value of a numeric or temporal column as a range bound */
+static union RangeBound SQLrange_Bound(const struct Column *const column)
+{
+    union RangeBound bound;
+
+    switch (column->type)
+    {
+    case Integer:
+        bound.exact = column->value.integer;
+        break;
+    case Int64:
+        bound.exact = column->value.int64;
+        break;
+    case Decimal:
+        bound.exact = column->value.decimal;
+        break;
+    case Timestamp:
+        bound.exact = column->value.timestamp;
+        break;
+    case Date:
+        bound.exact = column->value.date;
+        break;
+    case Double:
+        bound.real = column->value.real;
+        break;
+    default:
+        bound.real = column->value.number;
+        break;
+    }
+    return bound;
+}
+
+/* Compare two range bounds, `exact` or not, returns a negative number, 0 or a positive number like strcmp() */
+static int SQLrange_Compare(int exact, union RangeBound lhs, union RangeBound rhs)
+{
+    if (exact != 0)
+        return (lhs.exact > rhs.exact) - (lhs.exact < rhs.exact);
+    return (lhs.real > rhs.real) - (lhs.real < rhs.real);
+}
+
+/* Find the partition holding `value` of the partition column */
+static size_t SQLpartitionOfValue(const struct TableStructureInfo *const tableStructure, const struct Column *const column)
+{
+    size_t i;
+
+    if (tableStructure->partitionType == HashPartition)
+        return SQLhashColumnValue(2166136261UL, column->value, column->type) % tableStructure->partitionCount;
+    if (tableStructure->partitionType == RangePartition)
+    {
+        union RangeBound value;
+        int              exact;
+
+        value = SQLrange_Bound(column);
+        exact = SQLrange_IsExact(column->type);
+        for (i = 0 ; i + 1 < tableStructure->partitionCount ; ++i)
+        {
+            if (SQLrange_Compare(exact, value, tableStructure->partitionBounds[i]) < 0)
+                return i;
+        }
+        return tableStructure->partitionCount - 1;
+    }
+    return 0;
+}
+
+/* Find the partition of the rows whose partition column is NULL, the one of the value kept in NULL columns */
+static size_t SQLpartitionOfNull(const struct TableStructureInfo *const tableStructure)
+{
+    struct Column column;
+    size_t        partition;
+
+    column.type     = tableStructure->columnTypes[tableStructure->partitionColumn];
+    column.position = tableStructure->partitionColumn;
+    column.value    = SQLnullValue(column.type);
+    partition       = SQLpartitionOfValue(tableStructure, &column);
+    if (column.type == String)
+        free(column.value.string);
+
+    return partition;
+}
+
+/* Find the partition the row must be stored in, a NULL partition column is filed like the value kept for it */
+size_t SQLpartitionOfRow(const struct TableStructureInfo *const tableStructure, const struct Row *const row)
+{
+    if (tableStructure->partitionType == NoPartition)
+        return 0;
+    return SQLpartitionOfValue(tableStructure, &(row->columns[tableStructure->partitionColumn]));
+}
+
+/* Get the condition value of a token on the partition column */
+static struct Column SQLpartitionConditionValue(const struct TableStructureInfo *const tableStructure,
+                                                                   const struct TokenList *const token)
+{
+    struct Column column;
+
+    column.type     = tableStructure->columnTypes[tableStructure->partitionColumn];
+    column.position = tableStructure->partitionColumn;
+    column.value    = SQLvalueFromStringAndType(token->value, column.type);
+
+    return column;
+}
+
+/*
+ * The bounds the conditions of a query put on one numeric column, merged into a single range:
+ *      exact               : set when the bounds are `exact`, see union RangeBound
+ *      lower, upper        : the bounds
+ *      hasLower, hasUpper  : set when the column is bounded on that side
+ *      lowerOpen, upperOpen: set when the bound itself is excluded
+ */
+struct ValueRange
+{
+    int              exact;
+    union RangeBound lower;
+    union RangeBound upper;
+    int              hasLower;
+    int              hasUpper;
+    int              lowerOpen;
+    int              upperOpen;
+};
+
+/* Narrow the range to the values `operator` keeps from `bound` */
+static void SQLrange_Narrow(struct ValueRange *range, enum Operator operator, union RangeBound bound)
+{
+    int open;
+
+    if ((operator == EqualOperator) || (operator == GreaterThanOperator) || (operator == GreaterOrEqualOperator))
+    {
+        open = (operator == GreaterThanOperator);
+        if ((range->hasLower == 0) || (SQLrange_Compare(range->exact, bound, range->lower) > 0) ||
+            ((SQLrange_Compare(range->exact, bound, range->lower) == 0) && (open != 0)))
+        {
+            range->lower     = bound;
+            range->hasLower  = 1;
+            range->lowerOpen = open;
+        }
+    }
+    if ((operator == EqualOperator) || (operator == LessThanOperator) || (operator == LessOrEqualOperator))
+    {
+        open = (operator == LessThanOperator);
+        if ((range->hasUpper == 0) || (SQLrange_Compare(range->exact, bound, range->upper) < 0) ||
+            ((SQLrange_Compare(range->exact, bound, range->upper) == 0) && (open != 0)))
+        {
+            range->upper     = bound;
+            range->hasUpper  = 1;
+            range->upperOpen = open;
+        }
+    }
+}
+
+/* Check if no value can be in the range */
+static int SQLrange_Empty(const struct ValueRange *const range)
+{
+    return (range->hasLower != 0) && (range->hasUpper != 0) &&
+           ((SQLrange_Compare(range->exact, range->lower, range->upper) > 0) ||
+            ((SQLrange_Compare(range->exact, range->lower, range->upper) == 0) &&
+             ((range->lowerOpen != 0) || (range->upperOpen != 0))));
+}
+
+/*
+ * Merge the comparisons and the compiled BETWEEN conditions of `list` on the numeric `column` into `range`
+ *
+ *      `FIELD>=10 FIELD<=20` and `BETWEEN:FIELD,10,20` give the same range.
+ *      Returns the number of merged conditions.
+ */
+static int SQLrange_Collect(const struct TokenList *list, const struct TableStructureInfo *const tableStructure,
+                                                       int column, struct ValueRange *range)
+{
+    struct Column value;
+    int           count;
+
+    memset(range, 0, sizeof(*range));
+    value.type     = tableStructure->columnTypes[column];
+    value.position = column;
+    range->exact   = SQLrange_IsExact(value.type);
+    for (count = 0, list = list->next ; list != NULL ; list = list->next)
+    {
+        if ((list->operator == AssignOperator) && (list->set != NULL) && (list->set->column == column) &&
+            (SQLParser_GetClauseType(list->keyword) == BetweenClause))
+        {
+            if (list->set->count != 2)
+            {
+                /* A BETWEEN without two bounds matches nothing */
+                memset(&(value.value), 0, sizeof(value.value));
+                SQLrange_Narrow(range, GreaterThanOperator, SQLrange_Bound(&value));
+                SQLrange_Narrow(range, LessThanOperator, SQLrange_Bound(&value));
+            }
+            else
+            {
+                value.value = list->set->values[0];
+                SQLrange_Narrow(range, GreaterOrEqualOperator, SQLrange_Bound(&value));
+                value.value = list->set->values[1];
+                SQLrange_Narrow(range, LessOrEqualOperator, SQLrange_Bound(&value));
+            }
+            count += 1;
+            continue;
+        }
+        if ((list->operator == AssignOperator) || (list->operator == NotEqualOperator) ||
+            (list->operator == InvalidOperator) || (SQLParser_FindColumn(tableStructure, list->keyword) != column))
+            continue;
+        if (SQLisNullToken(list) != 0)
+        {
+            /* A comparison with NULL matches nothing */
+            memset(&(value.value), 0, sizeof(value.value));
+            SQLrange_Narrow(range, GreaterThanOperator, SQLrange_Bound(&value));
+            SQLrange_Narrow(range, LessThanOperator, SQLrange_Bound(&value));
+        }
+        else
+        {
+            value.value = SQLvalueFromStringAndType(list->value, value.type);
+            SQLrange_Narrow(range, list->operator, SQLrange_Bound(&value));
+        }
+        count += 1;
+    }
+    return count;
+}
+
+/* Get the range of the values of RANGE partition `partition`, it holds the values in [lower, upper) */
+static void SQLpartitionRange(const struct TableStructureInfo *const tableStructure, size_t partition,
+                                                                   struct ValueRange *range)
+{
+    memset(range, 0, sizeof(*range));
+    range->exact     = SQLrange_IsExact(tableStructure->columnTypes[tableStructure->partitionColumn]);
+    range->hasLower  = (partition > 0);
+    range->hasUpper  = (partition + 1 < tableStructure->partitionCount);
+    if (range->hasLower != 0)
+        range->lower = tableStructure->partitionBounds[partition - 1];
+    if (range->hasUpper != 0)
+        range->upper = tableStructure->partitionBounds[partition];
+    range->lowerOpen = 0;
+    range->upperOpen = 1;
+}
+
+/* Check if the conditions of `list` contradict each other on a numeric column, then no row can satisfy them */
+static int SQLrangeContradiction(const struct TokenList *list, const struct TableStructureInfo *const tableStructure)
+{
+    const struct TokenList *current;
+
+    for (current = list->next ; current != NULL ; current = current->next)
+    {
+        struct ValueRange range;
+        int               column;
+
+        column = ((current->operator == AssignOperator) && (current->set != NULL)) ? current->set->column
+                                                   : SQLParser_FindColumn(tableStructure, current->keyword);
+        if ((column == -1) || ((SQLisNumericType(tableStructure->columnTypes[column]) == 0) &&
+                               (SQLisTemporalType(tableStructure->columnTypes[column]) == 0)))
+            continue;
+        if ((SQLrange_Collect(list, tableStructure, column, &range) != 0) && (SQLrange_Empty(&range) != 0))
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * Partition pruning, find the partitions that may hold rows satisfying `list`
+ *
+ *      `keep[i]` is set to 1 for the partitions that must be read, and 0 for
+ *      the ones the conditions on the partition column rule out. The bounds
+ *      on the partition column of a RANGE table are merged into a single
+ *      range first, and a compiled IN list on the partition column only
+ *      keeps the partitions of its values. Bounds contradicting each other
+ *      on any numeric column rule out every partition.
+ */
+void SQLprunePartitions(const struct TokenList *list, const struct TableStructureInfo *const tableStructure, char *keep)
+{
+    size_t count;
+    size_t i;
+
+    count = SQLpartitionCount(tableStructure);
+    memset(keep, 1, count);
+    if (list == NULL)
+        return;
+    if (SQLrangeContradiction(list, tableStructure) != 0)
+    {
+        memset(keep, 0, count);
+        return;
+    }
+    if (tableStructure->partitionType == NoPartition)
+        return;
+    if (tableStructure->partitionType == RangePartition)
+    {
+        struct ValueRange range;
+
+        if (SQLrange_Collect(list, tableStructure, tableStructure->partitionColumn, &range) != 0)
+        {
+            for (i = 0 ; i < count ; ++i)
+            {
+                struct ValueRange partition;
+
+                SQLpartitionRange(tableStructure, i, &partition);
+                /* The partition holds no value of the range when it ends before it or starts after it */
+                if (((partition.hasUpper != 0) && (range.hasLower != 0) &&
+                     (SQLrange_Compare(range.exact, range.lower, partition.upper) >= 0)) ||
+                    ((partition.hasLower != 0) && (range.hasUpper != 0) &&
+                     ((SQLrange_Compare(range.exact, range.upper, partition.lower) < 0) ||
+                      ((SQLrange_Compare(range.exact, range.upper, partition.lower) == 0) && (range.upperOpen != 0)))))
+                    keep[i] = 0;
+            }
+        }
+    }
+    for (list = list->next ; list != NULL ; list = list->next)
+    {
+        struct Column value;
+        size_t        partition;
+
+        if ((list->operator == AssignOperator) && (list->set != NULL) &&
+            (list->set->column == tableStructure->partitionColumn) &&
+            (SQLParser_GetClauseType(list->keyword) == InClause))
+        {
+            char hit[64];
+
+            memset(hit, 0, count);
+            value.type     = list->set->type;
+            value.position = list->set->column;
+            for (i = 0 ; i < list->set->count ; ++i)
+            {
+                value.value = list->set->values[i];
+                hit[SQLpartitionOfValue(tableStructure, &value)] = 1;
+            }
+            for (i = 0 ; i < count ; ++i)
+                keep[i] = keep[i] && hit[i];
+            continue;
+        }
+        /* Only equality can be mapped to a hash partition */
+        if ((tableStructure->partitionType != HashPartition) || (list->operator != EqualOperator) ||
+            (SQLParser_FindColumn(tableStructure, list->keyword) != tableStructure->partitionColumn))
+            continue;
+        value     = SQLpartitionConditionValue(tableStructure, list);
+        partition = SQLpartitionOfValue(tableStructure, &value);
+        for (i = 0 ; i < count ; ++i)
+            keep[i] = keep[i] && (i == partition);
+        if (value.type == String)
+            free(value.value.string);
+    }
+}
+
+/*
+ * Check if every row of a RANGE partition satisfies the conditions in `list`
+ *
+ *      This is true when all the conditions are ranges or BETWEEN on the
+ *      partition column, and their merged range contains the whole partition
+ *      range, then a DELETE just drops the partition file. The partition
+ *      holding the rows with a NULL partition column never is, no condition
+ *      keeps them.
+ */
+int SQLpartitionCovered(const struct TokenList *list, const struct TableStructureInfo *const tableStructure, size_t partition)
+{
+    const struct TokenList *current;
+    struct ValueRange       range;
+    struct ValueRange       bounds;
+    enum FieldType          type;
+
+    if ((list == NULL) || (tableStructure->partitionType != RangePartition) ||
+        (partition == SQLpartitionOfNull(tableStructure)))
+        return 0;
+    for (current = list->next ; current != NULL ; current = current->next)
+    {
+        if ((current->operator == AssignOperator) && (current->set != NULL) &&
+            (current->set->column == tableStructure->partitionColumn) &&
+            (SQLParser_GetClauseType(current->keyword) == BetweenClause))
+            continue;
+        if ((current->operator != GreaterThanOperator) && (current->operator != GreaterOrEqualOperator) &&
+            (current->operator != LessThanOperator) && (current->operator != LessOrEqualOperator))
+            return 0;
+        if (SQLParser_FindColumn(tableStructure, current->keyword) != tableStructure->partitionColumn)
+            return 0;
+    }
+    SQLrange_Collect(list, tableStructure, tableStructure->partitionColumn, &range);
+    SQLpartitionRange(tableStructure, partition, &bounds);
+    /* Whole numbers have no value between 19 and 20, `FIELD<=19` covers up to 20 and `FIELD>9` from 10 */
+    type = tableStructure->columnTypes[tableStructure->partitionColumn];
+    if ((type == Integer) || (type == Int64) || (type == Date))
+    {
+        if ((range.hasUpper != 0) && (range.upperOpen == 0) && (range.upper.exact < LLONG_MAX))
+            range.upper.exact += 1;
+        if ((range.hasLower != 0) && (range.lowerOpen != 0) && (range.lower.exact < LLONG_MAX))
+        {
+            range.lower.exact += 1;
+            range.lowerOpen    = 0;
+        }
+    }
+    if ((range.hasLower != 0) && ((bounds.hasLower == 0) || (SQLrange_Compare(range.exact, range.lower, bounds.lower) > 0) ||
+                                  ((SQLrange_Compare(range.exact, range.lower, bounds.lower) == 0) && (range.lowerOpen != 0))))
+        return 0;
+    if ((range.hasUpper != 0) && ((bounds.hasUpper == 0) || (SQLrange_Compare(range.exact, range.upper, bounds.upper) < 0)))
+        return 0;
+    return 1;
+}
+
+/* Move the rows of `source` to the end of `destination`, `source` is left empty */
+void SQLmoveRows(struct Table *destination, struct Table *source)
+{
+    struct Row *auxiliar;
+
+    if (destination->rowCount == 0)
+    {
+        free(destination->rows);
+        *destination     = *source;
+        source->rows     = NULL;
+        source->rowCount = 0;
+        return;
+    }
+    auxiliar = realloc(destination->rows, (destination->rowCount + source->rowCount) * sizeof(struct Row));
+    if (auxiliar == NULL)
+    {
+        SQLfreeTable(source);
+        return;
+    }
+    destination->rows = auxiliar;
+    memcpy(destination->rows + destination->rowCount, source->rows, source->rowCount * sizeof(struct Row));
+    destination->rowCount += source->rowCount;
+    free(source->rows);
+    source->rows     = NULL;
+    source->rowCount = 0;
+}
+
+/* Load the rows satisfying the conditions in `list` from every partition that may hold them */
+struct Table SQLloadTable(const struct TokenList *list, const struct TableStructureInfo *const tableStructure)
+{
+    struct Table table;
+    char         keep[64];
+    char         filename[160];
+    size_t       i;
+
+    table.rows     = NULL;
+    table.rowCount = 0;
+    if (tableStructure == NULL)
+        return table;
+    SQLprunePartitions(list, tableStructure, keep);
+    for (i = 0 ; i < SQLpartitionCount(tableStructure) ; ++i)
+    {
+        struct Table partition;
+
+        if (keep[i] == 0)
+            continue;
+        SQLpartitionFile(tableStructure, i, filename, sizeof(filename));
+        partition = SQLloadFile(list, tableStructure, filename);
+        SQLmoveRows(&table, &partition);
+    }
+    return table;
+}
+
+/* Parse the line into `row` and send it to the sink if it satisfies the conditions in `list` */
+static void SQLscanLine(char *line, const struct TokenList *list, const struct TableStructureInfo *const tableStructure,
+                                                                          const struct ResultSink *const sink)
+{
+    struct Row row;
+
+    if (SQLparseRow(line, tableStructure, &row) == 0)
+        return;
+    if ((list == NULL) || (SQLfilterRow(list, tableStructure, &row) != 0))
+        sink->row(sink->context, &row);
+    SQLfreeRow(&row);
+}
+
+/*
+ * Stream the sampled rows of one partition file to the sink
+ *
+ *      Row samples still read every line, but only parse the sampled ones.
+ *      Block samples seek to the sampled blocks and skip the others, a block
+ *      holds the lines starting in it.
+ */
+static void SQLscanSample(FILE *file, size_t partition, const struct TokenList *list,
+                          const struct TableStructureInfo *const tableStructure,
+                          const struct TableSample *const sample, const struct ResultSink *const sink)
+{
+    char  *line;
+    size_t size;
+    long   length;
+    long   position;
+    long   block;
+
+    line = NULL;
+    size = 0;
+    if (sample->blocks == 0)
+    {
+        for (position = 0 ; (SQLcancel_Check() == 0) && (getline(&line, &size, file) > 0) ; ++position)
+        {
+            if ((line[0] != SQL_TOMBSTONE) && (SQLsample_Pick(sample, partition, position) != 0))
+                SQLscanLine(line, list, tableStructure, sink);
+        }
+        free(line);
+        return;
+    }
+    fseek(file, 0, SEEK_END);
+    length = ftell(file);
+    for (block = 0 ; (block * SQL_SAMPLE_BLOCK < length) && (SQLcancel_Check() == 0) ; ++block)
+    {
+        if (SQLsample_Pick(sample, partition, block) == 0)
+            continue;
+        /* The line running over the start of the block belongs to the previous one */
+        if (block == 0)
+            fseek(file, 0, SEEK_SET);
+        else
+        {
+            fseek(file, block * SQL_SAMPLE_BLOCK - 1, SEEK_SET);
+            if ((fgetc(file) != '\n') && (getline(&line, &size, file) <= 0))
+                break;
+        }
+        while ((ftell(file) < (block + 1) * SQL_SAMPLE_BLOCK) && (SQLcancel_Check() == 0) &&
+               (getline(&line, &size, file) > 0))
+        {
+            if (line[0] != SQL_TOMBSTONE)
+                SQLscanLine(line, list, tableStructure, sink);
+        }
+    }
+    free(line);
+}
+
+/* Rows appended after a full-text index was built are scanned, until there are this many bytes of them */
+#define SQL_FULLTEXT_TAIL (256 * 1024)
+
+/*
+ * Posting list of a term while a full-text index is built:
+ *      column  : position of the indexed column
+ *      term    : the term
+ *      hash    : hash of the column and the term
+ *      bytes   : offsets of the lines holding the term, each one stored as
+ *                the difference to the previous one, in 7 bit groups with
+ *                the high bit set on all but the last group (varint)
+ *      length  : bytes used
+ *      capacity: bytes allocated
+ *      count   : number of offsets
+ *      last    : the last offset added
+ */
+struct Posting
+{
+    int            column;
+    char          *term;
+    unsigned long  hash;
+    unsigned char *bytes;
+    size_t         length;
+    size_t         capacity;
+    size_t         count;
+    long           last;
+};
+
+/*
+ * The terms of a full-text index being built, an open addressing hash table:
+ *      slots    : the posting lists, empty slots have no term
+ *      capacity : number of slots, a power of two
+ *      count    : number of terms
+ */
+struct PostingTable
+{
+    struct Posting *slots;
+    size_t          capacity;
+    size_t          count;
+};
+
+/*
+ * A term of a loaded full-text index:
+ *      column: position of the indexed column
+ *      term  : the term
+ *      count : number of offsets in its posting list
+ *      offset: position of its posting list in the index file
+ *      length: size of its posting list
+ */
+struct FullTextTerm
+{
+    int    column;
+    char  *term;
+    size_t count;
+    long   offset;
+    size_t length;
+};
+
+/*
+ * A loaded full-text index:
+ *      covered: size of the storage file when the index was built, the lines
+ *               after it are not indexed
+ *      count  : number of terms
+ *      terms  : the terms, sorted by column and term
+ */
+struct FullTextIndex
+{
+    long                 covered;
+    size_t               count;
+    struct FullTextTerm *terms;
+};
+
+/* Full-text index file name of a storage file */
+static void SQLfulltext_File(const char *const storage, char *filename, size_t size)
+{
+    snprintf(filename, size, "%s.fts", storage);
+}
+
+/* Drop the full-text index of a storage file whose lines were rewritten, the next MATCH builds it again */
+void SQLfulltext_Invalidate(const char *const storage)
+{
+    char filename[176];
+
+    SQLfulltext_File(storage, filename, sizeof(filename));
+    remove(filename);
+}
+
+/* Find the posting list of `term` in column `column`, adding an empty one if missing, returns NULL on failure */
+static struct Posting *SQLposting_Find(struct PostingTable *table, int column, const char *const term)
+{
+    unsigned long hash;
+    size_t        i;
+
+    /* Keep the table at most half full */
+    if (2 * (table->count + 1) > table->capacity)
+    {
+        struct PostingTable grown;
+
+        grown.capacity = (table->capacity == 0) ? 1024 : 2 * table->capacity;
+        grown.count    = table->count;
+        grown.slots    = calloc(grown.capacity, sizeof(struct Posting));
+        if (grown.slots == NULL)
+            return NULL;
+        for (i = 0 ; i < table->capacity ; ++i)
+        {
+            size_t slot;
+
+            if (table->slots[i].term == NULL)
+                continue;
+            for (slot = table->slots[i].hash & (grown.capacity - 1) ; grown.slots[slot].term != NULL ;
+                 slot = (slot + 1) & (grown.capacity - 1));
+            grown.slots[slot] = table->slots[i];
+        }
+        free(table->slots);
+        *table = grown;
+    }
+    hash = SQLmixHash(SQLdistinct_Hash((const unsigned char *) term, strlen(term)) ^ (unsigned long) column);
+    for (i = hash & (table->capacity - 1) ; table->slots[i].term != NULL ; i = (i + 1) & (table->capacity - 1))
+    {
+        if ((table->slots[i].hash == hash) && (table->slots[i].column == column) &&
+            (strcmp(table->slots[i].term, term) == 0))
+            return &(table->slots[i]);
+    }
+    if ((table->slots[i].term = strdup(term)) == NULL)
+        return NULL;
+    table->slots[i].column = column;
+    table->slots[i].hash   = hash;
+    table->count          += 1;
+
+    return &(table->slots[i]);
+}
+
+/* Add the line at `offset` to the posting list, once per line, returns 0 on failure */
+static int SQLposting_Add(struct Posting *posting, long offset)
+{
+    unsigned long delta;
+
+    if ((posting->count != 0) && (posting->last == offset))
+        return 1;
+    /* A varint takes at most 10 bytes */
+    if (posting->length + 10 > posting->capacity)
+    {
+        unsigned char *bytes;
+        size_t         capacity;
+
+        capacity = (posting->capacity == 0) ? 16 : 2 * posting->capacity;
+        if ((bytes = realloc(posting->bytes, capacity)) == NULL)
+            return 0;
+        posting->bytes    = bytes;
+        posting->capacity = capacity;
+    }
+    delta = offset - posting->last;
+    do
+    {
+        posting->bytes[posting->length++] = (delta & 0x7F) | ((delta >> 7) != 0 ? 0x80 : 0);
+        delta >>= 7;
+    } while (delta != 0);
+    posting->last   = offset;
+    posting->count += 1;
+
+    return 1;
+}
+
+/* Decode the `count` offsets of a posting list, returns NULL on failure */
+static long *SQLposting_Decode(const unsigned char *bytes, size_t length, size_t count)
+{
+    long  *offsets;
+    long   offset;
+    size_t used;
+    size_t i;
+
+    if ((offsets = malloc((count + 1) * sizeof(long))) == NULL)
+        return NULL;
+    offset = 0;
+    used   = 0;
+    for (i = 0 ; i < count ; ++i)
+    {
+        unsigned long delta;
+        int           shift;
+
+        delta = 0;
+        shift = 0;
+        do
+        {
+            if (used == length)
+            {
+                free(offsets);
+                return NULL;
+            }
+            delta |= (unsigned long) (bytes[used] & 0x7F) << shift;
+            shift += 7;
+        } while ((bytes[used++] & 0x80) != 0);
+        offset    += delta;
+        offsets[i] = offset;
+    }
+    return offsets;
+}
+
+/* Posting list comparison function, sorts by column and term */
+static int SQLposting_Compare(const void *const lhs, const void *const rhs)
+{
+    const struct Posting *const *left  = lhs;
+    const struct Posting *const *right = rhs;
+
+    if ((*left)->column != (*right)->column)
+        return ((*left)->column > (*right)->column) - ((*left)->column < (*right)->column);
+    return strcmp((*left)->term, (*right)->term);
+}
+
+/* Write the posting lists to the index file, then the dictionary and the footer, returns 0 on failure */
+static int SQLfulltext_Write(FILE *file, struct PostingTable *table, long covered)
+{
+    struct Posting **sorted;
+    long             offset;
+    long             dictionary;
+    size_t           count;
+    size_t           i;
+    int              status;
+
+    if ((sorted = malloc((table->count + 1) * sizeof(struct Posting *))) == NULL)
+        return 0;
+    for (count = 0, i = 0 ; i < table->capacity ; ++i)
+    {
+        if (table->slots[i].term != NULL)
+            sorted[count++] = &(table->slots[i]);
+    }
+    qsort(sorted, count, sizeof(struct Posting *), SQLposting_Compare);
+    status = 1;
+    for (i = 0 ; (status != 0) && (i < count) ; ++i)
+        status = (fwrite(sorted[i]->bytes, 1, sorted[i]->length, file) == sorted[i]->length);
+    dictionary = ftell(file);
+    for (offset = 0, i = 0 ; (status != 0) && (i < count) ; ++i)
+    {
+        size_t length;
+
+        length = strlen(sorted[i]->term);
+        if ((fwrite(&(sorted[i]->column), sizeof(sorted[i]->column), 1, file) != 1) ||
+            (fwrite(&length, sizeof(length), 1, file) != 1) ||
+            (fwrite(sorted[i]->term, 1, length, file) != length) ||
+            (fwrite(&(sorted[i]->count), sizeof(sorted[i]->count), 1, file) != 1) ||
+            (fwrite(&offset, sizeof(offset), 1, file) != 1) ||
+            (fwrite(&(sorted[i]->length), sizeof(sorted[i]->length), 1, file) != 1))
+            status = 0;
+        offset += sorted[i]->length;
+    }
+    free(sorted);
+
+    return (status != 0) && (fwrite(&covered, sizeof(covered), 1, file) == 1) &&
+           (fwrite(&count, sizeof(count), 1, file) == 1) &&
+           (fwrite(&dictionary, sizeof(dictionary), 1, file) == 1);
+}
+
+/*
+ * Build the full-text index of a storage file, returns 0 on failure
+ *
+ *      Every live line is parsed, the terms of its indexed columns are added
+ *      to their posting lists, then the index is written to a temporary file
+ *      renamed over the old index.
+ */
+int SQLfulltext_Build(const struct TableStructureInfo *const tableStructure, const char *const storage)
+{
+    struct PostingTable table;
+    char                filename[] = "__database_Temporary_XXXXXX"; /* temporary filename */
+    char                index[176];
+    char               *line;
+    size_t              size;
+    size_t              i;
+    long                offset;
+    FILE               *source;
+    FILE               *destination;
+    int                 status;
+
+    source = fopen(storage, "r");
+    if (source == NULL)
+        return 0;
+    memset(&table, 0, sizeof(table));
+    line   = NULL;
+    size   = 0;
+    status = 1;
+    for (offset = 0 ; (status != 0) && (getline(&line, &size, source) > 0) ; offset = ftell(source))
+    {
+        struct Row row;
+
+        if ((line[0] == SQL_TOMBSTONE) || (SQLparseRow(line, tableStructure, &row) == 0))
+            continue;
+        for (i = 0 ; (status != 0) && (i < tableStructure->count) ; ++i)
+        {
+            char        term[SQL_FULLTEXT_TERM + 1];
+            const char *text;
+
+            if ((tableStructure->columnIndexed[i] == 0) || (tableStructure->columnDropped[i] != 0) ||
+                (row.columns[i].type != String) || (SQLisNull(&row, i) != 0))
+                continue;
+            text = row.columns[i].value.string;
+            while ((status != 0) && (SQLfulltext_NextTerm(&text, term) != 0))
+            {
+                struct Posting *posting;
+
+                posting = SQLposting_Find(&table, i, term);
+                status  = (posting != NULL) && (SQLposting_Add(posting, offset) != 0);
+            }
+        }
+        SQLfreeRow(&row);
+    }
+    free(line);
+    if ((status != 0) && ((destination = SQLtemporaryFile(filename)) != NULL))
+    {
+        status = SQLfulltext_Write(destination, &table, offset);
+        if (fclose(destination) != 0)
+            status = 0;
+        SQLfulltext_File(storage, index, sizeof(index));
+        if (status != 0)
+            status = (rename(filename, index) == 0);
+        else
+            remove(filename);
+    }
+    else
+        status = 0;
+    fclose(source);
+    for (i = 0 ; i < table.capacity ; ++i)
+    {
+        free(table.slots[i].term);
+        free(table.slots[i].bytes);
+    }
+    free(table.slots);
+
+    return status;
+}
+
+/* Release the terms of a loaded index */
+static void SQLfulltext_Free(struct FullTextIndex *index)
+{
+    size_t i;
+
+    for (i = 0 ; i < index->count ; ++i)
+        free(index->terms[i].term);
+    free(index->terms);
+    memset(index, 0, sizeof(*index));
+}
+
+/* Read the dictionary of an index file written by SQLfulltext_Write(), returns 0 on failure */
+static int SQLfulltext_Load(FILE *file, struct FullTextIndex *index)
+{
+    long   dictionary;
+    size_t i;
+
+    memset(index, 0, sizeof(*index));
+    if ((fseek(file, -(long) (2 * sizeof(long) + sizeof(size_t)), SEEK_END) != 0) ||
+        (fread(&(index->covered), sizeof(index->covered), 1, file) != 1) ||
+        (fread(&(index->count), sizeof(index->count), 1, file) != 1) ||
+        (fread(&dictionary, sizeof(dictionary), 1, file) != 1) ||
+        (fseek(file, dictionary, SEEK_SET) != 0) ||
+        ((index->terms = calloc(index->count + 1, sizeof(struct FullTextTerm))) == NULL))
+    {
+        index->count = 0;
+        return 0;
+    }
+    for (i = 0 ; i < index->count ; ++i)
+    {
+        struct FullTextTerm *term;
+        size_t               length;
+
+        term = &(index->terms[i]);
+        if ((fread(&(term->column), sizeof(term->column), 1, file) != 1) ||
+            (fread(&length, sizeof(length), 1, file) != 1) || (length > SQL_FULLTEXT_TERM) ||
+            ((term->term = malloc(length + 1)) == NULL) ||
+            (fread(term->term, 1, length, file) != length) ||
+            (fread(&(term->count), sizeof(term->count), 1, file) != 1) ||
+            (fread(&(term->offset), sizeof(term->offset), 1, file) != 1) ||
+            (fread(&(term->length), sizeof(term->length), 1, file) != 1))
+        {
+            SQLfulltext_Free(index);
+            return 0;
+        }
+        term->term[length] = '\0';
+    }
+    return 1;
+}
+
+/* Index term comparison function, for binary search */
+static int SQLfulltext_CompareTerms(const void *const lhs, const void *const rhs)
+{
+    const struct FullTextTerm *left  = lhs;
+    const struct FullTextTerm *right = rhs;
+
+    if (left->column != right->column)
+        return (left->column > right->column) - (left->column < right->column);
+    return strcmp(left->term, right->term);
+}
+
+/* Open and load the index of a storage file of `size` bytes, rebuilding it if missing or stale, returns NULL on failure */
+static FILE *SQLfulltext_Open(const struct TableStructureInfo *const tableStructure, const char *const storage,
+                                                               long size, struct FullTextIndex *index)
+{
+    char  filename[176];
+    FILE *file;
+    int   attempt;
+
+    SQLfulltext_File(storage, filename, sizeof(filename));
+    for (attempt = 0 ; attempt < 2 ; ++attempt)
+    {
+        if ((file = fopen(filename, "r")) != NULL)
+        {
+            if ((SQLfulltext_Load(file, index) != 0) && (index->covered <= size) &&
+                (size - index->covered <= SQL_FULLTEXT_TAIL))
+                return file;
+            SQLfulltext_Free(index);
+            fclose(file);
+        }
+        if ((attempt != 0) || (SQLfulltext_Build(tableStructure, storage) == 0))
+            break;
+    }
+    return NULL;
+}
+
+/*
+ * Find the lines of the indexed part of the storage holding every term, returns their count or -1 on failure
+ *
+ *      The posting lists are intersected from the shortest one, so the work
+ *      is bounded by the rarest term.
+ */
+static long SQLfulltext_Lookup(FILE *file, const struct FullTextIndex *const index, int column, const char *terms,
+                                                                                        long **lines)
+{
+    struct FullTextTerm *found[strlen(terms) / 2 + 1];
+    struct FullTextTerm  key;
+    char                 term[SQL_FULLTEXT_TERM + 1];
+    size_t               count;
+    size_t               i;
+    size_t               j;
+    long                 matches;
+
+    *lines     = NULL;
+    key.column = column;
+    key.term   = term;
+    for (count = 0 ; SQLfulltext_NextTerm(&terms, term) != 0 ; ++count)
+    {
+        found[count] = bsearch(&key, index->terms, index->count, sizeof(struct FullTextTerm), SQLfulltext_CompareTerms);
+        /* A term missing from the index matches no indexed line */
+        if (found[count] == NULL)
+            return 0;
+        for (i = count ; (i > 0) && (found[i - 1]->count > found[i]->count) ; --i)
+        {
+            struct FullTextTerm *swap;
+
+            swap         = found[i - 1];
+            found[i - 1] = found[i];
+            found[i]     = swap;
+        }
+    }
+    if (count == 0)
+        return -1;
+    matches = 0;
+    for (i = 0 ; i < count ; ++i)
+    {
+        unsigned char *bytes;
+        long          *offsets;
+        long           kept;
+        size_t         k;
+
+        offsets = NULL;
+        if ((bytes = malloc(found[i]->length + 1)) != NULL)
+        {
+            if ((fseek(file, found[i]->offset, SEEK_SET) == 0) &&
+                (fread(bytes, 1, found[i]->length, file) == found[i]->length))
+                offsets = SQLposting_Decode(bytes, found[i]->length, found[i]->count);
+            free(bytes);
+        }
+        if (offsets == NULL)
+        {
+            free(*lines);
+            *lines = NULL;
+            return -1;
+        }
+        if (i == 0)
+        {
+            *lines  = offsets;
+            matches = found[i]->count;
+            continue;
+        }
+        /* Both lists are sorted, keep the lines found in both */
+        for (kept = 0, j = 0, k = 0 ; (j < (size_t) matches) && (k < found[i]->count) ; )
+        {
+            if ((*lines)[j] < offsets[k])
+                j++;
+            else if ((*lines)[j] > offsets[k])
+                k++;
+            else
+            {
+                (*lines)[kept++] = (*lines)[j];
+                j++;
+                k++;
+            }
+        }
+        free(offsets);
+        matches = kept;
+    }
+    return matches;
+}
+
+/* Find a MATCH condition in `list` on a column with a full-text index, returns its column or -1 (`*terms` NULL) if none */
+static int SQLfulltext_Condition(const struct TokenList *list, const struct TableStructureInfo *const tableStructure,
+                                                                                        const char **terms)
+{
+    *terms = NULL;
+    if (list == NULL)
+        return -1;
+    for (list = list->next ; list != NULL ; list = list->next)
+    {
+        char name[strlen(list->value) + 1];
+        int  column;
+
+        if ((list->operator != AssignOperator) || (SQLParser_GetClauseType(list->keyword) != MatchClause))
+            continue;
+        *terms = SQLsplitCondition(list->value, name);
+        column = SQLParser_FindColumn(tableStructure, name);
+        if ((column != -1) && (tableStructure->columnIndexed[column] != 0))
+            return column;
+    }
+    return -1;
+}
+
+/*
+ * Stream the rows of one storage file matching `list` to the sink, using the full-text index of `column`
+ *
+ *      Only the indexed lines holding every term are read, then the lines
+ *      appended since the index was built. The rows are still filtered, so
+ *      lines deleted or updated since then are skipped. Returns 0 if the
+ *      index cannot be used, then the caller scans the whole file.
+ */
+static int SQLfulltext_Scan(FILE *file, const char *const storage, int column, const char *const terms,
+                            const struct TokenList *list, const struct TableStructureInfo *const tableStructure,
+                            const struct ResultSink *const sink)
+{
+    struct FullTextIndex index;
+    FILE                *indexFile;
+    char                *line;
+    size_t               size;
+    long                *lines;
+    long                 count;
+    long                 i;
+
+    fseek(file, 0, SEEK_END);
+    if ((indexFile = SQLfulltext_Open(tableStructure, storage, ftell(file), &index)) == NULL)
+        return 0;
+    count = SQLfulltext_Lookup(indexFile, &index, column, terms, &lines);
+    fclose(indexFile);
+    if (count < 0)
+    {
+        SQLfulltext_Free(&index);
+        return 0;
+    }
+    line = NULL;
+    size = 0;
+    for (i = 0 ; (i < count) && (SQLcancel_Check() == 0) ; ++i)
+    {
+        fseek(file, lines[i], SEEK_SET);
+        if ((getline(&line, &size, file) > 0) && (line[0] != SQL_TOMBSTONE))
+            SQLscanLine(line, list, tableStructure, sink);
+    }
+    fseek(file, index.covered, SEEK_SET);
+    while ((SQLcancel_Check() == 0) && (getline(&line, &size, file) > 0))
+    {
+        if (line[0] != SQL_TOMBSTONE)
+            SQLscanLine(line, list, tableStructure, sink);
+    }
+    free(line);
+    free(lines);
+    SQLfulltext_Free(&index);
+
+    return 1;
+}
+
+/* Most LIKE conditions checked on the stored lines before they are parsed */
+#define SQL_LINE_NEEDLES 8
+
+/*
+ * Text a stored line must hold to be parsed by a scan:
+ *      count  : number of needles
+ *      needles: the longest literal of each LIKE condition
+ *      lengths: length of each needle
+ */
+struct LineFilter
+{
+    size_t      count;
+    const char *needles[SQL_LINE_NEEDLES];
+    size_t      lengths[SQL_LINE_NEEDLES];
+};
+
+/*
+ * Collect the needles of the LIKE conditions in `list`
+ *
+ *      Strings are stored unescaped, so a value matching the pattern puts its
+ *      needle in the line. The columns with a DEFAULT are skipped, the rows
+ *      stored before they were added do not hold their value.
+ */
+static void SQLlineFilter_Compile(struct LineFilter *filter, const struct TokenList *list,
+                                  const struct TableStructureInfo *const tableStructure)
+{
+    filter->count = 0;
+    if (list == NULL)
+        return;
+    for (list = list->next ; (list != NULL) && (filter->count < SQL_LINE_NEEDLES) ; list = list->next)
+    {
+        const struct LikeCondition *like;
+
+        if ((like = list->like) == NULL)
+            continue;
+        if ((like->pattern.needleLength == 0) || (tableStructure->columnDefaults[like->column][0] != '\0'))
+            continue;
+        filter->needles[filter->count] = like->pattern.needle;
+        filter->lengths[filter->count] = like->pattern.needleLength;
+        filter->count                 += 1;
+    }
+}
+
+/* Check if the line of `length` bytes holds every needle of the filter */
+static int SQLlineFilter_Pass(const struct LineFilter *const filter, const char *const line, size_t length)
+{
+    size_t i;
+
+    for (i = 0 ; i < filter->count ; ++i)
+    {
+        if (SQLsubstring_Find(line, length, filter->needles[i], filter->lengths[i]) == NULL)
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * Stream the rows of the table satisfying the conditions in `list` to the sink, only the sampled ones if not NULL
+ *
+ *      The scan stops early at the cancellation checkpoints, the sink is
+ *      still ended.
+ */
+void SQLscanTable(const struct TokenList *list, const struct TableStructureInfo *const tableStructure,
+                  const struct TableSample *const sample, const struct ResultSink *const sink)
+{
+    struct LineFilter filter;
+    FILE             *file;
+    char              keep[64];
+    char              filename[160];
+    const char       *terms;
+    char             *line;
+    size_t            size;
+    ssize_t           length;
+    int               indexed;
+    size_t            i;
+
+    if (sink->begin != NULL)
+        sink->begin(sink->context, tableStructure);
+    /* A MATCH on a column with a full-text index only reads the lines holding its terms */
+    indexed = SQLfulltext_Condition(list, tableStructure, &terms);
+    /* LIKE conditions skip the lines without their literal text before parsing them */
+    SQLlineFilter_Compile(&filter, list, tableStructure);
+    line = NULL;
+    size = 0;
+    /* Only read the partitions that may hold matching rows */
+    SQLprunePartitions(list, tableStructure, keep);
+    for (i = 0 ; (i < SQLpartitionCount(tableStructure)) && (SQLcancel_Check() == 0) ; ++i)
+    {
+        if (keep[i] == 0)
+            continue;
+        /* Open the table file storage, a missing file is just an empty table */
+        SQLpartitionFile(tableStructure, i, filename, sizeof(filename));
+        file = fopen(filename, "r");
+        if (file == NULL)
+            continue;
+        if ((sample != NULL) && (sample->percent < 100))
+        {
+            SQLscanSample(file, i, list, tableStructure, sample, sink);
+            fclose(file);
+            continue;
+        }
+        if ((indexed != -1) && (SQLfulltext_Scan(file, filename, indexed, terms, list, tableStructure, sink) != 0))
+        {
+            fclose(file);
+            continue;
+        }
+        rewind(file);
+        while ((SQLcancel_Check() == 0) && ((length = getline(&line, &size, file)) > 0))
+        {
+            if ((line[0] != SQL_TOMBSTONE) && (SQLlineFilter_Pass(&filter, line, length) != 0))
+                SQLscanLine(line, list, tableStructure, sink);
+        }
+        fclose(file);
+    }
+    free(line);
+    if (sink->end != NULL)
+        sink->end(sink->context);
+}
+
+/*
+ * Run a planned select, streaming the result rows to the sink
+ *
+ *      The plan is applied by wrapping the sink, so rows are projected or
+ *      aggregated as they are read from the storage, and DISTINCT rows are
+ *      only sent the first time they are seen.
+ */
+void SQLexecutePlan(const struct TokenList *list, const struct TableStructureInfo *const tableStructure,
+                    const struct SelectPlan *const plan, const struct ResultSink *sink)
+{
+    struct Aggregation  aggregation;
+    struct PlanSink     planSink;
+    struct DistinctSink distinct;
+    struct ResultSink   distinctSink;
+    struct ResultSink   wrapper;
+
+    if (plan->distinct != 0)
+    {
+        if (SQLdistinctSink_Init(&distinct, &distinctSink, sink, &(plan->result)) == 0)
+        {
+            SQLdistinctSink_Free(&distinct);
+            return;
+        }
+        sink = &distinctSink;
+    }
+    planSink.plan        = plan;
+    planSink.sink        = sink;
+    planSink.aggregation = NULL;
+    wrapper.context      = &planSink;
+    wrapper.begin        = SQLprojectSinkBegin;
+    if ((plan->groupCount != 0) || (plan->aggregateCount != 0))
+    {
+        if (SQLaggregation_Init(&aggregation, plan) == 0)
+            return;
+        /* Without GROUP there is exactly one result row, even for an empty table */
+        if ((plan->groupCount == 0) && (SQLaggregation_Lookup(&aggregation, NULL, NULL, 1) == NULL))
+        {
+            SQLaggregation_Free(&aggregation);
+            return;
+        }
+        planSink.aggregation = &aggregation;
+        wrapper.row          = SQLaggregateSinkRow;
+        wrapper.end          = SQLaggregateSinkEnd;
+        SQLscanTable(list, tableStructure, &(plan->sample), &wrapper);
+        SQLaggregation_Free(&aggregation);
+    }
+    else if (plan->fieldCount != 0)
+    {
+        /* The projected values are borrowed from the scanned rows, only the columns are released */
+        if (SQLallocRow(&(planSink.projected), plan->fieldCount) == 0)
+            return;
+        wrapper.row = SQLprojectSinkRow;
+        wrapper.end = SQLprojectSinkEnd;
+        SQLscanTable(list, tableStructure, &(plan->sample), &wrapper);
+        free(planSink.projected.columns);
+    }
+    else
+        SQLscanTable(list, tableStructure, &(plan->sample), sink);
+    if (plan->distinct != 0)
+        SQLdistinctSink_Free(&distinct);
+}
+
+/*
+ * The sql select function
+ *
+ *      Rows are streamed from the storage file to the sink one at a time, so
+ *      the result set never has to be held in memory.
+ */
+void SQLselect(const struct TokenList *list, const struct TableStructureInfo *const tableStructure,
+                                                          const struct ResultSink *const sink)
+{
+    struct SelectPlan *plan;
+
+    if ((tableStructure == NULL) || (sink == NULL))
+        return;
+    plan = malloc(sizeof(struct SelectPlan));
+    if (plan == NULL)
+        return;
+    if (SQLplanSelect(list, tableStructure, plan, 0) != 0)
+        SQLexecutePlan(list, tableStructure, plan, sink);
+    SQLplanFree(plan);
+    free(plan);
+}
+
+/* Materialized view maintenance, defined with the views below */
+int  SQLview_HasViews(const char *const table);
+void SQLview_ApplyDelta(const char *const table, const struct Table *const deleted, const struct Table *const inserted);
+
+/* Append a copy of the row to the table, returns 0 on failure */
+int SQLappendRow(struct Table *table, const struct Row *const row)
+{
+    struct Row *auxiliar;
+
+    auxiliar = realloc(table->rows, (1 + table->rowCount) * sizeof(struct Row));
+    if (auxiliar == NULL)
+        return 0;
+    table->rows = auxiliar;
+    if (SQLcopyRow(&(table->rows[table->rowCount]), row) == 0)
+        return 0;
+    table->rowCount += 1;
+
+    return 1;
+}
+
+/* Maximum number of storage files whose dead rows are tracked for the vacuum */
+#define SQL_VACUUM_FILES 256
+
+/*
+ * Dead space of one storage file:
+ *      storage   : the file name
+ *      deadBytes : bytes used by deleted rows
+ *      size      : file size when the dead bytes were counted
+ *      generation: incremented by every change other than appending rows,
+ *                  a compaction started before the change is discarded
+ */
+struct VacuumFile
+{
+    char          storage[160];
+    long          deadBytes;
+    long          size;
+    unsigned long generation;
+};
+
+/* Storage files with deleted rows, compacted in the background */
+struct VacuumState
+{
+    size_t            count;
+    struct VacuumFile files[SQL_VACUUM_FILES];
+};
+
+/* The dead rows registry, shared by every query */
+static struct VacuumState SQLvacuum;
+
+/* Find the registry entry of `storage`, creating it (maybe replacing the entry with the least dead bytes) if needed */
+struct VacuumFile *SQLvacuum_Find(const char *const storage, int create)
+{
+    struct VacuumFile *entry;
+    size_t             i;
+
+    entry = NULL;
+    for (i = 0 ; i < SQLvacuum.count ; ++i)
+    {
+        if (strcmp(SQLvacuum.files[i].storage, storage) == 0)
+            return &(SQLvacuum.files[i]);
+        if ((entry == NULL) || (SQLvacuum.files[i].deadBytes < entry->deadBytes))
+            entry = &(SQLvacuum.files[i]);
+    }
+    if (create == 0)
+        return NULL;
+    if (SQLvacuum.count < SQL_VACUUM_FILES)
+        entry = &(SQLvacuum.files[SQLvacuum.count++]);
+    snprintf(entry->storage, sizeof(entry->storage), "%s", storage);
+    entry->deadBytes  = 0;
+    entry->size       = 0;
+    entry->generation = 0;
+
+    return entry;
+}
+
+/* Record the dead bytes of `storage` after a delete */
+void SQLvacuum_Record(const char *const storage, long deadBytes, long size)
+{
+    struct VacuumFile *entry;
+
+    entry             = SQLvacuum_Find(storage, 1);
+    entry->deadBytes  = deadBytes;
+    entry->size       = size;
+    entry->generation += 1;
+}
+
+/* `storage` was rewritten without dead rows, or removed */
+void SQLvacuum_Rewritten(const char *const storage)
+{
+    struct VacuumFile *entry;
+
+    SQLfulltext_Invalidate(storage);
+    if ((entry = SQLvacuum_Find(storage, 0)) == NULL)
+        return;
+    entry->deadBytes  = 0;
+    entry->generation += 1;
+}
+
+/*
+ * Delete the matching rows from one storage file, keeping a copy in `deleted` if not NULL, returns 0 on failure
+ *
+ *      The rows are only marked dead in place, once every row has been checked,
+ *      the vacuum reclaims their space in the background.
+ */
+static int SQLdeleteFromFile(struct TokenList *list, const struct TableStructureInfo *const tableStructure,
+                                              const char *const storage, struct Table *deleted)
+{
+    struct Row  row;
+    long       *offsets;
+    long       *auxiliar;
+    long        offset;
+    long        live;
+    size_t      count;
+    size_t      i;
+    FILE       *file;
+
+    /* Open the storage file, a missing file has no rows to delete */
+    file = fopen(storage, "r+");
+    if (file == NULL)
+        return 1;
+    offsets = NULL;
+    count   = 0;
+    live    = 0;
+    while (SQLreadRowAt(file, tableStructure, &row, &offset) != 0)
+    {
+        /* If row is invalid, abort the operation */
+        if (SQLisValidRow(list->next, tableStructure, &row) == 0)
+            goto abort;
+        /* If the row does not satisfy the condition, it stays alive */
+        if (SQLfilterRow(list, tableStructure, &row) == 0)
+        {
+            live += ftell(file) - offset;
+            SQLfreeRow(&row);
+            continue;
+        }
+        if ((deleted != NULL) && (SQLappendRow(deleted, &row) == 0))
+            goto abort;
+        auxiliar = realloc(offsets, (count + 1) * sizeof(long));
+        if (auxiliar == NULL)
+            goto abort;
+        offsets          = auxiliar;
+        offsets[count++] = offset;
+        SQLfreeRow(&row);
+    }
+    /* Every row was checked, mark the deleted ones */
+    if (count != 0)
+        SQLvacuum_Record(storage, ftell(file) - live, ftell(file));
+    for (i = 0 ; i < count ; ++i)
+    {
+        fseek(file, offsets[i], SEEK_SET);
+        fputc(SQL_TOMBSTONE, file);
+    }
+    fclose(file);
+    free(offsets);
+
+    return 1;
+
+abort:
+    SQLfreeRow(&row);
+    fclose(file);
+    free(offsets);
+
+    return 0;
+}
+
+/*
+ * The sql delete function
+ *
+ *      Only the partitions that may hold matching rows are rewritten, and a
+ *      RANGE partition whose rows all match is dropped without reading it.
+ */
+void SQLdelete(struct TokenList *list, const struct TableStructureInfo *const tableStructure)
+{
+    struct Table deleted;
+    char         keep[64];
+    char         storage[160];
+    size_t       i;
+    int          views;
+
+    if (tableStructure == NULL)
+        return;
+    /* Deleted rows are only kept when there are views to maintain */
+    views            = SQLview_HasViews(tableStructure->name);
+    deleted.rows     = NULL;
+    deleted.rowCount = 0;
+    SQLprunePartitions(list, tableStructure, keep);
+    for (i = 0 ; i < SQLpartitionCount(tableStructure) ; ++i)
+    {
+        if (keep[i] == 0)
+            continue;
+        SQLpartitionFile(tableStructure, i, storage, sizeof(storage));
+        if (SQLpartitionCovered(list, tableStructure, i) != 0)
+        {
+            struct Table partition;
+
+            if (views != 0)
+            {
+                partition = SQLloadFile(NULL, tableStructure, storage);
+                SQLmoveRows(&deleted, &partition);
+            }
+            remove(storage);
+            SQLvacuum_Rewritten(storage);
+        }
+        else if (SQLdeleteFromFile(list, tableStructure, storage, (views != 0) ? &deleted : NULL) == 0)
+            break;
+    }
+    if (deleted.rowCount != 0)
+        SQLview_ApplyDelta(tableStructure->name, &deleted, NULL);
+    SQLfreeTable(&deleted);
+}
+
+/* Maximum number of steps of one compiled UPDATE expression */
+#define SQL_UPDATE_STEPS 64
+
+/* Instructions of a compiled UPDATE expression, run on a stack of numbers */
+enum UpdateInstruction
+{
+    PushConstant,
+    PushColumn,
+    AddInstruction,
+    SubtractInstruction,
+    MultiplyInstruction,
+    DivideInstruction,
+    NegateInstruction
+};
+
+/*
+ * Arithmetic an UPDATE expression is evaluated with:
+ *      RealArithmetic   : doubles, when a NUMBER or DOUBLE column, a constant
+ *                         with more fractional digits than DECIMAL, or the
+ *                         assigned column need them
+ *      IntegerArithmetic: exact 64-bit integers, divisions truncate, for
+ *                         INTEGER and INT64 columns assigned integer operands
+ *      DecimalArithmetic: exact DECIMAL units, products and quotients are
+ *                         rounded to the nearest unit
+ */
+enum UpdateArithmetic
+{
+    RealArithmetic,
+    IntegerArithmetic,
+    DecimalArithmetic
+};
+
+/*
+ * One step of a compiled expression, the operand of the Push instructions is `column` or the constant:
+ *      constant: the constant as a double
+ *      integer : the constant as an integer, when it has no fractional digit
+ *      units   : the constant in DECIMAL units, when it has few enough fractional digits
+ *      exact   : the most exact arithmetic the constant can be used with
+ */
+struct UpdateStep
+{
+    enum UpdateInstruction instruction;
+    int                    column;
+    double                 constant;
+    long long              integer;
+    long long              units;
+    enum UpdateArithmetic  exact;
+};
+
+/*
+ * One assignment of an UPDATE:
+ *      name      : name of the assigned column, as written in the query
+ *      column    : the assigned column
+ *      type      : the type of the assigned column
+ *      value     : the assigned literal value, when there are no steps
+ *      null      : set when the assigned literal is NULL
+ *      arithmetic: the arithmetic the expression is evaluated with
+ *      steps     : the expression, in postfix order
+ *      stepCount : number of steps of the expression
+ */
+struct UpdateAssignment
+{
+    const char           *name;
+    int                   column;
+    enum FieldType        type;
+    union Value           value;
+    int                   null;
+    enum UpdateArithmetic arithmetic;
+    size_t                stepCount;
+    struct UpdateStep     steps[SQL_UPDATE_STEPS];
+};
+
+/* The assignments of an UPDATE, compiled once and applied to every matching row */
+struct UpdateProgram
+{
+    size_t                   count;
+    struct UpdateAssignment *assignments;
+};
+
+/* Append one step to the expression, returns 0 if it is too long */
+static int SQLupdate_Emit(struct UpdateAssignment *assignment, enum UpdateInstruction instruction,
+                                                                 int column, double constant)
+{
+    struct UpdateStep *step;
+
+    if (assignment->stepCount == SQL_UPDATE_STEPS)
+        return 0;
+    step              = &(assignment->steps[assignment->stepCount++]);
+    step->instruction = instruction;
+    step->column      = column;
+    step->constant    = constant;
+    step->integer     = 0;
+    step->units       = 0;
+    step->exact       = RealArithmetic;
+
+    return 1;
+}
+
+/* Compile the number constant at `*source` */
+static int SQLupdate_CompileConstant(const char **source, struct UpdateAssignment *assignment)
+{
+    struct UpdateStep *step;
+    const char        *query;
+    const char        *point;
+    const char        *exponent;
+    char              *stop;
+    char              *end;
+    double             constant;
+    long               digits;
+
+    query    = *source;
+    constant = strtod(query, &end);
+    *source  = end;
+    if (SQLupdate_Emit(assignment, PushConstant, 0, constant) == 0)
+        return 0;
+    step = &(assignment->steps[assignment->stepCount - 1]);
+    /* Exponents and long fractions are only exact as doubles */
+    for (point = query ; (point < end) && (*point != '.') ; ++point);
+    for (exponent = query ; (exponent < end) && (*exponent != 'e') && (*exponent != 'E') ; ++exponent);
+    digits = (point < end) ? end - point - 1 : 0;
+    if ((exponent < end) || (digits > SQL_DECIMAL_DIGITS))
+        return 1;
+    errno         = 0;
+    step->integer = strtoll(query, &stop, 10);
+    if ((errno == ERANGE) || (stop != point))
+        return 1;
+    if (digits == 0)
+        step->exact = IntegerArithmetic;
+    /* Larger integers have no DECIMAL units */
+    if (step->integer > LLONG_MAX / SQL_DECIMAL_SCALE)
+        return 1;
+    step->units = SQLdecimalFromString(query, NULL);
+    if (digits != 0)
+        step->exact = DecimalArithmetic;
+
+    return 1;
+}
+
+static int SQLupdate_CompileSum(const char **source, const struct TableStructureInfo *const tableStructure,
+                                                            struct UpdateAssignment *assignment);
+
+/* Compile a number, a numeric column, a negation or a parenthesized expression */
+static int SQLupdate_CompileFactor(const char **source, const struct TableStructureInfo *const tableStructure,
+                                                               struct UpdateAssignment *assignment)
+{
+    const char *query;
+    size_t      length;
+    int         index;
+
+    query = *source;
+    if (*query == '-')
+    {
+        *source = query + 1;
+        return SQLupdate_CompileFactor(source, tableStructure, assignment) &&
+               SQLupdate_Emit(assignment, NegateInstruction, 0, 0);
+    }
+    if (*query == '(')
+    {
+        *source = query + 1;
+        if ((SQLupdate_CompileSum(source, tableStructure, assignment) == 0) || (**source != ')'))
+            return 0;
+        *source += 1;
+        return 1;
+    }
+    if ((isdigit(*query) != 0) || (*query == '.'))
+        return SQLupdate_CompileConstant(source, assignment);
+    /* Otherwise a column name */
+    for (length = 0 ; (isalnum(query[length]) != 0) || (query[length] == '_') ; ++length);
+    if (length == 0)
+        return 0;
+    {
+        char name[length + 1];
+
+        memcpy(name, query, length);
+        name[length] = '\0';
+        index        = SQLParser_FindColumn(tableStructure, name);
+    }
+    if ((index == -1) || (SQLisNumericType(tableStructure->columnTypes[index]) == 0))
+        return 0;
+    *source = query + length;
+
+    return SQLupdate_Emit(assignment, PushColumn, index, 0);
+}
+
+/* Compile a product or quotient of factors */
+static int SQLupdate_CompileProduct(const char **source, const struct TableStructureInfo *const tableStructure,
+                                                                struct UpdateAssignment *assignment)
+{
+    if (SQLupdate_CompileFactor(source, tableStructure, assignment) == 0)
+        return 0;
+    while ((**source == '*') || (**source == '/'))
+    {
+        enum UpdateInstruction instruction;
+
+        instruction = (**source == '*') ? MultiplyInstruction : DivideInstruction;
+        *source    += 1;
+        if ((SQLupdate_CompileFactor(source, tableStructure, assignment) == 0) ||
+            (SQLupdate_Emit(assignment, instruction, 0, 0) == 0))
+            return 0;
+    }
+    return 1;
+}
+
+/* Compile a sum or difference of products */
+static int SQLupdate_CompileSum(const char **source, const struct TableStructureInfo *const tableStructure,
+                                                            struct UpdateAssignment *assignment)
+{
+    if (SQLupdate_CompileProduct(source, tableStructure, assignment) == 0)
+        return 0;
+    while ((**source == '+') || (**source == '-'))
+    {
+        enum UpdateInstruction instruction;
+
+        instruction = (**source == '+') ? AddInstruction : SubtractInstruction;
+        *source    += 1;
+        if ((SQLupdate_CompileProduct(source, tableStructure, assignment) == 0) ||
+            (SQLupdate_Emit(assignment, instruction, 0, 0) == 0))
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * Choose the most exact arithmetic able to evaluate the compiled expression
+ *
+ *      INTEGER and INT64 columns are assigned integer results when every
+ *      operand is an integer, and the DECIMAL result truncated when some
+ *      operand has a fraction DECIMAL can hold exactly.
+ */
+static void SQLupdate_ChooseArithmetic(const struct TableStructureInfo *const tableStructure,
+                                       struct UpdateAssignment *assignment)
+{
+    size_t i;
+
+    if ((assignment->type != Integer) && (assignment->type != Int64) && (assignment->type != Decimal))
+    {
+        assignment->arithmetic = RealArithmetic;
+        return;
+    }
+    assignment->arithmetic = (assignment->type == Decimal) ? DecimalArithmetic : IntegerArithmetic;
+    for (i = 0 ; i < assignment->stepCount ; ++i)
+    {
+        const struct UpdateStep *step;
+        enum UpdateArithmetic    exact;
+
+        step  = &(assignment->steps[i]);
+        exact = assignment->arithmetic;
+        if (step->instruction == PushConstant)
+            exact = step->exact;
+        else if (step->instruction == PushColumn)
+        {
+            switch (tableStructure->columnTypes[step->column])
+            {
+            case Integer:
+            case Int64:
+                exact = IntegerArithmetic;
+                break;
+            case Decimal:
+                exact = DecimalArithmetic;
+                break;
+            default:
+                exact = RealArithmetic;
+                break;
+            }
+        }
+        /* Integers are exact DECIMAL operands, fractions need DECIMAL, anything else doubles */
+        if (exact == RealArithmetic)
+        {
+            assignment->arithmetic = RealArithmetic;
+            return;
+        }
+        if (exact == DecimalArithmetic)
+            assignment->arithmetic = DecimalArithmetic;
+    }
+}
+
+/*
+ * Compile the assignments of an UPDATE, returns 0 on failure
+ *
+ *      A numeric column can be assigned an arithmetic expression of numbers and
+ *      numeric columns (`+ - * /` and parentheses, no spaces), like
+ *      `COUNT:COUNT+1` or `PRICE:PRICE*1.1`, other values are literals.
+ *      An expression reading a NULL column makes the column NULL.
+ */
+int SQLupdate_Compile(const struct TokenList *list, const struct TableStructureInfo *const tableStructure,
+                                                              struct UpdateProgram *program)
+{
+    const struct TokenList *current;
+    size_t                  count;
+
+    /* Every token may be an assignment */
+    for (count = 0, current = list ; current != NULL ; current = current->next)
+        count += 1;
+    program->count       = 0;
+    program->assignments = malloc((count + 1) * sizeof(struct UpdateAssignment));
+    if (program->assignments == NULL)
+        return 0;
+    for ( ; list != NULL ; list = list->next)
+    {
+        struct UpdateAssignment *assignment;
+        enum FieldType           type;
+        const char              *source;
+        char                    *end;
+        int                      index;
+
+        if ((list->operator != AssignOperator) || (SQLisColumnCondition(SQLParser_GetClauseType(list->keyword)) != 0))
+            continue;
+        if ((index = SQLParser_FindColumn(tableStructure, list->keyword)) == -1)
+        {
+            SQLreport("no column `%s` in table `%s`\n", list->keyword, tableStructure->name);
+            return 0;
+        }
+        type                  = tableStructure->columnTypes[index];
+        assignment            = &(program->assignments[program->count++]);
+        assignment->name      = list->keyword;
+        assignment->column    = index;
+        assignment->type      = type;
+        assignment->null      = SQLisNullToken(list);
+        assignment->stepCount = 0;
+        if (assignment->null != 0)
+        {
+            assignment->value = SQLnullValue(type);
+            continue;
+        }
+        if (SQLisNumericType(type) == 0)
+        {
+            assignment->value = SQLvalueFromStringAndType(list->value, type);
+            continue;
+        }
+        /* Plain numbers are literals, anything else is an expression */
+        strtod(list->value, &end);
+        if ((end != list->value) && (*end == '\0'))
+        {
+            assignment->value = SQLvalueFromStringAndType(list->value, type);
+            continue;
+        }
+        source = list->value;
+        if ((SQLupdate_CompileSum(&source, tableStructure, assignment) == 0) || (*source != '\0'))
+        {
+            SQLreport("invalid expression `%s` for column `%s`\n", list->value, list->keyword);
+            return 0;
+        }
+        SQLupdate_ChooseArithmetic(tableStructure, assignment);
+    }
+    return 1;
+}
+
+/* Release the literal values of the program */
+void SQLupdate_Free(struct UpdateProgram *program)
+{
+    size_t i;
+
+    for (i = 0 ; i < program->count ; ++i)
+    {
+        struct UpdateAssignment *assignment;
+
+        assignment = &(program->assignments[i]);
+        if ((assignment->stepCount == 0) && (assignment->type == String))
+            free(assignment->value.string);
+    }
+    free(program->assignments);
+    program->assignments = NULL;
+    program->count       = 0;
+}
+
+/* Round the quotient of two 128-bit integers to the nearest integer, halves away from zero */
+static __int128 SQLupdate_RoundedQuotient(__int128 numerator, __int128 denominator)
+{
+    __int128 quotient;
+    __int128 remainder;
+
+    quotient  = numerator / denominator;
+    remainder = numerator % denominator;
+    if (remainder < 0)
+        remainder = -remainder;
+    if (2 * remainder >= ((denominator < 0) ? -denominator : denominator))
+        quotient += ((numerator < 0) == (denominator < 0)) ? 1 : -1;
+
+    return quotient;
+}
+
+/*
+ * Apply one binary instruction to exact operands, DECIMAL ones are in units,
+ * returns 0 on success, 1 for a division by zero and 2 for an overflow
+ */
+static int SQLupdate_ExactOperation(enum UpdateInstruction instruction, enum UpdateArithmetic arithmetic,
+                                                                long long *lhs, long long rhs)
+{
+    __int128 result;
+
+    switch (instruction)
+    {
+    case AddInstruction:
+        return (__builtin_add_overflow(*lhs, rhs, lhs) != 0) ? 2 : 0;
+    case SubtractInstruction:
+        return (__builtin_sub_overflow(*lhs, rhs, lhs) != 0) ? 2 : 0;
+    case MultiplyInstruction:
+        if (arithmetic == IntegerArithmetic)
+            return (__builtin_mul_overflow(*lhs, rhs, lhs) != 0) ? 2 : 0;
+        result = SQLupdate_RoundedQuotient((__int128) *lhs * rhs, SQL_DECIMAL_SCALE);
+        break;
+    case DivideInstruction:
+        if (rhs == 0)
+            return 1;
+        if (arithmetic == IntegerArithmetic)
+        {
+            if ((*lhs == LLONG_MIN) && (rhs == -1))
+                return 2;
+            *lhs /= rhs;
+            return 0;
+        }
+        result = SQLupdate_RoundedQuotient((__int128) *lhs * SQL_DECIMAL_SCALE, rhs);
+        break;
+    default:
+        return 0;
+    }
+    if ((result < LLONG_MIN) || (result > LLONG_MAX))
+        return 2;
+    *lhs = (long long) result;
+
+    return 0;
+}
+
+/* Evaluate a compiled expression with exact arithmetic, returns -1 when it reads a NULL column */
+static int SQLupdate_EvaluateExact(const struct UpdateAssignment *const assignment, const struct Row *const row,
+                                                                                    long long *value)
+{
+    long long stack[SQL_UPDATE_STEPS];
+    long long scale;
+    size_t    top;
+    size_t    i;
+    int       status;
+
+    /* Integers are scaled to DECIMAL units when the expression holds decimals */
+    scale = (assignment->arithmetic == DecimalArithmetic) ? SQL_DECIMAL_SCALE : 1;
+    top   = 0;
+    for (i = 0 ; i < assignment->stepCount ; ++i)
+    {
+        const struct UpdateStep *step;
+        const struct Column     *column;
+
+        step = &(assignment->steps[i]);
+        switch (step->instruction)
+        {
+        case PushConstant:
+            if (step->exact == DecimalArithmetic)
+                stack[top++] = step->units;
+            else if (__builtin_mul_overflow(step->integer, scale, &(stack[top++])) != 0)
+                return 2;
+            break;
+        case PushColumn:
+            if (SQLisNull(row, step->column) != 0)
+                return -1;
+            column = &(row->columns[step->column]);
+            if (column->type == Decimal)
+                stack[top++] = column->value.decimal;
+            else if (__builtin_mul_overflow((column->type == Integer) ? column->value.integer : column->value.int64,
+                                            scale, &(stack[top++])) != 0)
+                return 2;
+            break;
+        case NegateInstruction:
+            if (stack[top - 1] == LLONG_MIN)
+                return 2;
+            stack[top - 1] = -stack[top - 1];
+            break;
+        default:
+            top -= 1;
+            status = SQLupdate_ExactOperation(step->instruction, assignment->arithmetic,
+                                              &(stack[top - 1]), stack[top]);
+            if (status != 0)
+                return status;
+            break;
+        }
+    }
+    *value = stack[0];
+
+    return 0;
+}
+
+/* Evaluate a compiled expression with doubles, returns -1 when it reads a NULL column */
+static int SQLupdate_EvaluateReal(const struct UpdateAssignment *const assignment, const struct Row *const row,
+                                                                                   double *value)
+{
+    double stack[SQL_UPDATE_STEPS];
+    size_t top;
+    size_t i;
+
+    top = 0;
+    for (i = 0 ; i < assignment->stepCount ; ++i)
+    {
+        const struct UpdateStep *step;
+
+        step = &(assignment->steps[i]);
+        switch (step->instruction)
+        {
+        case PushConstant:
+            stack[top++] = step->constant;
+            break;
+        case PushColumn:
+            if (SQLisNull(row, step->column) != 0)
+                return -1;
+            stack[top++] = SQLnumericValue(&(row->columns[step->column]));
+            break;
+        case AddInstruction:
+            top            -= 1;
+            stack[top - 1] += stack[top];
+            break;
+        case SubtractInstruction:
+            top            -= 1;
+            stack[top - 1] -= stack[top];
+            break;
+        case MultiplyInstruction:
+            top            -= 1;
+            stack[top - 1] *= stack[top];
+            break;
+        case DivideInstruction:
+            top -= 1;
+            if (stack[top] == 0)
+                return 1;
+            stack[top - 1] /= stack[top];
+            break;
+        case NegateInstruction:
+            stack[top - 1] = -stack[top - 1];
+            break;
+        }
+    }
+    *value = stack[0];
+
+    return (isfinite(*value) != 0) ? 0 : 2;
+}
+
+/* Convert the result of a real expression to the assigned type, returns 0 when it is out of its range */
+static int SQLupdate_StoreReal(enum FieldType type, double real, union Value *value)
+{
+    /* 2^63 is exact as a double, unlike LLONG_MAX */
+    static const double limit = 9223372036854775808.0;
+
+    switch (type)
+    {
+    case Integer:
+        if ((real <= (double) INT_MIN - 1) || (real >= (double) INT_MAX + 1))
+            return 0;
+        value->integer = real;
+        return 1;
+    case Int64:
+        if ((real < -limit) || (real >= limit))
+            return 0;
+        value->int64 = real;
+        return 1;
+    case Decimal: /* rounded to the nearest unit */
+        real *= SQL_DECIMAL_SCALE;
+        if ((real < -limit) || (real >= limit))
+            return 0;
+        value->decimal = real + ((real < 0) ? -0.5 : 0.5);
+        return 1;
+    case Double:
+        value->real = real;
+        return 1;
+    default:
+        if (fabs(real) > FLT_MAX)
+            return 0;
+        value->number = real;
+        return 1;
+    }
+}
+
+/*
+ * Evaluate a compiled expression on the row into `value`, of the type of the assigned column
+ *
+ *      INTEGER and INT64 results of DECIMAL arithmetic are truncated like
+ *      the quotients of integer arithmetic. Returns 1 on success, 0 when the
+ *      expression reads a NULL column and -1 (after printing why) for a
+ *      division by zero or a result out of the range of the column.
+ */
+static int SQLupdate_Evaluate(const struct UpdateAssignment *const assignment, const struct Row *const row,
+                                                                                    union Value *value)
+{
+    long long exact;
+    double    real;
+    int       status;
+
+    if (assignment->arithmetic == RealArithmetic)
+    {
+        status = SQLupdate_EvaluateReal(assignment, row, &real);
+        if ((status == 0) && (SQLupdate_StoreReal(assignment->type, real, value) == 0))
+            status = 2;
+    }
+    else
+    {
+        status = SQLupdate_EvaluateExact(assignment, row, &exact);
+        if ((status == 0) && (assignment->arithmetic == DecimalArithmetic) && (assignment->type != Decimal))
+            exact /= SQL_DECIMAL_SCALE;
+        if ((status == 0) && (assignment->type == Integer) && ((exact < INT_MIN) || (exact > INT_MAX)))
+            status = 2;
+        if (status == 0)
+        {
+            if (assignment->type == Integer)
+                value->integer = exact;
+            else if (assignment->type == Int64)
+                value->int64 = exact;
+            else
+                value->decimal = exact;
+        }
+    }
+    switch (status)
+    {
+    case -1:
+        return 0;
+    case 0:
+        return 1;
+    case 1:
+        SQLreport("division by zero in the expression of column `%s`\n", assignment->name);
+        return -1;
+    default:
+        SQLreport("overflow in the expression of column `%s`\n", assignment->name);
+        return -1;
+    }
+}
+
+/*
+ * Apply the program to the row, every expression reads the values from before the update
+ *
+ *      Returns 0, leaving the row unchanged, when an expression fails.
+ */
+int SQLupdate_Apply(const struct UpdateProgram *const program, struct Row *const row)
+{
+    union Value values[program->count + 1];
+    int         nulls[program->count + 1];
+    size_t      i;
+
+    for (i = 0 ; i < program->count ; ++i)
+    {
+        int status;
+
+        nulls[i] = program->assignments[i].null;
+        if (program->assignments[i].stepCount == 0)
+            continue;
+        status = SQLupdate_Evaluate(&(program->assignments[i]), row, &(values[i]));
+        if (status == -1)
+            return 0;
+        nulls[i] = (status == 0);
+    }
+    for (i = 0 ; i < program->count ; ++i)
+    {
+        const struct UpdateAssignment *assignment;
+        struct Column                 *column;
+
+        assignment = &(program->assignments[i]);
+        column     = &(row->columns[assignment->column]);
+        if (column->type == String)
+            free(column->value.string);
+        column->type     = assignment->type;
+        column->position = assignment->column;
+        if (nulls[i] != 0)
+            column->value = SQLnullValue(column->type);
+        else if (assignment->stepCount != 0)
+            column->value = values[i];
+        else if (column->type == String)
+            column->value.string = strdup(assignment->value.string);
+        else
+            column->value = assignment->value;
+        SQLsetNull(row, assignment->column, nulls[i]);
+    }
+
+    return 1;
+}
+
+/* Check that the program can be applied to the matching rows of one storage file, returns 0 if not */
+static int SQLupdate_CheckFile(struct TokenList *list, const struct TableStructureInfo *const tableStructure,
+                               const struct UpdateProgram *const program, const char *const storage)
+{
+    struct Row row;
+    long       offset;
+    int        status;
+    FILE      *file;
+
+    file = fopen(storage, "r");
+    if (file == NULL)
+        return 1;
+    status = 1;
+    while ((status != 0) && (SQLreadRowAt(file, tableStructure, &row, &offset) != 0))
+    {
+        if ((SQLisValidRow(list->next, tableStructure, &row) == 0) ||
+            ((SQLfilterRow(list, tableStructure, &row) != 0) && (SQLupdate_Apply(program, &row) == 0)))
+            status = 0;
+        SQLfreeRow(&row);
+    }
+    fclose(file);
+
+    return status;
+}
+
+/*
+ * Update the matching rows of one storage file, keeping copies of the old and
+ * new row versions if `deleted` and `inserted` are not NULL
+ *
+ *      Once every row has been checked, an updated row that still fits in its
+ *      line is written over it (padded with spaces), otherwise the old line is
+ *      marked dead and the row is appended. Updated rows that now belong to
+ *      another partition are moved to `moved`, the caller appends them to
+ *      their new partition. Returns 0 on failure.
+ */
+static int SQLupdateFile(struct TokenList *list, const struct TableStructureInfo *const tableStructure,
+                         const struct UpdateProgram *const program, const char *const storage,
+                         size_t partition, struct Table *deleted, struct Table *inserted, struct Table *moved)
+{
+    struct Table updated;
+    struct Row   row;
+    long        *offsets;
+    long        *auxiliar;
+    long         offset;
+    long         live;
+    long         size;
+    char        *buffer;
+    size_t       capacity;
+    size_t       i;
+    int          rewritten;
+    FILE        *file;
+
+    /* Open the storage file, a missing file has no rows to update */
+    file = fopen(storage, "r+");
+    if (file == NULL)
+        return 1;
+    updated.rows     = NULL;
+    updated.rowCount = 0;
+    offsets          = NULL;
+    buffer           = NULL;
+    capacity         = 0;
+    live             = 0;
+    rewritten        = 0;
+    while (SQLreadRowAt(file, tableStructure, &row, &offset) != 0)
+    {
+        /* If row is invalid, abort the operation */
+        if (SQLisValidRow(list->next, tableStructure, &row) == 0)
+            goto abort;
+        live += ftell(file) - offset;
+        /* If the row, does satisfy the condition, keep its new version and line offset */
+        if (SQLfilterRow(list, tableStructure, &row) != 0)
+        {
+            if ((deleted != NULL) && (SQLappendRow(deleted, &row) == 0))
+                goto abort;
+            if (SQLupdate_Apply(program, &row) == 0)
+                goto abort;
+            auxiliar = realloc(offsets, (updated.rowCount + 1) * sizeof(long));
+            if (auxiliar == NULL)
+                goto abort;
+            offsets                   = auxiliar;
+            offsets[updated.rowCount] = offset;
+            if (SQLappendRow(&updated, &row) == 0)
+                goto abort;
+        }
+        SQLfreeRow(&row);
+    }
+    size = ftell(file);
+    for (i = 0 ; i < updated.rowCount ; ++i)
+    {
+        size_t length;
+        long   previous;
+        int    character;
+
+        /* The length of the old line, read back from the file */
+        fseek(file, offsets[i], SEEK_SET);
+        previous = 0;
+        while (((character = fgetc(file)) != EOF) && (character != '\n'))
+            previous += 1;
+        if ((inserted != NULL) && (SQLappendRow(inserted, &(updated.rows[i])) == 0))
+            goto abort;
+        length = SQLformatRow(&buffer, &capacity, &(updated.rows[i]));
+        if (length == 0)
+            goto abort;
+        fseek(file, offsets[i], SEEK_SET);
+        if ((SQLpartitionOfRow(tableStructure, &(updated.rows[i])) == partition) && ((long) length - 1 <= previous))
+        {
+            fwrite(buffer, 1, length - 1, file);
+            for ( ; (long) length - 1 < previous ; ++length)
+                fputc(' ', file);
+            rewritten = 1;
+            continue;
+        }
+        /* Too long for its line, or moving to another partition */
+        fputc(SQL_TOMBSTONE, file);
+        live -= previous + 1;
+        if (SQLpartitionOfRow(tableStructure, &(updated.rows[i])) != partition)
+        {
+            if (SQLappendRow(moved, &(updated.rows[i])) == 0)
+                goto abort;
+            continue;
+        }
+        fseek(file, 0, SEEK_END);
+        fwrite(buffer, 1, length, file);
+        live += length;
+        size += length;
+    }
+    if (updated.rowCount != 0)
+        SQLvacuum_Record(storage, size - live, size);
+    /* The full-text index does not know the new terms of the lines rewritten in place */
+    if (rewritten != 0)
+        SQLfulltext_Invalidate(storage);
+    fclose(file);
+    SQLfreeTable(&updated);
+    free(offsets);
+    free(buffer);
+
+    return 1;
+
+abort:
+    if (rewritten != 0)
+        SQLfulltext_Invalidate(storage);
+    SQLfreeRow(&row);
+    fclose(file);
+    SQLfreeTable(&updated);
+    free(offsets);
+    free(buffer);
+
+    return 0;
+}
+
+/* The sql update function */
+void SQLupdate(struct TokenList *list, const struct TableStructureInfo *const tableStructure)
+{
+    struct UpdateProgram program;
+    struct Table         deleted;
+    struct Table         inserted;
+    struct Table         moved;
+    char                 keep[64];
+    char                 storage[160];
+    size_t               i;
+    int                  expressions;
+    int                  views;
+
+    if (tableStructure == NULL)
+        return;
+    /* The assignments are compiled once, for all the matching rows */
+    if (SQLupdate_Compile(list->next, tableStructure, &program) == 0)
+    {
+        SQLupdate_Free(&program);
+        return;
+    }
+    for (i = 0, expressions = 0 ; i < program.count ; ++i)
+        expressions |= (program.assignments[i].stepCount != 0);
+    /* Old and new row versions are only kept when there are views to maintain */
+    views             = SQLview_HasViews(tableStructure->name);
+    deleted.rows      = NULL;
+    deleted.rowCount  = 0;
+    inserted.rows     = NULL;
+    inserted.rowCount = 0;
+    moved.rows        = NULL;
+    moved.rowCount    = 0;
+    SQLprunePartitions(list, tableStructure, keep);
+    /* A failing expression leaves its file unchanged, the other partitions are checked before any is updated */
+    for (i = 0 ; (SQLpartitionCount(tableStructure) > 1) && (expressions != 0) &&
+                 (i < SQLpartitionCount(tableStructure)) ; ++i)
+    {
+        if (keep[i] == 0)
+            continue;
+        SQLpartitionFile(tableStructure, i, storage, sizeof(storage));
+        if (SQLupdate_CheckFile(list, tableStructure, &program, storage) == 0)
+        {
+            SQLupdate_Free(&program);
+            return;
+        }
+    }
+    for (i = 0 ; i < SQLpartitionCount(tableStructure) ; ++i)
+    {
+        if (keep[i] == 0)
+            continue;
+        SQLpartitionFile(tableStructure, i, storage, sizeof(storage));
+        if (SQLupdateFile(list, tableStructure, &program, storage, i, (views != 0) ? &deleted : NULL,
+                                                      (views != 0) ? &inserted : NULL, &moved) == 0)
+            break;
+    }
+    /* Rows whose partition column changed go to their new partition */
+    for (i = 0 ; i < moved.rowCount ; ++i)
+    {
+        SQLpartitionFile(tableStructure, SQLpartitionOfRow(tableStructure, &(moved.rows[i])), storage, sizeof(storage));
+        SQLwriteRow(storage, &(moved.rows[i]));
+    }
+    if (deleted.rowCount != 0)
+        SQLview_ApplyDelta(tableStructure->name, &deleted, &inserted);
+    SQLfreeTable(&deleted);
+    SQLfreeTable(&inserted);
+    SQLfreeTable(&moved);
+    SQLupdate_Free(&program);
+}
+
+/* Simple check operators are equal function */
+int SQLcheckOperator(enum Operator lhs, enum Operator rhs)
+{
+    if (lhs != rhs)
+        SQLreport("invalid operator for expression.\n");
+    return (lhs == rhs);
+}
+
+/* The sql insert function */
+void SQLinsert(struct TokenList *list, const struct TableStructureInfo *const tableStructure)
+{
+    struct Row   row;
+    struct Table inserted;
+    const char  *tableName;
+    char         storage[160];
+    size_t       i;
+
+    if ((list == NULL) || (tableStructure == NULL))
+        return;
+
+    /* The columns missing from the query get their default value, or NULL */
+    if (SQLallocRow(&row, tableStructure->count) == 0)
+        return;
+    for (i = 0 ; i < tableStructure->count ; ++i)
+        SQLsetColumnDefault(tableStructure, &row, i);
+    tableName = tableStructure->name;
+    list      = list->next;
+    /* Parse the AST to get the row values */
+    while (list != NULL)
+    {
+        struct Column column;
+
+        /* Only assignment operator is valid here */
+        if (SQLcheckOperator(list->operator, AssignOperator) == 0)
+            goto abort;
+        /* Check that this column is valid */
+        if (SQLisValidRow(list, tableStructure, &row) == 0)
+            goto abort;
+
+        /* Store the column at its table position, whatever the order in the query */
+        column.position              = SQLParser_FindColumn(tableStructure, list->keyword);
+        column.type                  = tableStructure->columnTypes[column.position];
+        column.value                 = SQLisNullToken(list) ? SQLnullValue(column.type)
+                                                            : SQLvalueFromStringAndType(list->value, column.type);
+        if (column.type == String)
+            free(row.columns[column.position].value.string);
+        row.columns[column.position] = column;
+        SQLsetNull(&row, column.position, SQLisNullToken(list));
+        list = list->next;
+    }
+    /* Append the row to the file of its partition */
+    SQLpartitionFile(tableStructure, SQLpartitionOfRow(tableStructure, &row), storage, sizeof(storage));
+    SQLwriteRow(storage, &row);
+    /* Keep the materialized views over this table up to date */
+    inserted.rows     = &row;
+    inserted.rowCount = 1;
+    SQLview_ApplyDelta(tableName, NULL, &inserted);
+
+abort:
+    SQLfreeRow(&row);
+}
+
+/* Bytes of rows buffered for every file written by INSERT ... SELECT, they reach the file a page at a time */
+#define SQL_INSERT_PAGE (64 * 1024)
+
+/*
+ * State of the sink writing a query result to a table:
+ *      table      : structure of the target table
+ *      columns    : target position of every result column
+ *      columnCount: number of result columns
+ *      row        : the target row, its dropped columns hold their default
+ *                   and the others borrow the values of the result row
+ *      files      : the target partition files, opened on their first row
+ *      inserted   : copies of the rows, kept when the target has views to
+ *                   maintain or is also the source
+ *      count      : number of written rows
+ *      defer      : set when the source is the target, the rows are only
+ *                   written after the scan so it never reads them back
+ *      views      : set when the target has materialized views
+ *      failed     : set when a row could not be kept or written
+ */
+struct InsertSink
+{
+    const struct TableStructureInfo *table;
+    int                             *columns;
+    size_t                           columnCount;
+    struct Row                       row;
+    FILE                            *files[64];
+    struct Table                     inserted;
+    size_t                           count;
+    int                              defer;
+    int                              views;
+    int                              failed;
+};
+
+/* Append the row to the file of its target partition, opened with a page sized buffer on its first row */
+static void SQLinsertSink_Write(struct InsertSink *insert, const struct Row *const row)
+{
+    char   storage[160];
+    size_t partition;
+
+    partition = SQLpartitionOfRow(insert->table, row);
+    if (insert->files[partition] == NULL)
+    {
+        SQLpartitionFile(insert->table, partition, storage, sizeof(storage));
+        if ((insert->files[partition] = fopen(storage, "a")) == NULL)
+        {
+            insert->failed = 1;
+            return;
+        }
+        setvbuf(insert->files[partition], NULL, _IOFBF, SQL_INSERT_PAGE);
+    }
+    SQLwriteRowToFile(insert->files[partition], row);
+    insert->count += 1;
+}
+
+/* ResultSink callback, stores a result row in the target table */
+static void SQLinsertSinkRow(void *context, const struct Row *const row)
+{
+    struct InsertSink *insert;
+    size_t             i;
+
+    insert = context;
+    if (insert->failed != 0)
+        return;
+    for (i = 0 ; i < insert->columnCount ; ++i)
+    {
+        insert->row.columns[insert->columns[i]].value = row->columns[i].value;
+        SQLsetNull(&(insert->row), insert->columns[i], SQLisNull(row, i));
+    }
+    if (((insert->defer != 0) || (insert->views != 0)) && (SQLappendRow(&(insert->inserted), &(insert->row)) == 0))
+        insert->failed = 1;
+    else if (insert->defer == 0)
+        SQLinsertSink_Write(insert, &(insert->row));
+}
+
+/*
+ * Prepare the sink writing rows of the `result` structure to `table`, returns 0 if they do not match
+ *
+ *      The result columns fill the columns of the table that are not
+ *      dropped, in order, and must have the same types.
+ */
+static int SQLinsertSink_Init(struct InsertSink *insert, const struct TableStructureInfo *const table,
+                              const struct TableStructureInfo *const result, int defer)
+{
+    size_t i;
+    size_t j;
+
+    memset(insert, 0, sizeof(*insert));
+    insert->table = table;
+    insert->defer = defer;
+    insert->views = SQLview_HasViews(table->name);
+    if ((SQLallocRow(&(insert->row), table->count) == 0) ||
+        ((insert->columns = malloc((result->count + 1) * sizeof(int))) == NULL))
+        return 0;
+    for (i = 0 ; i < table->count ; ++i)
+        SQLsetColumnDefault(table, &(insert->row), i);
+    for (i = 0, j = 0 ; i < table->count ; ++i)
+    {
+        if (table->columnDropped[i] != 0)
+            continue;
+        if ((j == result->count) || (result->columnTypes[j] != table->columnTypes[i]))
+            break;
+        /* The strings are borrowed from the result rows */
+        if (table->columnTypes[i] == String)
+        {
+            free(insert->row.columns[i].value.string);
+            insert->row.columns[i].value.string = NULL;
+        }
+        insert->columns[j++] = i;
+    }
+    insert->columnCount = j;
+    if ((i != table->count) || (j != result->count))
+    {
+        SQLreport("cannot insert into `%s`, the result columns do not match the columns of the table\n", table->name);
+        return 0;
+    }
+    return 1;
+}
+
+/* Write the deferred rows, close the files and maintain the views of the target, then release the sink */
+static void SQLinsertSink_Finish(struct InsertSink *insert)
+{
+    size_t i;
+
+    for (i = 0 ; (insert->defer != 0) && (insert->failed == 0) && (i < insert->inserted.rowCount) ; ++i)
+        SQLinsertSink_Write(insert, &(insert->inserted.rows[i]));
+    for (i = 0 ; i < sizeof(insert->files) / sizeof(insert->files[0]) ; ++i)
+    {
+        if ((insert->files[i] != NULL) && (fclose(insert->files[i]) != 0))
+            insert->failed = 1;
+    }
+    if (insert->failed != 0)
+        SQLreport("error: cannot write the rows of `%s`, %u were written\n", insert->table->name, (unsigned) insert->count);
+    else if ((insert->views != 0) && (insert->inserted.rowCount != 0))
+        SQLview_ApplyDelta(insert->table->name, NULL, &(insert->inserted));
+    for (i = 0 ; (insert->row.columns != NULL) && (i < insert->columnCount) ; ++i)
+    {
+        if (insert->table->columnTypes[insert->columns[i]] == String)
+            insert->row.columns[insert->columns[i]].value.string = NULL;
+    }
+    SQLfreeRow(&(insert->row));
+    SQLfreeTable(&(insert->inserted));
+    free(insert->columns);
+}
+
+/* Catalog, defined below */
+int                       SQLParser_StoreTable(const struct TableStructureInfo *const info);
+struct TableStructureInfo SQLParser_FindTable(const char *const name);
+
+/* Create the table `name` with the columns of `result`, unpartitioned and without defaults, returns 0 on failure */
+static int SQLinsertSelect_CreateTable(const char *const name, const struct TableStructureInfo *const result)
+{
+    struct TableStructureInfo info;
+    size_t                    i;
+    int                       status;
+
+    memset(&info, 0, sizeof(info));
+    if (strlen(name) >= sizeof(info.name))
+    {
+        SQLreport("table name `%s` is too long\n", name);
+        return 0;
+    }
+    strcpy(info.name, name);
+    status = 1;
+    for (i = 0 ; (status != 0) && (i < result->count) ; ++i)
+        status = SQLstructure_AddColumn(&info, result->columns[i], result->columnTypes[i], NULL);
+    if ((status != 0) && (SQLParser_StoreTable(&info) != 0))
+        status = 0;
+    SQLstructure_Free(&info);
+
+    return status;
+}
+
+/*
+ * Write the result of a SELECT on `source` to the table `target`, without sending it to the client
+ *
+ *      SELECT:TABLENAME ... INTO:TARGET
+ *      INSERT_INTO:TARGET FROM:TABLENAME ...
+ *
+ *  The query accepts the conditions and clauses of SELECT. SELECT ... INTO
+ *  creates the target (`create` != 0) with the result columns when it does
+ *  not exist yet. The rows are streamed from the scan to the target files,
+ *  which are written a page at a time instead of being opened for each row.
+ */
+void SQLinsertSelect(const struct TokenList *list, const struct TableStructureInfo *const source,
+                                                   const char *const target, int create)
+{
+    struct TableStructureInfo table;
+    struct SelectPlan        *plan;
+    struct InsertSink         insert;
+    struct ResultSink         sink;
+
+    plan = malloc(sizeof(struct SelectPlan));
+    if (plan == NULL)
+        return;
+    table = SQLParser_FindTable(target);
+    if (SQLplanSelect(list, source, plan, 0) == 0)
+        goto abort;
+    if ((table.name[0] == '\0') && (create != 0))
+    {
+        if (SQLinsertSelect_CreateTable(target, &(plan->result)) == 0)
+            goto abort;
+        table = SQLParser_FindTable(target);
+    }
+    if (table.name[0] == '\0')
+    {
+        SQLreport("no table `%s`\n", target);
+        goto abort;
+    }
+    if (SQLinsertSink_Init(&insert, &table, &(plan->result), strcmp(source->name, table.name) == 0) != 0)
+    {
+        sink.begin   = NULL;
+        sink.row     = SQLinsertSinkRow;
+        sink.end     = NULL;
+        sink.context = &insert;
+        SQLexecutePlan(list, source, plan, &sink);
+    }
+    SQLinsertSink_Finish(&insert);
+
+abort:
+    SQLstructure_Free(&table);
+    SQLplanFree(plan);
+    free(plan);
+}
+
+/* Write a string to the catalog as its length followed by its characters */
+static int SQLcatalog_WriteString(FILE *file, const char *const string)
+{
+    size_t length;
+
+    length = strlen(string);
+    return (fwrite(&length, sizeof(length), 1, file) == 1) && (fwrite(string, 1, length, file) == length);
+}
+
+/* Read a string written by SQLcatalog_WriteString(), returns NULL on failure */
+static char *SQLcatalog_ReadString(FILE *file)
+{
+    char  *string;
+    size_t length;
+
+    if (fread(&length, sizeof(length), 1, file) != 1)
+        return NULL;
+    string = malloc(length + 1);
+    if (string == NULL)
+        return NULL;
+    if (fread(string, 1, length, file) != length)
+    {
+        free(string);
+        return NULL;
+    }
+    string[length] = '\0';
+
+    return string;
+}
+
+/*
+ * Write a table structure record to the catalog, returns 0 on failure
+ *
+ *      The record holds the name and the partitioning, then the column count
+ *      and, for every column, its type, a flags byte (bit 0 when it was
+ *      dropped, bit 1 when it has a full-text index), its name and its
+ *      default value.
+ */
+static int SQLcatalog_WriteTable(FILE *file, const struct TableStructureInfo *const info)
+{
+    size_t i;
+    char   flags;
+
+    if ((fwrite(info->name, sizeof(info->name), 1, file) != 1) ||
+        (fwrite(&(info->partitionType), sizeof(info->partitionType), 1, file) != 1) ||
+        (fwrite(&(info->partitionColumn), sizeof(info->partitionColumn), 1, file) != 1) ||
+        (fwrite(&(info->partitionCount), sizeof(info->partitionCount), 1, file) != 1) ||
+        (fwrite(info->partitionBounds, sizeof(info->partitionBounds), 1, file) != 1) ||
+        (fwrite(&(info->count), sizeof(info->count), 1, file) != 1))
+        return 0;
+    for (i = 0 ; i < info->count ; ++i)
+    {
+        flags = (info->columnDropped[i] != 0) | ((info->columnIndexed[i] != 0) << 1);
+        if ((fwrite(&(info->columnTypes[i]), sizeof(info->columnTypes[i]), 1, file) != 1) ||
+            (fwrite(&flags, 1, 1, file) != 1) ||
+            (SQLcatalog_WriteString(file, info->columns[i]) == 0) ||
+            (SQLcatalog_WriteString(file, info->columnDefaults[i]) == 0))
+            return 0;
+    }
+    return 1;
+}
+
+/* Read a table structure record written by SQLcatalog_WriteTable(), returns 0 at the end of the catalog */
+static int SQLcatalog_ReadTable(FILE *file, struct TableStructureInfo *info)
+{
+    size_t count;
+    size_t i;
+
+    memset(info, 0, sizeof(*info));
+    if ((fread(info->name, sizeof(info->name), 1, file) != 1) ||
+        (fread(&(info->partitionType), sizeof(info->partitionType), 1, file) != 1) ||
+        (fread(&(info->partitionColumn), sizeof(info->partitionColumn), 1, file) != 1) ||
+        (fread(&(info->partitionCount), sizeof(info->partitionCount), 1, file) != 1) ||
+        (fread(info->partitionBounds, sizeof(info->partitionBounds), 1, file) != 1) ||
+        (fread(&count, sizeof(count), 1, file) != 1))
+        return 0;
+    for (i = 0 ; i < count ; ++i)
+    {
+        enum FieldType type;
+        char           flags;
+        char          *name;
+        char          *initial;
+        int            success;
+
+        if ((fread(&type, sizeof(type), 1, file) != 1) || (fread(&flags, 1, 1, file) != 1))
+            break;
+        name    = SQLcatalog_ReadString(file);
+        initial = (name != NULL) ? SQLcatalog_ReadString(file) : NULL;
+        success = (initial != NULL) && (SQLstructure_AddColumn(info, name, type, initial) != 0);
+        free(name);
+        free(initial);
+        if (success == 0)
+            break;
+        info->columnDropped[i] = flags & 1;
+        info->columnIndexed[i] = (flags >> 1) & 1;
+    }
+    if (i == count)
+        return 1;
+    SQLstructure_Free(info);
+
+    return 0;
+}
+
+/* Append a table structure to the database internal table structure storage file */
+int SQLParser_StoreTable(const struct TableStructureInfo *const info)
+{
+    FILE *file;
+    int   success;
+
+    /* Open the database internal table structure storage file */
+    file = fopen("__tables_data.dat", "a");
+    if (file == NULL)
+        return 1;
+    /* Write the data to the file */
+    success = SQLcatalog_WriteTable(file, info);
+    /* close the file */
+    if (fclose(file) != 0)
+        success = 0;
+
+    return (success == 0);
+}
+
+/*
+ * Set the partitioning of a new table, from the DATASET clauses
+ *
+ *      PARTITION:FIELD HASH:COUNT       rows are spread by the hash of FIELD
+ *      PARTITION:FIELD RANGE:B1,B2,...  FIELD < B1, B1 <= FIELD < B2, ..., FIELD >= Bn
+ *
+ *  Returns 0 if the clauses are invalid.
+ */
+static int SQLParser_SetPartitioning(struct TableStructureInfo *info, const struct TokenList *partition,
+                                                                       const struct TokenList *method)
+{
+    if ((partition == NULL) && (method == NULL))
+        return 1;
+    if ((partition == NULL) || (method == NULL))
+    {
+        SQLreport("PARTITION needs either HASH or RANGE.\n");
+        return 0;
+    }
+    if ((info->partitionColumn = SQLParser_FindColumn(info, partition->value)) == -1)
+    {
+        SQLreport("no column `%s` in table `%s`\n", partition->value, info->name);
+        return 0;
+    }
+    if (SQLParser_GetClauseType(method->keyword) == HashClause)
+    {
+        info->partitionType  = HashPartition;
+        info->partitionCount = strtoul(method->value, NULL, 10);
+        if ((info->partitionCount < 1) || (info->partitionCount > 64))
+        {
+            SQLreport("HASH needs between 1 and 64 partitions.\n");
+            return 0;
+        }
+        return 1;
+    }
+    else
+    {
+        union RangeBound *bounds;
+        enum FieldType    type;
+        const char       *bound;
+        char             *end;
+
+        type = info->columnTypes[info->partitionColumn];
+        if ((SQLisNumericType(type) == 0) && (SQLisTemporalType(type) == 0))
+        {
+            SQLreport("RANGE partitions need a numeric, DATE or TIMESTAMP column.\n");
+            return 0;
+        }
+        info->partitionType  = RangePartition;
+        info->partitionCount = 1;
+        for (bound = method->value ; *bound != '\0' ; bound = end + (*end == ','))
+        {
+            if (info->partitionCount == 64)
+            {
+                SQLreport("RANGE needs at most 63 bounds.\n");
+                return 0;
+            }
+            /* Bounds are kept in the encoding of the column, see SQLrange_Bound() */
+            bounds = &(info->partitionBounds[info->partitionCount - 1]);
+            if (type == Timestamp)
+                bounds->exact = SQLtimestampFromString(bound, &end);
+            else if (type == Date)
+                bounds->exact = SQLdateFromString(bound, &end);
+            else if (type == Decimal)
+                bounds->exact = SQLdecimalFromString(bound, &end);
+            else if (SQLrange_IsExact(type) != 0)
+                bounds->exact = strtoll(bound, &end, 10);
+            else
+                bounds->real = strtod(bound, &end);
+            if ((end == bound) || ((*end != ',') && (*end != '\0')) ||
+                ((info->partitionCount > 1) && (SQLrange_Compare(SQLrange_IsExact(type), bounds[0], bounds[-1]) <= 0)))
+            {
+                SQLreport("RANGE bounds must be increasing values.\n");
+                return 0;
+            }
+            info->partitionCount += 1;
+        }
+        return 1;
+    }
+}
+
+/* This function will create a table in the database */
+int SQLParser_CreateTable(struct TokenList *list)
+{
+    struct TableStructureInfo info;
+    struct TokenList         *current;
+    struct TokenList         *partition;
+    struct TokenList         *method;
+    size_t                    length;
+    int                       status;
+
+    if (list == NULL)
+        return 1;
+
+    /* Initialize TableStructureInfo to 0 */
+    memset(&info, 0, sizeof(info));
+
+    /* Get the length of the table name, and ensure it can be stored (it names the storage files) */
+    length = strlen(list->value);
+    if (length > sizeof(info.name) - 1)
+        return 1;
+    current   = list->next;
+    partition = NULL;
+    method    = NULL;
+    /* Copy the table name */
+    memcpy(info.name, list->value, length);
+    /* Parse the AST to get all field's names, and types */
+    while (current != NULL)
+    {
+        /* The partitioning clauses are not fields */
+        switch (SQLParser_GetClauseType(current->keyword))
+        {
+        case PartitionClause:
+            partition = current;
+            current   = current->next;
+            continue;
+        case HashClause:
+        case RangeClause:
+            method  = current;
+            current = current->next;
+            continue;
+        default:
+            break;
+        }
+        /* Copy the field name, with its type enum value */
+        if (SQLstructure_AddColumn(&info, current->keyword, SQLParser_GetFieldType(current->value), NULL) == 0)
+        {
+            SQLstructure_Free(&info);
+            return 1;
+        }
+        current = current->next;
+    }
+    status = 1;
+    if (SQLParser_SetPartitioning(&info, partition, method) != 0)
+        status = SQLParser_StoreTable(&info);
+    SQLstructure_Free(&info);
+
+    return status;
+}
+
+/*
+ * This function searches for a table in the TableStructureInfo
+ *
+ *      The found structure owns its columns and must be released with
+ *      SQLstructure_Free(), an unknown table has an empty name.
+ */
+struct TableStructureInfo SQLParser_FindTable(const char *const name)
+{
+    FILE                     *file;
+    struct TableStructureInfo table;
+
+    memset(&table, 0, sizeof(table));
+
+    /* Open the storage file for reading */
+    file = fopen("__tables_data.dat", "r");
+    if (file == NULL)
+        return table;
+    /* read records until the record is found, or the end of file is reached */
+    while (SQLcatalog_ReadTable(file, &table) != 0)
+    {
+        if (strcmp(name, table.name) == 0)
+        {
+            fclose(file);
+            return table;
+        }
+        SQLstructure_Free(&table);
+    }
+    fclose(file);
+
+    return table;
+}
+
+/* Overwrite the stored structure of the table named like `info`, returns 0 on success */
+int SQLParser_ReplaceTable(const struct TableStructureInfo *const info)
+{
+    struct TableStructureInfo table;
+    char                      filename[] = "__database_Temporary_XXXXXX"; /* temporary filename */
+    FILE                     *source;
+    FILE                     *destination;
+    int                       success;
+    int                       found;
+
+    /* The records do not have a fixed size, the catalog is rewritten */
+    source = fopen("__tables_data.dat", "r");
+    if (source == NULL)
+        return 1;
+    destination = SQLtemporaryFile(filename);
+    if (destination == NULL)
+    {
+        fclose(source);
+        return 1;
+    }
+    success = 1;
+    found   = 0;
+    while ((success != 0) && (SQLcatalog_ReadTable(source, &table) != 0))
+    {
+        if (strcmp(info->name, table.name) == 0)
+        {
+            success = SQLcatalog_WriteTable(destination, info);
+            found   = 1;
+        }
+        else
+            success = SQLcatalog_WriteTable(destination, &table);
+        SQLstructure_Free(&table);
+    }
+    fclose(source);
+    if (fclose(destination) != 0)
+        success = 0;
+    if ((success == 0) || (found == 0))
+    {
+        remove(filename);
+        return 1;
+    }
+    remove("__tables_data.dat");
+    rename(filename, "__tables_data.dat");
+
+    return 0;
+}
+
+/*
+ * Add or drop a column, or add a full-text index to a column
+ *
+ *      ALTER:TABLENAME ADD:FIELD TYPE:INTEGER DEFAULT:VALUE
+ *      ALTER:TABLENAME DROP:FIELD
+ *      ALTER:TABLENAME FULLTEXT:FIELD
+ *
+ *  The rows stored before a column was added are read with its default value
+ *  (NULL without DEFAULT), the values of a dropped
+ *  column stay in the stored rows but are hidden. Only FULLTEXT reads the
+ *  rows, to build the index of every partition file.
+ */
+int SQLParser_AlterTable(struct TokenList *list, struct TableStructureInfo *info)
+{
+    const char *add;
+    const char *drop;
+    const char *type;
+    const char *initial;
+    const char *fulltext;
+    char        storage[160];
+    int         column;
+    size_t      i;
+
+    add      = NULL;
+    drop     = NULL;
+    type     = NULL;
+    initial  = "";
+    fulltext = NULL;
+    for (list = list->next ; list != NULL ; list = list->next)
+    {
+        if (list->operator != AssignOperator)
+            continue;
+        switch (SQLParser_GetClauseType(list->keyword))
+        {
+        case AddClause:
+            add = list->value;
+            break;
+        case DropClause:
+            drop = list->value;
+            break;
+        case TypeClause:
+            type = list->value;
+            break;
+        case DefaultClause:
+            initial = list->value;
+            break;
+        case FullTextClause:
+            fulltext = list->value;
+            break;
+        default:
+            break;
+        }
+    }
+    if ((fulltext != NULL) && (add == NULL) && (drop == NULL))
+    {
+        if ((column = SQLParser_FindColumn(info, fulltext)) == -1)
+        {
+            SQLreport("no column `%s` in table `%s`\n", fulltext, info->name);
+            return 1;
+        }
+        if (info->columnTypes[column] != String)
+        {
+            SQLreport("FULLTEXT needs a STRING column, `%s` is not one\n", fulltext);
+            return 1;
+        }
+        info->columnIndexed[column] = 1;
+        if (SQLParser_ReplaceTable(info) != 0)
+            return 1;
+        for (i = 0 ; i < SQLpartitionCount(info) ; ++i)
+        {
+            SQLpartitionFile(info, i, storage, sizeof(storage));
+            SQLfulltext_Invalidate(storage);
+            SQLfulltext_Build(info, storage);
+        }
+        return 0;
+    }
+    if ((add != NULL) && (drop == NULL) && (type != NULL))
+    {
+        enum FieldType fieldType;
+
+        fieldType = SQLParser_GetFieldType(type);
+        if (fieldType == (enum FieldType) Invalid)
+        {
+            SQLreport("invalid type `%s` for column `%s`\n", type, add);
+            return 1;
+        }
+        if (SQLParser_FindColumn(info, add) != -1)
+        {
+            SQLreport("there is a column with the same name, cannot add column `%s`\n", add);
+            return 1;
+        }
+        if (SQLstructure_AddColumn(info, add, fieldType, initial) == 0)
+        {
+            SQLreport("cannot add column `%s` to table `%s`\n", add, info->name);
+            return 1;
+        }
+    }
+    else if ((drop != NULL) && (add == NULL))
+    {
+        if ((column = SQLParser_FindColumn(info, drop)) == -1)
+        {
+            SQLreport("no column `%s` in table `%s`\n", drop, info->name);
+            return 1;
+        }
+        if ((info->partitionType != NoPartition) && (info->partitionColumn == column))
+        {
+            SQLreport("cannot drop the partition column `%s`\n", drop);
+            return 1;
+        }
+        /* Views store their own copy of the columns they read */
+        if (SQLview_HasViews(info->name) != 0)
+        {
+            SQLreport("cannot drop column `%s`, table `%s` has materialized views\n", drop, info->name);
+            return 1;
+        }
+        for (i = 0 ; i < info->count ; ++i)
+        {
+            if ((i != (size_t) column) && (info->columnDropped[i] == 0))
+                break;
+        }
+        if (i == info->count)
+        {
+            SQLreport("cannot drop the last column of table `%s`\n", info->name);
+            return 1;
+        }
+        info->columnDropped[column] = 1;
+        info->columnIndexed[column] = 0;
+    }
+    else
+    {
+        SQLreport("usage: ALTER:TABLENAME ADD:FIELD TYPE:TYPE [DEFAULT:VALUE], ALTER:TABLENAME DROP:FIELD "
+               "or ALTER:TABLENAME FULLTEXT:FIELD\n");
+        return 1;
+    }
+    return SQLParser_ReplaceTable(info);
+}
+
+/* Number of hash buckets of the result cache */
+#define SQL_CACHE_BUCKETS 1024
+
+/*
+ * One cached SELECT result:
+ *      key      : the normalized query text
+ *      table    : the queried table, writes to it invalidate the entry
+ *      structure: the result structure, replayed to ResultSink begin
+ *      rows     : the result rows
+ *      size     : the memory accounted for this entry
+ *      next     : next entry in the same hash bucket
+ *      newer    : next entry in LRU order (towards the most recently used)
+ *      older    : previous entry in LRU order
+ */
+struct CacheEntry
+{
+    char                      *key;
+    char                       table[128];
+    struct TableStructureInfo  structure;
+    struct Table               rows;
+    size_t                     size;
+    unsigned long              hash;
+    struct CacheEntry         *next;
+    struct CacheEntry         *newer;
+    struct CacheEntry         *older;
+};
+
+/*
+ * Query result cache, disabled while capacity is 0:
+ *      capacity: maximum memory used by all the entries
+ *      size    : memory currently used by all the entries
+ *      buckets : hash table of the entries by key
+ *      newest  : most recently used entry
+ *      oldest  : least recently used entry, the first to be evicted
+ */
+struct ResultCache
+{
+    size_t             capacity;
+    size_t             size;
+    struct CacheEntry *buckets[SQL_CACHE_BUCKETS];
+    struct CacheEntry *newest;
+    struct CacheEntry *oldest;
+};
+
+/* The result cache, shared by every query */
+static struct ResultCache SQLresultCache;
+
+/*
+ * ResultSink that forwards the rows and records a copy for the cache:
+ *      sink    : the sink receiving the results
+ *      entry   : the entry being filled
+ *      begun   : set once the select started its result, it failed otherwise
+ *      overflow: set when the result is too large to be cached
+ */
+struct CacheRecorder
+{
+    const struct ResultSink *sink;
+    struct CacheEntry       *entry;
+    int                      begun;
+    int                      overflow;
+};
+
+/* Text of every operator, indexed by enum Operator */
+static const char *const SQLoperatorText[] = {"=", "<>", ">", "<", ">=", "<=", ":"};
+
+/* FNV-1a hash of the string */
+static unsigned long SQLhashString(const char *string)
+{
+    unsigned long hash;
+
+    hash = 2166136261UL;
+    while (*string != '\0')
+    {
+        hash ^= (unsigned char) *(string++);
+        hash *= 16777619UL;
+    }
+    return hash;
+}
+
+/*
+ * Build the normalized query text used as cache key
+ *
+ *      The query is rebuilt from the parsed tokens, so differences in spacing
+ *      or quoting do not produce different keys.
+ */
+static char *SQLresultCache_Key(const struct TokenList *list)
+{
+    const struct TokenList *current;
+    char                   *key;
+    size_t                  length;
+
+    length = 1;
+    for (current = list ; current != NULL ; current = current->next)
+        length += strlen(current->keyword) + strlen(current->value) + 4;
+    key = malloc(length);
+    if (key == NULL)
+        return NULL;
+    key[0] = '\0';
+    for (current = list ; current != NULL ; current = current->next)
+    {
+        if (current != list)
+            strcat(key, " ");
+        strcat(key, current->keyword);
+        if ((current->operator >= EqualOperator) && (current->operator <= AssignOperator))
+            strcat(key, SQLoperatorText[current->operator]);
+        strcat(key, current->value);
+    }
+    return key;
+}
+
+/* Unlink the entry from the LRU list */
+static void SQLresultCache_Unlink(struct CacheEntry *entry)
+{
+    if (entry->newer != NULL)
+        entry->newer->older = entry->older;
+    else
+        SQLresultCache.newest = entry->older;
+    if (entry->older != NULL)
+        entry->older->newer = entry->newer;
+    else
+        SQLresultCache.oldest = entry->newer;
+    entry->newer = NULL;
+    entry->older = NULL;
+}
+
+/* Make the entry the most recently used one */
+static void SQLresultCache_Touch(struct CacheEntry *entry)
+{
+    SQLresultCache_Unlink(entry);
+    entry->older = SQLresultCache.newest;
+    if (SQLresultCache.newest != NULL)
+        SQLresultCache.newest->newer = entry;
+    SQLresultCache.newest = entry;
+    if (SQLresultCache.oldest == NULL)
+        SQLresultCache.oldest = entry;
+}
+
+/* Release the entry memory, it must not be linked anymore */
+static void SQLresultCache_FreeEntry(struct CacheEntry *entry)
+{
+    size_t i;
+
+    for (i = 0 ; i < entry->rows.rowCount ; ++i)
+        SQLfreeRow(&(entry->rows.rows[i]));
+    free(entry->rows.rows);
+    SQLstructure_Free(&(entry->structure));
+    free(entry->key);
+    free(entry);
+}
+
+/* Remove the entry from the cache, and release it */
+static void SQLresultCache_Remove(struct CacheEntry *entry)
+{
+    struct CacheEntry **link;
+
+    link = &(SQLresultCache.buckets[entry->hash % SQL_CACHE_BUCKETS]);
+    while ((*link != NULL) && (*link != entry))
+        link = &((*link)->next);
+    if (*link != NULL)
+        *link = entry->next;
+    SQLresultCache_Unlink(entry);
+    SQLresultCache.size -= entry->size;
+    SQLresultCache_FreeEntry(entry);
+}
+
+/* Search the cache for `key`, returns NULL if not cached */
+static struct CacheEntry *SQLresultCache_Find(const char *const key)
+{
+    struct CacheEntry *entry;
+    unsigned long      hash;
+
+    hash = SQLhashString(key);
+    for (entry = SQLresultCache.buckets[hash % SQL_CACHE_BUCKETS] ; entry != NULL ; entry = entry->next)
+    {
+        if ((entry->hash == hash) && (strcmp(entry->key, key) == 0))
+            return entry;
+    }
+    return NULL;
+}
+
+/* Add a complete entry to the cache, evicting the least recently used entries to make room */
+static void SQLresultCache_Insert(struct CacheEntry *entry)
+{
+    struct CacheEntry **bucket;
+
+    while ((SQLresultCache.oldest != NULL) && (SQLresultCache.size + entry->size > SQLresultCache.capacity))
+        SQLresultCache_Remove(SQLresultCache.oldest);
+
+    bucket                = &(SQLresultCache.buckets[entry->hash % SQL_CACHE_BUCKETS]);
+    entry->next           = *bucket;
+    *bucket               = entry;
+    SQLresultCache.size  += entry->size;
+    SQLresultCache_Touch(entry);
+}
+
+/* Drop every cached result that read from `table`, called for every write to it */
+void SQLresultCache_Invalidate(const char *const table)
+{
+    struct CacheEntry *entry;
+    struct CacheEntry *older;
+
+    for (entry = SQLresultCache.newest ; entry != NULL ; entry = older)
+    {
+        older = entry->older;
+        if (strcmp(entry->table, table) == 0)
+            SQLresultCache_Remove(entry);
+    }
+}
+
+/* Set the memory cap of the result cache, 0 disables caching */
+void SQLresultCache_SetCapacity(size_t capacity)
+{
+    SQLresultCache.capacity = capacity;
+    while ((SQLresultCache.oldest != NULL) && (SQLresultCache.size > capacity))
+        SQLresultCache_Remove(SQLresultCache.oldest);
+}
+
+/* ResultSink callbacks of the CacheRecorder */
+static void SQLcacheRecorderBegin(void *context, const struct TableStructureInfo *const tableStructure)
+{
+    struct CacheRecorder *recorder;
+
+    recorder        = context;
+    recorder->begun = 1;
+    if (SQLstructure_Copy(&(recorder->entry->structure), tableStructure) == 0)
+        recorder->overflow = 1;
+    if (recorder->sink->begin != NULL)
+        recorder->sink->begin(recorder->sink->context, tableStructure);
+}
+
+static void SQLcacheRecorderRow(void *context, const struct Row *const row)
+{
+    struct CacheRecorder *recorder;
+    struct CacheEntry    *entry;
+    struct Row           *auxiliar;
+    size_t                size;
+    size_t                i;
+
+    recorder = context;
+    entry    = recorder->entry;
+    recorder->sink->row(recorder->sink->context, row);
+    if (recorder->overflow != 0)
+        return;
+    /* The copy holds the columns, the NULL flags and a duplicate of every string */
+    size = sizeof(struct Row) + row->columnCount * sizeof(struct Column) + (row->columnCount + 7) / 8;
+    for (i = 0 ; i < row->columnCount ; ++i)
+    {
+        if ((row->columns[i].type == String) && (row->columns[i].value.string != NULL))
+            size += strlen(row->columns[i].value.string) + 1;
+    }
+    /* Results larger than the whole cache are not worth recording */
+    if (entry->size + size > SQLresultCache.capacity)
+    {
+        recorder->overflow = 1;
+        return;
+    }
+    auxiliar = realloc(entry->rows.rows, (1 + entry->rows.rowCount) * sizeof(struct Row));
+    if (auxiliar == NULL)
+    {
+        recorder->overflow = 1;
+        return;
+    }
+    entry->rows.rows = auxiliar;
+    if (SQLcopyRow(&(entry->rows.rows[entry->rows.rowCount]), row) == 0)
+    {
+        recorder->overflow = 1;
+        return;
+    }
+    entry->rows.rowCount += 1;
+    entry->size          += size;
+}
+
+static void SQLcacheRecorderEnd(void *context)
+{
+    struct CacheRecorder *recorder;
+
+    recorder = context;
+    if (recorder->sink->end != NULL)
+        recorder->sink->end(recorder->sink->context);
+}
+
+/*
+ * Select through the result cache
+ *
+ *      A cached result is replayed to the sink without reading the table,
+ *      otherwise the select runs and its result is recorded for next time.
+ */
+void SQLcachedSelect(const struct TokenList *list, const struct TableStructureInfo *const tableStructure,
+                                                                 const struct ResultSink *const sink)
+{
+    struct CacheRecorder recorder;
+    struct ResultSink    recorderSink;
+    struct CacheEntry   *entry;
+    char                *key;
+    size_t               reported;
+    size_t               i;
+
+    if ((SQLresultCache.capacity == 0) || ((key = SQLresultCache_Key(list)) == NULL))
+    {
+        SQLselect(list, tableStructure, sink);
+        return;
+    }
+
+    entry = SQLresultCache_Find(key);
+    if (entry != NULL) /* Cache hit, replay the result */
+    {
+        free(key);
+        SQLresultCache_Touch(entry);
+        if (sink->begin != NULL)
+            sink->begin(sink->context, &(entry->structure));
+        for (i = 0 ; i < entry->rows.rowCount ; ++i)
+            sink->row(sink->context, &(entry->rows.rows[i]));
+        if (sink->end != NULL)
+            sink->end(sink->context);
+        return;
+    }
+
+    entry = calloc(1, sizeof(struct CacheEntry));
+    if (entry == NULL)
+    {
+        free(key);
+        SQLselect(list, tableStructure, sink);
+        return;
+    }
+    entry->key  = key;
+    entry->hash = SQLhashString(key);
+    entry->size = sizeof(struct CacheEntry) + strlen(key) + 1;
+    strncpy(entry->table, list->value, sizeof(entry->table) - 1);
+
+    recorder.sink        = sink;
+    recorder.entry       = entry;
+    recorder.begun       = 0;
+    recorder.overflow    = 0;
+    recorderSink.begin   = SQLcacheRecorderBegin;
+    recorderSink.row     = SQLcacheRecorderRow;
+    recorderSink.end     = SQLcacheRecorderEnd;
+    recorderSink.context = &recorder;
+    reported             = SQLmessages.count;
+    SQLselect(list, tableStructure, &recorderSink);
+
+    /* The rows of a stopped statement are only a part of its result, a failed one has none to replay */
+    if ((recorder.begun == 0) || (SQLmessages.count != reported) || (recorder.overflow != 0) ||
+        (entry->size > SQLresultCache.capacity) || (SQLcancel.stopped != NULL))
+        SQLresultCache_FreeEntry(entry);
+    else
+        SQLresultCache_Insert(entry);
+}
+
+/* Storage file of the materialized view definitions, one `view\tbase\tquery` line per view */
+#define SQL_VIEWS_FILE "__views_data.dat"
+
+/*
+ * A materialized view, the view rows are stored in a table with the view name:
+ *      name         : the view name
+ *      base         : the table the view reads from
+ *      list         : the parsed definition query
+ *      baseStructure: structure of the base table
+ *      structure    : structure of the table holding the view rows
+ *      plan         : plan of the definition query over the base table
+ */
+struct ViewDefinition
+{
+    char                      name[128];
+    char                      base[128];
+    struct TokenList         *list;
+    struct TableStructureInfo baseStructure;
+    struct TableStructureInfo structure;
+    struct SelectPlan         plan;
+};
+
+/* Find the base table of a view definition query, given with `FROM:TABLENAME` */
+static const char *SQLview_FindBase(const struct TokenList *list)
+{
+    return SQLParser_FindClause(list, FromClause);
+}
+
+/* Release the view definition */
+static void SQLview_Release(struct ViewDefinition *view)
+{
+    freeTokens(view->list);
+    view->list = NULL;
+    SQLstructure_Free(&(view->baseStructure));
+    SQLstructure_Free(&(view->structure));
+    SQLplanFree(&(view->plan));
+}
+
+/* Build the view definition from its query, returns 0 on failure */
+static int SQLview_Prepare(struct ViewDefinition *view, const char *const query)
+{
+    const char *base;
+
+    memset(view, 0, sizeof(*view));
+    view->list = SQLParser_Parse(query);
+    if (view->list == NULL)
+        return 0;
+    base = SQLview_FindBase(view->list);
+    if ((base == NULL) || (strlen(base) >= sizeof(view->base)) || (strlen(view->list->value) >= sizeof(view->name)))
+        goto abort;
+    strcpy(view->name, view->list->value);
+    strcpy(view->base, base);
+    view->baseStructure = SQLParser_FindTable(view->base);
+    if (view->baseStructure.name[0] == '\0')
+    {
+        SQLreport("no table `%s`\n", view->base);
+        goto abort;
+    }
+    /* Aggregated views keep the group row count, to maintain AVG and drop empty groups */
+    SQLvalueSet_CompileList(view->list, &(view->baseStructure));
+    SQLlike_CompileList(view->list, &(view->baseStructure));
+    if ((SQLplanSelect(view->list, &(view->baseStructure), &(view->plan), 1) == 0) ||
+        (SQLstructure_Copy(&(view->structure), &(view->plan.result)) == 0))
+        goto abort;
+    /* The inserted rows would all be added, a view cannot be kept a sample of its table */
+    if (view->plan.sample.percent < 100)
+    {
+        SQLreport("a materialized view cannot SAMPLE its table.\n");
+        goto abort;
+    }
+    strcpy(view->structure.name, view->name);
+
+    return 1;
+
+abort:
+    SQLview_Release(view);
+    return 0;
+}
+
+/*
+ * Read the next view definition line
+ *
+ *      The line is read into `*line`, grown like getline() does, `name` and
+ *      `base` point into it, and `query` to the rest of the line. Returns 0
+ *      at the end of the file.
+ */
+static int SQLview_ReadLine(FILE *file, char **line, size_t *size, char **name, char **base, char **query)
+{
+    ssize_t length;
+
+    while ((length = getline(line, size, file)) > 0)
+    {
+        if ((*line)[length - 1] == '\n')
+            (*line)[length - 1] = '\0';
+        *name = *line;
+        if ((*base = strchr(*name, '\t')) == NULL)
+            continue;
+        *((*base)++) = '\0';
+        if ((*query = strchr(*base, '\t')) == NULL)
+            continue;
+        *((*query)++) = '\0';
+
+        return 1;
+    }
+    return 0;
+}
+
+/* Check if `name` is a view (`base` == 0), or the base table of any view (`base` != 0) */
+static int SQLview_Exists(const char *const table, int base)
+{
+    FILE *file;
+    char  *line;
+    size_t size;
+    char  *name;
+    char  *from;
+    char  *query;
+    int    found;
+
+    file = fopen(SQL_VIEWS_FILE, "r");
+    if (file == NULL)
+        return 0;
+    line  = NULL;
+    size  = 0;
+    found = 0;
+    while ((found == 0) && (SQLview_ReadLine(file, &line, &size, &name, &from, &query) != 0))
+        found = (strcmp(table, (base != 0) ? from : name) == 0);
+    free(line);
+    fclose(file);
+
+    return found;
+}
+
+/* Check if there are views to maintain for writes to `table` */
+int SQLview_HasViews(const char *const table)
+{
+    return SQLview_Exists(table, 1);
+}
+
+/* Check if `table` is a materialized view, views cannot be written directly */
+int SQLview_IsView(const char *const table)
+{
+    return SQLview_Exists(table, 0);
+}
+
+/* Build the definition of the view `name`, returns 0 if there is no such view */
+int SQLview_Find(struct ViewDefinition *view, const char *const name)
+{
+    FILE  *file;
+    char  *line;
+    size_t size;
+    char  *current;
+    char  *base;
+    char  *query;
+    int    found;
+
+    memset(view, 0, sizeof(*view));
+    file = fopen(SQL_VIEWS_FILE, "r");
+    if (file == NULL)
+        return 0;
+    line  = NULL;
+    size  = 0;
+    found = 0;
+    while ((found == 0) && (SQLview_ReadLine(file, &line, &size, &current, &base, &query) != 0))
+    {
+        if (strcmp(current, name) == 0)
+            found = SQLview_Prepare(view, query);
+    }
+    free(line);
+    fclose(file);
+
+    return found;
+}
+
+/* ResultSink callback writing the rows to a storage file */
+static void SQLfileSinkRow(void *context, const struct Row *const row)
+{
+    SQLwriteRowToFile(context, row);
+}
+
+/* Replace the view rows with `rows` (or with `aggregation` groups), returns 0 on failure */
+static int SQLview_Write(const struct ViewDefinition *const view, const struct Table *const rows,
+                         const char *const removed, struct Aggregation *aggregation)
+{
+    struct ResultSink sink;
+    char              filename[] = "__database_Temporary_XXXXXX"; /* temporary filename */
+    FILE             *file;
+    size_t            i;
+
+    file = SQLtemporaryFile(filename);
+    if (file == NULL)
+        return 0;
+    sink.begin   = NULL;
+    sink.row     = SQLfileSinkRow;
+    sink.end     = NULL;
+    sink.context = file;
+    if (aggregation != NULL)
+        SQLaggregation_Emit(aggregation, &sink);
+    for (i = 0 ; (rows != NULL) && (i < rows->rowCount) ; ++i)
+    {
+        if ((removed == NULL) || (removed[i] == 0))
+            SQLwriteRowToFile(file, &(rows->rows[i]));
+    }
+    fclose(file);
+    remove(view->name);
+    rename(filename, view->name);
+
+    return 1;
+}
+
+/* Recompute the whole view from its base table */
+static void SQLview_Refresh(const struct ViewDefinition *const view)
+{
+    struct ResultSink sink;
+    char              filename[] = "__database_Temporary_XXXXXX"; /* temporary filename */
+    FILE             *file;
+
+    file = SQLtemporaryFile(filename);
+    if (file == NULL)
+        return;
+    sink.begin   = NULL;
+    sink.row     = SQLfileSinkRow;
+    sink.end     = NULL;
+    sink.context = file;
+    SQLexecutePlan(view->list, &(view->baseStructure), &(view->plan), &sink);
+    fclose(file);
+    remove(view->name);
+    rename(filename, view->name);
+}
+
+/* Check if two rows hold the same values */
+static int SQLrowsEqual(const struct Row *const lhs, const struct Row *const rhs)
+{
+    size_t i;
+
+    if (lhs->columnCount != rhs->columnCount)
+        return 0;
+    for (i = 0 ; i < lhs->columnCount ; ++i)
+    {
+        if ((lhs->columns[i].type != rhs->columns[i].type) || (SQLisNull(lhs, i) != SQLisNull(rhs, i)))
+            return 0;
+        if (SQLcompareColumnValues(lhs->columns[i].value, rhs->columns[i].value, lhs->columns[i].type) != 0)
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * Apply the changes of the base table to an aggregated view
+ *
+ *      The stored groups are loaded, the deleted rows are subtracted and the
+ *      inserted rows added. Returns 0 when the delta cannot be applied (a
+ *      MIN or MAX lost its extreme value) and the view must be recomputed.
+ */
+static int SQLview_MaintainAggregate(const struct ViewDefinition *const view,
+                           const struct Table *const deleted, const struct Table *const inserted)
+{
+    struct Aggregation     aggregation;
+    struct AggregateGroup *group;
+    struct Table           stored;
+    int                    identity[view->plan.groupCount + 1];
+    size_t                 i;
+    size_t                 j;
+    int                    exact;
+
+    /* The values counted by COUNT_DISTINCT are not stored, such views are recomputed */
+    if ((SQLplanHasAggregate(&(view->plan), CountDistinctAggregate) != 0) ||
+        (SQLaggregation_Init(&aggregation, &(view->plan)) == 0))
+        return 0;
+    exact = 0;
+    /* The stored view rows start with their group values */
+    for (i = 0 ; i < view->plan.groupCount ; ++i)
+        identity[i] = i;
+    stored = SQLloadTable(NULL, &(view->structure));
+    for (i = 0 ; i < stored.rowCount ; ++i)
+    {
+        if ((group = SQLaggregation_Lookup(&aggregation, &(stored.rows[i]), identity, 1)) == NULL)
+            goto abort;
+        SQLfreeRow(&(group->row));
+        if (SQLcopyRow(&(group->row), &(stored.rows[i])) == 0)
+            goto abort;
+        group->count = group->row.columns[view->structure.count - 1].value.integer;
+        /* COUNT is its own number of non NULL arguments, the other aggregates keep it in `__values` */
+        for (j = 0 ; j < view->plan.aggregateCount ; ++j)
+        {
+            int column;
+
+            column = view->plan.valueColumns[j];
+            if (column == -1)
+                group->values[j] = group->row.columns[view->plan.groupCount + j].value.integer;
+            else if (SQLisNull(&(group->row), column) == 0)
+                group->values[j] = group->row.columns[column].value.integer;
+            else /* stored before NULL support, every row had a value */
+                group->values[j] = SQLisNull(&(group->row), view->plan.groupCount + j) ? 0 : group->count;
+            /* The approximate aggregates continue from their stored sketch */
+            column = view->plan.sketchColumns[j];
+            if ((column != -1) && (SQLisNull(&(group->row), column) == 0) &&
+                (SQLsketch_Merge(view->plan.aggregateTypes[j], group->sketches[j],
+                                 group->row.columns[column].value.string) == 0))
+                goto abort;
+        }
+    }
+    for (i = 0 ; (deleted != NULL) && (i < deleted->rowCount) ; ++i)
+    {
+        if (SQLfilterRow(view->list, &(view->baseStructure), &(deleted->rows[i])) == 0)
+            continue;
+        group = SQLaggregation_Lookup(&aggregation, &(deleted->rows[i]), view->plan.groups, 0);
+        if ((group == NULL) || (SQLaggregation_Remove(&aggregation, group, &(deleted->rows[i])) == 0))
+            goto abort;
+    }
+    for (i = 0 ; (inserted != NULL) && (i < inserted->rowCount) ; ++i)
+    {
+        if (SQLfilterRow(view->list, &(view->baseStructure), &(inserted->rows[i])) == 0)
+            continue;
+        group = SQLaggregation_Lookup(&aggregation, &(inserted->rows[i]), view->plan.groups, 1);
+        if (group == NULL)
+            goto abort;
+        SQLaggregation_Add(&aggregation, group, &(inserted->rows[i]));
+    }
+    exact = SQLview_Write(view, NULL, NULL, &aggregation);
+
+abort:
+    SQLfreeTable(&stored);
+    SQLaggregation_Free(&aggregation);
+
+    return exact;
+}
+
+/*
+ * Apply the changes of the base table to a filter/projection view
+ *
+ *      Inserted rows are appended to the view storage, deleted rows remove
+ *      one equal view row each. Returns 0 if the view must be recomputed.
+ */
+static int SQLview_MaintainProjection(const struct ViewDefinition *const view,
+                            const struct Table *const deleted, const struct Table *const inserted)
+{
+    struct Table stored;
+    struct Table added;
+    struct Row   projected;
+    char        *removed;
+    size_t       i;
+    size_t       j;
+    int          exact;
+
+    stored.rows     = NULL;
+    stored.rowCount = 0;
+    added.rows      = NULL;
+    added.rowCount  = 0;
+    removed         = NULL;
+    exact           = 0;
+    /* A DISTINCT view row may come from several base rows, such views are recomputed */
+    if (view->plan.distinct != 0)
+        return 0;
+    /* The projected values are borrowed from the base rows, only the columns are released */
+    memset(&projected, 0, sizeof(projected));
+    if ((view->plan.fieldCount != 0) && (SQLallocRow(&projected, view->plan.fieldCount) == 0))
+        return 0;
+    for (i = 0 ; (inserted != NULL) && (i < inserted->rowCount) ; ++i)
+    {
+        const struct Row *row;
+
+        row = &(inserted->rows[i]);
+        if (SQLfilterRow(view->list, &(view->baseStructure), row) == 0)
+            continue;
+        if (view->plan.fieldCount != 0)
+        {
+            SQLprojectRow(&(view->plan), row, &projected);
+            row = &projected;
+        }
+        if (SQLappendRow(&added, row) == 0)
+            goto abort;
+    }
+    /* Only inserts, the new rows are simply appended */
+    if ((deleted == NULL) || (deleted->rowCount == 0))
+    {
+        FILE *file;
+
+        file = fopen(view->name, "a");
+        if (file == NULL)
+            goto abort;
+        for (i = 0 ; i < added.rowCount ; ++i)
+            SQLwriteRowToFile(file, &(added.rows[i]));
+        fclose(file);
+        exact = 1;
+        goto abort;
+    }
+
+    stored  = SQLloadTable(NULL, &(view->structure));
+    removed = calloc(stored.rowCount + 1, 1);
+    if (removed == NULL)
+        goto abort;
+    for (i = 0 ; i < deleted->rowCount ; ++i)
+    {
+        const struct Row *row;
+
+        row = &(deleted->rows[i]);
+        if (SQLfilterRow(view->list, &(view->baseStructure), row) == 0)
+            continue;
+        if (view->plan.fieldCount != 0)
+        {
+            SQLprojectRow(&(view->plan), row, &projected);
+            row = &projected;
+        }
+        for (j = 0 ; j < stored.rowCount ; ++j)
+        {
+            if ((removed[j] == 0) && (SQLrowsEqual(&(stored.rows[j]), row) != 0))
+                break;
+        }
+        if (j == stored.rowCount) /* The view is out of sync with its base table */
+            goto abort;
+        removed[j] = 1;
+    }
+    for (i = 0 ; i < added.rowCount ; ++i)
+    {
+        if (SQLappendRow(&stored, &(added.rows[i])) == 0)
+            goto abort;
+    }
+    exact = SQLview_Write(view, &stored, removed, NULL);
+
+abort:
+    free(removed);
+    free(projected.columns);
+    SQLfreeTable(&stored);
+    SQLfreeTable(&added);
+
+    return exact;
+}
+
+/*
+ * Propagate the changes of `table` to the materialized views reading from it
+ *
+ *      `deleted` holds the removed rows (or the old version of updated rows)
+ *      and `inserted` the new rows (or the new version of updated rows).
+ */
+void SQLview_ApplyDelta(const char *const table, const struct Table *const deleted, const struct Table *const inserted)
+{
+    struct ViewDefinition *view;
+    FILE                  *file;
+    char                  *line;
+    size_t                 size;
+    char                  *name;
+    char                  *base;
+    char                  *query;
+
+    file = fopen(SQL_VIEWS_FILE, "r");
+    if (file == NULL)
+        return;
+    view = malloc(sizeof(struct ViewDefinition));
+    if (view == NULL)
+    {
+        fclose(file);
+        return;
+    }
+    line = NULL;
+    size = 0;
+    while (SQLview_ReadLine(file, &line, &size, &name, &base, &query) != 0)
+    {
+        int exact;
+
+        if ((strcmp(base, table) != 0) || (SQLview_Prepare(view, query) == 0))
+            continue;
+        if ((view->plan.groupCount != 0) || (view->plan.aggregateCount != 0))
+            exact = SQLview_MaintainAggregate(view, deleted, inserted);
+        else
+            exact = SQLview_MaintainProjection(view, deleted, inserted);
+        if (exact == 0)
+            SQLview_Refresh(view);
+        SQLresultCache_Invalidate(view->name);
+        SQLview_Release(view);
+    }
+    free(line);
+    free(view);
+    fclose(file);
+}
+
+/*
+ * Create a materialized view
+ *
+ *      MATERIALIZED_VIEW:VIEWNAME FROM:TABLENAME FIELD=VALUE GROUP:A SUM:B ...
+ *
+ *  The view accepts the conditions and clauses of SELECT, its rows are stored
+ *  in a table named after the view and kept up to date by every write to the
+ *  base table.
+ */
+void SQLview_Create(const char *const query)
+{
+    struct ViewDefinition *view;
+    FILE                  *file;
+
+    if (strchr(query, '\n') != NULL)
+        return;
+    view = malloc(sizeof(struct ViewDefinition));
+    if (view == NULL)
+        return;
+    if (SQLview_Prepare(view, query) == 0)
+    {
+        SQLreport("cannot create materialized view, usage: MATERIALIZED_VIEW:NAME FROM:TABLENAME ...\n");
+        free(view);
+        return;
+    }
+    if ((file = fopen(SQL_VIEWS_FILE, "a")) == NULL)
+        goto abort;
+    /* The view rows are stored like a table, so SELECT reads them directly */
+    if (SQLParser_StoreTable(&(view->structure)) != 0)
+    {
+        fclose(file);
+        goto abort;
+    }
+    fprintf(file, "%s\t%s\t%s\n", view->name, view->base, query);
+    fclose(file);
+    SQLview_Refresh(view);
+
+abort:
+    SQLview_Release(view);
+    free(view);
+}
+
+/* Write-ahead log of a primary, one `lsn\ttime\tquery` line per write */
+#define SQL_WAL_FILE "__wal.log"
+
+/* Role of this process in log shipping replication */
+enum ReplicationRole
+{
+    StandaloneRole,
+    PrimaryRole,
+    ReplicaRole
+};
+
+/*
+ * Replication state:
+ *      role      : standalone, primary logging its writes, or read-only replica
+ *      wal       : the log appended by a primary
+ *      lsn       : last log sequence number written (primary) or applied (replica)
+ *      primaryLsn: last log sequence number found in the primary log (replica)
+ *      lagSeconds: delay between the primary logging and the replica applying
+ *                  the last applied record
+ *      applying  : set while a replica executes a logged write
+ */
+struct ReplicationState
+{
+    enum ReplicationRole role;
+    FILE                *wal;
+    unsigned long        lsn;
+    unsigned long        primaryLsn;
+    double               lagSeconds;
+    int                  applying;
+};
+
+/* The replication state of this process */
+static struct ReplicationState SQLreplication;
+
+/* Current time in seconds */
+double SQLwal_Now(void)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return now.tv_sec + now.tv_usec / 1e6;
+}
+
+/* Split a complete log record in place, returns 0 if the line is incomplete or malformed */
+int SQLwal_ParseRecord(char *line, unsigned long *lsn, double *time, char **query)
+{
+    char  *end;
+    size_t length;
+
+    length = strlen(line);
+    if ((length == 0) || (line[length - 1] != '\n'))
+        return 0;
+    line[length - 1] = '\0';
+
+    *lsn = strtoul(line, &end, 10);
+    if (*end != '\t')
+        return 0;
+    *time = strtod(end + 1, &end);
+    if (*end != '\t')
+        return 0;
+    *query = end + 1;
+
+    return 1;
+}
+
+/* Become a primary, numbering the logged writes after the records already in the log */
+int SQLwal_Open(void)
+{
+    FILE   *file;
+    char   *line;
+    size_t  size;
+
+    SQLreplication.lsn = 0;
+    if ((file = fopen(SQL_WAL_FILE, "r")) != NULL)
+    {
+        line = NULL;
+        size = 0;
+        while (getline(&line, &size, file) > 0)
+        {
+            unsigned long lsn;
+            double        time;
+            char         *query;
+
+            if ((SQLwal_ParseRecord(line, &lsn, &time, &query) != 0) && (lsn > SQLreplication.lsn))
+                SQLreplication.lsn = lsn;
+        }
+        free(line);
+        fclose(file);
+    }
+    if ((SQLreplication.wal = fopen(SQL_WAL_FILE, "a")) == NULL)
+    {
+        SQLreport("error: cannot open the write-ahead log `%s`.\n", SQL_WAL_FILE);
+        return 0;
+    }
+    SQLreplication.role       = PrimaryRole;
+    SQLreplication.primaryLsn = SQLreplication.lsn;
+
+    return 1;
+}
+
+/* Log a write before it is executed, the replicas replay it in the same order */
+void SQLwal_Append(const char *const query)
+{
+    if (strchr(query, '\n') != NULL)
+        return;
+    SQLreplication.primaryLsn = ++SQLreplication.lsn;
+    fprintf(SQLreplication.wal, "%lu\t%.6f\t%s\n", SQLreplication.lsn, SQLwal_Now(), query);
+    fflush(SQLreplication.wal);
+}
+
+/* Check if executing a query of this type modifies the database */
+int SQLisWrite(enum QueryType type)
+{
+    return (type == Create) || (type == CreateView) || (type == Insert) || (type == Update) || (type == Delete) ||
+           (type == Alter);
+}
+
+/*
+ * Report the replication state as one row
+ *
+ *      STATUS:REPLICATION
+ *
+ *  role, lsn (last written or applied), primary_lsn, lag_records and
+ *  lag_seconds (delay of the last applied record).
+ */
+void SQLreplication_Status(const struct ResultSink *const sink)
+{
+    static const char *const roles[] = {"standalone", "primary", "replica"};
+    static const char *const names[] = {"role", "lsn", "primary_lsn", "lag_records", "lag_seconds"};
+    static const enum FieldType types[] = {String, Int64, Int64, Int64, Double};
+    struct TableStructureInfo structure;
+    struct Row                row;
+    size_t                    i;
+
+    memset(&structure, 0, sizeof(structure));
+    memset(&row, 0, sizeof(row));
+    strcpy(structure.name, "REPLICATION");
+    for (i = 0 ; i < sizeof(names) / sizeof(names[0]) ; ++i)
+    {
+        if (SQLstructure_AddColumn(&structure, names[i], types[i], NULL) == 0)
+            goto abort;
+    }
+    if (SQLallocRow(&row, structure.count) == 0)
+        goto abort;
+    for (i = 0 ; i < structure.count ; ++i)
+    {
+        row.columns[i].type     = types[i];
+        row.columns[i].position = i;
+    }
+    row.index                   = 1;
+    row.columns[0].value.string = strdup(roles[SQLreplication.role]);
+    row.columns[1].value.int64  = SQLreplication.lsn;
+    row.columns[2].value.int64  = SQLreplication.primaryLsn;
+    row.columns[3].value.int64  = SQLreplication.primaryLsn - SQLreplication.lsn;
+    row.columns[4].value.real   = SQLreplication.lagSeconds;
+    if (row.columns[0].value.string == NULL)
+        goto abort;
+
+    if (sink->begin != NULL)
+        sink->begin(sink->context, &structure);
+    sink->row(sink->context, &row);
+    if (sink->end != NULL)
+        sink->end(sink->context);
+
+abort:
+    SQLstructure_Free(&structure);
+    SQLfreeRow(&row);
+}
+
+/*
+ * Execute query function, sending the results to `sink`
+ *
+ *      Returns 1 if the query cannot be parsed, 2 if a timeout or a CANCEL
+ *      stopped it, SQLcancel.stopped then tells which.
+ */
+int SQLExecuteQueryToSink(const char *const query, const struct ResultSink *const sink)
+{
+    struct TokenList         *list;
+    struct TableStructureInfo table;
+    struct TableStructureInfo source;
+    enum QueryType            type;
+    const char               *from;
+    const char               *into;
+    int                       write;
+
+    list = SQLParser_Parse(query);
+    if (list == NULL)
+        return 1;
+
+    /* Find the queried table */
+    table = SQLParser_FindTable(list->value);
+    type  = SQLParser_GetQueryType(list->keyword);
+    /* INSERT ... SELECT reads the rows of its FROM table, SELECT ... INTO writes them to its INTO table */
+    from = (type == Insert) ? SQLParser_FindClause(list, FromClause) : NULL;
+    into = (type == Select) ? SQLParser_FindClause(list, IntoClause) : NULL;
+    memset(&source, 0, sizeof(source));
+    if (from != NULL)
+        source = SQLParser_FindTable(from);
+    /* IN lists and LIKE patterns are compiled once, not for every row they are checked against */
+    SQLvalueSet_CompileList(list, (from != NULL) ? &source : &table);
+    SQLlike_CompileList(list, (from != NULL) ? &source : &table);
+    write = (SQLisWrite(type) != 0) || (into != NULL);
+    if (((type == Insert) || (type == Update) || (type == Delete) || (type == Select)) &&
+        (SQLcheckLiterals(list, (from != NULL) ? &source : &table) == 0))
+        type = Invalid;
+    /* Only the plain SELECT statements stop early, at their timeout or a CANCEL */
+    if (SQLcancel_Begin(list, (type == Select) && (into == NULL)) == 0)
+        type = Invalid;
+    /* Materialized views are only written by the maintenance of their base table */
+    if (((type == Insert) || (type == Update) || (type == Delete) || (type == Alter)) &&
+        (SQLview_IsView(list->value) != 0))
+    {
+        SQLreport("cannot modify materialized view `%s`\n", list->value);
+        type = Invalid;
+    }
+    if ((into != NULL) && (SQLview_IsView(into) != 0))
+    {
+        SQLreport("cannot modify materialized view `%s`\n", into);
+        type = Invalid;
+    }
+    /* Replicas only change by replaying the primary log */
+    if ((SQLreplication.role == ReplicaRole) && (SQLreplication.applying == 0) && (write != 0))
+    {
+        SQLreport("read-only replica, cannot execute `%s`\n", list->keyword);
+        type = Invalid;
+    }
+    if ((SQLreplication.role == PrimaryRole) && (type != Invalid) && (write != 0))
+        SQLwal_Append(query);
+    switch (type) /* Check the command and call the right function */
+    {
+        case Create:
+            if (table.name[0] == '\0')
+                SQLParser_CreateTable(list);
+            else
+                SQLreport("there is a table with the same name, cannot create table `%s`\n", list->value);
+            /* Results cached while the table did not exist are now wrong */
+            SQLresultCache_Invalidate(list->value);
+            break;
+        case CreateView:
+            if (table.name[0] == '\0')
+                SQLview_Create(query);
+            else
+                SQLreport("there is a table with the same name, cannot create view `%s`\n", list->value);
             break;
         case Select:
-            SQLselect(list, &table);
+            if (into == NULL)
+                SQLcachedSelect(list, &table, sink);
+            else if (table.name[0] == '\0')
+                SQLreport("no table `%s`\n", list->value);
+            else
+            {
+                SQLinsertSelect(list, &table, into, 1);
+                SQLresultCache_Invalidate(into);
+            }
             break;
         case Update:
             SQLupdate(list, &table);
+            SQLresultCache_Invalidate(list->value);
             break;
         case Insert:
-            SQLinsert(list, &table);
+            if (from == NULL)
+                SQLinsert(list, &table);
+            else if (source.name[0] == '\0')
+                SQLreport("no table `%s`\n", from);
+            else
+                SQLinsertSelect(list, &source, list->value, 0);
+            SQLresultCache_Invalidate(list->value);
             break;
         case Delete:
             SQLdelete(list, &table);
+            SQLresultCache_Invalidate(list->value);
+            break;
+        case Alter:
+            if (table.name[0] == '\0')
+                SQLreport("no table `%s`\n", list->value);
+            else
+                SQLParser_AlterTable(list, &table);
+            SQLresultCache_Invalidate(list->value);
+            break;
+        case Status:
+            if (strcmp(list->value, "REPLICATION") == 0)
+                SQLreplication_Status(sink);
+            else
+                SQLreport("unknown status `%s`, usage: STATUS:REPLICATION\n", list->value);
+            break;
+        case Cancel: /* The server stops the request as soon as the CANCEL is received */
             break;
         default:
             break;
     }
+    SQLcancel.enabled = 0;
+    if (SQLcancel.stopped != NULL)
+        SQLreport("%s, the result is incomplete\n", SQLcancel.stopped);
+    SQLstructure_Free(&table);
+    SQLstructure_Free(&source);
     freeTokens(list);
 
-    return 0;
+    return (SQLcancel.stopped != NULL) ? 2 : 0;
+}
+
+/* Execute query function, printing the results to stdout */
+int SQLExecuteQuery(const char *const query)
+{
+    return SQLExecuteQueryToSink(query, &SQLstdoutSink);
 }
+
+#endif /* SQLPARSER_H */
@@ -0,0 +1,606 @@
+#ifndef SQLPROTOCOL_H
+#define SQLPROTOCOL_H
+
+#include <stdint.h>
+#include <errno.h>
+#include <arpa/inet.h>
+
+#include "sqlparser.h"
+
+/*
+ * Binary client/server wire protocol
+ *
+ *  Every message is a length prefixed frame:
+ *
+ *      u32 length : number of bytes following this field
+ *      u8  type   : one of `enum FrameType`
+ *      u32 request: request id chosen by the client, echoed in the replies
+ *      ...        : the frame payload
+ *
+ *  All integers are sent in network byte order. The client sends QueryFrame
+ *  frames with the query text as payload, and it can send many of them before
+ *  reading any reply (pipelining), the replies come back in request order:
+ *
+ *      HeaderFrame  : u16 column count, then for each column u8 type, u16 name
+ *                     length and the name bytes
+ *      BatchFrame   : u32 row count, then the column-major data, for each
+ *                     column its validity bitmap ((row count + 7) / 8
+ *                     bytes, bit `j % 8` of byte `j / 8` set when the
+ *                     value of row `j` is NULL) followed by the values of
+ *                     all the rows in the batch, NULL values included
+ *                          INTEGER i32, NUMBER f32 bits, BOOLEAN u8,
+ *                          INT64 i64, DOUBLE f64 bits, DECIMAL i64
+ *                          (in units of 1 / SQL_DECIMAL_SCALE),
+ *                          TIMESTAMP i64 microseconds, DATE i64 days,
+ *                          STRING  u32 length followed by the bytes
+ *      CompleteFrame: u32 status, 0 on success
+ *      ErrorFrame   : the error message
+ */
+enum FrameType
+{
+    QueryFrame    = 'Q',
+    HeaderFrame   = 'H',
+    BatchFrame    = 'B',
+    CompleteFrame = 'C',
+    ErrorFrame    = 'E'
+};
+
+/* Size of the fixed frame header: length, type and request id */
+#define SQL_FRAME_HEADER_SIZE 9
+/* Maximum rows encoded in one BatchFrame */
+#define SQL_FRAME_BATCH_ROWS 4096
+/* Larger frames are considered garbage and the connection is dropped */
+#define SQL_FRAME_MAX_SIZE (64 * 1024 * 1024)
+
+/*
+ * Growable byte buffer used to build and receive frames:
+ *      data    : the bytes
+ *      length  : number of used bytes
+ *      capacity: number of allocated bytes
+ *      error   : set when an allocation failed, the content is then invalid
+ */
+struct FrameBuffer
+{
+    unsigned char *data;
+    size_t         length;
+    size_t         capacity;
+    int            error;
+};
+
+/*
+ * Cursor to decode the payload of a received frame:
+ *      data  : the payload
+ *      length: size of the payload
+ *      offset: position of the next value to read
+ *      error : set when reading past the end of the payload
+ */
+struct FrameReader
+{
+    const unsigned char *data;
+    size_t               length;
+    size_t               offset;
+    int                  error;
+};
+
+/*
+ * ResultSink state that encodes the rows as protocol frames:
+ *      output     : the buffer that receives the frames
+ *      request    : the request id the frames answer to
+ *      columnCount: number of columns in the result
+ *      columnTypes: data type of each result column
+ *      columns    : column-major data of the batch being built
+ *      nulls      : validity bitmap of each column of the batch being built,
+ *                   SQL_FRAME_BATCH_ROWS / 8 bytes per column
+ *      rowCount   : number of rows in the batch being built
+ *
+ *  The column arrays are allocated for the result by the begin callback and
+ *  released with SQLFrameEncoder_Free().
+ */
+struct FrameEncoder
+{
+    struct FrameBuffer *output;
+    uint32_t            request;
+    size_t              columnCount;
+    enum FieldType     *columnTypes;
+    struct FrameBuffer *columns;
+    unsigned char      *nulls;
+    uint32_t            rowCount;
+};
+
+/* Make room for `size` more bytes in the buffer */
+static int SQLFrame_Reserve(struct FrameBuffer *buffer, size_t size)
+{
+    unsigned char *auxiliar;
+    size_t         capacity;
+
+    if (buffer->error != 0)
+        return 0;
+    if (buffer->length + size <= buffer->capacity)
+        return 1;
+    capacity = (buffer->capacity == 0) ? 4096 : buffer->capacity;
+    while (capacity < buffer->length + size)
+        capacity *= 2;
+    auxiliar = realloc(buffer->data, capacity);
+    if (auxiliar == NULL)
+    {
+        buffer->error = 1;
+        return 0;
+    }
+    buffer->data     = auxiliar;
+    buffer->capacity = capacity;
+
+    return 1;
+}
+
+/* Release the buffer memory */
+static void SQLFrame_Free(struct FrameBuffer *buffer)
+{
+    free(buffer->data);
+    memset(buffer, 0, sizeof(*buffer));
+}
+
+/* Append raw bytes to the buffer */
+static void SQLFrame_PutBytes(struct FrameBuffer *buffer, const void *const bytes, size_t size)
+{
+    if (SQLFrame_Reserve(buffer, size) == 0)
+        return;
+    memcpy(buffer->data + buffer->length, bytes, size);
+    buffer->length += size;
+}
+
+/* Append integers in network byte order */
+static void SQLFrame_PutU8(struct FrameBuffer *buffer, uint8_t value)
+{
+    SQLFrame_PutBytes(buffer, &value, sizeof(value));
+}
+
+static void SQLFrame_PutU16(struct FrameBuffer *buffer, uint16_t value)
+{
+    value = htons(value);
+    SQLFrame_PutBytes(buffer, &value, sizeof(value));
+}
+
+static void SQLFrame_PutU32(struct FrameBuffer *buffer, uint32_t value)
+{
+    value = htonl(value);
+    SQLFrame_PutBytes(buffer, &value, sizeof(value));
+}
+
+/* Append a 64-bit value, in network order */
+static void SQLFrame_PutU64(struct FrameBuffer *buffer, uint64_t value)
+{
+    SQLFrame_PutU32(buffer, (uint32_t) (value >> 32));
+    SQLFrame_PutU32(buffer, (uint32_t) value);
+}
+
+/* Start a new frame, returns the frame offset to pass to SQLFrame_End() */
+static size_t SQLFrame_Begin(struct FrameBuffer *buffer, enum FrameType type, uint32_t request)
+{
+    size_t start;
+
+    start = buffer->length;
+    SQLFrame_PutU32(buffer, 0); /* patched by SQLFrame_End() */
+    SQLFrame_PutU8(buffer, type);
+    SQLFrame_PutU32(buffer, request);
+
+    return start;
+}
+
+/* Finish the frame started at `start`, writing its length prefix */
+static void SQLFrame_End(struct FrameBuffer *buffer, size_t start)
+{
+    uint32_t length;
+
+    if (buffer->error != 0)
+        return;
+    length = htonl(buffer->length - start - sizeof(length));
+    memcpy(buffer->data + start, &length, sizeof(length));
+}
+
+/* Append a whole frame with a byte payload */
+static void SQLFrame_PutFrame(struct FrameBuffer *buffer, enum FrameType type, uint32_t request,
+                                                        const void *const payload, size_t size)
+{
+    size_t start;
+
+    start = SQLFrame_Begin(buffer, type, request);
+    SQLFrame_PutBytes(buffer, payload, size);
+    SQLFrame_End(buffer, start);
+}
+
+/* Append a CompleteFrame */
+static void SQLFrame_PutComplete(struct FrameBuffer *buffer, uint32_t request, uint32_t status)
+{
+    size_t start;
+
+    start = SQLFrame_Begin(buffer, CompleteFrame, request);
+    SQLFrame_PutU32(buffer, status);
+    SQLFrame_End(buffer, start);
+}
+
+/*
+ * Check for a complete frame at `offset` in the received data
+ *
+ *      Returns the full size of the frame (including the length prefix), 0 if
+ *      more data is needed, or -1 if the frame is malformed.
+ */
+static long SQLFrame_Available(const struct FrameBuffer *buffer, size_t offset)
+{
+    uint32_t length;
+
+    if (buffer->length - offset < SQL_FRAME_HEADER_SIZE)
+        return 0;
+    memcpy(&length, buffer->data + offset, sizeof(length));
+    length = ntohl(length);
+    if ((length < SQL_FRAME_HEADER_SIZE - sizeof(length)) || (length > SQL_FRAME_MAX_SIZE))
+        return -1;
+    if (buffer->length - offset < sizeof(length) + length)
+        return 0;
+
+    return sizeof(length) + length;
+}
+
+/* Initialize a reader over the frame at `frame` of `size` bytes, returns the frame type */
+static enum FrameType SQLFrame_Open(struct FrameReader *reader, const unsigned char *frame,
+                                                            size_t size, uint32_t *request)
+{
+    uint32_t value;
+
+    memcpy(&value, frame + 5, sizeof(value));
+    *request       = ntohl(value);
+    reader->data   = frame + SQL_FRAME_HEADER_SIZE;
+    reader->length = size - SQL_FRAME_HEADER_SIZE;
+    reader->offset = 0;
+    reader->error  = 0;
+
+    return frame[4];
+}
+
+/* Read raw bytes from the payload, returns NULL if there are not enough */
+static const unsigned char *SQLFrame_GetBytes(struct FrameReader *reader, size_t size)
+{
+    const unsigned char *bytes;
+
+    if ((reader->error != 0) || (reader->length - reader->offset < size))
+    {
+        reader->error = 1;
+        return NULL;
+    }
+    bytes           = reader->data + reader->offset;
+    reader->offset += size;
+
+    return bytes;
+}
+
+/* Read integers in network byte order */
+static uint8_t SQLFrame_GetU8(struct FrameReader *reader)
+{
+    const unsigned char *bytes;
+
+    bytes = SQLFrame_GetBytes(reader, 1);
+    return (bytes == NULL) ? 0 : *bytes;
+}
+
+static uint16_t SQLFrame_GetU16(struct FrameReader *reader)
+{
+    const unsigned char *bytes;
+    uint16_t             value;
+
+    if ((bytes = SQLFrame_GetBytes(reader, sizeof(value))) == NULL)
+        return 0;
+    memcpy(&value, bytes, sizeof(value));
+
+    return ntohs(value);
+}
+
+static uint32_t SQLFrame_GetU32(struct FrameReader *reader)
+{
+    const unsigned char *bytes;
+    uint32_t             value;
+
+    if ((bytes = SQLFrame_GetBytes(reader, sizeof(value))) == NULL)
+        return 0;
+    memcpy(&value, bytes, sizeof(value));
+
+    return ntohl(value);
+}
+
+/* Read a 64-bit value, in network order */
+static uint64_t SQLFrame_GetU64(struct FrameReader *reader)
+{
+    uint64_t high;
+
+    high = SQLFrame_GetU32(reader);
+    return (high << 32) | SQLFrame_GetU32(reader);
+}
+
+/* Write the whole buffer to the descriptor, returns 0 on failure */
+static int SQLFrame_WriteAll(int descriptor, const unsigned char *data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t written;
+
+        written = write(descriptor, data, size);
+        if ((written < 0) && (errno == EINTR))
+            continue;
+        if (written <= 0)
+            return 0;
+        data += written;
+        size -= written;
+    }
+    return 1;
+}
+
+/* Read whatever is available from the descriptor into the buffer, returns 0 on EOF or error */
+static int SQLFrame_Fill(int descriptor, struct FrameBuffer *buffer)
+{
+    ssize_t received;
+
+    if (SQLFrame_Reserve(buffer, 64 * 1024) == 0)
+        return 0;
+    do
+        received = read(descriptor, buffer->data + buffer->length, buffer->capacity - buffer->length);
+    while ((received < 0) && (errno == EINTR));
+    if (received <= 0)
+        return 0;
+    buffer->length += received;
+
+    return 1;
+}
+
+/* Drop the first `size` bytes of the buffer, keeping the rest */
+static void SQLFrame_Consume(struct FrameBuffer *buffer, size_t size)
+{
+    memmove(buffer->data, buffer->data + size, buffer->length - size);
+    buffer->length -= size;
+}
+
+/* Validity bitmap of one column of the batch being built */
+static unsigned char *SQLFrameEncoder_Nulls(struct FrameEncoder *encoder, size_t column)
+{
+    return encoder->nulls + column * (SQL_FRAME_BATCH_ROWS / 8);
+}
+
+/* Encode the pending rows as one BatchFrame */
+static void SQLFrameEncoder_Flush(struct FrameEncoder *encoder)
+{
+    size_t start;
+    size_t i;
+
+    if (encoder->rowCount == 0)
+        return;
+    start = SQLFrame_Begin(encoder->output, BatchFrame, encoder->request);
+    SQLFrame_PutU32(encoder->output, encoder->rowCount);
+    for (i = 0 ; i < encoder->columnCount ; ++i)
+    {
+        SQLFrame_PutBytes(encoder->output, SQLFrameEncoder_Nulls(encoder, i), (encoder->rowCount + 7) / 8);
+        SQLFrame_PutBytes(encoder->output, encoder->columns[i].data, encoder->columns[i].length);
+        memset(SQLFrameEncoder_Nulls(encoder, i), 0, (encoder->rowCount + 7) / 8);
+        encoder->columns[i].length = 0;
+    }
+    SQLFrame_End(encoder->output, start);
+    encoder->rowCount = 0;
+}
+
+/* Release the encoder column buffers */
+static void SQLFrameEncoder_Free(struct FrameEncoder *encoder)
+{
+    size_t i;
+
+    for (i = 0 ; (encoder->columns != NULL) && (i < encoder->columnCount) ; ++i)
+        SQLFrame_Free(&(encoder->columns[i]));
+    free(encoder->columnTypes);
+    free(encoder->columns);
+    free(encoder->nulls);
+    encoder->columnTypes = NULL;
+    encoder->columns     = NULL;
+    encoder->nulls       = NULL;
+    encoder->columnCount = 0;
+}
+
+/* ResultSink callback, sends the HeaderFrame */
+static void SQLFrameEncoder_Begin(void *context, const struct TableStructureInfo *const tableStructure)
+{
+    struct FrameEncoder *encoder;
+    size_t               start;
+    size_t               i;
+
+    encoder = context;
+    SQLFrameEncoder_Free(encoder);
+    encoder->columnTypes = calloc(tableStructure->count + 1, sizeof(enum FieldType));
+    encoder->columns     = calloc(tableStructure->count + 1, sizeof(struct FrameBuffer));
+    encoder->nulls       = calloc(tableStructure->count + 1, SQL_FRAME_BATCH_ROWS / 8);
+    /* The HeaderFrame sends the column count on 16 bits */
+    if ((encoder->columnTypes == NULL) || (encoder->columns == NULL) || (encoder->nulls == NULL) ||
+        (tableStructure->count > UINT16_MAX))
+    {
+        encoder->output->error = 1;
+        return;
+    }
+    encoder->columnCount = tableStructure->count;
+    start                = SQLFrame_Begin(encoder->output, HeaderFrame, encoder->request);
+    SQLFrame_PutU16(encoder->output, tableStructure->count);
+    for (i = 0 ; i < tableStructure->count ; ++i)
+    {
+        size_t length;
+
+        length                  = strlen(tableStructure->columns[i]);
+        encoder->columnTypes[i] = tableStructure->columnTypes[i];
+        SQLFrame_PutU8(encoder->output, tableStructure->columnTypes[i]);
+        SQLFrame_PutU16(encoder->output, length);
+        SQLFrame_PutBytes(encoder->output, tableStructure->columns[i], length);
+    }
+    SQLFrame_End(encoder->output, start);
+}
+
+/* ResultSink callback, appends the row to the column-major batch */
+static void SQLFrameEncoder_Row(void *context, const struct Row *const row)
+{
+    struct FrameEncoder *encoder;
+    size_t               i;
+
+    encoder = context;
+    for (i = 0 ; i < encoder->columnCount ; ++i)
+    {
+        struct FrameBuffer *column;
+        union Value         value;
+        uint32_t            bits;
+        uint64_t            wide;
+        size_t              length;
+
+        column = &(encoder->columns[i]);
+        /* A short row (missing trailing columns) is sent with zero values */
+        memset(&value, 0, sizeof(value));
+        if (i < row->columnCount)
+            value = row->columns[i].value;
+        if ((i < row->columnCount) && (SQLisNull(row, i) != 0))
+            SQLFrameEncoder_Nulls(encoder, i)[encoder->rowCount / 8] |= 1 << (encoder->rowCount % 8);
+        switch (encoder->columnTypes[i])
+        {
+        case Integer:
+            SQLFrame_PutU32(column, (uint32_t) value.integer);
+            break;
+        case Number:
+            memcpy(&bits, &(value.number), sizeof(bits));
+            SQLFrame_PutU32(column, bits);
+            break;
+        case Int64:
+            SQLFrame_PutU64(column, (uint64_t) value.int64);
+            break;
+        case Double:
+            memcpy(&wide, &(value.real), sizeof(wide));
+            SQLFrame_PutU64(column, wide);
+            break;
+        case Decimal:
+            SQLFrame_PutU64(column, (uint64_t) value.decimal);
+            break;
+        case Timestamp:
+            SQLFrame_PutU64(column, (uint64_t) value.timestamp);
+            break;
+        case Date:
+            SQLFrame_PutU64(column, (uint64_t) value.date);
+            break;
+        case Boolean:
+            SQLFrame_PutU8(column, value.boolean);
+            break;
+        case String:
+            length = (value.string == NULL) ? 0 : strlen(value.string);
+            SQLFrame_PutU32(column, length);
+            SQLFrame_PutBytes(column, value.string, length);
+            break;
+        }
+    }
+    if (++encoder->rowCount == SQL_FRAME_BATCH_ROWS)
+        SQLFrameEncoder_Flush(encoder);
+}
+
+/* ResultSink callback, sends the last partial batch */
+static void SQLFrameEncoder_End(void *context)
+{
+    SQLFrameEncoder_Flush(context);
+}
+
+/*
+ * Decode a BatchFrame payload into rows
+ *
+ *      `types` are the column types from the HeaderFrame, the returned rows
+ *      must be released with SQLfreeRow() and free(), NULL is returned when
+ *      the payload is malformed.
+ */
+static struct Row *SQLFrame_DecodeBatch(struct FrameReader *reader, const enum FieldType *types,
+                                                        size_t columnCount, uint32_t *rowCount)
+{
+    struct Row *rows;
+    uint32_t    count;
+    size_t      i;
+    uint32_t    j;
+
+    count = SQLFrame_GetU32(reader);
+    if ((reader->error != 0) || (count > SQL_FRAME_BATCH_ROWS))
+        return NULL;
+    rows = calloc(count + 1, sizeof(struct Row));
+    if (rows == NULL)
+        return NULL;
+    for (j = 0 ; j < count ; ++j)
+    {
+        if (SQLallocRow(&(rows[j]), columnCount) == 0)
+        {
+            while (j-- > 0)
+                SQLfreeRow(&(rows[j]));
+            free(rows);
+            return NULL;
+        }
+    }
+    for (i = 0 ; i < columnCount ; ++i)
+    {
+        const unsigned char *nulls;
+
+        if ((nulls = SQLFrame_GetBytes(reader, (count + 7) / 8)) == NULL)
+            break;
+        for (j = 0 ; j < count ; ++j)
+            SQLsetNull(&(rows[j]), i, (nulls[j / 8] >> (j % 8)) & 1);
+        for (j = 0 ; j < count ; ++j)
+        {
+            struct Column       *column;
+            const unsigned char *bytes;
+            uint32_t             bits;
+            uint64_t             wide;
+
+            column           = &(rows[j].columns[i]);
+            column->type     = types[i];
+            column->position = i;
+            switch (types[i])
+            {
+            case Integer:
+                column->value.integer = (int32_t) SQLFrame_GetU32(reader);
+                break;
+            case Number:
+                bits = SQLFrame_GetU32(reader);
+                memcpy(&(column->value.number), &bits, sizeof(bits));
+                break;
+            case Int64:
+                column->value.int64 = (int64_t) SQLFrame_GetU64(reader);
+                break;
+            case Double:
+                wide = SQLFrame_GetU64(reader);
+                memcpy(&(column->value.real), &wide, sizeof(wide));
+                break;
+            case Decimal:
+                column->value.decimal = (int64_t) SQLFrame_GetU64(reader);
+                break;
+            case Timestamp:
+                column->value.timestamp = (int64_t) SQLFrame_GetU64(reader);
+                break;
+            case Date:
+                column->value.date = (int64_t) SQLFrame_GetU64(reader);
+                break;
+            case Boolean:
+                column->value.boolean = SQLFrame_GetU8(reader) ? True : False;
+                break;
+            case String:
+                bits  = SQLFrame_GetU32(reader);
+                bytes = SQLFrame_GetBytes(reader, bits);
+                column->value.string = malloc(1 + bits);
+                if ((bytes != NULL) && (column->value.string != NULL))
+                {
+                    memcpy(column->value.string, bytes, bits);
+                    column->value.string[bits] = '\0';
+                }
+                break;
+            }
+        }
+    }
+    if (reader->error != 0)
+    {
+        for (j = 0 ; j < count ; ++j)
+            SQLfreeRow(&(rows[j]));
+        free(rows);
+        return NULL;
+    }
+    *rowCount = count;
+
+    return rows;
+}
+
+#endif /* SQLPROTOCOL_H */
@@ -0,0 +1,171 @@
+#ifndef SQLREPLICA_H
+#define SQLREPLICA_H
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "sqlparser.h"
+#include "sqlserver.h"
+
+/* Time between two reads of the primary log, once all its records are applied */
+#define SQL_REPLICA_POLL_MICROSECONDS 100000
+
+/* Last applied log sequence number, so a restarted replica resumes where it stopped */
+#define SQL_REPLICA_LSN_FILE "__replica.lsn"
+
+/* Path of the primary log being followed */
+static char SQLReplica_LogPath[1024];
+
+/* Logged writes produce no rows, anything else is dropped */
+static void SQLReplica_DiscardRow(void *context, const struct Row *const row)
+{
+    (void) context;
+    (void) row;
+}
+
+static const struct ResultSink SQLReplica_DiscardSink = {NULL, SQLReplica_DiscardRow, NULL, NULL};
+
+/* Read the last applied log sequence number, 0 for a new replica */
+static unsigned long SQLReplica_LoadLsn(void)
+{
+    unsigned long lsn;
+    FILE         *file;
+
+    lsn = 0;
+    if ((file = fopen(SQL_REPLICA_LSN_FILE, "r")) != NULL)
+    {
+        if (fscanf(file, "%lu", &lsn) != 1)
+            lsn = 0;
+        fclose(file);
+    }
+    return lsn;
+}
+
+/* Store the last applied log sequence number */
+static void SQLReplica_SaveLsn(unsigned long lsn)
+{
+    FILE *file;
+
+    if ((file = fopen(SQL_REPLICA_LSN_FILE, "w")) == NULL)
+        return;
+    fprintf(file, "%lu\n", lsn);
+    fclose(file);
+}
+
+/* Find the last complete record of the log after the current position, the position is restored */
+static unsigned long SQLReplica_LastLsn(FILE *log, char **line, size_t *size)
+{
+    unsigned long last;
+    long          offset;
+
+    last   = 0;
+    offset = ftell(log);
+    while (getline(line, size, log) > 0)
+    {
+        unsigned long lsn;
+        double        time;
+        char         *query;
+
+        if (SQLwal_ParseRecord(*line, &lsn, &time, &query) != 0)
+            last = lsn;
+    }
+    clearerr(log);
+    fseek(log, offset, SEEK_SET);
+
+    return last;
+}
+
+/*
+ * Follow the primary log, replaying its new records
+ *
+ *      The log is read again from the last complete record every time it has
+ *      been exhausted, a record still being written by the primary (without
+ *      its final newline) is left for the next read.
+ */
+static void *SQLReplica_Follow(void *argument)
+{
+    char   *line;
+    size_t  size;
+    long    offset;
+
+    (void) argument;
+    line   = NULL;
+    size   = 0;
+    offset = 0;
+    for (;;)
+    {
+        FILE   *log;
+        ssize_t length;
+
+        if ((log = fopen(SQLReplica_LogPath, "r")) != NULL)
+        {
+            unsigned long last;
+
+            fseek(log, offset, SEEK_SET);
+            last = SQLReplica_LastLsn(log, &line, &size);
+            pthread_mutex_lock(&SQLServer_EngineLock);
+            if (last > SQLreplication.primaryLsn)
+                SQLreplication.primaryLsn = last;
+            pthread_mutex_unlock(&SQLServer_EngineLock);
+
+            while ((length = getline(&line, &size, log)) > 0)
+            {
+                unsigned long lsn;
+                double        time;
+                char         *query;
+
+                if (line[length - 1] != '\n')
+                    break;
+                offset += length;
+                if ((SQLwal_ParseRecord(line, &lsn, &time, &query) == 0) || (lsn <= SQLreplication.lsn))
+                    continue;
+
+                pthread_mutex_lock(&SQLServer_EngineLock);
+                SQLreplication.applying = 1;
+                SQLExecuteQueryToSink(query, &SQLReplica_DiscardSink);
+                SQLreplication.applying   = 0;
+                SQLreplication.lsn        = lsn;
+                SQLreplication.lagSeconds = SQLwal_Now() - time;
+                SQLReplica_SaveLsn(lsn);
+                pthread_mutex_unlock(&SQLServer_EngineLock);
+            }
+            fclose(log);
+        }
+        usleep(SQL_REPLICA_POLL_MICROSECONDS);
+    }
+    free(line);
+
+    return NULL;
+}
+
+/*
+ * Become a read-only replica of the primary running in `directory`
+ *
+ *      The primary (started with --primary) logs its writes to SQL_WAL_FILE,
+ *      a background thread replays them here as they are appended. Queries
+ *      must hold SQLServer_EngineLock, the replay runs concurrently.
+ */
+int SQLReplica_Start(const char *const directory)
+{
+    pthread_t thread;
+
+    if (snprintf(SQLReplica_LogPath, sizeof(SQLReplica_LogPath), "%s/%s", directory, SQL_WAL_FILE)
+        >= (int) sizeof(SQLReplica_LogPath))
+    {
+        printf("error: primary directory path is too long.\n");
+        return 0;
+    }
+    SQLreplication.role       = ReplicaRole;
+    SQLreplication.lsn        = SQLReplica_LoadLsn();
+    SQLreplication.primaryLsn = SQLreplication.lsn;
+    if (pthread_create(&thread, NULL, SQLReplica_Follow, NULL) != 0)
+    {
+        printf("error: cannot start the replication thread.\n");
+        return 0;
+    }
+    pthread_detach(thread);
+
+    return 1;
+}
+
+#endif /* SQLREPLICA_H */
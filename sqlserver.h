@@ -0,0 +1,1146 @@
+#ifndef SQLSERVER_H
+#define SQLSERVER_H
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+
+#include "sqlparser.h"
+#include "sqlprotocol.h"
+
+/* Output is sent to the socket once this many bytes are pending */
+#define SQL_SERVER_FLUSH_SIZE (256 * 1024)
+
+/* The storage engine is not reentrant, queries from all connections run one at a time */
+static pthread_mutex_t SQLServer_EngineLock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * The CANCEL requests of a connection:
+ *      requests: ids of the requests to stop once they start executing
+ *      count   : number of ids in `requests`
+ *      capacity: number of ids `requests` can hold
+ *
+ *  An id is forgotten when its request starts or finishes executing.
+ */
+struct ServerCancel
+{
+    uint32_t *requests;
+    size_t    count;
+    size_t    capacity;
+};
+
+/*
+ * The request the engine executes:
+ *      lock   : protects these fields, the ServerCancel of the connections
+ *               and SQLcancel.requested
+ *      cancel : CANCEL requests of the connection of the executing request,
+ *               NULL when none executes or its connection cannot cancel
+ *      request: id of the executing request
+ */
+struct ServerRunning
+{
+    pthread_mutex_t      lock;
+    struct ServerCancel *cancel;
+    uint32_t             request;
+};
+
+static struct ServerRunning SQLServer_Running = {PTHREAD_MUTEX_INITIALIZER, NULL, 0};
+
+/* Remove `request` from the CANCEL requests waiting for it, with SQLServer_Running.lock held, returns 1 if it was there */
+static int SQLServer_Forget(struct ServerCancel *cancel, uint32_t request)
+{
+    size_t i;
+
+    for (i = 0 ; i < cancel->count ; ++i)
+    {
+        if (cancel->requests[i] == request)
+        {
+            cancel->requests[i] = cancel->requests[--cancel->count];
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Record the request the engine starts executing, with the engine lock held, it stops at once if it was cancelled
+ *
+ *      The request executing before, if any, finished: a CANCEL of it
+ *      received meanwhile is forgotten.
+ */
+static void SQLServer_Executing(struct ServerCancel *cancel, uint32_t request)
+{
+    int stop;
+
+    pthread_mutex_lock(&(SQLServer_Running.lock));
+    if (SQLServer_Running.cancel != NULL)
+        SQLServer_Forget(SQLServer_Running.cancel, SQLServer_Running.request);
+    stop = (cancel != NULL) && (SQLServer_Forget(cancel, request) != 0);
+    SQLServer_Running.cancel  = cancel;
+    SQLServer_Running.request = request;
+    __atomic_store_n(&(SQLcancel.requested), stop, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&(SQLServer_Running.lock));
+}
+
+/*
+ * Stop a request of a connection, for `CANCEL:REQUEST` or `CANCEL:*`
+ *
+ *      `*` stops the request of the connection executing now, a request id
+ *      stops that request, now or when it starts if it waits to execute:
+ *      every request id cancelled ahead is kept until then.
+ */
+static void SQLServer_Cancel(struct ServerCancel *cancel, const char *const target, size_t length)
+{
+    char     text[16];
+    char    *end;
+    uint32_t request;
+    size_t   i;
+    int      any;
+
+    if ((length == 0) || (length >= sizeof(text)))
+        return;
+    memcpy(text, target, length);
+    text[length] = '\0';
+    any     = (strcmp(text, "*") == 0);
+    request = strtoul(text, &end, 10);
+    if ((any == 0) && ((end == text) || (*end != '\0')))
+        return;
+    pthread_mutex_lock(&(SQLServer_Running.lock));
+    if ((SQLServer_Running.cancel == cancel) && ((any != 0) || (SQLServer_Running.request == request)))
+        __atomic_store_n(&(SQLcancel.requested), 1, __ATOMIC_RELAXED);
+    else if (any == 0)
+    {
+        for (i = 0 ; (i < cancel->count) && (cancel->requests[i] != request) ; ++i)
+            ;
+        /* Grow by doubling, a CANCEL that does not fit is lost */
+        if ((i == cancel->count) && (cancel->count == cancel->capacity))
+        {
+            uint32_t *requests;
+            size_t    capacity;
+
+            capacity = (cancel->capacity != 0) ? 2 * cancel->capacity : 8;
+            requests = realloc(cancel->requests, capacity * sizeof(uint32_t));
+            if (requests != NULL)
+            {
+                cancel->requests = requests;
+                cancel->capacity = capacity;
+            }
+        }
+        if ((i == cancel->count) && (cancel->count < cancel->capacity))
+            cancel->requests[cancel->count++] = request;
+    }
+    pthread_mutex_unlock(&(SQLServer_Running.lock));
+}
+
+/*
+ * Where the replies of a request go while it executes:
+ *      send   : takes the reply frames built so far out of the output buffer
+ *      context: passed to `send`
+ */
+struct ServerStream
+{
+    void (*send)(void *context, struct FrameBuffer *output);
+    void  *context;
+};
+
+/*
+ * Reply of an executing request:
+ *      encoder: builds the result frames
+ *      stream : receives them once SQL_SERVER_FLUSH_SIZE bytes are pending,
+ *               NULL to keep the whole reply in the output buffer
+ */
+struct ServerReply
+{
+    struct FrameEncoder       *encoder;
+    const struct ServerStream *stream;
+};
+
+/* ResultSink callbacks of the ServerReply, the encoder callbacks streaming the full batches */
+static void SQLServer_ReplyBegin(void *context, const struct TableStructureInfo *const tableStructure)
+{
+    struct ServerReply *reply;
+
+    reply = context;
+    SQLFrameEncoder_Begin(reply->encoder, tableStructure);
+}
+
+static void SQLServer_ReplyRow(void *context, const struct Row *const row)
+{
+    struct ServerReply *reply;
+
+    reply = context;
+    SQLFrameEncoder_Row(reply->encoder, row);
+    if ((reply->stream != NULL) && (reply->encoder->output->length >= SQL_SERVER_FLUSH_SIZE))
+        reply->stream->send(reply->stream->context, reply->encoder->output);
+}
+
+static void SQLServer_ReplyEnd(void *context)
+{
+    struct ServerReply *reply;
+
+    reply = context;
+    SQLFrameEncoder_End(reply->encoder);
+}
+
+/*
+ * Execute one received frame, appending the reply frames to `output`
+ *
+ *      `cancel` receives the CANCEL requests of the connection, NULL when
+ *      its requests cannot be cancelled. The result batches are handed to
+ *      `stream` as the statement produces them, when it is not NULL. The
+ *      errors the engine reports end the reply with an ErrorFrame holding
+ *      their text, instead of a Complete frame.
+ */
+static void SQLServer_HandleFrame(const unsigned char *frame, size_t size, struct FrameBuffer *output,
+                                  struct ServerCancel *cancel, const struct ServerStream *const stream)
+{
+    struct FrameReader   reader;
+    struct FrameEncoder *encoder;
+    struct ServerReply   reply;
+    struct ResultSink    sink;
+    uint32_t             request;
+    const char          *stopped;
+    char                *query;
+    int                  status;
+
+    if (SQLFrame_Open(&reader, frame, size, &request) != QueryFrame)
+    {
+        static const char message[] = "unexpected frame type";
+        SQLFrame_PutFrame(output, ErrorFrame, request, message, sizeof(message) - 1);
+        return;
+    }
+    /* Copy the query text, the parser needs a nul terminated string */
+    query   = malloc(1 + reader.length);
+    encoder = calloc(1, sizeof(struct FrameEncoder));
+    if ((query == NULL) || (encoder == NULL))
+    {
+        static const char message[] = "out of memory";
+        SQLFrame_PutFrame(output, ErrorFrame, request, message, sizeof(message) - 1);
+        goto abort;
+    }
+    memcpy(query, reader.data, reader.length);
+    query[reader.length] = '\0';
+
+    encoder->output  = output;
+    encoder->request = request;
+    reply.encoder    = encoder;
+    reply.stream     = stream;
+    sink.begin       = SQLServer_ReplyBegin;
+    sink.row         = SQLServer_ReplyRow;
+    sink.end         = SQLServer_ReplyEnd;
+    sink.context     = &reply;
+
+    pthread_mutex_lock(&SQLServer_EngineLock);
+    SQLServer_Executing(cancel, request);
+    /* The messages of the engine are sent to the client, not printed */
+    SQLmessages.capture = 1;
+    SQLmessages.length  = 0;
+    status  = SQLExecuteQueryToSink(query, &sink);
+    stopped = SQLcancel.stopped;
+    SQLmessages.capture = 0;
+    /* One message per line, without the last line break */
+    while ((SQLmessages.length != 0) && (SQLmessages.text[SQLmessages.length - 1] == '\n'))
+        SQLmessages.length -= 1;
+    if (status == 2)
+        SQLFrame_PutFrame(output, ErrorFrame, request, stopped, strlen(stopped));
+    else if (SQLmessages.length != 0)
+        SQLFrame_PutFrame(output, ErrorFrame, request, SQLmessages.text, SQLmessages.length);
+    else if (status != 0)
+    {
+        static const char message[] = "cannot parse query";
+        SQLFrame_PutFrame(output, ErrorFrame, request, message, sizeof(message) - 1);
+    }
+    else
+        SQLFrame_PutComplete(output, request, 0);
+    SQLServer_Executing(NULL, 0);
+    pthread_mutex_unlock(&SQLServer_EngineLock);
+
+abort:
+    if (encoder != NULL)
+        SQLFrameEncoder_Free(encoder);
+    free(encoder);
+    free(query);
+}
+
+/* ServerStream callback of a blocking connection, writes the reply frames, the socket is a descriptor */
+static void SQLServer_WriteStream(void *context, struct FrameBuffer *output)
+{
+    /* A client that is gone needs no more rows */
+    if (SQLFrame_WriteAll((int) (intptr_t) context, output->data, output->length) == 0)
+    {
+        output->error = 1;
+        __atomic_store_n(&(SQLcancel.requested), 1, __ATOMIC_RELAXED);
+    }
+    output->length = 0;
+}
+
+/*
+ * Serve one client connection from this thread, for the shard workers
+ *
+ *      All the complete requests already received are executed before the
+ *      replies are flushed, so a client pipelining many queries gets its
+ *      results in as few writes as possible. A large result is written as
+ *      its batches are built.
+ */
+static void *SQLServer_Connection(void *argument)
+{
+    struct ServerStream stream;
+    struct FrameBuffer  input;
+    struct FrameBuffer  output;
+    int                 descriptor;
+
+    descriptor = (int) (intptr_t) argument;
+    memset(&input, 0, sizeof(input));
+    memset(&output, 0, sizeof(output));
+    stream.send    = SQLServer_WriteStream;
+    stream.context = argument;
+    while (SQLFrame_Fill(descriptor, &input) != 0)
+    {
+        size_t offset;
+        long   size;
+
+        offset = 0;
+        while ((size = SQLFrame_Available(&input, offset)) > 0)
+        {
+            SQLServer_HandleFrame(input.data + offset, size, &output, NULL, &stream);
+            offset += size;
+            if (output.error != 0)
+                goto abort;
+            if (output.length >= SQL_SERVER_FLUSH_SIZE)
+            {
+                if (SQLFrame_WriteAll(descriptor, output.data, output.length) == 0)
+                    goto abort;
+                output.length = 0;
+            }
+        }
+        if (size < 0) /* Malformed frame, the stream cannot be resynchronized */
+            goto abort;
+        SQLFrame_Consume(&input, offset);
+        if (SQLFrame_WriteAll(descriptor, output.data, output.length) == 0)
+            goto abort;
+        output.length = 0;
+    }
+
+abort:
+    close(descriptor);
+    SQLFrame_Free(&input);
+    SQLFrame_Free(&output);
+
+    return NULL;
+}
+
+/* Maximum number of epoll events handled per wakeup of an event loop */
+#define SQL_SERVER_EVENTS 64
+
+/* Tables up to this many stored bytes are cheap to read, their queries are lookups */
+#define SQL_SCHEDULER_LOOKUP_BYTES (1024 * 1024)
+
+/*
+ * Scheduling classes of the requests, in priority order:
+ *      LookupClass: inserts, cancellations, and the queries reading small tables
+ *      WriteClass : the other writes and the table changes
+ *      ScanClass  : the queries reading large tables
+ */
+enum QueryClass
+{
+    LookupClass,
+    WriteClass,
+    ScanClass
+};
+
+/* Number of scheduling classes */
+#define SQL_QUERY_CLASSES 3
+
+/*
+ * Admission control of the execution pool:
+ *      limits: maximum number of connections of each class executing at
+ *              once, 0 for the default
+ *      memory: total memory the executing requests may be estimated to need,
+ *              0 for no limit, a request is admitted anyway when nothing else
+ *              executes
+ */
+struct ServerScheduler
+{
+    size_t limits[SQL_QUERY_CLASSES];
+    size_t memory;
+};
+
+static struct ServerScheduler SQLServer_Scheduler = {{0, 0, 0}, 256 * 1024 * 1024};
+
+/* Set the class limits from `LOOKUP,WRITE,SCAN`, returns 0 if the text is invalid */
+int SQLServer_SetLimits(const char *text)
+{
+    size_t limits[SQL_QUERY_CLASSES];
+    char  *end;
+    int    i;
+
+    for (i = 0 ; i < SQL_QUERY_CLASSES ; ++i)
+    {
+        limits[i] = strtoul(text, &end, 10);
+        if ((end == text) || (limits[i] == 0) || (*end != ((i + 1 < SQL_QUERY_CLASSES) ? ',' : '\0')))
+            return 0;
+        text = end + 1;
+    }
+    memcpy(SQLServer_Scheduler.limits, limits, sizeof(limits));
+
+    return 1;
+}
+
+/* Bytes stored for the table, in its file or its partition files */
+static size_t SQLServer_TableBytes(const char *const table)
+{
+    struct stat information;
+    char        storage[160];
+    size_t      total;
+    unsigned    i;
+
+    total = (stat(table, &information) == 0) ? information.st_size : 0;
+    for (i = 0 ; i < 64 ; ++i)
+    {
+        snprintf(storage, sizeof(storage), "%s.p%u", table, i);
+        if (stat(storage, &information) != 0)
+            break;
+        total += information.st_size;
+    }
+    return total;
+}
+
+/*
+ * Find the scheduling class of a query, and add the memory it may need to `*memory`
+ *
+ *      The engine has no index, the cost of a query is the size of the table
+ *      it reads. The rows of a SELECT are sent as they are produced, but its
+ *      groups and distinct values are kept in memory, it may need as much
+ *      memory as its table. The query and the stored files are only looked
+ *      at, without the engine lock: the parse reports nothing, an estimate
+ *      is all that is needed.
+ */
+static enum QueryClass SQLServer_Classify(const char *const query, size_t *memory)
+{
+    struct TokenList *list;
+    enum QueryClass   class;
+    const char       *from;
+    size_t            bytes;
+
+    list = SQLParser_Tokenize(query, 1);
+    if (list == NULL)
+        return LookupClass;
+    class = WriteClass;
+    from  = SQLParser_FindClause(list, FromClause);
+    switch (SQLParser_GetQueryType(list->keyword))
+    {
+    case Insert:
+        bytes = (from != NULL) ? SQLServer_TableBytes(from) : 0;
+        class = (bytes <= SQL_SCHEDULER_LOOKUP_BYTES) ? LookupClass : ScanClass;
+        break;
+    case Select:
+        bytes = SQLServer_TableBytes(list->value);
+        if (bytes > SQL_SCHEDULER_LOOKUP_BYTES)
+            class = ScanClass;
+        else if (SQLParser_FindClause(list, IntoClause) == NULL)
+            class = LookupClass;
+        if (SQLParser_FindClause(list, IntoClause) == NULL)
+            *memory += bytes;
+        break;
+    case Update:
+    case Delete:
+        if (SQLServer_TableBytes(list->value) > SQL_SCHEDULER_LOOKUP_BYTES)
+            class = ScanClass;
+        break;
+    case Cancel:
+        class = LookupClass;
+        break;
+    default:
+        break;
+    }
+    freeTokens(list);
+
+    return class;
+}
+
+struct ServerLoop;
+
+/*
+ * A client connection of the event loops:
+ *      descriptor: the non blocking socket, -1 once closed
+ *      loop      : the event loop watching the socket
+ *      input     : received bytes not yet executed
+ *      output    : reply bytes not yet accepted by the socket
+ *      work      : copy of the complete requests handed to the pool
+ *      reply     : the replies the pool built for `work`
+ *      streamed  : replies the pool sent before its request completed,
+ *                  protected by the lock of the loop
+ *      consumed  : bytes of `work` the pool executed
+ *      class     : scheduling class of the requests in `work`
+ *      memory    : memory the requests in `work` are estimated to need
+ *      scanned   : bytes of `input` already looked at for CANCEL requests
+ *      cancel    : the CANCEL requests received
+ *      busy      : set while the pool owns `work` and `reply`
+ *      eof       : set when the client will send no more requests
+ *      failed    : set when the connection must be dropped
+ *      closed    : set once the socket is closed, with the lock of the loop
+ *      streaming : set while the connection is in the streaming list
+ *      next      : next connection in the pool queue or the completed list
+ *      nextStream: next connection in the streaming list
+ *
+ *  Only the event loop touches the socket, `input` and `output`. A connection
+ *  is executed by at most one pool thread at a time, so its replies keep the
+ *  request order, and it is only released once the pool is done with it.
+ */
+struct ServerConnection
+{
+    int                      descriptor;
+    struct ServerLoop       *loop;
+    struct FrameBuffer       input;
+    struct FrameBuffer       output;
+    struct FrameBuffer       work;
+    struct FrameBuffer       reply;
+    struct FrameBuffer       streamed;
+    size_t                   consumed;
+    enum QueryClass          class;
+    size_t                   memory;
+    size_t                   scanned;
+    struct ServerCancel      cancel;
+    int                      busy;
+    int                      eof;
+    int                      failed;
+    int                      closed;
+    int                      streaming;
+    struct ServerConnection *next;
+    struct ServerConnection *nextStream;
+};
+
+/*
+ * An event loop, one per core:
+ *      epoll    : watches the listener, the wakeup and the connections
+ *      wakeup   : eventfd signalled by the pool when connections completed
+ *      listener : the listening socket, shared by all the loops
+ *      lock     : protects `completed`, `streaming` and the streamed replies
+ *      drained  : signalled when the loop took streamed replies
+ *      completed: connections whose requests the pool executed
+ *      streaming: connections with streamed replies to send
+ */
+struct ServerLoop
+{
+    int                      epoll;
+    int                      wakeup;
+    int                      listener;
+    pthread_mutex_t          lock;
+    pthread_cond_t           drained;
+    struct ServerConnection *completed;
+    struct ServerConnection *streaming;
+};
+
+/*
+ * Execution thread pool, the queues of the connections with requests to execute:
+ *      lock   : protects the queues and the counts
+ *      ready  : signalled when a connection is queued or done executing
+ *      first  : the oldest queued connection of each class
+ *      last   : the newest queued connection of each class
+ *      running: number of executing connections of each class
+ *      memory : memory the executing connections are estimated to need
+ */
+struct ServerPool
+{
+    pthread_mutex_t          lock;
+    pthread_cond_t           ready;
+    struct ServerConnection *first[SQL_QUERY_CLASSES];
+    struct ServerConnection *last[SQL_QUERY_CLASSES];
+    size_t                   running[SQL_QUERY_CLASSES];
+    size_t                   memory;
+};
+
+static struct ServerPool SQLServer_Pool = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+                                           {NULL, NULL, NULL}, {NULL, NULL, NULL}, {0, 0, 0}, 0};
+
+/*
+ * Take the next connection to execute from the queues, with the pool lock held, returns NULL if none is admitted
+ *
+ *      The classes are tried in priority order, a class is skipped while it
+ *      runs its limit of connections, or while its oldest connection would
+ *      exceed the memory budget of the pool.
+ */
+static struct ServerConnection *SQLServer_Admit(void)
+{
+    struct ServerConnection *connection;
+    int                      class;
+
+    for (class = 0 ; class < SQL_QUERY_CLASSES ; ++class)
+    {
+        connection = SQLServer_Pool.first[class];
+        if ((connection == NULL) || (SQLServer_Pool.running[class] >= SQLServer_Scheduler.limits[class]))
+            continue;
+        if ((SQLServer_Scheduler.memory != 0) && (SQLServer_Pool.memory != 0) &&
+            (SQLServer_Pool.memory + connection->memory > SQLServer_Scheduler.memory))
+            continue;
+        SQLServer_Pool.first[class] = connection->next;
+        if (SQLServer_Pool.first[class] == NULL)
+            SQLServer_Pool.last[class] = NULL;
+        SQLServer_Pool.running[class] += 1;
+        SQLServer_Pool.memory         += connection->memory;
+
+        return connection;
+    }
+    return NULL;
+}
+
+/* Check if a connection of a class before `class` waits, the running requests then stop at the next one */
+static int SQLServer_Preempted(enum QueryClass class)
+{
+    int waiting;
+    int i;
+
+    pthread_mutex_lock(&(SQLServer_Pool.lock));
+    for (waiting = 0, i = 0 ; (waiting == 0) && (i < (int) class) ; ++i)
+        waiting = (SQLServer_Pool.first[i] != NULL);
+    pthread_mutex_unlock(&(SQLServer_Pool.lock));
+
+    return waiting;
+}
+
+/*
+ * ServerStream callback of the pool, hands the replies built so far to the event loop of the connection
+ *
+ *      It waits until the loop took the previous ones, so the result is
+ *      built at the pace the client reads it. The replies of a closed
+ *      connection are dropped and its statement stopped.
+ */
+static void SQLServer_Stream(void *context, struct FrameBuffer *output)
+{
+    struct ServerConnection *connection;
+    struct ServerLoop       *loop;
+    struct FrameBuffer       swap;
+    uint64_t                 one;
+    int                      notify;
+
+    connection = context;
+    loop       = connection->loop;
+    notify     = 0;
+    pthread_mutex_lock(&(loop->lock));
+    while ((connection->streamed.length != 0) && (connection->closed == 0))
+        pthread_cond_wait(&(loop->drained), &(loop->lock));
+    if (connection->closed != 0)
+    {
+        output->length = 0;
+        __atomic_store_n(&(SQLcancel.requested), 1, __ATOMIC_RELAXED);
+    }
+    else
+    {
+        /* The emptied buffer of the previous replies is reused for the next ones */
+        swap                 = connection->streamed;
+        connection->streamed = *output;
+        *output              = swap;
+        output->length       = 0;
+        if (connection->streaming == 0)
+        {
+            connection->streaming  = 1;
+            connection->nextStream = loop->streaming;
+            loop->streaming        = connection;
+        }
+        notify = 1;
+    }
+    pthread_mutex_unlock(&(loop->lock));
+    one = 1;
+    if ((notify != 0) && (write(loop->wakeup, &one, sizeof(one)) < 0))
+        return;
+}
+
+/* Execute the requests of the connections queued by the event loops, forever */
+static void *SQLServer_Worker(void *argument)
+{
+    (void) argument;
+    for (;;)
+    {
+        struct ServerConnection *connection;
+        struct ServerLoop       *loop;
+        struct ServerStream      stream;
+        uint64_t                 one;
+        long                     size;
+
+        pthread_mutex_lock(&(SQLServer_Pool.lock));
+        while ((connection = SQLServer_Admit()) == NULL)
+            pthread_cond_wait(&(SQLServer_Pool.ready), &(SQLServer_Pool.lock));
+        pthread_mutex_unlock(&(SQLServer_Pool.lock));
+
+        /*
+         * Stop once enough output is pending, or when more urgent requests
+         * wait, the rest is queued again after the replies were sent
+         */
+        stream.send          = SQLServer_Stream;
+        stream.context       = connection;
+        connection->consumed = 0;
+        while ((connection->reply.length < SQL_SERVER_FLUSH_SIZE) && (connection->reply.error == 0) &&
+               ((size = SQLFrame_Available(&(connection->work), connection->consumed)) > 0) &&
+               ((connection->consumed == 0) || (SQLServer_Preempted(connection->class) == 0)))
+        {
+            SQLServer_HandleFrame(connection->work.data + connection->consumed, size, &(connection->reply),
+                                  &(connection->cancel), &stream);
+            connection->consumed += size;
+        }
+        /* The slot and the memory of the connection may admit a waiting one */
+        pthread_mutex_lock(&(SQLServer_Pool.lock));
+        SQLServer_Pool.running[connection->class] -= 1;
+        SQLServer_Pool.memory                     -= connection->memory;
+        pthread_cond_broadcast(&(SQLServer_Pool.ready));
+        pthread_mutex_unlock(&(SQLServer_Pool.lock));
+
+        loop = connection->loop;
+        pthread_mutex_lock(&(loop->lock));
+        connection->next = loop->completed;
+        loop->completed  = connection;
+        pthread_mutex_unlock(&(loop->lock));
+        one = 1;
+        if (write(loop->wakeup, &one, sizeof(one)) < 0)
+            continue;
+    }
+    return NULL;
+}
+
+/*
+ * Hand the complete requests received on the connection to the pool
+ *
+ *      They are queued in the class of their most expensive query, with the
+ *      memory all of them may need.
+ */
+static void SQLServer_Dispatch(struct ServerConnection *connection)
+{
+    size_t end;
+    long   size;
+
+    end                = 0;
+    connection->class  = LookupClass;
+    connection->memory = 0;
+    while ((size = SQLFrame_Available(&(connection->input), end)) > 0)
+    {
+        struct FrameReader reader;
+        enum QueryClass    class;
+        uint32_t           request;
+
+        if (SQLFrame_Open(&reader, connection->input.data + end, size, &request) == QueryFrame)
+        {
+            char *query;
+
+            /* A request that cannot be classified is only executed as a scan */
+            class = ScanClass;
+            if ((query = malloc(reader.length + 1)) != NULL)
+            {
+                memcpy(query, reader.data, reader.length);
+                query[reader.length] = '\0';
+                class = SQLServer_Classify(query, &(connection->memory));
+                free(query);
+            }
+            if (class > connection->class)
+                connection->class = class;
+        }
+        end += size;
+    }
+    if (size < 0) /* Malformed frame, the stream cannot be resynchronized */
+        connection->failed = 1;
+    if ((end == 0) || (connection->failed != 0))
+        return;
+    connection->work.length = 0;
+    SQLFrame_PutBytes(&(connection->work), connection->input.data, end);
+    if (connection->work.error != 0)
+    {
+        connection->failed = 1;
+        return;
+    }
+    connection->busy = 1;
+    connection->next = NULL;
+    pthread_mutex_lock(&(SQLServer_Pool.lock));
+    if (SQLServer_Pool.last[connection->class] != NULL)
+        SQLServer_Pool.last[connection->class]->next = connection;
+    else
+        SQLServer_Pool.first[connection->class] = connection;
+    SQLServer_Pool.last[connection->class] = connection;
+    pthread_cond_broadcast(&(SQLServer_Pool.ready));
+    pthread_mutex_unlock(&(SQLServer_Pool.lock));
+}
+
+/* Close the connection socket, and release the connection unless the pool still owns it */
+static void SQLServer_Close(struct ServerConnection *connection)
+{
+    if (connection->descriptor >= 0)
+    {
+        epoll_ctl(connection->loop->epoll, EPOLL_CTL_DEL, connection->descriptor, NULL);
+        close(connection->descriptor);
+        connection->descriptor = -1;
+        /* A pool thread streaming replies stops waiting for them to be sent */
+        pthread_mutex_lock(&(connection->loop->lock));
+        connection->closed = 1;
+        pthread_cond_broadcast(&(connection->loop->drained));
+        pthread_mutex_unlock(&(connection->loop->lock));
+    }
+    if (connection->busy != 0)
+        return;
+    SQLFrame_Free(&(connection->input));
+    SQLFrame_Free(&(connection->output));
+    SQLFrame_Free(&(connection->work));
+    SQLFrame_Free(&(connection->reply));
+    SQLFrame_Free(&(connection->streamed));
+    free(connection->cancel.requests);
+    free(connection);
+}
+
+/*
+ * Move the streamed replies to the output, once the output is mostly sent or when `all` is set
+ *
+ *      The pool thread waiting to stream more replies is woken up.
+ */
+static void SQLServer_TakeStreamed(struct ServerConnection *connection, int all)
+{
+    struct ServerLoop *loop;
+
+    loop = connection->loop;
+    pthread_mutex_lock(&(loop->lock));
+    if ((connection->streamed.length != 0) && ((all != 0) || (connection->output.length < SQL_SERVER_FLUSH_SIZE)))
+    {
+        SQLFrame_PutBytes(&(connection->output), connection->streamed.data, connection->streamed.length);
+        connection->failed = (connection->failed != 0) || (connection->streamed.error != 0) ||
+                             (connection->output.error != 0);
+        connection->streamed.length = 0;
+        pthread_cond_broadcast(&(loop->drained));
+    }
+    pthread_mutex_unlock(&(loop->lock));
+}
+
+/* Send the pending replies as far as the socket accepts them, returns 0 on failure */
+static int SQLServer_Flush(struct ServerConnection *connection)
+{
+    size_t sent;
+
+    sent = 0;
+    while (sent < connection->output.length)
+    {
+        ssize_t written;
+
+        written = send(connection->descriptor, connection->output.data + sent, connection->output.length - sent,
+                       MSG_NOSIGNAL);
+        if ((written < 0) && (errno == EINTR))
+            continue;
+        if ((written < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+            break;
+        if (written <= 0)
+            return 0;
+        sent += written;
+    }
+    SQLFrame_Consume(&(connection->output), sent);
+
+    return 1;
+}
+
+/*
+ * Move the connection forward after an event
+ *
+ *      Sends the pending replies, hands the next requests to the pool once
+ *      the replies are mostly sent, and watches the socket for what is still
+ *      to do. The connection is closed after failures, or once the client
+ *      stopped sending and got all its replies.
+ */
+static void SQLServer_Update(struct ServerConnection *connection)
+{
+    struct epoll_event event;
+
+    if (connection->busy != 0)
+        SQLServer_TakeStreamed(connection, 0);
+    if ((connection->failed == 0) && (SQLServer_Flush(connection) == 0))
+        connection->failed = 1;
+    if ((connection->failed == 0) && (connection->busy == 0) && (connection->output.length < SQL_SERVER_FLUSH_SIZE))
+        SQLServer_Dispatch(connection);
+    /* Every request received was executed, the CANCEL of a request that completed before it is forgotten */
+    if ((connection->busy == 0) && (connection->cancel.count != 0) &&
+        (SQLFrame_Available(&(connection->input), 0) == 0))
+    {
+        pthread_mutex_lock(&(SQLServer_Running.lock));
+        connection->cancel.count = 0;
+        pthread_mutex_unlock(&(SQLServer_Running.lock));
+    }
+    if ((connection->failed != 0) ||
+        ((connection->eof != 0) && (connection->busy == 0) && (connection->output.length == 0)))
+    {
+        SQLServer_Close(connection);
+        return;
+    }
+    event.events   = ((connection->eof == 0) ? EPOLLIN : 0) | ((connection->output.length != 0) ? EPOLLOUT : 0);
+    event.data.ptr = connection;
+    epoll_ctl(connection->loop->epoll, EPOLL_CTL_MOD, connection->descriptor, &event);
+}
+
+/* Read what the client sent */
+static void SQLServer_Read(struct ServerConnection *connection)
+{
+    ssize_t received;
+
+    if (SQLFrame_Reserve(&(connection->input), 64 * 1024) == 0)
+    {
+        connection->failed = 1;
+        return;
+    }
+    do
+        received = recv(connection->descriptor, connection->input.data + connection->input.length,
+                        connection->input.capacity - connection->input.length, 0);
+    while ((received < 0) && (errno == EINTR));
+    if (received > 0)
+        connection->input.length += received;
+    else if (received == 0)
+        connection->eof = 1;
+    else if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+        connection->failed = 1;
+}
+
+/*
+ * Act on the CANCEL requests just received, without waiting for the requests before them
+ *
+ *      The CANCEL request is still executed in its turn, it only replies
+ *      that it completed.
+ */
+static void SQLServer_Interrupt(struct ServerConnection *connection)
+{
+    static const char command[] = "CANCEL:";
+    long              size;
+
+    while ((size = SQLFrame_Available(&(connection->input), connection->scanned)) > 0)
+    {
+        struct FrameReader reader;
+        uint32_t           request;
+
+        if ((SQLFrame_Open(&reader, connection->input.data + connection->scanned, size, &request) == QueryFrame) &&
+            (reader.length > sizeof(command) - 1) && (memcmp(reader.data, command, sizeof(command) - 1) == 0))
+            SQLServer_Cancel(&(connection->cancel), (const char *) reader.data + sizeof(command) - 1,
+                             reader.length - (sizeof(command) - 1));
+        connection->scanned += size;
+    }
+}
+
+/* Accept the pending connections, watching them with this loop */
+static void SQLServer_Accept(struct ServerLoop *loop)
+{
+    for (;;)
+    {
+        struct ServerConnection *connection;
+        struct epoll_event       event;
+        int                      descriptor;
+
+        descriptor = accept(loop->listener, NULL, NULL);
+        if (descriptor < 0)
+            return;
+        fcntl(descriptor, F_SETFL, fcntl(descriptor, F_GETFL) | O_NONBLOCK);
+        connection = calloc(1, sizeof(struct ServerConnection));
+        if (connection == NULL)
+        {
+            close(descriptor);
+            continue;
+        }
+        connection->descriptor = descriptor;
+        connection->loop       = loop;
+        event.events           = EPOLLIN;
+        event.data.ptr         = connection;
+        if (epoll_ctl(loop->epoll, EPOLL_CTL_ADD, descriptor, &event) != 0)
+        {
+            close(descriptor);
+            free(connection);
+        }
+    }
+}
+
+/* Take back the connections the pool executed, and send their replies */
+static void SQLServer_Complete(struct ServerLoop *loop)
+{
+    struct ServerConnection *connection;
+    struct ServerConnection *streaming;
+    uint64_t                 count;
+
+    if (read(loop->wakeup, &count, sizeof(count)) < 0)
+        return;
+    pthread_mutex_lock(&(loop->lock));
+    connection      = loop->completed;
+    loop->completed = NULL;
+    streaming       = loop->streaming;
+    loop->streaming = NULL;
+    pthread_mutex_unlock(&(loop->lock));
+    /* Still busy, the completed connections are only released after their streamed replies */
+    while (streaming != NULL)
+    {
+        struct ServerConnection *next;
+
+        /* Once its flag is cleared, the pool may queue the connection again */
+        pthread_mutex_lock(&(loop->lock));
+        next                 = streaming->nextStream;
+        streaming->streaming = 0;
+        pthread_mutex_unlock(&(loop->lock));
+        if (streaming->descriptor >= 0)
+            SQLServer_Update(streaming);
+        streaming = next;
+    }
+    while (connection != NULL)
+    {
+        struct ServerConnection *next;
+
+        next             = connection->next;
+        connection->busy = 0;
+        if (connection->descriptor < 0)
+            SQLServer_Close(connection);
+        else
+        {
+            SQLFrame_Consume(&(connection->input), connection->consumed);
+            connection->scanned -= connection->consumed;
+            SQLServer_TakeStreamed(connection, 1);
+            SQLFrame_PutBytes(&(connection->output), connection->reply.data, connection->reply.length);
+            connection->failed = (connection->failed != 0) || (connection->reply.error != 0) ||
+                                 (connection->output.error != 0);
+            connection->reply.length = 0;
+            SQLServer_Update(connection);
+        }
+        connection = next;
+    }
+}
+
+/*
+ * Run one event loop, forever
+ *
+ *      The listener and the wakeup are told apart from the connections by
+ *      their epoll data, NULL for the listener and the loop for the wakeup.
+ */
+static void *SQLServer_Loop(void *argument)
+{
+    struct ServerLoop *loop;
+
+    loop = argument;
+    for (;;)
+    {
+        struct epoll_event events[SQL_SERVER_EVENTS];
+        int                count;
+        int                i;
+
+        count = epoll_wait(loop->epoll, events, SQL_SERVER_EVENTS, -1);
+        for (i = 0 ; i < count ; ++i)
+        {
+            struct ServerConnection *connection;
+
+            if (events[i].data.ptr == NULL)
+            {
+                SQLServer_Accept(loop);
+                continue;
+            }
+            if (events[i].data.ptr == loop)
+            {
+                SQLServer_Complete(loop);
+                continue;
+            }
+            connection = events[i].data.ptr;
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+            {
+                SQLServer_Read(connection);
+                SQLServer_Interrupt(connection);
+            }
+            SQLServer_Update(connection);
+        }
+    }
+    return NULL;
+}
+
+/* Create an event loop watching `listener`, returns 0 on failure */
+static int SQLServer_LoopInit(struct ServerLoop *loop, int listener)
+{
+    struct epoll_event event;
+
+    memset(loop, 0, sizeof(*loop));
+    pthread_mutex_init(&(loop->lock), NULL);
+    pthread_cond_init(&(loop->drained), NULL);
+    loop->listener = listener;
+    loop->epoll    = epoll_create1(0);
+    loop->wakeup   = eventfd(0, EFD_NONBLOCK);
+    if ((loop->epoll < 0) || (loop->wakeup < 0))
+        return 0;
+    /* Only one of the loops waiting is woken up for a new connection */
+    event.events   = EPOLLIN | EPOLLEXCLUSIVE;
+    event.data.ptr = NULL;
+    if (epoll_ctl(loop->epoll, EPOLL_CTL_ADD, listener, &event) != 0)
+        return 0;
+    event.events   = EPOLLIN;
+    event.data.ptr = loop;
+
+    return epoll_ctl(loop->epoll, EPOLL_CTL_ADD, loop->wakeup, &event) == 0;
+}
+
+/*
+ * Run the server, listening on `port`
+ *
+ *      Every core runs an event loop multiplexing its share of the
+ *      connections, and the requests they receive are executed by a pool of
+ *      as many threads, so idle connections cost no thread. By default the
+ *      lookups may use all the pool threads, the other writes half of them
+ *      and the scans one, so a few large scans never delay the lookups by
+ *      more than one scan.
+ */
+int SQLServer_Run(unsigned short port)
+{
+    struct sockaddr_in address;
+    struct ServerLoop *loops;
+    pthread_t          thread;
+    long               count;
+    long               i;
+    int                listener;
+    int                enable;
+
+    /* A client closing its connection early must not kill the server */
+    signal(SIGPIPE, SIG_IGN);
+
+    listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (listener < 0)
+    {
+        printf("error: cannot create socket.\n");
+        return 1;
+    }
+    enable = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+    memset(&address, 0, sizeof(address));
+    address.sin_family      = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port        = htons(port);
+    if ((bind(listener, (struct sockaddr *) &address, sizeof(address)) != 0) || (listen(listener, 128) != 0))
+    {
+        printf("error: cannot listen on port %u.\n", port);
+        close(listener);
+        return 1;
+    }
+    count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (count < 1)
+        count = 1;
+    if (SQLServer_Scheduler.limits[LookupClass] == 0)
+    {
+        SQLServer_Scheduler.limits[LookupClass] = count;
+        SQLServer_Scheduler.limits[WriteClass]  = (count + 1) / 2;
+        SQLServer_Scheduler.limits[ScanClass]   = 1;
+    }
+    loops = calloc(count, sizeof(struct ServerLoop));
+    if (loops == NULL)
+    {
+        close(listener);
+        return 1;
+    }
+    for (i = 0 ; i < count ; ++i)
+    {
+        if ((SQLServer_LoopInit(&(loops[i]), listener) == 0) ||
+            (pthread_create(&thread, NULL, SQLServer_Worker, NULL) != 0) ||
+            ((i != 0) && (pthread_create(&thread, NULL, SQLServer_Loop, &(loops[i])) != 0)))
+        {
+            printf("error: cannot start the server threads.\n");
+            return 1;
+        }
+    }
+    printf("listening on port %u\n", port);
+    fflush(stdout);
+    SQLServer_Loop(&(loops[0]));
+
+    return 0;
+}
+
+#endif /* SQLSERVER_H */
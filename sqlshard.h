@@ -0,0 +1,711 @@
+#ifndef SQLSHARD_H
+#define SQLSHARD_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "sqlparser.h"
+#include "sqlprotocol.h"
+#include "sqlserver.h"
+#include "sqlclient.h"
+#include "sqlvacuum.h"
+
+/* Maximum number of worker processes of a coordinator */
+#define SQL_MAX_SHARDS 64
+
+/*
+ * Coordinator of the local shards
+ *
+ *      Every table is hash sharded by its first column over `count` worker
+ *      processes, each one running the engine in its own `shardN` directory
+ *      and talking the binary protocol over a socket pair. The coordinator
+ *      keeps the table structures only, to route and merge the queries.
+ *
+ *      count  : number of shards
+ *      shards : connection to every worker
+ *      workers: process id of every worker
+ *      request: id of the next request sent to the workers
+ */
+struct ShardCluster
+{
+    size_t           count;
+    struct SQLClient shards[SQL_MAX_SHARDS];
+    pid_t            workers[SQL_MAX_SHARDS];
+    uint32_t         request;
+};
+
+/*
+ * Merge state of a scattered aggregate:
+ *      plan       : plan of the query sent to the shards, with the `PARTIAL:*`
+ *                   added by the coordinator
+ *      aggregation: the merged groups
+ *      identity   : positions of the GROUP values in the partial rows
+ *      sink       : the sink receiving the merged rows
+ */
+struct ShardMerge
+{
+    struct SelectPlan        plan;
+    struct Aggregation       aggregation;
+    int                     *identity;
+    const struct ResultSink *sink;
+};
+
+/* Start `count` worker processes, returns 0 on failure */
+int SQLShard_Start(struct ShardCluster *cluster, size_t count)
+{
+    size_t i;
+
+    memset(cluster, 0, sizeof(*cluster));
+    if ((count < 1) || (count > SQL_MAX_SHARDS))
+    {
+        printf("the number of shards must be between 1 and %d.\n", SQL_MAX_SHARDS);
+        return 0;
+    }
+    /* Buffered output would be written again by every worker */
+    fflush(stdout);
+    for (i = 0 ; i < count ; ++i)
+    {
+        char directory[32];
+        int  descriptors[2];
+
+        snprintf(directory, sizeof(directory), "shard%u", (unsigned) i);
+        if ((mkdir(directory, 0755) != 0) && (errno != EEXIST))
+            return 0;
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, descriptors) != 0)
+            return 0;
+        cluster->workers[i] = fork();
+        if (cluster->workers[i] < 0)
+        {
+            close(descriptors[0]);
+            close(descriptors[1]);
+            return 0;
+        }
+        if (cluster->workers[i] == 0)
+        {
+            size_t j;
+
+            /* The worker only keeps its own end of its own socket */
+            for (j = 0 ; j < i ; ++j)
+                close(cluster->shards[j].descriptor);
+            close(descriptors[0]);
+            if (chdir(directory) != 0)
+                _exit(1);
+            SQLVacuum_Start(SQLVacuum_Budget);
+            SQLServer_Connection((void *) (intptr_t) descriptors[1]);
+            _exit(0);
+        }
+        close(descriptors[1]);
+        cluster->shards[i].descriptor = descriptors[0];
+        cluster->count               += 1;
+    }
+    return 1;
+}
+
+/* Stop the workers, closing their connection makes them exit */
+void SQLShard_Stop(struct ShardCluster *cluster)
+{
+    size_t i;
+
+    for (i = 0 ; i < cluster->count ; ++i)
+    {
+        SQLClient_Close(&(cluster->shards[i]));
+        waitpid(cluster->workers[i], NULL, 0);
+    }
+    cluster->count = 0;
+}
+
+/*
+ * Send the query to one shard (`target`), or to all of them (`target` == -1)
+ * and collect the replies, every result row is passed to `sink`
+ *
+ *      The query is sent to every shard before reading any reply, so the
+ *      shards execute it in parallel. The replies of every shard the query
+ *      reached are read even when sending it to another one failed, so they
+ *      are not taken for the replies of the next query, and a shard the
+ *      query was only partly written to is closed. The errors of the shards
+ *      are reported like the errors of the engine, once when several shards
+ *      reject the query the same way. Returns 0 if any shard failed.
+ */
+int SQLShard_Scatter(struct ShardCluster *cluster, const char *const query, int target,
+                                                  const struct ResultSink *const sink)
+{
+    char        sent[SQL_MAX_SHARDS];
+    const char *reported;
+    size_t      i;
+    int         success;
+
+    success  = 1;
+    reported = NULL;
+    for (i = 0 ; i < cluster->count ; ++i)
+    {
+        sent[i] = 0;
+        if ((target != -1) && ((size_t) target != i))
+            continue;
+        sent[i] = (SQLClient_Send(&(cluster->shards[i]), cluster->request, query) != 0);
+        if (sent[i] == 0)
+        {
+            SQLreport("cannot send the query to shard %u\n", (unsigned) i);
+            SQLClient_Close(&(cluster->shards[i]));
+            success = 0;
+        }
+    }
+    for (i = 0 ; i < cluster->count ; ++i)
+    {
+        int result;
+
+        if (sent[i] == 0)
+            continue;
+        result = SQLClient_Receive(&(cluster->shards[i]), sink);
+        if (result == 1)
+        {
+            if ((reported == NULL) || (strcmp(reported, cluster->shards[i].message) != 0))
+                SQLreport("%s\n", cluster->shards[i].message);
+            reported = cluster->shards[i].message;
+        }
+        else if (result != 0)
+            SQLreport("shard %u did not reply\n", (unsigned) i);
+        if (result != 0)
+            success = 0;
+    }
+    cluster->request += 1;
+
+    return success;
+}
+
+/*
+ * Find the shard holding the rows of a query
+ *
+ *      Rows live in the shard given by the hash of their first column, so a
+ *      query with a `FIRSTCOLUMN<operator>VALUE` token only involves one
+ *      shard, like a compiled IN list on the first column whose values all
+ *      live in the same shard. Returns -1 when every shard is involved.
+ */
+int SQLShard_Route(const struct ShardCluster *cluster, const struct TokenList *list,
+                   const struct TableStructureInfo *const tableStructure, enum Operator operator)
+{
+    struct Column key;
+    unsigned long hash;
+    size_t        i;
+    int           target;
+
+    if (tableStructure->count == 0)
+        return -1;
+    for (list = list->next ; list != NULL ; list = list->next)
+    {
+        if ((list->operator == operator) && (strcmp(list->keyword, tableStructure->columns[0]) == 0))
+            break;
+        if ((operator == EqualOperator) && (list->set != NULL) && (list->set->column == 0) &&
+            (list->set->count != 0) && (SQLParser_GetClauseType(list->keyword) == InClause))
+        {
+            target = SQLhashColumnValue(2166136261UL, list->set->values[0], list->set->type) % cluster->count;
+            for (i = 1 ; i < list->set->count ; ++i)
+            {
+                if (SQLhashColumnValue(2166136261UL, list->set->values[i], list->set->type) % cluster->count !=
+                    (unsigned long) target)
+                    break;
+            }
+            if (i == list->set->count)
+                return target;
+        }
+    }
+    if (list == NULL)
+        return (operator == AssignOperator) ? 0 : -1;
+    key.type  = tableStructure->columnTypes[0];
+    key.value = SQLvalueFromStringAndType(list->value, key.type);
+    hash      = SQLhashColumnValue(2166136261UL, key.value, key.type);
+    if (key.type == String)
+        free(key.value.string);
+
+    return hash % cluster->count;
+}
+
+/* ResultSink callback, merges a partial aggregate row of a shard */
+static void SQLShard_MergeRow(void *context, const struct Row *const row)
+{
+    struct ShardMerge     *merge;
+    struct AggregateGroup *group;
+
+    merge = context;
+    group = SQLaggregation_Lookup(&(merge->aggregation), row, merge->identity, 1);
+    if (group != NULL)
+        SQLaggregation_Merge(&(merge->aggregation), group, row);
+}
+
+/* ResultSink callback, sends a merged row without the columns of the partial aggregates */
+static void SQLShard_EmitRow(void *context, const struct Row *const row)
+{
+    struct ShardMerge *merge;
+    struct Row         trimmed;
+
+    merge               = context;
+    trimmed             = *row;
+    trimmed.columnCount = merge->plan.groupCount + merge->plan.aggregateCount;
+    merge->sink->row(merge->sink->context, &trimmed);
+}
+
+/*
+ * Scatter an aggregated SELECT and merge the partial results
+ *
+ *      A `PARTIAL:*` is appended to the query so every partial group carries
+ *      its row count, the number of values of each aggregate, which AVG needs
+ *      to be merged, and the sketches of the approximate aggregates.
+ */
+static void SQLShard_SelectAggregate(struct ShardCluster *cluster, const char *const query, int target,
+                      const struct TableStructureInfo *const tableStructure, const struct ResultSink *const sink)
+{
+    struct ShardMerge *merge;
+    struct TokenList  *list;
+    struct ResultSink  mergeSink;
+    struct ResultSink  emitSink;
+    char              *partial;
+    size_t             count;
+    size_t             i;
+
+    partial = malloc(strlen(query) + sizeof(" PARTIAL:*"));
+    merge   = calloc(1, sizeof(struct ShardMerge));
+    list    = NULL;
+    if ((partial == NULL) || (merge == NULL))
+        goto abort;
+    strcpy(partial, query);
+    strcat(partial, " PARTIAL:*");
+    if ((list = SQLParser_Parse(partial)) == NULL)
+        goto abort;
+    if ((SQLplanSelect(list, tableStructure, &(merge->plan), 0) == 0) ||
+        ((merge->identity = malloc((merge->plan.groupCount + 1) * sizeof(int))) == NULL) ||
+        (SQLaggregation_Init(&(merge->aggregation), &(merge->plan)) == 0))
+        goto abort;
+    for (i = 0 ; i < merge->plan.groupCount ; ++i)
+        merge->identity[i] = i;
+    merge->sink = sink;
+    /* Without GROUP there is exactly one result row, even for an empty table */
+    if (merge->plan.groupCount == 0)
+        SQLaggregation_Lookup(&(merge->aggregation), NULL, NULL, 1);
+
+    mergeSink.begin   = NULL;
+    mergeSink.row     = SQLShard_MergeRow;
+    mergeSink.end     = NULL;
+    mergeSink.context = merge;
+    SQLShard_Scatter(cluster, partial, target, &mergeSink);
+
+    /* The partial columns are hidden from the result, not removed from the plan */
+    count                    = merge->plan.result.count;
+    merge->plan.result.count = merge->plan.groupCount + merge->plan.aggregateCount;
+    if (sink->begin != NULL)
+        sink->begin(sink->context, &(merge->plan.result));
+    merge->plan.result.count = count;
+    emitSink.begin   = NULL;
+    emitSink.row     = SQLShard_EmitRow;
+    emitSink.end     = NULL;
+    emitSink.context = merge;
+    SQLaggregation_Emit(&(merge->aggregation), &emitSink);
+    if (sink->end != NULL)
+        sink->end(sink->context);
+    SQLaggregation_Free(&(merge->aggregation));
+
+abort:
+    if (merge != NULL)
+    {
+        SQLplanFree(&(merge->plan));
+        free(merge->identity);
+    }
+    freeTokens(list);
+    free(merge);
+    free(partial);
+}
+
+/*
+ * Check that the COUNT_DISTINCT counts of the shards can be added
+ *
+ *      Equal rows are in the same shard only if they have the same first
+ *      column, so the counts are exact when it is the counted column or one
+ *      of the GROUP columns.
+ */
+static int SQLShard_CanMergeDistinct(const struct SelectPlan *const plan)
+{
+    size_t i;
+
+    for (i = 0 ; i < plan->groupCount ; ++i)
+    {
+        if (plan->groups[i] == 0)
+            return 1;
+    }
+    for (i = 0 ; i < plan->aggregateCount ; ++i)
+    {
+        if ((plan->aggregateTypes[i] == CountDistinctAggregate) && (plan->aggregateColumns[i] != 0))
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * Hiding state of the internal columns of an aggregated view:
+ *      sink   : the sink receiving the visible columns
+ *      columns: number of columns of the view rows
+ *      visible: number of group and aggregate columns, the ones shown
+ *      hide   : set when the result has the columns of the view rows
+ */
+struct ShardView
+{
+    const struct ResultSink *sink;
+    size_t                   columns;
+    size_t                   visible;
+    int                      hide;
+};
+
+/* ResultSink callback, starts the result without the `__values`, `__sketch` and `__rows` columns of the view */
+static void SQLShard_ViewBegin(void *context, const struct TableStructureInfo *const structure)
+{
+    struct ShardView          *view;
+    struct TableStructureInfo  visible;
+
+    view       = context;
+    view->hide = (structure->count == view->columns);
+    visible    = *structure;
+    if (view->hide != 0)
+        visible.count = view->visible;
+    if (view->sink->begin != NULL)
+        view->sink->begin(view->sink->context, &visible);
+}
+
+/* ResultSink callback, sends a view row without its internal columns */
+static void SQLShard_ViewRow(void *context, const struct Row *const row)
+{
+    struct ShardView *view;
+    struct Row        trimmed;
+
+    view    = context;
+    trimmed = *row;
+    if (view->hide != 0)
+        trimmed.columnCount = view->visible;
+    view->sink->row(view->sink->context, &trimmed);
+}
+
+/* ResultSink callback, ends the result of the view */
+static void SQLShard_ViewEnd(void *context)
+{
+    struct ShardView *view;
+
+    view = context;
+    if (view->sink->end != NULL)
+        view->sink->end(view->sink->context);
+}
+
+/*
+ * SELECT an aggregated materialized view
+ *
+ *      Every shard keeps the groups of its own rows, with the same columns
+ *      as the partial aggregates of `PARTIAL:*`. The coordinator merges the
+ *      view rows of all the shards into its own copy of the view, then runs
+ *      the query on that copy, showing the group and aggregate columns only.
+ */
+static void SQLShard_SelectView(struct ShardCluster *cluster, const struct TokenList *list,
+                                const struct TableStructureInfo *const tableStructure,
+                                struct ViewDefinition *view, const struct ResultSink *const sink)
+{
+    struct ShardMerge *merge;
+    struct ShardView   hidden;
+    struct ResultSink  mergeSink;
+    struct ResultSink  hiddenSink;
+    char              *query;
+    size_t             i;
+
+    if (SQLShard_CanMergeDistinct(&(view->plan)) == 0)
+    {
+        printf("COUNT_DISTINCT over several shards needs the shard key `%s` as argument or GROUP column.\n",
+               view->baseStructure.columns[0]);
+        return;
+    }
+    query = malloc(strlen(view->name) + sizeof("SELECT:"));
+    merge = calloc(1, sizeof(struct ShardMerge));
+    if ((query == NULL) || (merge == NULL))
+        goto abort;
+    sprintf(query, "SELECT:%s", view->name);
+    /* The groups are merged with the plan of the view, `merge->plan` is left unused */
+    if (((merge->identity = malloc((view->plan.groupCount + 1) * sizeof(int))) == NULL) ||
+        (SQLaggregation_Init(&(merge->aggregation), &(view->plan)) == 0))
+        goto abort;
+    for (i = 0 ; i < view->plan.groupCount ; ++i)
+        merge->identity[i] = i;
+    if (view->plan.groupCount == 0)
+        SQLaggregation_Lookup(&(merge->aggregation), NULL, NULL, 1);
+    mergeSink.begin   = NULL;
+    mergeSink.row     = SQLShard_MergeRow;
+    mergeSink.end     = NULL;
+    mergeSink.context = merge;
+    if ((SQLShard_Scatter(cluster, query, -1, &mergeSink) != 0) &&
+        (SQLview_Write(view, NULL, NULL, &(merge->aggregation)) != 0))
+    {
+        hidden.sink        = sink;
+        hidden.columns     = view->structure.count;
+        hidden.visible     = view->plan.groupCount + view->plan.aggregateCount;
+        hidden.hide        = 0;
+        hiddenSink.begin   = SQLShard_ViewBegin;
+        hiddenSink.row     = SQLShard_ViewRow;
+        hiddenSink.end     = SQLShard_ViewEnd;
+        hiddenSink.context = &hidden;
+        SQLselect(list, tableStructure, &hiddenSink);
+    }
+    SQLaggregation_Free(&(merge->aggregation));
+
+abort:
+    if (merge != NULL)
+        free(merge->identity);
+    free(merge);
+    free(query);
+}
+
+/* Scatter a SELECT, concatenating (or merging, for aggregates) the shard results */
+static void SQLShard_Select(struct ShardCluster *cluster, const char *const query, const struct TokenList *list,
+                      const struct TableStructureInfo *const tableStructure, const struct ResultSink *sink)
+{
+    struct SelectPlan  *plan;
+    struct DistinctSink distinct;
+    struct ResultSink   distinctSink;
+    struct ResultSink   rows;
+    int                 target;
+
+    plan = malloc(sizeof(struct SelectPlan));
+    if (plan == NULL)
+        return;
+    if (SQLplanSelect(list, tableStructure, plan, 0) == 0)
+    {
+        SQLplanFree(plan);
+        free(plan);
+        return;
+    }
+    target = SQLShard_Route(cluster, list, tableStructure, EqualOperator);
+    if ((target == -1) && (SQLShard_CanMergeDistinct(plan) == 0))
+        printf("COUNT_DISTINCT over several shards needs the shard key `%s` as argument or GROUP column.\n",
+               tableStructure->columns[0]);
+    else if ((plan->groupCount != 0) || (plan->aggregateCount != 0))
+        SQLShard_SelectAggregate(cluster, query, target, tableStructure, sink);
+    else
+    {
+        /* Equal rows of different shards are only sent once */
+        if ((plan->distinct != 0) && (SQLdistinctSink_Init(&distinct, &distinctSink, sink, &(plan->result)) != 0))
+            sink = &distinctSink;
+        if (sink->begin != NULL)
+            sink->begin(sink->context, &(plan->result));
+        rows.begin   = NULL;
+        rows.row     = sink->row;
+        rows.end     = NULL;
+        rows.context = sink->context;
+        SQLShard_Scatter(cluster, query, target, &rows);
+        if (sink->end != NULL)
+            sink->end(sink->context);
+        if (plan->distinct != 0)
+            SQLdistinctSink_Free(&distinct);
+    }
+    SQLplanFree(plan);
+    free(plan);
+}
+
+/*
+ * Scatter an INSERT ... SELECT or a SELECT ... INTO, every shard writes the rows it reads to its part of the target
+ *
+ *      The rows must stay in their shard, so the first result column has to
+ *      be the shard key of the source. The coordinator creates the missing
+ *      target of SELECT ... INTO, then every shard creates it too.
+ */
+static void SQLShard_InsertSelect(struct ShardCluster *cluster, const char *const query, const struct TokenList *list,
+                  const struct TableStructureInfo *const source, const char *const target, int create)
+{
+    struct TableStructureInfo table;
+    struct SelectPlan        *plan;
+    struct InsertSink         insert;
+    int                       keep;
+
+    plan = malloc(sizeof(struct SelectPlan));
+    if (plan == NULL)
+        return;
+    table = SQLParser_FindTable(target);
+    if (SQLplanSelect(list, source, plan, 0) == 0)
+        goto abort;
+    if (plan->groupCount != 0)
+        keep = (plan->groups[0] == 0);
+    else
+        keep = (plan->aggregateCount == 0) && ((plan->fieldCount == 0) || (plan->fields[0] == 0));
+    if ((keep == 0) || ((table.name[0] != '\0') && (table.columnDropped[0] != 0)))
+    {
+        printf("INSERT ... SELECT over several shards needs the shard key `%s` as first result column.\n",
+               source->columns[0]);
+        goto abort;
+    }
+    if (table.name[0] == '\0')
+    {
+        if ((create == 0) || (SQLinsertSelect_CreateTable(target, &(plan->result)) == 0))
+        {
+            if (create == 0)
+                printf("no table `%s`\n", target);
+            goto abort;
+        }
+        SQLShard_Scatter(cluster, query, -1, NULL);
+        goto abort;
+    }
+    /* The shards would all refuse a result not matching the target */
+    if (SQLinsertSink_Init(&insert, &table, &(plan->result), 0) != 0)
+        SQLShard_Scatter(cluster, query, SQLShard_Route(cluster, list, source, EqualOperator), NULL);
+    SQLinsertSink_Finish(&insert);
+
+abort:
+    SQLstructure_Free(&table);
+    SQLplanFree(plan);
+    free(plan);
+}
+
+/* Execute a query on the cluster, sending the results to `sink` */
+int SQLShard_Execute(struct ShardCluster *cluster, const char *const query, const struct ResultSink *const sink)
+{
+    struct TokenList          *list;
+    struct TokenList          *current;
+    struct TableStructureInfo  created;
+    struct TableStructureInfo *table;
+    struct TableStructureInfo  source;
+    struct ViewDefinition     *view;
+    enum QueryType             type;
+    const char                *from;
+    const char                *into;
+
+    list = SQLParser_Parse(query);
+    if (list == NULL)
+        return 1;
+    table = malloc(sizeof(struct TableStructureInfo));
+    if (table == NULL)
+    {
+        freeTokens(list);
+        return 1;
+    }
+    *table = SQLParser_FindTable(list->value);
+    type   = SQLParser_GetQueryType(list->keyword);
+    from   = (type == Insert) ? SQLParser_FindClause(list, FromClause) : NULL;
+    into   = (type == Select) ? SQLParser_FindClause(list, IntoClause) : NULL;
+    memset(&source, 0, sizeof(source));
+    if (from != NULL)
+        source = SQLParser_FindTable(from);
+    SQLvalueSet_CompileList(list, (from != NULL) ? &source : table);
+    SQLlike_CompileList(list, (from != NULL) ? &source : table);
+    if (((type == Insert) || (type == Update) || (type == Delete) || (type == Select)) &&
+        (SQLcheckLiterals(list, (from != NULL) ? &source : table) == 0))
+        type = Invalid;
+    switch (type)
+    {
+    case Create:
+    case CreateView:
+        /* The coordinator keeps the table structures, to route and plan the queries */
+        SQLExecuteQueryToSink(query, sink);
+        created = SQLParser_FindTable(list->value);
+        if ((table->name[0] == '\0') && (created.name[0] != '\0'))
+            SQLShard_Scatter(cluster, query, -1, NULL);
+        SQLstructure_Free(&created);
+        break;
+    case Alter:
+        /* Every worker keeps the same table structures as the coordinator */
+        SQLExecuteQueryToSink(query, sink);
+        SQLShard_Scatter(cluster, query, -1, NULL);
+        break;
+    case Insert:
+        if (from == NULL)
+            SQLShard_Scatter(cluster, query, SQLShard_Route(cluster, list, table, AssignOperator), NULL);
+        else if (source.name[0] == '\0')
+            printf("no table `%s`\n", from);
+        else
+            SQLShard_InsertSelect(cluster, query, list, &source, list->value, 0);
+        break;
+    case Update:
+        /* A row never changes shard, its first column cannot be modified */
+        for (current = list->next ; current != NULL ; current = current->next)
+        {
+            if ((current->operator == AssignOperator) && (strcmp(current->keyword, table->columns[0]) == 0))
+                break;
+        }
+        if (current != NULL)
+        {
+            printf("cannot update `%s`, the shard key of `%s`\n", table->columns[0], table->name);
+            break;
+        }
+        SQLShard_Scatter(cluster, query, SQLShard_Route(cluster, list, table, EqualOperator), NULL);
+        break;
+    case Delete:
+        SQLShard_Scatter(cluster, query, SQLShard_Route(cluster, list, table, EqualOperator), NULL);
+        break;
+    case Select:
+        if (table->name[0] == '\0')
+            break;
+        view = NULL;
+        if ((into == NULL) && ((view = malloc(sizeof(struct ViewDefinition))) != NULL) &&
+            (SQLview_Find(view, list->value) != 0))
+        {
+            /* The rows of a projection view are in the shards of their base rows, only groups are merged */
+            if ((view->plan.groupCount != 0) || (view->plan.aggregateCount != 0))
+                SQLShard_SelectView(cluster, list, table, view, sink);
+            else
+                SQLShard_Select(cluster, query, list, table, sink);
+            SQLview_Release(view);
+        }
+        else if (into == NULL)
+            SQLShard_Select(cluster, query, list, table, sink);
+        else if (SQLview_IsView(into) != 0)
+            printf("cannot modify materialized view `%s`\n", into);
+        else
+            SQLShard_InsertSelect(cluster, query, list, table, into, 1);
+        free(view);
+        break;
+    case Status:
+        /* The coordinator reports its own state, the workers are not replicated */
+        SQLExecuteQueryToSink(query, sink);
+        break;
+    default:
+        break;
+    }
+    SQLstructure_Free(&source);
+    SQLstructure_Free(table);
+    free(table);
+    freeTokens(list);
+
+    return 0;
+}
+
+/* Interactive coordinator over `count` local shards */
+int SQLShard_Run(size_t count)
+{
+    struct ShardCluster cluster;
+    char               *input;
+    size_t              size;
+    ssize_t             length;
+
+    /* A worker that exited makes sending fail, instead of killing the coordinator */
+    signal(SIGPIPE, SIG_IGN);
+    if (SQLShard_Start(&cluster, count) == 0)
+    {
+        printf("error: cannot start the shards.\n");
+        SQLShard_Stop(&cluster);
+        return 1;
+    }
+    printf("------------- Database Manager (%u shards) -------------\n", (unsigned) count);
+    input = NULL;
+    size  = 0;
+    for (;;)
+    {
+        printf("dbc > ");
+        fflush(stdout);
+        if ((length = getline(&input, &size, stdin)) <= 0)
+            break;
+
+        if (input[length - 1] == '\n')
+            input[length - 1] = '\0';
+
+        if ((strcmp(input, "exit") == 0) || (strcmp(input, "\\q") == 0))
+            break;
+
+        SQLShard_Execute(&cluster, input, &SQLstdoutSink);
+    }
+    free(input);
+    SQLShard_Stop(&cluster);
+
+    return 0;
+}
+
+#endif /* SQLSHARD_H */
@@ -0,0 +1,277 @@
+#ifndef SQLVACUUM_H
+#define SQLVACUUM_H
+
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "sqlparser.h"
+#include "sqlserver.h"
+
+/* Files are compacted once this fraction of their bytes belongs to deleted rows */
+#define SQL_VACUUM_RATIO 0.25
+
+/* Time between two looks for a file to compact, when there was none */
+#define SQL_VACUUM_POLL_SECONDS 1
+
+/* Bytes the vacuum may read per second, 0 for no limit */
+static long SQLVacuum_Budget = 8 * 1024 * 1024;
+
+/* Pick the file with the most dead space, taking its current size while no write is running, returns 0 if none */
+static int SQLVacuum_Next(struct VacuumFile *candidate)
+{
+    struct VacuumFile *best;
+    struct stat        information;
+    size_t             i;
+
+    best = NULL;
+    for (i = 0 ; i < SQLvacuum.count ; ++i)
+    {
+        struct VacuumFile *entry;
+
+        entry = &(SQLvacuum.files[i]);
+        if ((entry->deadBytes == 0) || (entry->deadBytes < SQL_VACUUM_RATIO * entry->size))
+            continue;
+        if ((best == NULL) || (entry->deadBytes * best->size > best->deadBytes * entry->size))
+            best = entry;
+    }
+    if (best == NULL)
+        return 0;
+    if (stat(best->storage, &information) != 0)
+    {
+        best->deadBytes = 0;
+        return 0;
+    }
+    *candidate      = *best;
+    candidate->size = information.st_size;
+
+    return 1;
+}
+
+/* Sleep when the `spent` bytes read since `start` are more than `budget` bytes per second (0 for no limit) allow */
+static void SQLVacuum_Throttle(long spent, double start, long budget)
+{
+    double ahead;
+
+    if (budget == 0)
+        return;
+    ahead = (double) spent / budget - (SQLwal_Now() - start);
+    if (ahead > 0.01)
+        usleep(ahead * 1e6);
+}
+
+/* Copy the live rows of `source` until offset `end`, reading at most `budget` bytes per second (0 for no limit) */
+static int SQLVacuum_Copy(FILE *source, FILE *destination, long end, long budget)
+{
+    char   *line;
+    size_t  size;
+    ssize_t length;
+    long    spent;
+    double  start;
+
+    line  = NULL;
+    size  = 0;
+    spent = 0;
+    start = SQLwal_Now();
+    while (((end < 0) || (ftell(source) < end)) && ((length = getline(&line, &size, source)) > 0))
+    {
+        if (line[0] != SQL_TOMBSTONE)
+            fwrite(line, 1, length, destination);
+        spent += length;
+        SQLVacuum_Throttle(spent, start, budget);
+    }
+    free(line);
+
+    return ferror(source) == 0 && ferror(destination) == 0;
+}
+
+/*
+ * Count the dead bytes and the size of `file->storage`, reading at most `budget` bytes per second, returns 0 on failure
+ *
+ *      `inode` receives the inode of the file counted, a file replaced by a
+ *      compaction or an UPDATE meanwhile has another one.
+ */
+static int SQLVacuum_Count(struct VacuumFile *file, long budget, ino_t *inode)
+{
+    struct stat information;
+    FILE       *source;
+    char       *line;
+    size_t      size;
+    ssize_t     length;
+    double      start;
+    int         status;
+
+    if ((source = fopen(file->storage, "r")) == NULL)
+        return 0;
+    if (fstat(fileno(source), &information) != 0)
+    {
+        fclose(source);
+        return 0;
+    }
+    *inode          = information.st_ino;
+    file->deadBytes = 0;
+    file->size      = 0;
+    line            = NULL;
+    size            = 0;
+    start           = SQLwal_Now();
+    while ((length = getline(&line, &size, source)) > 0)
+    {
+        if (line[0] == SQL_TOMBSTONE)
+            file->deadBytes += length;
+        file->size += length;
+        SQLVacuum_Throttle(file->size, start, budget);
+    }
+    status = (ferror(source) == 0);
+    free(line);
+    fclose(source);
+
+    return status;
+}
+
+/*
+ * Count the dead bytes of every storage file again, the registry only lives in memory
+ *
+ *      The storage files of the tables and views are listed from the
+ *      catalog with the engine lock held, and read without it. A count is
+ *      only recorded when no delete recorded one meanwhile and the file was
+ *      not replaced.
+ */
+static void SQLVacuum_Recount(void)
+{
+    struct TableStructureInfo table;
+    struct VacuumFile        *files;
+    struct VacuumFile        *auxiliar;
+    FILE                     *catalog;
+    size_t                    count;
+    size_t                    i;
+
+    files = NULL;
+    count = 0;
+    pthread_mutex_lock(&SQLServer_EngineLock);
+    if ((catalog = fopen("__tables_data.dat", "r")) != NULL)
+    {
+        while (SQLcatalog_ReadTable(catalog, &table) != 0)
+        {
+            for (i = 0 ; i < SQLpartitionCount(&table) ; ++i)
+            {
+                if ((auxiliar = realloc(files, (count + 1) * sizeof(struct VacuumFile))) == NULL)
+                    break;
+                files = auxiliar;
+                memset(&(files[count]), 0, sizeof(struct VacuumFile));
+                SQLpartitionFile(&table, i, files[count].storage, sizeof(files[count].storage));
+                count += 1;
+            }
+            SQLstructure_Free(&table);
+        }
+        fclose(catalog);
+    }
+    pthread_mutex_unlock(&SQLServer_EngineLock);
+
+    for (i = 0 ; i < count ; ++i)
+    {
+        struct stat information;
+        ino_t       inode;
+
+        if ((SQLVacuum_Count(&(files[i]), SQLVacuum_Budget, &inode) == 0) || (files[i].deadBytes == 0))
+            continue;
+        pthread_mutex_lock(&SQLServer_EngineLock);
+        if ((stat(files[i].storage, &information) == 0) && (information.st_ino == inode) &&
+            (SQLvacuum_Find(files[i].storage, 0) == NULL))
+            SQLvacuum_Record(files[i].storage, files[i].deadBytes, files[i].size);
+        pthread_mutex_unlock(&SQLServer_EngineLock);
+    }
+    free(files);
+}
+
+/*
+ * Rewrite one storage file without its deleted rows, returns 0 on failure
+ *
+ *      The rows present when the file was picked are copied without holding
+ *      the engine lock, so queries keep running. The lock is only taken to
+ *      copy the rows appended meanwhile and replace the file, unless another
+ *      delete or update changed the file, then the copy is thrown away.
+ */
+static int SQLVacuum_Compact(const struct VacuumFile *const candidate)
+{
+    struct VacuumFile *entry;
+    char               filename[] = "__database_Temporary_XXXXXX"; /* temporary filename */
+    FILE              *source;
+    FILE              *destination;
+    int                status;
+
+    source = fopen(candidate->storage, "r");
+    if (source == NULL)
+        return 0;
+    destination = SQLtemporaryFile(filename);
+    if (destination == NULL)
+    {
+        fclose(source);
+        return 0;
+    }
+    status = SQLVacuum_Copy(source, destination, candidate->size, SQLVacuum_Budget);
+
+    pthread_mutex_lock(&SQLServer_EngineLock);
+    entry = SQLvacuum_Find(candidate->storage, 0);
+    if ((entry == NULL) || (entry->generation != candidate->generation))
+        status = 0;
+    if (status != 0)
+        status = SQLVacuum_Copy(source, destination, -1, 0);
+    fclose(source);
+    if (fclose(destination) != 0)
+        status = 0;
+    if (status != 0)
+    {
+        remove(candidate->storage);
+        rename(filename, candidate->storage);
+        SQLfulltext_Invalidate(candidate->storage);
+        entry->deadBytes   = 0;
+        entry->generation += 1;
+    }
+    else
+        remove(filename);
+    pthread_mutex_unlock(&SQLServer_EngineLock);
+
+    return status;
+}
+
+/* Count the deleted rows left by the previous runs, then compact the files with many of them, forever */
+static void *SQLVacuum_Run(void *argument)
+{
+    (void) argument;
+    SQLVacuum_Recount();
+    for (;;)
+    {
+        struct VacuumFile candidate;
+        int               found;
+
+        pthread_mutex_lock(&SQLServer_EngineLock);
+        found = SQLVacuum_Next(&candidate);
+        pthread_mutex_unlock(&SQLServer_EngineLock);
+        if ((found == 0) || (SQLVacuum_Compact(&candidate) == 0))
+            sleep(SQL_VACUUM_POLL_SECONDS);
+    }
+    return NULL;
+}
+
+/*
+ * Start the background vacuum, reading at most `budget` bytes per second
+ *
+ *      Queries must hold SQLServer_EngineLock, the vacuum replaces storage
+ *      files concurrently.
+ */
+int SQLVacuum_Start(long budget)
+{
+    pthread_t thread;
+
+    SQLVacuum_Budget = budget;
+    if (pthread_create(&thread, NULL, SQLVacuum_Run, NULL) != 0)
+    {
+        printf("error: cannot start the vacuum thread.\n");
+        return 0;
+    }
+    pthread_detach(thread);
+
+    return 1;
+}
+
+#endif /* SQLVACUUM_H */
@@ -0,0 +1,23 @@
+#!/bin/sh
+# Run the query scripts of this directory with the REPL, comparing its output to the .expected files
+# a NAME.args file holds the command line arguments of NAME.txt, like `--shards 3`
+# usage: tests/run.sh PATH_TO_DBC
+dbc=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+tests=$(cd "$(dirname "$0")" && pwd)
+failed=0
+for script in "$tests"/*.txt
+do
+    name=$(basename "$script" .txt)
+    directory=$(mktemp -d)
+    arguments=$(cat "$tests/$name.args" 2>/dev/null)
+    (cd "$directory" && "$dbc" $arguments < "$script" > output 2>&1)
+    if diff -u "$tests/$name.expected" "$directory/output"
+    then
+        echo "ok   $name"
+    else
+        echo "FAIL $name"
+        failed=1
+    fi
+    rm -rf "$directory"
+done
+exit $failed